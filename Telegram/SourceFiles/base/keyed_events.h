@@ -0,0 +1,123 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "base/basic_types.h"
+
+#include <rpl/producer.h>
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace base {
+
+// Like rpl::event_stream, but each fired value is delivered only to the
+// consumers of its key, which wait for at least one of its flags.
+//
+// Firing takes time proportional to the count of the consumers of the
+// key, not to the count of all the consumers. Unlike rpl::event_stream
+// it doesn't put done to the consumers when destroyed, so it can be
+// a global object outliving the code of the consumers.
+template <typename Key, typename Value, typename Flags>
+class keyed_events {
+public:
+	keyed_events() = default;
+	keyed_events(const keyed_events &other) = delete;
+	keyed_events &operator=(const keyed_events &other) = delete;
+
+	[[nodiscard]] rpl::producer<Value> events(Key key, Flags flags) const;
+	void fire(const Key &key, Flags flags, const Value &value) const;
+
+	[[nodiscard]] int keys_count() const {
+		return _data ? int(_data->viewers.size()) : 0;
+	}
+
+private:
+	struct Viewer {
+		uint64 id = 0;
+		Flags flags;
+		rpl::consumer<Value> consumer;
+	};
+	struct Data {
+		std::unordered_map<Key, std::vector<Viewer>> viewers;
+		uint64 autoincrement = 0;
+	};
+	std::weak_ptr<Data> make_weak() const;
+
+	mutable std::shared_ptr<Data> _data;
+
+};
+
+template <typename Key, typename Value, typename Flags>
+rpl::producer<Value> keyed_events<Key, Value, Flags>::events(
+		Key key,
+		Flags flags) const {
+	return [=, weak = make_weak()](const auto &consumer) {
+		const auto strong = weak.lock();
+		if (!strong) {
+			return rpl::lifetime();
+		}
+		const auto id = ++strong->autoincrement;
+		strong->viewers[key].push_back({ id, flags, consumer });
+		return rpl::lifetime([=] {
+			const auto strong = weak.lock();
+			if (!strong) {
+				return;
+			}
+			const auto i = strong->viewers.find(key);
+			if (i == end(strong->viewers)) {
+				return;
+			}
+			auto &list = i->second;
+			list.erase(
+				std::remove_if(begin(list), end(list), [&](const Viewer &v) {
+					return (v.id == id);
+				}),
+				end(list));
+			if (list.empty()) {
+				strong->viewers.erase(i);
+			}
+		});
+	};
+}
+
+template <typename Key, typename Value, typename Flags>
+void keyed_events<Key, Value, Flags>::fire(
+		const Key &key,
+		Flags flags,
+		const Value &value) const {
+	if (!_data) {
+		return;
+	}
+	const auto i = _data->viewers.find(key);
+	if (i == end(_data->viewers)) {
+		return;
+	}
+
+	// Consumers may be added or removed by the handlers, the removed ones
+	// are terminated and ignore the value.
+	const auto data = _data;
+	const auto list = i->second;
+	for (const auto &viewer : list) {
+		if (viewer.flags & flags) {
+			viewer.consumer.put_next_copy(value);
+		}
+	}
+}
+
+template <typename Key, typename Value, typename Flags>
+std::weak_ptr<typename keyed_events<Key, Value, Flags>::Data>
+keyed_events<Key, Value, Flags>::make_weak() const {
+	if (!_data) {
+		_data = std::make_shared<Data>();
+	}
+	return _data;
+}
+
+} // namespace base
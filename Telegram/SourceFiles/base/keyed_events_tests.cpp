@@ -0,0 +1,201 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "base/keyed_events.h"
+#include "base/flags.h"
+#include <rpl/event_stream.h>
+#include <rpl/filter.h>
+#include <chrono>
+
+const auto DisableBenchmarkTests = true;
+
+namespace {
+
+enum class Flag : uint32 {
+	Name = (1 << 0),
+	Photo = (1 << 1),
+	Members = (1 << 2),
+};
+using Flags = base::flags<Flag>;
+inline constexpr auto is_flag_type(Flag) { return true; }
+
+struct Update {
+	int peer = 0;
+	Flags flags;
+};
+
+using Events = base::keyed_events<int, Update, Flags>;
+
+void Fire(const Events &events, int peer, Flags flags) {
+	events.fire(peer, flags, Update{ peer, flags });
+}
+
+} // namespace
+
+TEST_CASE("keyed events", "[keyed_events]") {
+	auto events = Events();
+	auto lifetime = rpl::lifetime();
+
+	SECTION("values are delivered by key and flags") {
+		auto first = std::vector<Flags>();
+		auto second = std::vector<Flags>();
+		events.events(
+			1,
+			Flag::Name | Flag::Photo
+		) | rpl::start_with_next([&](const Update &update) {
+			REQUIRE(update.peer == 1);
+			first.push_back(update.flags);
+		}, lifetime);
+		events.events(
+			2,
+			Flag::Members
+		) | rpl::start_with_next([&](const Update &update) {
+			REQUIRE(update.peer == 2);
+			second.push_back(update.flags);
+		}, lifetime);
+
+		Fire(events, 1, Flag::Name);
+		Fire(events, 1, Flag::Members);
+		Fire(events, 2, Flag::Members | Flag::Name);
+		Fire(events, 3, Flag::Name);
+		Fire(events, 1, Flag::Photo | Flag::Members);
+
+		REQUIRE(first.size() == 2);
+		REQUIRE(first[0] == Flags(Flag::Name));
+		REQUIRE(first[1] == (Flag::Photo | Flag::Members));
+		REQUIRE(second.size() == 1);
+		REQUIRE(second[0] == (Flag::Members | Flag::Name));
+	}
+	SECTION("destroyed consumers are removed") {
+		auto count = 0;
+		auto other = rpl::lifetime();
+		events.events(
+			1,
+			Flag::Name
+		) | rpl::start_with_next([&](const Update &update) {
+			++count;
+		}, lifetime);
+		events.events(
+			2,
+			Flag::Name
+		) | rpl::start_with_next([&](const Update &update) {
+			++count;
+		}, other);
+		REQUIRE(events.keys_count() == 2);
+
+		other.destroy();
+		REQUIRE(events.keys_count() == 1);
+		Fire(events, 2, Flag::Name);
+		REQUIRE(count == 0);
+
+		lifetime.destroy();
+		REQUIRE(events.keys_count() == 0);
+		Fire(events, 1, Flag::Name);
+		REQUIRE(count == 0);
+	}
+	SECTION("consumers may be changed while firing") {
+		auto second = rpl::lifetime();
+		auto third = rpl::lifetime();
+		auto received = std::vector<int>();
+		events.events(
+			1,
+			Flag::Name
+		) | rpl::start_with_next([&](const Update &update) {
+			received.push_back(1);
+
+			// Remove the next one and add a new one.
+			second.destroy();
+			events.events(
+				1,
+				Flag::Name
+			) | rpl::start_with_next([&](const Update &update) {
+				received.push_back(3);
+			}, third);
+		}, lifetime);
+		events.events(
+			1,
+			Flag::Name
+		) | rpl::start_with_next([&](const Update &update) {
+			received.push_back(2);
+		}, second);
+
+		Fire(events, 1, Flag::Name);
+		REQUIRE(received == std::vector<int>(1, 1));
+
+		Fire(events, 1, Flag::Name);
+		REQUIRE(received.size() == 3);
+		REQUIRE(received[0] == 1);
+		REQUIRE(received[1] == 1);
+		REQUIRE(received[2] == 3);
+	}
+	SECTION("consumers may outlive the events") {
+		auto destroyed = std::make_unique<Events>();
+		destroyed->events(
+			1,
+			Flag::Name
+		) | rpl::start(lifetime);
+		destroyed = nullptr;
+		lifetime.destroy();
+	}
+}
+
+TEST_CASE("keyed events benchmark", "[keyed_events]") {
+	if (DisableBenchmarkTests) {
+		return;
+	}
+	using namespace std::chrono;
+
+	// A subscriber for each of the participants of a large group and
+	// an update for each of them.
+	constexpr auto kCount = 10000;
+	auto lifetime = rpl::lifetime();
+	auto received = 0;
+	const auto measure = [&](auto &&fire) {
+		received = 0;
+		const auto start = steady_clock::now();
+		for (auto i = 0; i != kCount; ++i) {
+			fire(i, Flags(Flag::Name));
+		}
+		const auto result = duration_cast<milliseconds>(
+			steady_clock::now() - start).count();
+		REQUIRE(received == kCount);
+		return result;
+	};
+
+	auto keyed = Events();
+	for (auto i = 0; i != kCount; ++i) {
+		keyed.events(
+			i,
+			Flag::Name | Flag::Photo
+		) | rpl::start_with_next([&](const Update &update) {
+			++received;
+		}, lifetime);
+	}
+	const auto keyedMs = measure([&](int peer, Flags flags) {
+		Fire(keyed, peer, flags);
+	});
+
+	// All the subscribers get all the updates and filter them by peer.
+	auto stream = rpl::event_stream<Update>();
+	for (auto i = 0; i != kCount; ++i) {
+		stream.events(
+		) | rpl::filter([=](const Update &update) {
+			return (update.peer == i)
+				&& (update.flags & (Flag::Name | Flag::Photo));
+		}) | rpl::start_with_next([&](const Update &update) {
+			++received;
+		}, lifetime);
+	}
+	const auto filteredMs = measure([&](int peer, Flags flags) {
+		stream.fire({ peer, flags });
+	});
+
+	WARN(kCount << " updates for " << kCount << " subscribers: "
+		<< keyedMs << " ms by key, " << filteredMs << " ms filtered");
+}
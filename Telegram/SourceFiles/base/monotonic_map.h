@@ -0,0 +1,283 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include <deque>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+namespace base {
+
+// Sorted map for keys that are inserted mostly in increasing order,
+// like mtproto msg ids or request ids.
+//
+// Entries live in a ring buffer (std::deque) sorted by key, so adding
+// a new largest key is a push_back() and lookups are binary searches.
+// Erased entries are only marked and dropped when they reach one of
+// the ends or when they become the majority, so erasing from the
+// middle (an ack for a request sent before other still pending ones)
+// doesn't move the remaining entries each time.
+//
+// Any insertion or erase invalidates all iterators and pointers.
+template <typename Key, typename Value>
+class monotonic_map {
+	struct Slot;
+	template <bool Const>
+	class Iterator;
+
+public:
+	using key_type = Key;
+	using mapped_type = Value;
+	using value_type = std::pair<Key, Value>;
+	using size_type = int;
+	using iterator = Iterator<false>;
+	using const_iterator = Iterator<true>;
+
+	monotonic_map() = default;
+
+	iterator begin() {
+		return iterator(_slots.begin(), _slots.end());
+	}
+	iterator end() {
+		return iterator(_slots.end(), _slots.end());
+	}
+	const_iterator begin() const {
+		return const_iterator(_slots.begin(), _slots.end());
+	}
+	const_iterator end() const {
+		return const_iterator(_slots.end(), _slots.end());
+	}
+	const_iterator cbegin() const {
+		return begin();
+	}
+	const_iterator cend() const {
+		return end();
+	}
+
+	size_type size() const {
+		return _size;
+	}
+	bool empty() const {
+		return !_size;
+	}
+
+	// The first and the last slots are never erased ones.
+	const value_type &front() const {
+		return _slots.front().data;
+	}
+	const value_type &back() const {
+		return _slots.back().data;
+	}
+
+	iterator find(const Key &key) {
+		return iterator(findSlot(key), _slots.end());
+	}
+	const_iterator find(const Key &key) const {
+		return const_iterator(
+			const_cast<monotonic_map*>(this)->findSlot(key),
+			_slots.end());
+	}
+	bool contains(const Key &key) const {
+		return find(key) != end();
+	}
+
+	template <typename OtherValue>
+	void emplace_or_assign(const Key &key, OtherValue &&value);
+
+	void erase(const_iterator i);
+	bool remove(const Key &key) {
+		const auto i = find(key);
+		if (i == end()) {
+			return false;
+		}
+		erase(i);
+		return true;
+	}
+
+	void clear() {
+		_slots.clear();
+		_size = 0;
+	}
+
+private:
+	using Slots = std::deque<Slot>;
+
+	struct Slot {
+		template <typename OtherValue>
+		Slot(const Key &key, OtherValue &&value)
+		: data(key, std::forward<OtherValue>(value)) {
+		}
+
+		value_type data;
+		bool alive = true;
+	};
+
+	typename Slots::iterator lowerBound(const Key &key) {
+		return std::lower_bound(
+			_slots.begin(),
+			_slots.end(),
+			key,
+			[](const Slot &slot, const Key &key) {
+				return slot.data.first < key;
+			});
+	}
+	typename Slots::iterator findSlot(const Key &key);
+	void trim();
+
+	Slots _slots;
+	size_type _size = 0;
+
+};
+
+template <typename Key, typename Value>
+template <bool Const>
+class monotonic_map<Key, Value>::Iterator {
+	using SlotIterator = std::conditional_t<
+		Const,
+		typename Slots::const_iterator,
+		typename Slots::iterator>;
+
+public:
+	using iterator_category = std::forward_iterator_tag;
+	using value_type = typename monotonic_map::value_type;
+	using difference_type = std::ptrdiff_t;
+	using reference = std::conditional_t<
+		Const,
+		const value_type&,
+		value_type&>;
+	using pointer = std::conditional_t<
+		Const,
+		const value_type*,
+		value_type*>;
+
+	Iterator() = default;
+	Iterator(SlotIterator i, SlotIterator end) : _i(i), _end(end) {
+		skipErased();
+	}
+	template <
+		bool OtherConst,
+		typename = std::enable_if_t<Const && !OtherConst>>
+	Iterator(const Iterator<OtherConst> &other)
+	: _i(other._i)
+	, _end(other._end) {
+	}
+
+	reference operator*() const {
+		return _i->data;
+	}
+	pointer operator->() const {
+		return &_i->data;
+	}
+	Iterator &operator++() {
+		++_i;
+		skipErased();
+		return *this;
+	}
+	Iterator operator++(int) {
+		auto result = *this;
+		++*this;
+		return result;
+	}
+
+	template <bool OtherConst>
+	bool operator==(const Iterator<OtherConst> &other) const {
+		return (_i == other._i);
+	}
+	template <bool OtherConst>
+	bool operator!=(const Iterator<OtherConst> &other) const {
+		return !(*this == other);
+	}
+
+private:
+	friend class monotonic_map;
+	template <bool OtherConst>
+	friend class Iterator;
+
+	void skipErased() {
+		while (_i != _end && !_i->alive) {
+			++_i;
+		}
+	}
+
+	SlotIterator _i;
+	SlotIterator _end;
+
+};
+
+template <typename Key, typename Value>
+auto monotonic_map<Key, Value>::findSlot(const Key &key)
+-> typename Slots::iterator {
+	if (_slots.empty()
+		|| key < _slots.front().data.first
+		|| _slots.back().data.first < key) {
+		return _slots.end();
+	} else if (!(_slots.front().data.first < key)) {
+		return _slots.begin();
+	}
+	const auto i = lowerBound(key);
+	return (i->alive && !(key < i->data.first)) ? i : _slots.end();
+}
+
+template <typename Key, typename Value>
+template <typename OtherValue>
+void monotonic_map<Key, Value>::emplace_or_assign(
+		const Key &key,
+		OtherValue &&value) {
+	if (_slots.empty() || _slots.back().data.first < key) {
+		_slots.emplace_back(key, std::forward<OtherValue>(value));
+	} else if (key < _slots.front().data.first) {
+		_slots.emplace_front(key, std::forward<OtherValue>(value));
+	} else {
+		const auto i = lowerBound(key);
+		if (key < i->data.first) {
+			_slots.emplace(i, key, std::forward<OtherValue>(value));
+		} else {
+			i->data.second = std::forward<OtherValue>(value);
+			if (i->alive) {
+				return;
+			}
+			i->alive = true;
+		}
+	}
+	++_size;
+}
+
+template <typename Key, typename Value>
+void monotonic_map<Key, Value>::erase(const_iterator i) {
+	const auto index = i._i - _slots.cbegin();
+	auto &slot = _slots[index];
+	slot.alive = false;
+	slot.data.second = Value();
+	--_size;
+	trim();
+}
+
+template <typename Key, typename Value>
+void monotonic_map<Key, Value>::trim() {
+	while (!_slots.empty() && !_slots.front().alive) {
+		_slots.pop_front();
+	}
+	while (!_slots.empty() && !_slots.back().alive) {
+		_slots.pop_back();
+	}
+
+	// Keep lookups logarithmic in the count of the alive entries.
+	constexpr auto kMinCompactSize = 16;
+	const auto count = int(_slots.size());
+	if (count > kMinCompactSize && count > 2 * _size) {
+		_slots.erase(
+			std::remove_if(
+				_slots.begin(),
+				_slots.end(),
+				[](const Slot &slot) { return !slot.alive; }),
+			_slots.end());
+	}
+}
+
+} // namespace base
@@ -0,0 +1,226 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "base/monotonic_map.h"
+#include "base/flat_map.h"
+#include <QtCore/QMap>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <chrono>
+
+const auto DisableBenchmarkTests = true;
+
+namespace {
+
+// mtproto msg ids are multiples of four and grow monotonically.
+constexpr auto kMsgIdStep = quint64(4);
+constexpr auto kFirstMsgId = (quint64(1) << 62);
+
+using Payload = std::shared_ptr<int>;
+
+template <typename Key, typename Value>
+void Assign(QMap<Key, Value> &map, Key key, Value value) {
+	map.insert(key, std::move(value));
+}
+
+template <typename Map, typename Key, typename Value>
+void Assign(Map &map, Key key, Value value) {
+	map.emplace_or_assign(key, std::move(value));
+}
+
+// Mimics the session bookkeeping: requests are sent with new msg ids and
+// acked mostly in order, while every eighth one stays in the map for a
+// while and then is resent with a fresh msg id. Acked ids are kept in a
+// limited window, like wereAcked in the session.
+template <typename SentMap, typename IdsMap>
+int SimulateAcks(int inFlight, int rounds) {
+	auto haveSent = SentMap();
+	auto toResend = IdsMap();
+	auto wereAcked = IdsMap();
+	auto sent = std::deque<quint64>();
+	auto nextId = kFirstMsgId;
+	const auto send = [&] {
+		nextId += kMsgIdStep;
+		Assign(haveSent, nextId, std::make_shared<int>(int(nextId)));
+		sent.push_back(nextId);
+	};
+	const auto batch = std::max(inFlight / 10, 1);
+	auto resending = std::vector<quint64>();
+	auto acked = 0;
+	for (auto round = 0; round != rounds; ++round) {
+		while (int(sent.size()) < inFlight + batch) {
+			send();
+		}
+		resending.clear();
+		for (auto i = 0; i != batch; ++i) {
+			const auto msgId = sent.front();
+			sent.pop_front();
+			if (!(msgId & (7 * kMsgIdStep))) {
+				resending.push_back(msgId);
+			} else if (const auto j = haveSent.find(msgId)
+				; j != haveSent.end()) {
+				haveSent.erase(j);
+				Assign(wereAcked, msgId, int(msgId));
+				++acked;
+			} else if (const auto k = toResend.find(msgId)
+				; k != toResend.end()) {
+				toResend.erase(k);
+				Assign(wereAcked, msgId, int(msgId));
+				++acked;
+			}
+		}
+		for (const auto msgId : resending) {
+			const auto j = haveSent.find(msgId);
+			if (j == haveSent.end()) {
+				continue;
+			}
+			haveSent.erase(j);
+
+			// Pick an id that won't be resent again, so it gets acked.
+			nextId += kMsgIdStep;
+			if (!(nextId & (7 * kMsgIdStep))) {
+				nextId += kMsgIdStep;
+			}
+			Assign(toResend, nextId, int(msgId));
+			sent.push_back(nextId);
+		}
+		while (wereAcked.size() > 400) {
+			wereAcked.erase(wereAcked.begin());
+		}
+	}
+	REQUIRE(int(haveSent.size() + toResend.size()) == int(sent.size()));
+	return acked;
+}
+
+} // namespace
+
+TEST_CASE("monotonic map keeps items sorted by key", "[monotonic_map]") {
+	auto map = base::monotonic_map<quint64, int>();
+	REQUIRE(map.empty());
+	REQUIRE(map.begin() == map.end());
+
+	const auto count = 100;
+	for (auto i = 0; i != count; ++i) {
+		map.emplace_or_assign(kFirstMsgId + i * kMsgIdStep, i);
+	}
+	REQUIRE(map.size() == count);
+	REQUIRE(map.front().second == 0);
+	REQUIRE(map.back().second == count - 1);
+
+	const auto checkSorted = [&] {
+		auto visited = 0;
+		auto previous = quint64(0);
+		for (const auto &[key, value] : map) {
+			REQUIRE(key > previous);
+			REQUIRE(key == kFirstMsgId + value * kMsgIdStep);
+			previous = key;
+			++visited;
+		}
+		REQUIRE(visited == map.size());
+	};
+
+	SECTION("erase from the middle") {
+		for (auto i = 1; i < count - 1; i += 2) {
+			REQUIRE(map.remove(kFirstMsgId + i * kMsgIdStep));
+		}
+		REQUIRE(map.size() == count - (count - 1) / 2);
+		for (auto i = 0; i != count; ++i) {
+			const auto found = map.find(kFirstMsgId + i * kMsgIdStep);
+			if ((i % 2) && i != count - 1) {
+				REQUIRE(found == map.end());
+			} else {
+				REQUIRE(found != map.end());
+				REQUIRE(found->second == i);
+			}
+		}
+		REQUIRE(!map.remove(kFirstMsgId + kMsgIdStep));
+		checkSorted();
+	}
+	SECTION("erase from both ends") {
+		map.erase(map.begin());
+		map.remove(map.back().first);
+		REQUIRE(map.size() == count - 2);
+		REQUIRE(map.front().second == 1);
+		REQUIRE(map.back().second == count - 2);
+		checkSorted();
+	}
+	SECTION("insert out of order and reassign") {
+		map.remove(kFirstMsgId + 50 * kMsgIdStep);
+		map.emplace_or_assign(kFirstMsgId + 50 * kMsgIdStep, 50);
+		map.emplace_or_assign(kFirstMsgId + 10 * kMsgIdStep, 10);
+		map.emplace_or_assign(kFirstMsgId - kMsgIdStep, -1);
+		REQUIRE(map.size() == count + 1);
+		REQUIRE(map.front().second == -1);
+		REQUIRE(map.contains(kFirstMsgId + 50 * kMsgIdStep));
+		map.emplace_or_assign(kFirstMsgId - kMsgIdStep, 0);
+		map.erase(map.begin());
+		checkSorted();
+	}
+	SECTION("erase all but the last one") {
+		for (auto i = 0; i != count - 1; ++i) {
+			map.erase(map.find(kFirstMsgId + (count - 2 - i) * kMsgIdStep));
+		}
+		REQUIRE(map.size() == 1);
+		REQUIRE(map.begin()->second == count - 1);
+		map.erase(map.begin());
+		REQUIRE(map.empty());
+		REQUIRE(map.begin() == map.end());
+	}
+}
+
+TEST_CASE("monotonic map ack simulation", "[monotonic_map]") {
+	const auto expected = SimulateAcks<
+		QMap<quint64, Payload>,
+		QMap<quint64, int>>(1000, 100);
+	const auto acked = SimulateAcks<
+		base::monotonic_map<quint64, Payload>,
+		base::monotonic_map<quint64, int>>(1000, 100);
+	REQUIRE(acked == expected);
+}
+
+TEST_CASE("monotonic map benchmark", "[monotonic_map]") {
+	if (DisableBenchmarkTests) {
+		return;
+	}
+	const auto rounds = 1000;
+	const auto measure = [&](int inFlight, auto simulate, const char *name) {
+		const auto start = std::chrono::steady_clock::now();
+		simulate(inFlight, rounds);
+		const auto elapsed = std::chrono::steady_clock::now() - start;
+		const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+			elapsed).count();
+		WARN(name
+			<< ": "
+			<< inFlight
+			<< " in-flight requests, "
+			<< rounds
+			<< " ack / resend rounds in "
+			<< ms
+			<< " ms");
+	};
+	for (const auto inFlight : { 1000, 5000, 20000 }) {
+		measure(
+			inFlight,
+			SimulateAcks<QMap<quint64, Payload>, QMap<quint64, int>>,
+			"QMap");
+		measure(
+			inFlight,
+			SimulateAcks<
+				base::flat_map<quint64, Payload>,
+				base::flat_map<quint64, int>>,
+			"base::flat_map");
+		measure(
+			inFlight,
+			SimulateAcks<
+				base::monotonic_map<quint64, Payload>,
+				base::monotonic_map<quint64, int>>,
+			"base::monotonic_map");
+	}
+}
@@ -0,0 +1,84 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include <atomic>
+#include <optional>
+
+namespace base {
+
+// Unbounded lock-free queue for many producers and a single consumer.
+//
+// push() may be called from any thread, pop() only from one thread at
+// a time. The last node is always a consumed one, so producers never
+// touch the nodes the consumer works with (Dmitry Vyukov's algorithm).
+//
+// pop() may return nothing while a push() is still in progress,
+// so producers should notify the consumer after pushing.
+template <typename T>
+class mpsc_queue {
+public:
+	mpsc_queue() : _head(new Node()), _tail(_head.load()) {
+	}
+	mpsc_queue(const mpsc_queue &other) = delete;
+	mpsc_queue &operator=(const mpsc_queue &other) = delete;
+
+	void push(T &&value) {
+		const auto node = new Node(std::move(value));
+		_size.fetch_add(1, std::memory_order_relaxed);
+		const auto previous = _head.exchange(node, std::memory_order_acq_rel);
+		previous->next.store(node, std::memory_order_release);
+	}
+	void push(const T &value) {
+		push(T(value));
+	}
+
+	std::optional<T> pop() {
+		const auto next = _tail->next.load(std::memory_order_acquire);
+		if (!next) {
+			return std::nullopt;
+		}
+		auto result = std::move(next->value);
+		next->value = std::nullopt;
+		delete _tail;
+		_tail = next;
+		_size.fetch_sub(1, std::memory_order_relaxed);
+		return result;
+	}
+
+	// May be called from any thread, exact only when no one is working.
+	int size() const {
+		return _size.load(std::memory_order_relaxed);
+	}
+	bool empty() const {
+		return !size();
+	}
+
+	~mpsc_queue() {
+		while (pop()) {
+		}
+		delete _tail;
+	}
+
+private:
+	struct Node {
+		Node() = default;
+		explicit Node(T &&value) : value(std::move(value)) {
+		}
+
+		std::atomic<Node*> next = { nullptr };
+		std::optional<T> value;
+	};
+
+	std::atomic<Node*> _head;
+	std::atomic<int> _size = { 0 };
+	Node *_tail = nullptr;
+
+};
+
+} // namespace base
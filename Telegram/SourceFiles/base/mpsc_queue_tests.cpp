@@ -0,0 +1,284 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "base/mpsc_queue.h"
+#include "base/basic_types.h"
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QVector>
+#include <thread>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <vector>
+
+const auto DisableBenchmarkTests = true;
+
+namespace {
+
+constexpr auto kProducers = 4;
+constexpr auto kMessages = 100 * 1000;
+
+using Message = QVector<int>;
+
+Message MakeMessage(int producer, int index) {
+	return Message{ producer, index, 0, 0, 0, 0, 0, 0 };
+}
+
+// Baseline: the locked container previously used for the hand-off.
+class LockedQueue {
+public:
+	void push(Message &&message) {
+		QWriteLocker locker(&_lock);
+		_list.push_back(std::move(message));
+	}
+	std::optional<Message> pop() {
+		QWriteLocker locker(&_lock);
+		if (_list.isEmpty()) {
+			return std::nullopt;
+		}
+		auto result = std::move(_list.front());
+		_list.pop_front();
+		return result;
+	}
+
+private:
+	QReadWriteLock _lock;
+	QList<Message> _list;
+
+};
+
+// Pushes kMessages from kProducers threads, pops them in this thread.
+// Returns consumed messages in the order of the receiving.
+template <typename Queue>
+std::vector<Message> Transfer(Queue &queue) {
+	auto producers = std::vector<std::thread>();
+	for (auto producer = 0; producer != kProducers; ++producer) {
+		producers.emplace_back([=, &queue] {
+			const auto count = kMessages / kProducers;
+			for (auto i = 0; i != count; ++i) {
+				queue.push(MakeMessage(producer, i));
+			}
+		});
+	}
+	auto result = std::vector<Message>();
+	result.reserve(kMessages);
+	while (int(result.size()) != kMessages) {
+		if (auto message = queue.pop()) {
+			result.push_back(std::move(*message));
+		} else {
+			std::this_thread::yield();
+		}
+	}
+	for (auto &producer : producers) {
+		producer.join();
+	}
+	return result;
+}
+
+// Received messages hand-off from a connection thread to the main thread,
+// every eighth of them is an update, the rest are responses.
+constexpr auto kReceivedMessages = 100 * 1000;
+constexpr auto kReceivedMessageSize = 64;
+
+Message MakeReceived(int index) {
+	auto result = Message(kReceivedMessageSize, index);
+	result[0] = index;
+	return result;
+}
+
+bool IsUpdate(int index) {
+	return (index % 8) == 0;
+}
+
+// The way SessionData did it before: responses in a QMap by request id
+// and updates in a QList, one lock taken for each message.
+class LockedReceived {
+public:
+	void add(int index, Message &&message) {
+		QWriteLocker locker(&_lock);
+		if (IsUpdate(index)) {
+			_updates.push_back(std::move(message));
+		} else {
+			_responses.insert(index, std::move(message));
+		}
+	}
+	std::optional<Message> take() {
+		QWriteLocker locker(&_lock);
+		if (!_responses.isEmpty()) {
+			auto result = std::move(_responses.begin().value());
+			_responses.erase(_responses.begin());
+			return result;
+		} else if (!_updates.isEmpty()) {
+			auto result = std::move(_updates.front());
+			_updates.pop_front();
+			return result;
+		}
+		return std::nullopt;
+	}
+
+private:
+	QReadWriteLock _lock;
+	QMap<int, Message> _responses;
+	QList<Message> _updates;
+
+};
+
+// The way SessionData and Session do it now: two queues, moved to the
+// containers of the main thread before processing.
+class QueuedReceived {
+public:
+	void add(int index, Message &&message) {
+		if (IsUpdate(index)) {
+			_updates.push(std::move(message));
+		} else {
+			_responses.push({ index, std::move(message) });
+		}
+	}
+	std::optional<Message> take() {
+		while (auto response = _responses.pop()) {
+			_takenResponses.emplace(
+				response->first,
+				std::move(response->second));
+		}
+		while (auto update = _updates.pop()) {
+			_takenUpdates.push_back(std::move(*update));
+		}
+		if (!_takenResponses.empty()) {
+			auto result = std::move(_takenResponses.begin()->second);
+			_takenResponses.erase(_takenResponses.begin());
+			return result;
+		} else if (!_takenUpdates.empty()) {
+			auto result = std::move(_takenUpdates.front());
+			_takenUpdates.pop_front();
+			return result;
+		}
+		return std::nullopt;
+	}
+
+private:
+	base::mpsc_queue<std::pair<int, Message>> _responses;
+	base::mpsc_queue<Message> _updates;
+	std::map<int, Message> _takenResponses;
+	std::deque<Message> _takenUpdates;
+
+};
+
+// Returns the connection thread and the total time in milliseconds.
+template <typename Received>
+std::pair<int64, int64> TransferReceived(Received &received) {
+	using namespace std::chrono;
+
+	const auto start = steady_clock::now();
+	auto producing = int64();
+	auto producer = std::thread([&] {
+		for (auto i = 0; i != kReceivedMessages; ++i) {
+			received.add(i, MakeReceived(i));
+		}
+		producing = duration_cast<milliseconds>(
+			steady_clock::now() - start).count();
+	});
+	auto checksum = int64();
+	for (auto taken = 0; taken != kReceivedMessages;) {
+		if (const auto message = received.take()) {
+			checksum += message->front();
+			++taken;
+		} else {
+			std::this_thread::yield();
+		}
+	}
+	producer.join();
+	const auto total = duration_cast<milliseconds>(
+		steady_clock::now() - start).count();
+	REQUIRE(checksum == int64(kReceivedMessages - 1) * kReceivedMessages / 2);
+	return { producing, total };
+}
+
+} // namespace
+
+TEST_CASE("mpsc queue keeps order of each producer", "[mpsc_queue]") {
+	base::mpsc_queue<Message> queue;
+	REQUIRE(queue.empty());
+	REQUIRE(!queue.pop());
+
+	SECTION("single thread") {
+		queue.push(MakeMessage(0, 0));
+		queue.push(MakeMessage(0, 1));
+		REQUIRE(queue.size() == 2);
+		REQUIRE((*queue.pop() == MakeMessage(0, 0)));
+		REQUIRE((*queue.pop() == MakeMessage(0, 1)));
+		REQUIRE(!queue.pop());
+		REQUIRE(queue.empty());
+	}
+	SECTION("many producers") {
+		const auto received = Transfer(queue);
+		auto next = std::vector<int>(kProducers, 0);
+		for (const auto &message : received) {
+			const auto producer = message[0];
+			REQUIRE(message[1] == next[producer]);
+			++next[producer];
+		}
+		for (const auto count : next) {
+			REQUIRE(count == kMessages / kProducers);
+		}
+		REQUIRE(queue.empty());
+	}
+	SECTION("destroying not empty queue") {
+		auto other = std::make_unique<base::mpsc_queue<Message>>();
+		other->push(MakeMessage(0, 0));
+		other->push(MakeMessage(0, 1));
+		other = nullptr;
+	}
+}
+
+TEST_CASE("mpsc queue benchmark", "[mpsc_queue]") {
+	if (DisableBenchmarkTests) {
+		return;
+	}
+	const auto measure = [](auto &&queue, const char *name) {
+		const auto start = std::chrono::steady_clock::now();
+		const auto received = Transfer(queue);
+		const auto elapsed = std::chrono::steady_clock::now() - start;
+		const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+			elapsed).count();
+		REQUIRE(int(received.size()) == kMessages);
+		WARN(name
+			<< ": "
+			<< kMessages
+			<< " messages from "
+			<< kProducers
+			<< " threads in "
+			<< ms
+			<< " ms");
+	};
+	measure(LockedQueue(), "QReadWriteLock + QList");
+	measure(base::mpsc_queue<Message>(), "mpsc_queue");
+}
+
+TEST_CASE("received messages hand-off benchmark", "[mpsc_queue]") {
+	if (DisableBenchmarkTests) {
+		return;
+	}
+	const auto measure = [](auto &&received, const char *name) {
+		const auto [producing, total] = TransferReceived(received);
+		WARN(name
+			<< ": "
+			<< kReceivedMessages
+			<< " messages of "
+			<< (kReceivedMessageSize * sizeof(int))
+			<< " bytes, connection thread "
+			<< producing
+			<< " ms, taken by main thread in "
+			<< total
+			<< " ms");
+	};
+	measure(LockedReceived(), "QReadWriteLock + QMap / QList");
+	measure(QueuedReceived(), "mpsc_queue + main thread containers");
+}
@@ -24,6 +24,13 @@ public:
 	void increment(int64 amount);
 	void decrement(int64 amount);
 
+	[[nodiscard]] int64 usage() const {
+		return _usage;
+	}
+	[[nodiscard]] int64 limit() const {
+		return _limit;
+	}
+
 private:
 	template <typename Unload>
 	void check(Unload &&unload);
@@ -32,6 +32,14 @@ constexpr auto kUrlCacheMask = 0x000000FFFFFFFFFFULL;
 constexpr auto kGeoPointCacheTag = 0x0000040000000000ULL;
 constexpr auto kGeoPointCacheMask = 0x000000FFFFFFFFFFULL;
 
+static_assert(std::max({
+	kImageCacheTag,
+	kStickerCacheTag,
+	kVoiceMessageCacheTag,
+	kVideoMessageCacheTag,
+	kAnimationCacheTag,
+}) <= Storage::Cache::kMaxValueTag, "Tags with the high bit can't be compressed.");
+
 } // namespace
 
 struct ReplyPreview::Data {
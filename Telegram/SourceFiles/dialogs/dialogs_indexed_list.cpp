@@ -23,6 +23,7 @@ RowsByLetter IndexedList::addToEnd(Key key) {
 	RowsByLetter result;
 	if (!_list.contains(key)) {
 		result.emplace(0, _list.addToEnd(key));
+		_nameIndex.set(key, key.entry()->chatListNameWords());
 		for (const auto ch : key.entry()->chatListFirstLetters()) {
 			auto j = _index.find(ch);
 			if (j == _index.cend()) {
@@ -40,6 +41,7 @@ Row *IndexedList::addByName(Key key) {
 	}
 
 	const auto result = _list.addByName(key);
+	_nameIndex.set(key, key.entry()->chatListNameWords());
 	for (const auto ch : key.entry()->chatListFirstLetters()) {
 		auto j = _index.find(ch);
 		if (j == _index.cend()) {
@@ -119,6 +121,8 @@ void IndexedList::adjustByName(
 	const auto mainRow = _list.adjustByName(key);
 	if (!mainRow) return;
 
+	_nameIndex.set(key, key.entry()->chatListNameWords());
+
 	auto toRemove = oldLetters;
 	auto toAdd = base::flat_set<QChar>();
 	for (const auto ch : key.entry()->chatListFirstLetters()) {
@@ -156,6 +160,8 @@ void IndexedList::adjustNames(
 	auto mainRow = _list.getRow(key);
 	if (!mainRow) return;
 
+	_nameIndex.set(key, key.entry()->chatListNameWords());
+
 	auto toRemove = oldLetters;
 	auto toAdd = base::flat_set<QChar>();
 	for (const auto ch : key.entry()->chatListFirstLetters()) {
@@ -188,6 +194,7 @@ void IndexedList::adjustNames(
 
 void IndexedList::del(Key key, Row *replacedBy) {
 	if (_list.del(key, replacedBy)) {
+		_nameIndex.remove(key);
 		for (const auto ch : key.entry()->chatListFirstLetters()) {
 			if (auto it = _index.find(ch); it != _index.cend()) {
 				it->second.del(key, replacedBy);
@@ -198,52 +205,61 @@ void IndexedList::del(Key key, Row *replacedBy) {
 
 void IndexedList::clear() {
 	_index.clear();
+	_nameIndex.clear();
 }
 
 std::vector<not_null<Row*>> IndexedList::filtered(
 		const QStringList &words) const {
-	const auto minimal = [&]() -> const Dialogs::List* {
-		if (empty()) {
-			return nullptr;
-		}
-		auto result = (const Dialogs::List*)nullptr;
-		for (const auto &word : words) {
-			if (word.isEmpty()) {
-				continue;
-			}
-			const auto found = filtered(word[0]);
-			if (!found || found->empty()) {
-				return nullptr;
-			} else if (!result || result->size() > found->size()) {
-				result = found;
-			}
-		}
+	auto result = std::vector<not_null<Row*>>();
+	if (empty()) {
 		return result;
-	}();
+	}
+	const auto letters = ranges::all_of(words, [](const QString &word) {
+		return (word.size() < 2);
+	});
+	if (letters) {
+		return filteredByLetters(words);
+	}
+	const auto keys = _nameIndex.find(words);
+	result.reserve(keys.size());
+	for (const auto key : keys) {
+		if (const auto row = _list.getRow(key)) {
+			result.push_back(row);
+		}
+	}
+	ranges::sort(result, [](not_null<Row*> a, not_null<Row*> b) {
+		return a->pos() < b->pos();
+	});
+	return result;
+}
+
+std::vector<not_null<Row*>> IndexedList::filteredByLetters(
+		const QStringList &words) const {
 	auto result = std::vector<not_null<Row*>>();
-	if (!minimal || minimal->empty()) {
+	auto minimal = (const List*)nullptr;
+	for (const auto &word : words) {
+		if (word.isEmpty()) {
+			continue;
+		}
+		const auto found = filtered(word[0]);
+		if (!found || found->empty()) {
+			return result;
+		} else if (!minimal || minimal->size() > found->size()) {
+			minimal = found;
+		}
+	}
+	if (!minimal) {
 		return result;
 	}
+
+	// First letter lists have the rows in the order of all() already.
 	result.reserve(minimal->size());
 	for (const auto row : *minimal) {
-		const auto &nameWords = row->entry()->chatListNameWords();
-		const auto found = [&](const QString &word) {
-			for (const auto &name : nameWords) {
-				if (name.startsWith(word)) {
-					return true;
-				}
-			}
-			return false;
-		};
-		const auto allFound = [&] {
-			for (const auto &word : words) {
-				if (!found(word)) {
-					return false;
-				}
-			}
-			return true;
-		}();
-		if (allFound) {
+		const auto &letters = row->entry()->chatListFirstLetters();
+		const auto all = ranges::all_of(words, [&](const QString &word) {
+			return word.isEmpty() || letters.contains(word[0]);
+		});
+		if (all) {
 			result.push_back(row);
 		}
 	}
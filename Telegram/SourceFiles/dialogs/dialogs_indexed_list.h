@@ -9,6 +9,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 #include "dialogs/dialogs_entry.h"
 #include "dialogs/dialogs_list.h"
+#include "dialogs/dialogs_name_index.h"
 
 class History;
 
@@ -47,6 +48,8 @@ public:
 		const auto i = _index.find(ch);
 		return (i != _index.end()) ? &i->second : nullptr;
 	}
+
+	// Rows of all() having all the words, in the order of all().
 	std::vector<not_null<Row*>> filtered(const QStringList &words) const;
 
 	~IndexedList();
@@ -81,10 +84,13 @@ private:
 		Mode list,
 		not_null<History*> history,
 		const base::flat_set<QChar> &oldChars);
+	std::vector<not_null<Row*>> filteredByLetters(
+		const QStringList &words) const;
 
 	SortMode _sortMode = SortMode();
 	List _list, _empty;
 	base::flat_map<QChar, List> _index;
+	NameIndex<Key> _nameIndex;
 
 };
 
@@ -0,0 +1,231 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "base/basic_types.h"
+#include "base/flat_set.h"
+
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <range/v3/all.hpp>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace Dialogs {
+
+// Finds values by the words of their names for the chat list search.
+//
+// Each query word should be a prefix of some name word of the value, the
+// words of three letters and more are also found in the middle of the
+// name words through the index of name word trigrams. Transliterated and
+// keyboard layout switched names are already among the name words.
+template <typename Value>
+class NameIndex final {
+public:
+	void set(Value value, const base::flat_set<QString> &words);
+	void remove(Value value);
+	void clear();
+
+	[[nodiscard]] int size() const {
+		return int(_wordsByValue.size());
+	}
+
+	// Values having all the words, sorted by operator<().
+	[[nodiscard]] std::vector<Value> find(const QStringList &words) const;
+
+private:
+	using Trigram = uint64;
+	static constexpr auto kTrigramLength = 3;
+
+	[[nodiscard]] static Trigram ComputeTrigram(const QChar *letters);
+	[[nodiscard]] static bool Matches(
+		const QString &name,
+		const QString &word);
+
+	void addWord(const QString &word, Value value);
+	void removeWord(const QString &word, Value value);
+	[[nodiscard]] std::vector<Value> findWord(const QString &word) const;
+
+	std::map<Value, base::flat_set<QString>> _wordsByValue;
+	std::map<QString, std::vector<Value>> _valuesByWord;
+
+	// Point to the keys of _valuesByWord.
+	std::unordered_map<Trigram, std::vector<const QString*>> _wordsByTrigram;
+
+};
+
+template <typename Value>
+void NameIndex<Value>::set(
+		Value value,
+		const base::flat_set<QString> &words) {
+	const auto i = _wordsByValue.find(value);
+	if (i != end(_wordsByValue)) {
+		if (ranges::equal(i->second, words)) {
+			return;
+		}
+		remove(value);
+	}
+	if (words.empty()) {
+		return;
+	}
+	_wordsByValue.emplace(value, words);
+	for (const auto &word : words) {
+		addWord(word, value);
+	}
+}
+
+template <typename Value>
+void NameIndex<Value>::remove(Value value) {
+	const auto i = _wordsByValue.find(value);
+	if (i == end(_wordsByValue)) {
+		return;
+	}
+	for (const auto &word : i->second) {
+		removeWord(word, value);
+	}
+	_wordsByValue.erase(i);
+}
+
+template <typename Value>
+void NameIndex<Value>::clear() {
+	_wordsByValue.clear();
+	_valuesByWord.clear();
+	_wordsByTrigram.clear();
+}
+
+template <typename Value>
+auto NameIndex<Value>::ComputeTrigram(const QChar *letters) -> Trigram {
+	return (Trigram(letters[0].unicode()) << 32)
+		| (Trigram(letters[1].unicode()) << 16)
+		| Trigram(letters[2].unicode());
+}
+
+template <typename Value>
+bool NameIndex<Value>::Matches(const QString &name, const QString &word) {
+	return (word.size() >= kTrigramLength)
+		? name.contains(word)
+		: name.startsWith(word);
+}
+
+template <typename Value>
+void NameIndex<Value>::addWord(const QString &word, Value value) {
+	const auto [i, added] = _valuesByWord.emplace(word, std::vector<Value>());
+	if (added) {
+		const auto key = &i->first;
+		for (auto k = 0; k + kTrigramLength <= word.size(); ++k) {
+			_wordsByTrigram[ComputeTrigram(word.constData() + k)].push_back(
+				key);
+		}
+	}
+	i->second.push_back(value);
+}
+
+template <typename Value>
+void NameIndex<Value>::removeWord(const QString &word, Value value) {
+	const auto i = _valuesByWord.find(word);
+	if (i == end(_valuesByWord)) {
+		return;
+	}
+	auto &values = i->second;
+	values.erase(ranges::remove(values, value), end(values));
+	if (!values.empty()) {
+		return;
+	}
+	const auto key = &i->first;
+	for (auto k = 0; k + kTrigramLength <= word.size(); ++k) {
+		const auto j = _wordsByTrigram.find(
+			ComputeTrigram(word.constData() + k));
+		if (j == end(_wordsByTrigram)) {
+			continue;
+		}
+		auto &keys = j->second;
+		const auto found = ranges::find(keys, key);
+		if (found != end(keys)) {
+			*found = keys.back();
+			keys.pop_back();
+		}
+		if (keys.empty()) {
+			_wordsByTrigram.erase(j);
+		}
+	}
+	_valuesByWord.erase(i);
+}
+
+template <typename Value>
+std::vector<Value> NameIndex<Value>::findWord(const QString &word) const {
+	auto result = std::vector<Value>();
+	const auto append = [&](const std::vector<Value> &values) {
+		result.insert(end(result), begin(values), end(values));
+	};
+
+	// Name words starting with the word follow each other in the map.
+	for (auto i = _valuesByWord.lower_bound(word)
+		; i != end(_valuesByWord) && i->first.startsWith(word)
+		; ++i) {
+		append(i->second);
+	}
+
+	if (word.size() >= kTrigramLength) {
+		const auto candidates = [&]() -> const std::vector<const QString*>* {
+			auto result = (const std::vector<const QString*>*)nullptr;
+			for (auto k = 0; k + kTrigramLength <= word.size(); ++k) {
+				const auto i = _wordsByTrigram.find(
+					ComputeTrigram(word.constData() + k));
+				if (i == end(_wordsByTrigram)) {
+					return nullptr;
+				} else if (!result || i->second.size() < result->size()) {
+					result = &i->second;
+				}
+			}
+			return result;
+		}();
+		if (candidates) {
+			for (const auto name : *candidates) {
+				// Zero index means a prefix, those are already added.
+				if (name->indexOf(word) > 0) {
+					append(_valuesByWord.find(*name)->second);
+				}
+			}
+		}
+	}
+
+	ranges::sort(result);
+	result.erase(ranges::unique(result), end(result));
+	return result;
+}
+
+template <typename Value>
+std::vector<Value> NameIndex<Value>::find(const QStringList &words) const {
+	// Values are looked up by the longest word, usually the rarest one,
+	// and the rest of the words are checked in the names of those values.
+	auto longest = (const QString*)nullptr;
+	for (const auto &word : words) {
+		if (!longest || word.size() > longest->size()) {
+			longest = &word;
+		}
+	}
+	if (!longest || longest->isEmpty()) {
+		return {};
+	}
+	auto result = findWord(*longest);
+	for (const auto &word : words) {
+		if (&word == longest || word.isEmpty()) {
+			continue;
+		}
+		result.erase(ranges::remove_if(result, [&](Value value) {
+			const auto i = _wordsByValue.find(value);
+			return ranges::none_of(i->second, [&](const QString &name) {
+				return Matches(name, word);
+			});
+		}), end(result));
+	}
+	return result;
+}
+
+} // namespace Dialogs
@@ -0,0 +1,243 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "dialogs/dialogs_name_index.h"
+#include "base/flat_map.h"
+
+#include <chrono>
+#include <random>
+
+using Dialogs::NameIndex;
+
+const auto DisableBenchmarkTests = true;
+
+namespace {
+
+using Words = base::flat_set<QString>;
+
+std::vector<int> Find(const NameIndex<int> &index, const QString &query) {
+	return index.find(query.split(' ', QString::SkipEmptyParts));
+}
+
+// Synthetic names of two or three words built from syllables.
+std::vector<Words> GenerateNames(int count) {
+	static const auto syllables = {
+		"a", "al", "an", "ar", "be", "bo", "da", "de", "el", "en",
+		"ga", "ho", "ia", "ir", "ka", "ko", "la", "le", "ma", "mi",
+		"na", "ni", "ol", "or", "pa", "pe", "ra", "ro", "sa", "se",
+		"ta", "te", "ul", "va", "vi", "xa", "ya", "za", "ze", "zo",
+	};
+	const auto list = std::vector<QString>(begin(syllables), end(syllables));
+	auto engine = std::mt19937(7);
+	const auto random = [&](int till) {
+		return std::uniform_int_distribution<int>(0, till - 1)(engine);
+	};
+	const auto word = [&] {
+		auto result = QString();
+		const auto length = 2 + random(3);
+		for (auto i = 0; i != length; ++i) {
+			result += list[random(list.size())];
+		}
+		return result;
+	};
+	auto result = std::vector<Words>();
+	result.reserve(count);
+	for (auto i = 0; i != count; ++i) {
+		auto words = Words();
+		const auto length = 2 + random(2);
+		for (auto j = 0; j != length; ++j) {
+			words.insert(word());
+		}
+		result.push_back(std::move(words));
+	}
+	return result;
+}
+
+// The search as it was done before the index: the rows of the smallest
+// first letter list are checked word by word.
+class LetterScan final {
+public:
+	explicit LetterScan(const std::vector<Words> &names) : _names(names) {
+		for (auto i = 0; i != int(names.size()); ++i) {
+			for (const auto &word : names[i]) {
+				auto &list = _index[word[0]];
+				if (list.empty() || list.back() != i) {
+					list.push_back(i);
+				}
+			}
+		}
+	}
+
+	std::vector<int> find(const QStringList &words) const {
+		auto minimal = (const std::vector<int>*)nullptr;
+		for (const auto &word : words) {
+			const auto i = _index.find(word[0]);
+			if (i == _index.end()) {
+				return {};
+			} else if (!minimal || minimal->size() > i->second.size()) {
+				minimal = &i->second;
+			}
+		}
+		auto result = std::vector<int>();
+		if (!minimal) {
+			return result;
+		}
+		for (const auto value : *minimal) {
+			const auto found = [&](const QString &word) {
+				for (const auto &name : _names[value]) {
+					if (name.startsWith(word)) {
+						return true;
+					}
+				}
+				return false;
+			};
+			if (ranges::all_of(words, found)) {
+				result.push_back(value);
+			}
+		}
+		return result;
+	}
+
+private:
+	const std::vector<Words> &_names;
+	base::flat_map<QChar, std::vector<int>> _index;
+
+};
+
+} // namespace
+
+TEST_CASE("name index search", "[name_index]") {
+	auto index = NameIndex<int>();
+	index.set(1, { "alexander", "petrov" });
+	index.set(2, { "alexey", "ivanov", "lesha" });
+	index.set(3, { "telegram", "news" });
+	index.set(4, { "saved", "messages" });
+
+	SECTION("words are found by prefix") {
+		REQUIRE(Find(index, "ale") == std::vector<int>{ 1, 2 });
+		REQUIRE(Find(index, "a") == std::vector<int>{ 1, 2 });
+		REQUIRE(Find(index, "ne") == std::vector<int>{ 3 });
+		REQUIRE(Find(index, "x").empty());
+	}
+	SECTION("all words should be found") {
+		REQUIRE(Find(index, "ale pe") == std::vector<int>{ 1 });
+		REQUIRE(Find(index, "pe ale") == std::vector<int>{ 1 });
+		REQUIRE(Find(index, "ale news").empty());
+		REQUIRE(Find(index, "").empty());
+	}
+	SECTION("long words are found in the middle") {
+		REQUIRE(Find(index, "gram") == std::vector<int>{ 3 });
+		REQUIRE(Find(index, "xander") == std::vector<int>{ 1 });
+		REQUIRE(Find(index, "sage") == std::vector<int>{ 4 });
+		REQUIRE(Find(index, "nov") == std::vector<int>{ 2 });
+		REQUIRE(Find(index, "les") == std::vector<int>{ 2 });
+
+		// Short words match only at the beginning.
+		REQUIRE(Find(index, "ex").empty());
+	}
+	SECTION("names are updated") {
+		index.set(1, { "boris", "petrov" });
+		REQUIRE(Find(index, "ale") == std::vector<int>{ 2 });
+		REQUIRE(Find(index, "bor pet") == std::vector<int>{ 1 });
+		REQUIRE(Find(index, "xander").empty());
+
+		index.remove(2);
+		REQUIRE(Find(index, "ale").empty());
+		REQUIRE(Find(index, "les").empty());
+		REQUIRE(index.size() == 3);
+
+		index.set(3, {});
+		REQUIRE(Find(index, "gram").empty());
+		REQUIRE(index.size() == 2);
+
+		index.clear();
+		REQUIRE(Find(index, "pet").empty());
+		REQUIRE(index.size() == 0);
+	}
+}
+
+TEST_CASE("name index matches the letter scan", "[name_index]") {
+	const auto names = GenerateNames(2000);
+	const auto scan = LetterScan(names);
+	auto index = NameIndex<int>();
+	for (auto i = 0; i != int(names.size()); ++i) {
+		index.set(i, names[i]);
+	}
+	const auto queries = {
+		"a", "al", "ala", "ko", "kor", "ma pe", "za ze", "le ni ta",
+	};
+	for (const auto query : queries) {
+		const auto words = QString(query).split(' ');
+		auto expected = scan.find(words);
+		ranges::sort(expected);
+
+		// Index also finds the words in the middle, so check those.
+		const auto found = index.find(words);
+		REQUIRE(ranges::includes(found, expected));
+		for (const auto value : found) {
+			for (const auto &word : words) {
+				const auto has = [&](const QString &name) {
+					return (word.size() >= 3)
+						? name.contains(word)
+						: name.startsWith(word);
+				};
+				REQUIRE(ranges::any_of(names[value], has));
+			}
+		}
+	}
+}
+
+TEST_CASE("name index benchmark", "[name_index]") {
+	if (DisableBenchmarkTests) {
+		return;
+	}
+	using namespace std::chrono;
+
+	constexpr auto kCount = 50000;
+	const auto names = GenerateNames(kCount);
+
+	const auto indexStart = steady_clock::now();
+	auto index = NameIndex<int>();
+	for (auto i = 0; i != kCount; ++i) {
+		index.set(i, names[i]);
+	}
+	const auto indexMs = duration_cast<milliseconds>(
+		steady_clock::now() - indexStart).count();
+
+	const auto scan = LetterScan(names);
+	const auto typed = QString("alkor pasete");
+	const auto measure = [&](auto &&find) {
+		auto total = int64(0);
+		auto worst = int64(0);
+		for (auto length = 1; length <= typed.size(); ++length) {
+			const auto words = typed.mid(0, length).split(
+				' ',
+				QString::SkipEmptyParts);
+			const auto start = steady_clock::now();
+			const auto found = find(words);
+			const auto us = duration_cast<microseconds>(
+				steady_clock::now() - start).count();
+			REQUIRE(found.size() <= kCount);
+			total += us;
+			worst = std::max(worst, int64(us));
+		}
+		return std::make_pair(total / typed.size(), worst);
+	};
+	const auto indexed = measure([&](const QStringList &words) {
+		return index.find(words);
+	});
+	const auto scanned = measure([&](const QStringList &words) {
+		return scan.find(words);
+	});
+	WARN("name index of " << kCount << " names built in " << indexMs
+		<< " ms, per keystroke: "
+		<< indexed.first << " us average, " << indexed.second << " us max; "
+		<< "letter scan: "
+		<< scanned.first << " us average, " << scanned.second << " us max");
+}
@@ -0,0 +1,372 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "ffmpeg/ffmpeg_premultiply.h"
+
+#include <array>
+
+#if defined(__SSE2__) \
+	|| defined(_M_X64) \
+	|| (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TDESKTOP_PREMULTIPLY_SSE2
+#include <emmintrin.h>
+#endif // __SSE2__ || _M_X64 || _M_IX86_FP >= 2
+
+#ifdef ARCH_CPU_X86_FAMILY
+#define TDESKTOP_PREMULTIPLY_AVX2
+#include <immintrin.h>
+
+// AVX2 code is compiled for the functions marked by TDESKTOP_TARGET_AVX2,
+// they are called only if the processor supports it.
+#ifdef COMPILER_MSVC
+#include <intrin.h>
+#define TDESKTOP_TARGET_AVX2
+#else // COMPILER_MSVC
+#include <cpuid.h>
+#define TDESKTOP_TARGET_AVX2 __attribute__((target("avx2")))
+#endif // COMPILER_MSVC
+#endif // ARCH_CPU_X86_FAMILY
+
+namespace FFmpeg {
+namespace details {
+namespace {
+
+// (255 * 65536 / alpha) rounded, qUnpremultiply() uses the same factors.
+constexpr auto kInverseFactors = [] {
+	auto result = std::array<uint32, 256>();
+	for (auto alpha = uint32(1); alpha != 256; ++alpha) {
+		result[alpha] = (255U * 65536U + alpha / 2) / alpha;
+	}
+	return result;
+}();
+
+TG_FORCE_INLINE uint32 Premultiply(uint32 pixel) {
+	const auto alpha = pixel >> 24;
+	const auto multiply = [&](int shift) {
+		const auto value = ((pixel >> shift) & 0xFFU) * alpha;
+		return ((value + (value >> 8) + 0x80U) >> 8) << shift;
+	};
+	return (alpha << 24) | multiply(16) | multiply(8) | multiply(0);
+}
+
+TG_FORCE_INLINE uint32 UnPremultiply(uint32 pixel) {
+	const auto alpha = pixel >> 24;
+	const auto factor = kInverseFactors[alpha];
+	const auto divide = [&](int shift) {
+		const auto value = ((pixel >> shift) & 0xFFU) * factor;
+		return (((value + 0x8000U) >> 16) & 0xFFU) << shift;
+	};
+	return (alpha << 24) | divide(16) | divide(8) | divide(0);
+}
+
+#ifdef TDESKTOP_PREMULTIPLY_SSE2
+
+// Each function processes whole blocks of pixels and returns their count,
+// the rest of the pixels are converted one by one.
+int PremultiplySse2(uint32 *to, const uint32 *from, int count) {
+	const auto zero = _mm_setzero_si128();
+	const auto alphaBytes = _mm_set1_epi32(int(0xFF000000U));
+	const auto colorWords = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+	const auto alphaWords = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+	const auto half = _mm_set1_epi16(0x80);
+
+	// Two pixels in 16 bit lanes, the colors are multiplied by alpha
+	// and the alpha is multiplied by 255, then all are divided by 255.
+	const auto multiply = [&](__m128i words) {
+		const auto alpha = _mm_shufflehi_epi16(
+			_mm_shufflelo_epi16(words, _MM_SHUFFLE(3, 3, 3, 3)),
+			_MM_SHUFFLE(3, 3, 3, 3));
+		const auto factor = _mm_or_si128(
+			_mm_and_si128(alpha, colorWords),
+			alphaWords);
+		const auto value = _mm_mullo_epi16(words, factor);
+		return _mm_srli_epi16(
+			_mm_add_epi16(
+				_mm_add_epi16(value, _mm_srli_epi16(value, 8)),
+				half),
+			8);
+	};
+	const auto blocks = count / 4;
+	for (auto i = 0; i != blocks; ++i) {
+		const auto pixels = _mm_loadu_si128(
+			reinterpret_cast<const __m128i*>(from) + i);
+		const auto opaque = _mm_cmpeq_epi32(
+			_mm_and_si128(pixels, alphaBytes),
+			alphaBytes);
+		const auto result = (_mm_movemask_epi8(opaque) == 0xFFFF)
+			? pixels
+			: _mm_packus_epi16(
+				multiply(_mm_unpacklo_epi8(pixels, zero)),
+				multiply(_mm_unpackhi_epi8(pixels, zero)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(to) + i, result);
+	}
+	return blocks * 4;
+}
+
+int UnPremultiplySse2(uint32 *to, const uint32 *from, int count) {
+	const auto byteMask = _mm_set1_epi32(0xFF);
+	const auto half = _mm_set_epi32(0, 0x8000, 0, 0x8000);
+
+	// There is no 32 bit lanes multiplication in SSE2, so the even and
+	// the odd lanes are multiplied to 64 bit separately.
+	const auto divide = [&](__m128i channel, __m128i factors) {
+		const auto even = _mm_srli_epi64(
+			_mm_add_epi64(_mm_mul_epu32(channel, factors), half),
+			16);
+		const auto odd = _mm_slli_epi64(
+			_mm_srli_epi64(
+				_mm_add_epi64(
+					_mm_mul_epu32(
+						_mm_srli_epi64(channel, 32),
+						_mm_srli_epi64(factors, 32)),
+					half),
+				16),
+			32);
+		return _mm_and_si128(_mm_or_si128(even, odd), byteMask);
+	};
+	const auto blocks = count / 4;
+	for (auto i = 0; i != blocks; ++i) {
+		const auto source = from + i * 4;
+		const auto pixels = _mm_loadu_si128(
+			reinterpret_cast<const __m128i*>(source));
+		const auto alpha = _mm_srli_epi32(pixels, 24);
+		const auto factors = _mm_set_epi32(
+			int(kInverseFactors[source[3] >> 24]),
+			int(kInverseFactors[source[2] >> 24]),
+			int(kInverseFactors[source[1] >> 24]),
+			int(kInverseFactors[source[0] >> 24]));
+		const auto blue = divide(_mm_and_si128(pixels, byteMask), factors);
+		const auto green = divide(
+			_mm_and_si128(_mm_srli_epi32(pixels, 8), byteMask),
+			factors);
+		const auto red = divide(
+			_mm_and_si128(_mm_srli_epi32(pixels, 16), byteMask),
+			factors);
+		const auto result = _mm_or_si128(
+			_mm_or_si128(_mm_slli_epi32(alpha, 24), _mm_slli_epi32(red, 16)),
+			_mm_or_si128(_mm_slli_epi32(green, 8), blue));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(to) + i, result);
+	}
+	return blocks * 4;
+}
+
+#endif // TDESKTOP_PREMULTIPLY_SSE2
+
+#ifdef TDESKTOP_PREMULTIPLY_AVX2
+
+// Lambdas don't get the target attribute, so the code is written inline.
+TDESKTOP_TARGET_AVX2 int PremultiplyAvx2(
+		uint32 *to,
+		const uint32 *from,
+		int count) {
+	const auto zero = _mm256_setzero_si256();
+	const auto alphaBytes = _mm256_set1_epi32(int(0xFF000000U));
+	const auto colorWords = _mm256_set_epi16(
+		0, -1, -1, -1, 0, -1, -1, -1,
+		0, -1, -1, -1, 0, -1, -1, -1);
+	const auto alphaWords = _mm256_set_epi16(
+		255, 0, 0, 0, 255, 0, 0, 0,
+		255, 0, 0, 0, 255, 0, 0, 0);
+	const auto half = _mm256_set1_epi16(0x80);
+
+	const auto blocks = count / 8;
+	for (auto i = 0; i != blocks; ++i) {
+		const auto pixels = _mm256_loadu_si256(
+			reinterpret_cast<const __m256i*>(from) + i);
+		const auto opaque = _mm256_cmpeq_epi32(
+			_mm256_and_si256(pixels, alphaBytes),
+			alphaBytes);
+		if (_mm256_movemask_epi8(opaque) == -1) {
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(to) + i, pixels);
+			continue;
+		}
+		__m256i words[2] = {
+			_mm256_unpacklo_epi8(pixels, zero),
+			_mm256_unpackhi_epi8(pixels, zero),
+		};
+		for (auto &part : words) {
+			const auto alpha = _mm256_shufflehi_epi16(
+				_mm256_shufflelo_epi16(part, _MM_SHUFFLE(3, 3, 3, 3)),
+				_MM_SHUFFLE(3, 3, 3, 3));
+			const auto factor = _mm256_or_si256(
+				_mm256_and_si256(alpha, colorWords),
+				alphaWords);
+			const auto value = _mm256_mullo_epi16(part, factor);
+			part = _mm256_srli_epi16(
+				_mm256_add_epi16(
+					_mm256_add_epi16(value, _mm256_srli_epi16(value, 8)),
+					half),
+				8);
+		}
+		_mm256_storeu_si256(
+			reinterpret_cast<__m256i*>(to) + i,
+			_mm256_packus_epi16(words[0], words[1]));
+	}
+	return blocks * 8;
+}
+
+TDESKTOP_TARGET_AVX2 int UnPremultiplyAvx2(
+		uint32 *to,
+		const uint32 *from,
+		int count) {
+	const auto byteMask = _mm256_set1_epi32(0xFF);
+	const auto half = _mm256_set1_epi32(0x8000);
+	const auto factorsTable = reinterpret_cast<const int*>(
+		kInverseFactors.data());
+
+	const auto blocks = count / 8;
+	for (auto i = 0; i != blocks; ++i) {
+		const auto pixels = _mm256_loadu_si256(
+			reinterpret_cast<const __m256i*>(from) + i);
+		const auto alpha = _mm256_srli_epi32(pixels, 24);
+		const auto factors = _mm256_i32gather_epi32(factorsTable, alpha, 4);
+
+		// The products fit in 32 bits, see qUnpremultiply().
+		auto result = _mm256_slli_epi32(alpha, 24);
+		for (auto shift = 0; shift != 24; shift += 8) {
+			const auto channel = _mm256_and_si256(
+				_mm256_srli_epi32(pixels, shift),
+				byteMask);
+			const auto value = _mm256_and_si256(
+				_mm256_srli_epi32(
+					_mm256_add_epi32(
+						_mm256_mullo_epi32(channel, factors),
+						half),
+					16),
+				byteMask);
+			result = _mm256_or_si256(result, _mm256_slli_epi32(value, shift));
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(to) + i, result);
+	}
+	return blocks * 8;
+}
+
+bool HasAvx2() {
+	constexpr auto kOsxsaveBit = (1U << 27);
+	constexpr auto kAvxBit = (1U << 28);
+	constexpr auto kAvx2Bit = (1U << 5);
+	constexpr auto kXmmYmmState = 0x06U;
+
+#ifdef COMPILER_MSVC
+	int info[4] = { 0 };
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	__cpuid(info, 1);
+	const auto features = uint32(info[2]);
+	if (!(features & kOsxsaveBit) || !(features & kAvxBit)) {
+		return false;
+	} else if ((_xgetbv(0) & kXmmYmmState) != kXmmYmmState) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (uint32(info[1]) & kAvx2Bit) != 0;
+#else // COMPILER_MSVC
+	auto eax = 0U, ebx = 0U, ecx = 0U, edx = 0U;
+	if (__get_cpuid_max(0, nullptr) < 7) {
+		return false;
+	} else if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		return false;
+	} else if (!(ecx & kOsxsaveBit) || !(ecx & kAvxBit)) {
+		return false;
+	}
+	auto xcr0 = 0U, xcr0high = 0U;
+	__asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0high) : "c"(0));
+	if ((xcr0 & kXmmYmmState) != kXmmYmmState) {
+		return false;
+	}
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return (ebx & kAvx2Bit) != 0;
+#endif // COMPILER_MSVC
+}
+
+#endif // TDESKTOP_PREMULTIPLY_AVX2
+
+Simd ComputeSupportedSimd() {
+#ifdef TDESKTOP_PREMULTIPLY_AVX2
+	if (HasAvx2()) {
+		return Simd::Avx2;
+	}
+#endif // TDESKTOP_PREMULTIPLY_AVX2
+#ifdef TDESKTOP_PREMULTIPLY_SSE2
+	return Simd::Sse2;
+#else // TDESKTOP_PREMULTIPLY_SSE2
+	return Simd::None;
+#endif // TDESKTOP_PREMULTIPLY_SSE2
+}
+
+} // namespace
+
+Simd SupportedSimd() {
+	static const auto result = ComputeSupportedSimd();
+	return result;
+}
+
+void PremultiplyLine(uchar *dst, const uchar *src, int intsCount, Simd simd) {
+	Expects(simd <= SupportedSimd());
+
+	const auto to = reinterpret_cast<uint32*>(dst);
+	const auto from = reinterpret_cast<const uint32*>(src);
+	auto done = 0;
+	switch (simd) {
+#ifdef TDESKTOP_PREMULTIPLY_AVX2
+	case Simd::Avx2: done = PremultiplyAvx2(to, from, intsCount); break;
+#endif // TDESKTOP_PREMULTIPLY_AVX2
+#ifdef TDESKTOP_PREMULTIPLY_SSE2
+	case Simd::Sse2: done = PremultiplySse2(to, from, intsCount); break;
+#endif // TDESKTOP_PREMULTIPLY_SSE2
+	default: break;
+	}
+	for (auto i = done; i != intsCount; ++i) {
+		to[i] = Premultiply(from[i]);
+	}
+}
+
+void UnPremultiplyLine(
+		uchar *dst,
+		const uchar *src,
+		int intsCount,
+		Simd simd) {
+	Expects(simd <= SupportedSimd());
+
+	const auto to = reinterpret_cast<uint32*>(dst);
+	const auto from = reinterpret_cast<const uint32*>(src);
+	auto done = 0;
+	switch (simd) {
+#ifdef TDESKTOP_PREMULTIPLY_AVX2
+	case Simd::Avx2: done = UnPremultiplyAvx2(to, from, intsCount); break;
+#endif // TDESKTOP_PREMULTIPLY_AVX2
+#ifdef TDESKTOP_PREMULTIPLY_SSE2
+	case Simd::Sse2: done = UnPremultiplySse2(to, from, intsCount); break;
+#endif // TDESKTOP_PREMULTIPLY_SSE2
+	default: break;
+	}
+	for (auto i = done; i != intsCount; ++i) {
+		to[i] = UnPremultiply(from[i]);
+	}
+}
+
+} // namespace details
+
+void PremultiplyLine(uchar *dst, const uchar *src, int intsCount) {
+	details::PremultiplyLine(
+		dst,
+		src,
+		intsCount,
+		details::SupportedSimd());
+}
+
+void UnPremultiplyLine(uchar *dst, const uchar *src, int intsCount) {
+	details::UnPremultiplyLine(
+		dst,
+		src,
+		intsCount,
+		details::SupportedSimd());
+}
+
+} // namespace FFmpeg
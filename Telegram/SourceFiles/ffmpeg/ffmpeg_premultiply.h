@@ -0,0 +1,40 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "base/basic_types.h"
+
+namespace FFmpeg {
+
+// Convert 'intsCount' pixels between ARGB32 and ARGB32 premultiplied
+// with the same results as qPremultiply() and qUnpremultiply() give.
+// 'dst' may be the same as 'src'.
+//
+// The best instruction set the processor supports is chosen at runtime.
+void PremultiplyLine(uchar *dst, const uchar *src, int intsCount);
+void UnPremultiplyLine(uchar *dst, const uchar *src, int intsCount);
+
+namespace details {
+
+enum class Simd {
+	None,
+	Sse2,
+	Avx2,
+};
+
+[[nodiscard]] Simd SupportedSimd();
+
+void PremultiplyLine(uchar *dst, const uchar *src, int intsCount, Simd simd);
+void UnPremultiplyLine(
+	uchar *dst,
+	const uchar *src,
+	int intsCount,
+	Simd simd);
+
+} // namespace details
+} // namespace FFmpeg
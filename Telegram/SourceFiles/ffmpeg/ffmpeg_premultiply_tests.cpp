@@ -0,0 +1,195 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "ffmpeg/ffmpeg_premultiply.h"
+
+#include <QtGui/qrgb.h>
+#include <chrono>
+#include <random>
+#include <vector>
+
+using FFmpeg::details::Simd;
+
+const auto DisableBenchmarkTests = true;
+
+namespace {
+
+std::vector<Simd> SupportedMethods() {
+	auto result = std::vector<Simd>{ Simd::None };
+	if (FFmpeg::details::SupportedSimd() >= Simd::Sse2) {
+		result.push_back(Simd::Sse2);
+	}
+	if (FFmpeg::details::SupportedSimd() >= Simd::Avx2) {
+		result.push_back(Simd::Avx2);
+	}
+	return result;
+}
+
+// All the alpha and color values, including not premultiplied ones.
+std::vector<uint32> AllPixels() {
+	auto result = std::vector<uint32>();
+	result.reserve(256 * 256);
+	for (auto alpha = 0; alpha != 256; ++alpha) {
+		for (auto color = 0; color != 256; ++color) {
+			result.push_back(qRgba(color, 255 - color, color / 2, alpha));
+		}
+	}
+	return result;
+}
+
+std::vector<uint32> Premultiply(std::vector<uint32> pixels, Simd simd) {
+	const auto bytes = reinterpret_cast<uchar*>(pixels.data());
+	FFmpeg::details::PremultiplyLine(bytes, bytes, int(pixels.size()), simd);
+	return pixels;
+}
+
+std::vector<uint32> UnPremultiply(
+		const std::vector<uint32> &pixels,
+		Simd simd) {
+	auto result = std::vector<uint32>(pixels.size());
+	FFmpeg::details::UnPremultiplyLine(
+		reinterpret_cast<uchar*>(result.data()),
+		reinterpret_cast<const uchar*>(pixels.data()),
+		int(pixels.size()),
+		simd);
+	return result;
+}
+
+std::vector<uint32> GenerateFrame(int count) {
+	auto engine = std::mt19937(7);
+	auto result = std::vector<uint32>(count);
+	for (auto &pixel : result) {
+		// Animations are mostly transparent or opaque.
+		const auto kind = engine() % 4;
+		const auto alpha = (kind == 0)
+			? 0
+			: (kind == 1)
+			? int(engine() & 0xFF)
+			: 255;
+		pixel = qPremultiply(qRgba(
+			int(engine() & 0xFF),
+			int(engine() & 0xFF),
+			int(engine() & 0xFF),
+			alpha));
+	}
+	return result;
+}
+
+} // namespace
+
+TEST_CASE("premultiply lines", "[premultiply]") {
+	const auto all = AllPixels();
+
+	SECTION("premultiply gives the same as qPremultiply") {
+		for (const auto simd : SupportedMethods()) {
+			const auto result = Premultiply(all, simd);
+			for (auto i = 0; i != int(all.size()); ++i) {
+				REQUIRE(result[i] == qPremultiply(all[i]));
+			}
+		}
+	}
+	SECTION("unpremultiply gives the same as qUnpremultiply") {
+		for (const auto simd : SupportedMethods()) {
+			const auto result = UnPremultiply(all, simd);
+			for (auto i = 0; i != int(all.size()); ++i) {
+				REQUIRE(result[i] == qUnpremultiply(all[i]));
+			}
+		}
+	}
+	SECTION("lines of any length are converted") {
+		for (const auto simd : SupportedMethods()) {
+			for (auto count = 0; count != 20; ++count) {
+				const auto line = std::vector<uint32>(
+					all.begin() + 1000,
+					all.begin() + 1000 + count);
+				const auto premultiplied = Premultiply(line, simd);
+				const auto restored = UnPremultiply(line, simd);
+				for (auto i = 0; i != count; ++i) {
+					REQUIRE(premultiplied[i] == qPremultiply(line[i]));
+					REQUIRE(restored[i] == qUnpremultiply(line[i]));
+				}
+			}
+		}
+	}
+	SECTION("unpremultiply is undone by premultiply") {
+		auto premultiplied = std::vector<uint32>();
+		for (const auto pixel : all) {
+			premultiplied.push_back(qPremultiply(pixel));
+		}
+		for (const auto simd : SupportedMethods()) {
+			const auto restored = Premultiply(
+				UnPremultiply(premultiplied, simd),
+				simd);
+			REQUIRE(restored == premultiplied);
+		}
+	}
+}
+
+TEST_CASE("premultiply benchmark", "[premultiply]") {
+	if (DisableBenchmarkTests) {
+		return;
+	}
+	using namespace std::chrono;
+
+	// A 512x512 lottie frame.
+	constexpr auto kCount = 512 * 512;
+	constexpr auto kRuns = 200;
+	const auto frame = GenerateFrame(kCount);
+	auto buffer = std::vector<uint32>(kCount);
+	const auto measure = [&](auto &&convert) {
+		const auto start = steady_clock::now();
+		for (auto i = 0; i != kRuns; ++i) {
+			convert(buffer.data(), frame.data());
+		}
+		const auto us = duration_cast<microseconds>(
+			steady_clock::now() - start).count();
+		return (double(kCount) * kRuns) / std::max(us, int64(1));
+	};
+	const auto name = [](Simd simd) {
+		switch (simd) {
+		case Simd::None: return "scalar";
+		case Simd::Sse2: return "sse2";
+		case Simd::Avx2: return "avx2";
+		}
+		return "";
+	};
+	WARN("qUnpremultiply: " << measure([](uint32 *to, const uint32 *from) {
+		for (auto i = 0; i != kCount; ++i) {
+			to[i] = qUnpremultiply(from[i]);
+		}
+	}) << " Mpixels/sec, qPremultiply: "
+		<< measure([](uint32 *to, const uint32 *from) {
+		for (auto i = 0; i != kCount; ++i) {
+			to[i] = qPremultiply(from[i]);
+		}
+	}) << " Mpixels/sec");
+	for (const auto simd : SupportedMethods()) {
+		const auto unpremultiply = measure([&](
+				uint32 *to,
+				const uint32 *from) {
+			FFmpeg::details::UnPremultiplyLine(
+				reinterpret_cast<uchar*>(to),
+				reinterpret_cast<const uchar*>(from),
+				kCount,
+				simd);
+		});
+		const auto premultiply = measure([&](
+				uint32 *to,
+				const uint32 *from) {
+			FFmpeg::details::PremultiplyLine(
+				reinterpret_cast<uchar*>(to),
+				reinterpret_cast<const uchar*>(from),
+				kCount,
+				simd);
+		});
+		WARN(name(simd) << " unpremultiply: " << unpremultiply
+			<< " Mpixels/sec, premultiply: " << premultiply
+			<< " Mpixels/sec");
+	}
+}
@@ -7,15 +7,12 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 */
 #include "ffmpeg/ffmpeg_utility.h"
 
+#include "ffmpeg/ffmpeg_premultiply.h"
 #include "base/algorithm.h"
 #include "logs.h"
 
 #include <QImage>
 
-#ifdef TDESKTOP_OFFICIAL_TARGET
-#include <private/qdrawhelper_p.h>
-#endif // TDESKTOP_OFFICIAL_TARGET
-
 extern "C" {
 #include <libavutil/opt.h>
 } // extern "C"
@@ -47,58 +44,6 @@ void AlignedImageBufferCleanupHandler(void* data) {
 		&& !(image.bytesPerLine() % kAlignImageBy);
 }
 
-void UnPremultiplyLine(uchar *dst, const uchar *src, int intsCount) {
-#ifdef TDESKTOP_OFFICIAL_TARGET
-	const auto layout = &qPixelLayouts[QImage::Format_ARGB32];
-	const auto convert = layout->convertFromARGB32PM;
-#else // TDESKTOP_OFFICIAL_TARGET
-	const auto layout = nullptr;
-	const auto convert = [](
-			uint *dst,
-			const uint *src,
-			int count,
-			std::nullptr_t,
-			std::nullptr_t) {
-		for (auto i = 0; i != count; ++i) {
-			dst[i] = qUnpremultiply(src[i]);
-		}
-	};
-#endif // TDESKTOP_OFFICIAL_TARGET
-
-	convert(
-		reinterpret_cast<uint*>(dst),
-		reinterpret_cast<const uint*>(src),
-		intsCount,
-		layout,
-		nullptr);
-}
-
-void PremultiplyLine(uchar *dst, const uchar *src, int intsCount) {
-#ifdef TDESKTOP_OFFICIAL_TARGET
-	const auto layout = &qPixelLayouts[QImage::Format_ARGB32];
-	const auto convert = layout->convertToARGB32PM;
-#else // TDESKTOP_OFFICIAL_TARGET
-	const auto layout = nullptr;
-	const auto convert = [](
-			uint *dst,
-			const uint *src,
-			int count,
-			std::nullptr_t,
-			std::nullptr_t) {
-		for (auto i = 0; i != count; ++i) {
-			dst[i] = qPremultiply(src[i]);
-		}
-	};
-#endif // TDESKTOP_OFFICIAL_TARGET
-
-	convert(
-		reinterpret_cast<uint*>(dst),
-		reinterpret_cast<const uint*>(src),
-		intsCount,
-		layout,
-		nullptr);
-}
-
 } // namespace
 
 IOPointer MakeIOPointer(
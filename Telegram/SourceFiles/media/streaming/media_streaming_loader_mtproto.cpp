@@ -121,6 +121,7 @@ void LoaderMtproto::sendNext() {
 	const auto index = _owner->chooseDcIndexForRequest(_dcId);
 	changeRequestedAmount(index, kPartSize);
 
+	const auto sent = crl::now();
 	const auto usedFileReference = _location.fileReference();
 	const auto id = _sender.request(MTPupload_GetFile(
 		MTP_flags(0),
@@ -129,6 +130,7 @@ void LoaderMtproto::sendNext() {
 		MTP_int(kPartSize)
 	)).done([=](const MTPupload_File &result) {
 		changeRequestedAmount(index, -kPartSize);
+		_owner->requestFinished(_dcId, index, kPartSize, crl::now() - sent);
 		requestDone(offset, result);
 	}).fail([=](const RPCError &error) {
 		changeRequestedAmount(index, -kPartSize);
@@ -12,7 +12,6 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "mtproto/rpc_sender.h"
 #include "mtproto/dc_options.h"
 #include "mtproto/connection_abstract.h"
-#include "zlib.h"
 #include "core/application.h"
 #include "core/launcher.h"
 #include "lang/lang_keys.h"
@@ -57,6 +56,9 @@ constexpr auto kRequestConfigTimeout = crl::time(8000);
 // Don't try to handle messages larger than this size.
 constexpr auto kMaxMessageLength = 16 * 1024 * 1024;
 
+// Keep the gzip_packed output buffer between messages up to this size.
+constexpr auto kMaxKeptGzipBufferSize = 1024 * 1024 / kIntSize;
+
 QString LogIdsVector(const QVector<MTPlong> &ids) {
 	if (!ids.size()) return "[]";
 	auto idsStr = QString("[%1").arg(ids.cbegin()->v);
@@ -222,9 +224,9 @@ ModExpFirst CreateModExp(
 
 void wrapInvokeAfter(SecureRequest &to, const SecureRequest &from, const RequestMap &haveSent, int32 skipBeforeRequest = 0) {
 	const auto afterId = *(mtpMsgId*)(from->after->data() + 4);
-	const auto i = afterId ? haveSent.constFind(afterId) : haveSent.cend();
+	const auto i = afterId ? haveSent.find(afterId) : haveSent.cend();
 	int32 size = to->size(), lenInInts = (from.innerLength() >> 2), headlen = 4, fulllen = headlen + lenInInts;
-	if (i == haveSent.constEnd()) { // no invoke after or such msg was not sent or was completed recently
+	if (i == haveSent.cend()) { // no invoke after or such msg was not sent or was completed recently
 		to->resize(size + fulllen + skipBeforeRequest);
 		if (skipBeforeRequest) {
 			memcpy(to->data() + size, from->constData() + 4, headlen * sizeof(mtpPrime));
@@ -430,6 +432,7 @@ ConnectionPrivate::ConnectionPrivate(
 , _waitForBetterTimer(thread, [=] { waitBetterFailed(); })
 , _waitForReceived(kMinReceiveTimeout)
 , _waitForConnected(kMinConnectedTimeout)
+, _dc(instance->getDcById(shiftedDcId))
 , _pingSender(thread, [=] { sendPingByTimer(); })
 , sessionData(data) {
 	Expects(_shiftedDcId != 0);
@@ -520,10 +523,7 @@ bool ConnectionPrivate::setState(int32 state, int32 ifState) {
 void ConnectionPrivate::resetSession() { // recreate all msg_id and msg_seqno
 	_needSessionReset = false;
 
-	QWriteLocker locker1(sessionData->haveSentMutex());
-	QWriteLocker locker2(sessionData->toResendMutex());
-	QWriteLocker locker3(sessionData->toSendMutex());
-	QWriteLocker locker4(sessionData->wereAckedMutex());
+	QWriteLocker locker(sessionData->haveSentMutex());
 	auto &haveSent = sessionData->haveSentMap();
 	auto &toResend = sessionData->toResendMap();
 	auto &toSend = sessionData->toSendMap();
@@ -533,13 +533,13 @@ void ConnectionPrivate::resetSession() { // recreate all msg_id and msg_seqno
 	auto setSeqNumbers = RequestMap();
 	auto replaces = QMap<mtpMsgId, mtpMsgId>();
 	for (auto i = haveSent.cbegin(), e = haveSent.cend(); i != e; ++i) {
-		if (!i.value().isSentContainer()) {
-			if (!*(mtpMsgId*)(i.value()->constData() + 4)) continue;
+		if (!i->second.isSentContainer()) {
+			if (!*(mtpMsgId*)(i->second->constData() + 4)) continue;
 
-			mtpMsgId id = i.key();
+			mtpMsgId id = i->first;
 			if (id > newId) {
 				while (true) {
-					if (toResend.constFind(newId) == toResend.cend() && wereAcked.constFind(newId) == wereAcked.cend() && haveSent.constFind(newId) == haveSent.cend()) {
+					if (toResend.find(newId) == toResend.cend() && wereAcked.find(newId) == wereAcked.cend() && haveSent.find(newId) == haveSent.cend()) {
 						break;
 					}
 					const auto m = base::unixtime::mtproto_msg_id();
@@ -551,22 +551,22 @@ void ConnectionPrivate::resetSession() { // recreate all msg_id and msg_seqno
 				MTP_LOG(_shiftedDcId, ("Replacing msgId %1 to %2!").arg(id).arg(newId));
 				replaces.insert(id, newId);
 				id = newId;
-				*(mtpMsgId*)(i.value()->data() + 4) = id;
+				*(mtpMsgId*)(i->second->data() + 4) = id;
 			}
-			setSeqNumbers.insert(id, i.value());
+			setSeqNumbers.emplace_or_assign(id, i->second);
 		}
 	}
 	for (auto i = toResend.cbegin(), e = toResend.cend(); i != e; ++i) { // collect all non-container requests
-		const auto j = toSend.constFind(i.value());
+		const auto j = toSend.constFind(i->second);
 		if (j == toSend.cend()) continue;
 
 		if (!j.value().isSentContainer()) {
 			if (!*(mtpMsgId*)(j.value()->constData() + 4)) continue;
 
-			mtpMsgId id = i.key();
+			mtpMsgId id = i->first;
 			if (id > newId) {
 				while (true) {
-					if (toResend.constFind(newId) == toResend.cend() && wereAcked.constFind(newId) == wereAcked.cend() && haveSent.constFind(newId) == haveSent.cend()) {
+					if (toResend.find(newId) == toResend.cend() && wereAcked.find(newId) == wereAcked.cend() && haveSent.find(newId) == haveSent.cend()) {
 						break;
 					}
 					const auto m = base::unixtime::mtproto_msg_id();
@@ -580,7 +580,7 @@ void ConnectionPrivate::resetSession() { // recreate all msg_id and msg_seqno
 				id = newId;
 				*(mtpMsgId*)(j.value()->data() + 4) = id;
 			}
-			setSeqNumbers.insert(id, j.value());
+			setSeqNumbers.emplace_or_assign(id, j.value());
 		}
 	}
 
@@ -589,34 +589,34 @@ void ConnectionPrivate::resetSession() { // recreate all msg_id and msg_seqno
 	sessionData->setSession(session);
 
 	for (auto i = setSeqNumbers.cbegin(), e = setSeqNumbers.cend(); i != e; ++i) { // generate new seq_numbers
-		bool wasNeedAck = (*(i.value()->data() + 6) & 1);
-		*(i.value()->data() + 6) = sessionData->nextRequestSeqNumber(wasNeedAck);
+		bool wasNeedAck = (*(i->second->data() + 6) & 1);
+		*(i->second->data() + 6) = sessionData->nextRequestSeqNumber(wasNeedAck);
 	}
 	if (!replaces.isEmpty()) {
 		for (auto i = replaces.cbegin(), e = replaces.cend(); i != e; ++i) { // replace msgIds keys in all data structs
 			const auto j = haveSent.find(i.key());
 			if (j != haveSent.cend()) {
-				const auto req = j.value();
+				const auto req = j->second;
 				haveSent.erase(j);
-				haveSent.insert(i.value(), req);
+				haveSent.emplace_or_assign(i.value(), req);
 			}
 			const auto k = toResend.find(i.key());
 			if (k != toResend.cend()) {
-				const auto req = k.value();
+				const auto req = k->second;
 				toResend.erase(k);
-				toResend.insert(i.value(), req);
+				toResend.emplace_or_assign(i.value(), req);
 			}
 			const auto l = wereAcked.find(i.key());
 			if (l != wereAcked.cend()) {
-				const auto req = l.value();
+				const auto req = l->second;
 				wereAcked.erase(l);
-				wereAcked.insert(i.value(), req);
+				wereAcked.emplace_or_assign(i.value(), req);
 			}
 		}
 		for (auto i = haveSent.cbegin(), e = haveSent.cend(); i != e; ++i) { // replace msgIds in saved containers
-			if (i.value().isSentContainer()) {
-				mtpMsgId *ids = (mtpMsgId*)(i.value()->data() + 8);
-				for (uint32 j = 0, l = (i.value()->size() - 8) >> 1; j < l; ++j) {
+			if (i->second.isSentContainer()) {
+				mtpMsgId *ids = (mtpMsgId*)(i->second->data() + 8);
+				for (uint32 j = 0, l = (i->second->size() - 8) >> 1; j < l; ++j) {
 					const auto k = replaces.constFind(ids[j]);
 					if (k != replaces.cend()) {
 						ids[j] = k.value();
@@ -640,7 +640,6 @@ mtpMsgId ConnectionPrivate::prepareToSend(SecureRequest &request, mtpMsgId curre
 	if (request->size() < 9) return 0;
 	mtpMsgId msgId = *(mtpMsgId*)(request->constData() + 4);
 	if (msgId) { // resending this request
-		QWriteLocker locker(sessionData->toResendMutex());
 		auto &toResend = sessionData->toResendMap();
 		const auto i = toResend.find(msgId);
 		if (i != toResend.cend()) {
@@ -653,21 +652,42 @@ mtpMsgId ConnectionPrivate::prepareToSend(SecureRequest &request, mtpMsgId curre
 	return msgId;
 }
 
+void ConnectionPrivate::gzipPackRequest(SecureRequest &request) {
+	if (!request->requestId || !request.needAck()) {
+		return;
+	}
+
+	// The request is shared with Instance::Private::_requestMap and read
+	// on the main thread, so the packed one is sent in place of it.
+	auto packed = SecureRequest::Prepare(0);
+	if (!_gzipPacker.packMessage(
+			*request,
+			uint32(_connectionOptions->gzipPackThreshold),
+			*packed)) {
+		return;
+	}
+	packed->msDate = request->msDate;
+	packed->requestId = request->requestId;
+	packed->after = request->after;
+	packed->needsLayer = request->needsLayer;
+	_dc->addGzipPacked(request.innerLength(), packed.innerLength());
+	request = std::move(packed);
+}
+
 mtpMsgId ConnectionPrivate::replaceMsgId(SecureRequest &request, mtpMsgId newId) {
 	if (request->size() < 9) return 0;
 
 	mtpMsgId oldMsgId = *(mtpMsgId*)(request->constData() + 4);
 	if (oldMsgId != newId) {
 		if (oldMsgId) {
-			QWriteLocker locker(sessionData->toResendMutex());
-			// haveSentMutex() and wereAckedMutex() were locked in tryToSend()
+			// haveSentMutex() was locked in tryToSend()
 
 			auto &toResend = sessionData->toResendMap();
 			auto &wereAcked = sessionData->wereAckedMap();
 			auto &haveSent = sessionData->haveSentMap();
 
 			while (true) {
-				if (toResend.constFind(newId) == toResend.cend() && wereAcked.constFind(newId) == wereAcked.cend() && haveSent.constFind(newId) == haveSent.cend()) {
+				if (toResend.find(newId) == toResend.cend() && wereAcked.find(newId) == wereAcked.cend() && haveSent.find(newId) == haveSent.cend()) {
 					break;
 				}
 				const auto m = base::unixtime::mtproto_msg_id();
@@ -678,27 +698,27 @@ mtpMsgId ConnectionPrivate::replaceMsgId(SecureRequest &request, mtpMsgId newId)
 
 			const auto i = toResend.find(oldMsgId);
 			if (i != toResend.cend()) {
-				const auto req = i.value();
+				const auto req = i->second;
 				toResend.erase(i);
-				toResend.insert(newId, req);
+				toResend.emplace_or_assign(newId, req);
 			}
 
 			const auto j = wereAcked.find(oldMsgId);
 			if (j != wereAcked.cend()) {
-				const auto req = j.value();
+				const auto req = j->second;
 				wereAcked.erase(j);
-				wereAcked.insert(newId, req);
+				wereAcked.emplace_or_assign(newId, req);
 			}
 
 			const auto k = haveSent.find(oldMsgId);
 			if (k != haveSent.cend()) {
-				const auto req = k.value();
+				const auto req = k->second;
 				haveSent.erase(k);
-				haveSent.insert(newId, req);
+				haveSent.emplace_or_assign(newId, req);
 			}
 
 			for (auto l = haveSent.begin(); l != haveSent.cend(); ++l) {
-				const auto req = l.value();
+				const auto req = l->second;
 				if (req.isSentContainer()) {
 					const auto ids = (mtpMsgId *)(req->data() + 8);
 					for (uint32 i = 0, l = (req->size() - 8) >> 1; i < l; ++i) {
@@ -738,6 +758,7 @@ void ConnectionPrivate::tryToSend() {
 	if (!sessionData || !_connection) {
 		return;
 	}
+	sessionData->takeToSend();
 
 	auto needsLayer = !_connectionOptions->inited;
 	auto state = getState();
@@ -874,11 +895,8 @@ void ConnectionPrivate::tryToSend() {
 	bool needAnyResponse = false;
 	SecureRequest toSendRequest;
 	{
-		QWriteLocker locker1(sessionData->toSendMutex());
-
 		auto toSendDummy = PreRequestMap();
 		auto &toSend = prependOnly ? toSendDummy : sessionData->toSendMap();
-		if (prependOnly) locker1.unlock();
 
 		uint32 toSendCount = toSend.size();
 		if (pingRequest) ++toSendCount;
@@ -889,12 +907,18 @@ void ConnectionPrivate::tryToSend() {
 
 		if (!toSendCount) return; // nothing to send
 
+		if (!prependOnly && _connectionOptions->gzipPackThreshold) {
+			for (auto &request : toSend) {
+				gzipPackRequest(request);
+			}
+		}
+
 		auto first = pingRequest ? pingRequest : (ackRequest ? ackRequest : (resendRequest ? resendRequest : (stateRequest ? stateRequest : (httpWaitRequest ? httpWaitRequest : toSend.cbegin().value()))));
 		if (toSendCount == 1 && first->msDate > 0) { // if can send without container
 			toSendRequest = first;
 			if (!prependOnly) {
 				toSend.clear();
-				locker1.unlock();
+				sessionData->toSendTaken();
 			}
 
 			const auto msgId = prepareToSend(
@@ -913,7 +937,7 @@ void ConnectionPrivate::tryToSend() {
 
 					QWriteLocker locker2(sessionData->haveSentMutex());
 					auto &haveSent = sessionData->haveSentMap();
-					haveSent.insert(msgId, toSendRequest);
+					haveSent.emplace_or_assign(msgId, toSendRequest);
 
 					if (needsLayer && !toSendRequest->needsLayer) needsLayer = false;
 					if (toSendRequest->after) {
@@ -941,8 +965,7 @@ void ConnectionPrivate::tryToSend() {
 
 					needAnyResponse = true;
 				} else {
-					QWriteLocker locker3(sessionData->wereAckedMutex());
-					sessionData->wereAckedMap().insert(msgId, toSendRequest->requestId);
+					sessionData->wereAckedMap().emplace_or_assign(msgId, toSendRequest->requestId);
 				}
 			}
 		} else { // send in container
@@ -980,9 +1003,6 @@ void ConnectionPrivate::tryToSend() {
 			// the fact of this lock is used in replaceMsgId()
 			QWriteLocker locker2(sessionData->haveSentMutex());
 			auto &haveSent = sessionData->haveSentMap();
-
-			// the fact of this lock is used in replaceMsgId()
-			QWriteLocker locker3(sessionData->wereAckedMutex());
 			auto &wereAcked = sessionData->wereAckedMap();
 
 			// prepare "request-like" wrap for msgId vector
@@ -1027,11 +1047,11 @@ void ConnectionPrivate::tryToSend() {
 							*(toSendRequest->data() + reqNeedsLayer + 3) += initSize;
 							added = true;
 						}
-						haveSent.insert(msgId, req);
+						haveSent.emplace_or_assign(msgId, req);
 
 						needAnyResponse = true;
 					} else {
-						wereAcked.insert(msgId, req->requestId);
+						wereAcked.emplace_or_assign(msgId, req->requestId);
 					}
 				}
 				if (!added) {
@@ -1043,7 +1063,7 @@ void ConnectionPrivate::tryToSend() {
 			if (stateRequest) {
 				mtpMsgId msgId = placeToContainer(toSendRequest, bigMsgId, haveSentArr, stateRequest);
 				stateRequest->msDate = 0; // 0 for state request, do not request state of it
-				haveSent.insert(msgId, stateRequest);
+				haveSent.emplace_or_assign(msgId, stateRequest);
 			}
 			if (resendRequest) placeToContainer(toSendRequest, bigMsgId, haveSentArr, resendRequest);
 			if (ackRequest) placeToContainer(toSendRequest, bigMsgId, haveSentArr, ackRequest);
@@ -1052,8 +1072,11 @@ void ConnectionPrivate::tryToSend() {
 			mtpMsgId contMsgId = prepareToSend(toSendRequest, bigMsgId);
 			*(mtpMsgId*)(haveSentIdsWrap->data() + 4) = contMsgId;
 			(*haveSentIdsWrap)[6] = 0; // for container, msDate = 0, seqNo = 0
-			haveSent.insert(contMsgId, haveSentIdsWrap);
+			haveSent.emplace_or_assign(contMsgId, haveSentIdsWrap);
 			toSend.clear();
+			if (!prependOnly) {
+				sessionData->toSendTaken();
+			}
 		}
 	}
 	sendSecureRequest(
@@ -1406,6 +1429,9 @@ void ConnectionPrivate::handleReceived() {
 	QReadLocker lockFinished(&sessionDataMutex);
 	if (!sessionData) return;
 
+	// Resent requests must be in toResend before their acks are handled.
+	sessionData->takeToSend();
+
 	onReceivedSome();
 
 	auto restartOnError = [this, &lockFinished] {
@@ -1428,16 +1454,36 @@ void ConnectionPrivate::handleReceived() {
 		return restartOnError();
 	}
 
-	while (!_connection->received().empty()) {
-		auto intsBuffer = std::move(_connection->received().front());
-		_connection->received().pop_front();
+	auto stats = ReceiveStats();
+	stats.copiedBytes = _connection->takeReceivedBytesCopied();
+	const auto flushStats = gsl::finally([&] {
+		_dc->addReceiveStats(stats);
+	});
+
+	auto intsBuffer = mtpBuffer();
+	while (true) {
+		// Queued packets were received before the one in place.
+		auto packet = bytes::span();
+		if (!_connection->received().empty()) {
+			intsBuffer = std::move(_connection->received().front());
+			_connection->received().pop_front();
+			packet = bytes::make_span(intsBuffer);
+		} else {
+			packet = _connection->takeReceivedInPlace();
+			if (packet.empty()) {
+				break;
+			}
+			++stats.inPlacePackets;
+		}
+		++stats.packets;
+		stats.receivedBytes += packet.size();
 
 		constexpr auto kExternalHeaderIntsCount = 6U; // 2 auth_key_id, 4 msg_key
 		constexpr auto kEncryptedHeaderIntsCount = 8U; // 2 salt, 2 session, 2 msg_id, 1 seq_no, 1 length
 		constexpr auto kMinimalEncryptedIntsCount = kEncryptedHeaderIntsCount + 4U; // + 1 data + 3 padding
 		constexpr auto kMinimalIntsCount = kExternalHeaderIntsCount + kMinimalEncryptedIntsCount;
-		auto intsCount = uint32(intsBuffer.size());
-		auto ints = intsBuffer.constData();
+		auto intsCount = uint32(packet.size() / kIntSize);
+		auto ints = reinterpret_cast<mtpPrime*>(packet.data());
 		if ((intsCount < kMinimalIntsCount) || (intsCount > kMaxMessageLength / kIntSize)) {
 			LOG(("TCP Error: bad message received, len %1").arg(intsCount * kIntSize));
 			TCP_LOG(("TCP Error: bad message %1").arg(Logs::mb(ints, intsCount * kIntSize).str()));
@@ -1454,16 +1500,16 @@ void ConnectionPrivate::handleReceived() {
 		auto encryptedInts = ints + kExternalHeaderIntsCount;
 		auto encryptedIntsCount = (intsCount - kExternalHeaderIntsCount) & ~0x03U;
 		auto encryptedBytesCount = encryptedIntsCount * kIntSize;
-		auto decryptedBuffer = QByteArray(encryptedBytesCount, Qt::Uninitialized);
 		auto msgKey = *(MTPint128*)(ints + 2);
 
+		// Decrypt in place, the packet is not needed after that.
 #ifdef TDESKTOP_MTPROTO_OLD
-		aesIgeDecrypt_oldmtp(encryptedInts, decryptedBuffer.data(), encryptedBytesCount, key, msgKey);
+		aesIgeDecrypt_oldmtp(encryptedInts, encryptedInts, encryptedBytesCount, key, msgKey);
 #else // TDESKTOP_MTPROTO_OLD
-		aesIgeDecrypt(encryptedInts, decryptedBuffer.data(), encryptedBytesCount, key, msgKey);
+		aesIgeDecrypt(encryptedInts, encryptedInts, encryptedBytesCount, key, msgKey);
 #endif // TDESKTOP_MTPROTO_OLD
 
-		auto decryptedInts = reinterpret_cast<const mtpPrime*>(decryptedBuffer.constData());
+		const auto decryptedInts = static_cast<const mtpPrime*>(encryptedInts);
 		auto serverSalt = *(uint64*)&decryptedInts[0];
 		auto session = *(uint64*)&decryptedInts[2];
 		auto msgId = *(uint64*)&decryptedInts[4];
@@ -1494,7 +1540,7 @@ void ConnectionPrivate::handleReceived() {
 		constexpr auto kMsgKeyShift_oldmtp = 4U;
 		if (memcmp(&msgKey, sha1ForMsgKeyCheck.data() + kMsgKeyShift_oldmtp, sizeof(msgKey)) != 0) {
 			LOG(("TCP Error: bad SHA1 hash after aesDecrypt in message."));
-			TCP_LOG(("TCP Error: bad message %1").arg(Logs::mb(encryptedInts, encryptedBytesCount).str()));
+			TCP_LOG(("TCP Error: bad decrypted message %1").arg(Logs::mb(encryptedInts, encryptedBytesCount).str()));
 
 			return restartOnError();
 		}
@@ -1514,7 +1560,7 @@ void ConnectionPrivate::handleReceived() {
 		constexpr auto kMsgKeyShift = 8U;
 		if (memcmp(&msgKey, sha256Buffer.data() + kMsgKeyShift, sizeof(msgKey)) != 0) {
 			LOG(("TCP Error: bad SHA256 hash after aesDecrypt in message"));
-			TCP_LOG(("TCP Error: bad message %1").arg(Logs::mb(encryptedInts, encryptedBytesCount).str()));
+			TCP_LOG(("TCP Error: bad decrypted message %1").arg(Logs::mb(encryptedInts, encryptedBytesCount).str()));
 
 			return restartOnError();
 		}
@@ -1522,7 +1568,7 @@ void ConnectionPrivate::handleReceived() {
 
 		if (badMessageLength || (messageLength & 0x03)) {
 			LOG(("TCP Error: bad msg_len received %1, data size: %2").arg(messageLength).arg(encryptedBytesCount));
-			TCP_LOG(("TCP Error: bad message %1").arg(Logs::mb(encryptedInts, encryptedBytesCount).str()));
+			TCP_LOG(("TCP Error: bad decrypted message %1").arg(Logs::mb(encryptedInts, encryptedBytesCount).str()));
 
 			return restartOnError();
 		}
@@ -1599,13 +1645,11 @@ void ConnectionPrivate::handleReceived() {
 			emit sendAnythingAsync(kAckSendWaiting);
 		}
 
-		bool emitSignal = false;
-		{
-			QReadLocker locker(sessionData->haveReceivedMutex());
-			emitSignal = !sessionData->haveReceivedResponses().isEmpty() || !sessionData->haveReceivedUpdates().isEmpty();
-			if (emitSignal) {
-				DEBUG_LOG(("MTP Info: emitting needToReceive() - need to parse in another thread, %1 responses, %2 updates.").arg(sessionData->haveReceivedResponses().size()).arg(sessionData->haveReceivedUpdates().size()));
-			}
+		const auto responsesCount = sessionData->receivedResponsesCount();
+		const auto updatesCount = sessionData->receivedUpdatesCount();
+		const auto emitSignal = (responsesCount > 0) || (updatesCount > 0);
+		if (emitSignal) {
+			DEBUG_LOG(("MTP Info: emitting needToReceive() - need to parse in another thread, %1 responses, %2 updates.").arg(responsesCount).arg(updatesCount));
 		}
 
 		if (emitSignal) {
@@ -1643,11 +1687,18 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 
 	case mtpc_gzip_packed: {
 		DEBUG_LOG(("Message Info: gzip container"));
-		mtpBuffer response = ungzip(++from, end);
-		if (response.empty()) {
+
+		// Everything is copied out of the unpacked container while
+		// handling it, so the buffer is kept for the next one.
+		auto response = base::take(_gzipBuffer);
+		if (!ungzip(++from, end, response)) {
 			return HandleResult::RestartConnection;
 		}
-		return handleOneReceived(response.data(), response.data() + response.size(), msgId, serverTime, serverSalt, badTime);
+		const auto result = handleOneReceived(response.data(), response.data() + response.size(), msgId, serverTime, serverSalt, badTime);
+		if (response.capacity() <= kMaxKeptGzipBufferSize) {
+			_gzipBuffer = std::move(response);
+		}
+		return result;
 	}
 
 	case mtpc_msg_container: {
@@ -1766,11 +1817,11 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 						QWriteLocker locker(sessionData->haveSentMutex());
 						auto &haveSent = sessionData->haveSentMap();
 
-						const auto i = haveSent.constFind(resendId);
+						const auto i = haveSent.find(resendId);
 						if (i == haveSent.cend()) {
 							LOG(("Message Error: Container not found!"));
 						} else {
-							request = i.value();
+							request = i->second;
 						}
 					}
 					if (request) {
@@ -1889,7 +1940,6 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 			auto minRecv = receivedIds.min();
 			auto maxRecv = receivedIds.max();
 
-			QReadLocker locker(sessionData->wereAckedMutex());
 			const auto &wereAcked = sessionData->wereAckedMap();
 			const auto wereAckedEnd = wereAcked.cend();
 
@@ -1906,7 +1956,7 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 						state |= 0x02;
 					} else {
 						state |= 0x04;
-						if (wereAcked.constFind(reqMsgId) != wereAckedEnd) {
+						if (wereAcked.find(reqMsgId) != wereAckedEnd) {
 							state |= 0x80; // we know, that server knows, that we received request
 						}
 						if (msgIdState == ReceivedMsgIds::State::NeedsAck) { // need ack, so we sent ack
@@ -1937,7 +1987,7 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 		{ // find this request in session-shared sent requests map
 			QReadLocker locker(sessionData->haveSentMutex());
 			const auto &haveSent = sessionData->haveSentMap();
-			const auto replyTo = haveSent.constFind(reqMsgId);
+			const auto replyTo = haveSent.find(reqMsgId);
 			if (replyTo == haveSent.cend()) { // do not look in toResend, because we do not resend msgs_state_req requests
 				DEBUG_LOG(("Message Error: such message was not sent recently %1").arg(reqMsgId));
 				return (badTime ? HandleResult::Ignored : HandleResult::Success);
@@ -1950,7 +2000,7 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 
 				badTime = false;
 			}
-			requestBuffer = replyTo.value();
+			requestBuffer = replyTo->second;
 		}
 		QVector<MTPlong> toAckReq(1, MTP_long(reqMsgId)), toAck;
 		requestsAcked(toAck, true);
@@ -2107,8 +2157,7 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 
 		if (typeId == mtpc_gzip_packed) {
 			DEBUG_LOG(("RPC Info: gzip container"));
-			response = ungzip(++from, end);
-			if (response.empty()) {
+			if (!ungzip(++from, end, response)) {
 				return HandleResult::RestartConnection;
 			}
 			typeId = response[0];
@@ -2129,8 +2178,7 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 		auto requestId = wasSent(reqMsgId.v);
 		if (requestId && requestId != mtpRequestId(0xFFFFFFFF)) {
 			// Save rpc_result for processing in the main thread.
-			QWriteLocker locker(sessionData->haveReceivedMutex());
-			sessionData->haveReceivedResponses().insert(requestId, response);
+			sessionData->addReceivedResponse(requestId, std::move(response));
 		} else {
 			DEBUG_LOG(("RPC Info: requestId not found for msgId %1").arg(reqMsgId.v));
 		}
@@ -2163,8 +2211,8 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 			const auto &haveSent = sessionData->haveSentMap();
 			toResend.reserve(haveSent.size());
 			for (auto i = haveSent.cbegin(), e = haveSent.cend(); i != e; ++i) {
-				if (i.key() >= firstMsgId) break;
-				if (i.value()->requestId) toResend.push_back(i.key());
+				if (i->first >= firstMsgId) break;
+				if (i->second->requestId) toResend.push_back(i->first);
 			}
 		}
 		resendMany(toResend, 10, true);
@@ -2173,8 +2221,7 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 		if (from > start) memcpy(update.data(), start, (from - start) * sizeof(mtpPrime));
 
 		// Notify main process about new session - need to get difference.
-		QWriteLocker locker(sessionData->haveReceivedMutex());
-		sessionData->haveReceivedUpdates().push_back(SerializedMessage(update));
+		sessionData->addReceivedUpdate(SerializedMessage(update));
 	} return HandleResult::Success;
 
 	case mtpc_pong: {
@@ -2218,8 +2265,7 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 		if (end > from) memcpy(update.data(), from, (end - from) * sizeof(mtpPrime));
 
 		// Notify main process about the new updates.
-		QWriteLocker locker(sessionData->haveReceivedMutex());
-		sessionData->haveReceivedUpdates().push_back(SerializedMessage(update));
+		sessionData->addReceivedUpdate(SerializedMessage(update));
 
 		if (cons != mtpc_updatesTooLong
 			&& cons != mtpc_updateShortMessage
@@ -2238,56 +2284,29 @@ ConnectionPrivate::HandleResult ConnectionPrivate::handleOneReceived(const mtpPr
 	return HandleResult::Success;
 }
 
-mtpBuffer ConnectionPrivate::ungzip(const mtpPrime *from, const mtpPrime *end) const {
-	mtpBuffer result; // * 4 because of mtpPrime type
-	result.resize(0);
-
-	MTPstring packed;
-	if (!packed.read(from, end)) { // read packed string as serialized mtp string type
+bool ConnectionPrivate::ungzip(
+		const mtpPrime *from,
+		const mtpPrime *end,
+		mtpBuffer &result) {
+	switch (_gzipUnpacker.unpack(from, end, result)) {
+	case GzipError::None:
+		return true;
+	case GzipError::BadPacked:
 		LOG(("RPC Error: could not read gziped bytes."));
-		return result;
-	}
-	uint32 packedLen = packed.v.size(), unpackedChunk = packedLen, unpackedLen = 0;
-
-	z_stream stream;
-	stream.zalloc = 0;
-	stream.zfree = 0;
-	stream.opaque = 0;
-	stream.avail_in = 0;
-	stream.next_in = 0;
-	int res = inflateInit2(&stream, 16 + MAX_WBITS);
-	if (res != Z_OK) {
-		LOG(("RPC Error: could not init zlib stream, code: %1").arg(res));
-		return result;
-	}
-	stream.avail_in = packedLen;
-	stream.next_in = reinterpret_cast<Bytef*>(packed.v.data());
-
-	stream.avail_out = 0;
-	while (!stream.avail_out) {
-		result.resize(result.size() + unpackedChunk);
-		stream.avail_out = unpackedChunk * sizeof(mtpPrime);
-		stream.next_out = (Bytef*)&result[result.size() - unpackedChunk];
-		int res = inflate(&stream, Z_NO_FLUSH);
-		if (res != Z_OK && res != Z_STREAM_END) {
-			inflateEnd(&stream);
-			LOG(("RPC Error: could not unpack gziped data, code: %1").arg(res));
-			DEBUG_LOG(("RPC Error: bad gzip: %1").arg(Logs::mb(packed.v.constData(), packedLen).str()));
-			return mtpBuffer();
-		}
-	}
-	if (stream.avail_out & 0x03) {
-		uint32 badSize = result.size() * sizeof(mtpPrime) - stream.avail_out;
-		LOG(("RPC Error: bad length of unpacked data %1").arg(badSize));
-		DEBUG_LOG(("RPC Error: bad unpacked data %1").arg(Logs::mb(result.data(), badSize).str()));
-		return mtpBuffer();
-	}
-	result.resize(result.size() - (stream.avail_out >> 2));
-	inflateEnd(&stream);
-	if (!result.size()) {
-		LOG(("RPC Error: bad length of unpacked data 0"));
+		return false;
+	case GzipError::InitFailed:
+		LOG(("RPC Error: could not init zlib stream, code: %1"
+			).arg(_gzipUnpacker.zlibCode()));
+		return false;
+	case GzipError::InflateFailed:
+		LOG(("RPC Error: could not unpack gziped data, code: %1"
+			).arg(_gzipUnpacker.zlibCode()));
+		return false;
+	case GzipError::BadLength:
+		LOG(("RPC Error: bad length of unpacked data."));
+		return false;
 	}
-	return result;
+	Unexpected("Result in GzipUnpacker::unpack.");
 }
 
 bool ConnectionPrivate::requestsFixTimeSalt(const QVector<MTPlong> &ids, int32 serverTime, uint64 serverSalt) {
@@ -2311,7 +2330,6 @@ void ConnectionPrivate::requestsAcked(const QVector<MTPlong> &ids, bool byRespon
 	auto clearedBecauseTooOld = std::vector<RPCCallbackClear>();
 	QVector<MTPlong> toAckMore;
 	{
-		QWriteLocker locker1(sessionData->wereAckedMutex());
 		auto &wereAcked = sessionData->wereAckedMap();
 
 		{
@@ -2322,23 +2340,23 @@ void ConnectionPrivate::requestsAcked(const QVector<MTPlong> &ids, bool byRespon
 				mtpMsgId msgId = ids[i].v;
 				const auto req = haveSent.find(msgId);
 				if (req != haveSent.cend()) {
-					if (!req.value()->msDate) {
+					if (!req->second->msDate) {
 						DEBUG_LOG(("Message Info: container ack received, msgId %1").arg(ids[i].v));
-						uint32 inContCount = ((*req)->size() - 8) / 2;
-						const mtpMsgId *inContId = (const mtpMsgId *)(req.value()->constData() + 8);
+						uint32 inContCount = (req->second->size() - 8) / 2;
+						const mtpMsgId *inContId = (const mtpMsgId *)(req->second->constData() + 8);
 						toAckMore.reserve(toAckMore.size() + inContCount);
 						for (uint32 j = 0; j < inContCount; ++j) {
 							toAckMore.push_back(MTP_long(*(inContId++)));
 						}
 						haveSent.erase(req);
 					} else {
-						mtpRequestId reqId = req.value()->requestId;
+						mtpRequestId reqId = req->second->requestId;
 						bool moveToAcked = byResponse;
 						if (!moveToAcked) { // ignore ACK, if we need a response (if we have a handler)
 							moveToAcked = !_instance->hasCallbacks(reqId);
 						}
 						if (moveToAcked) {
-							wereAcked.insert(msgId, reqId);
+							wereAcked.emplace_or_assign(msgId, reqId);
 							haveSent.erase(req);
 						} else {
 							DEBUG_LOG(("Message Info: ignoring ACK for msgId %1 because request %2 requires a response").arg(msgId).arg(reqId));
@@ -2346,27 +2364,26 @@ void ConnectionPrivate::requestsAcked(const QVector<MTPlong> &ids, bool byRespon
 					}
 				} else {
 					DEBUG_LOG(("Message Info: msgId %1 was not found in recent sent, while acking requests, searching in resend...").arg(msgId));
-					QWriteLocker locker3(sessionData->toResendMutex());
 					auto &toResend = sessionData->toResendMap();
 					const auto reqIt = toResend.find(msgId);
 					if (reqIt != toResend.cend()) {
-						const auto reqId = reqIt.value();
+						const auto reqId = reqIt->second;
 						bool moveToAcked = byResponse;
 						if (!moveToAcked) { // ignore ACK, if we need a response (if we have a handler)
 							moveToAcked = !_instance->hasCallbacks(reqId);
 						}
 						if (moveToAcked) {
-							QWriteLocker locker4(sessionData->toSendMutex());
 							auto &toSend = sessionData->toSendMap();
 							const auto req = toSend.find(reqId);
 							if (req != toSend.cend()) {
-								wereAcked.insert(msgId, req.value()->requestId);
+								wereAcked.emplace_or_assign(msgId, req.value()->requestId);
 								if (req.value()->requestId != reqId) {
 									DEBUG_LOG(("Message Error: for msgId %1 found resent request, requestId %2, contains requestId %3").arg(msgId).arg(reqId).arg(req.value()->requestId));
 								} else {
 									DEBUG_LOG(("Message Info: acked msgId %1 that was prepared to resend, requestId %2").arg(msgId).arg(reqId));
 								}
 								toSend.erase(req);
+								sessionData->toSendTaken();
 							} else {
 								DEBUG_LOG(("Message Info: msgId %1 was found in recent resent, requestId %2 was not found in prepared to send").arg(msgId));
 							}
@@ -2388,7 +2405,7 @@ void ConnectionPrivate::requestsAcked(const QVector<MTPlong> &ids, bool byRespon
 			while (ackedCount-- > kIdsBufferSize) {
 				auto i = wereAcked.begin();
 				clearedBecauseTooOld.push_back(RPCCallbackClear(
-					i.value(),
+					i->second,
 					RPCError::TimeoutError));
 				wereAcked.erase(i);
 			}
@@ -2425,7 +2442,6 @@ void ConnectionPrivate::handleMsgsStates(const QVector<MTPlong> &ids, const QByt
 			const auto haveSentEnd = haveSent.cend();
 			if (haveSent.find(requestMsgId) == haveSentEnd) {
 				DEBUG_LOG(("Message Info: state was received for msgId %1, but request is not found, looking in resent requests...").arg(requestMsgId));
-				QWriteLocker locker2(sessionData->toResendMutex());
 				auto &toResend = sessionData->toResendMap();
 				const auto reqIt = toResend.find(requestMsgId);
 				if (reqIt != toResend.cend()) {
@@ -2947,7 +2963,7 @@ void ConnectionPrivate::dhClientParamsAnswered() {
 		DEBUG_LOG(("AuthKey Info: auth key gen succeed, id: %1, server salt: %2").arg(authKey->keyId()).arg(serverSalt));
 
 		sessionData->owner()->notifyKeyCreated(std::move(authKey)); // slot will call authKeyCreated()
-		sessionData->clear(_instance);
+		sessionData->clear();
 		unlockKey();
 	} return;
 
@@ -3246,24 +3262,22 @@ mtpRequestId ConnectionPrivate::wasSent(mtpMsgId msgId) const {
 	{
 		QReadLocker locker(sessionData->haveSentMutex());
 		const auto &haveSent = sessionData->haveSentMap();
-		const auto i = haveSent.constFind(msgId);
+		const auto i = haveSent.find(msgId);
 		if (i != haveSent.cend()) {
-			return i.value()->requestId
-				? i.value()->requestId
+			return i->second->requestId
+				? i->second->requestId
 				: mtpRequestId(0xFFFFFFFF);
 		}
 	}
 	{
-		QReadLocker locker(sessionData->toResendMutex());
 		const auto &toResend = sessionData->toResendMap();
-		const auto i = toResend.constFind(msgId);
-		if (i != toResend.cend()) return i.value();
+		const auto i = toResend.find(msgId);
+		if (i != toResend.cend()) return i->second;
 	}
 	{
-		QReadLocker locker(sessionData->wereAckedMutex());
 		const auto &wereAcked = sessionData->wereAckedMap();
-		const auto i = wereAcked.constFind(msgId);
-		if (i != wereAcked.cend()) return i.value();
+		const auto i = wereAcked.find(msgId);
+		if (i != wereAcked.cend()) return i->second;
 	}
 	return 0;
 }
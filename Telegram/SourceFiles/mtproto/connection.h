@@ -10,6 +10,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "mtproto/auth_key.h"
 #include "mtproto/dc_options.h"
 #include "mtproto/connection_abstract.h"
+#include "mtproto/mtp_gzip.h"
 #include "base/openssl_help.h"
 #include "base/timer.h"
 
@@ -35,6 +36,7 @@ namespace internal {
 
 class AbstractConnection;
 class ConnectionPrivate;
+class Dcenter;
 class SessionData;
 class RSAPublicKey;
 struct ConnectionOptions;
@@ -182,6 +184,7 @@ private:
 		mtpMsgId *&haveSentArr,
 		SecureRequest &req);
 	mtpMsgId prepareToSend(SecureRequest &request, mtpMsgId currentLastId);
+	void gzipPackRequest(SecureRequest &request);
 	mtpMsgId replaceMsgId(SecureRequest &request, mtpMsgId newId);
 
 	bool sendSecureRequest(
@@ -198,7 +201,10 @@ private:
 		ParseError,
 	};
 	[[nodiscard]] HandleResult handleOneReceived(const mtpPrime *from, const mtpPrime *end, uint64 msgId, int32 serverTime, uint64 serverSalt, bool badTime);
-	mtpBuffer ungzip(const mtpPrime *from, const mtpPrime *end) const;
+	[[nodiscard]] bool ungzip(
+		const mtpPrime *from,
+		const mtpPrime *end,
+		mtpBuffer &result);
 	void handleMsgsStates(const QVector<MTPlong> &ids, const QByteArray &states, QVector<MTPlong> &acked);
 
 	void clearMessages();
@@ -259,6 +265,11 @@ private:
 
 	QVector<MTPlong> ackRequestData, resendRequestData;
 
+	GzipUnpacker _gzipUnpacker;
+	mtpBuffer _gzipBuffer; // reused for gzip_packed containers
+	GzipPacker _gzipPacker;
+	std::shared_ptr<Dcenter> _dc; // for the gzip_packed stats
+
 	mtpPingId _pingId = 0;
 	mtpPingId _pingIdToSend = 0;
 	crl::time _pingSendAt = 0;
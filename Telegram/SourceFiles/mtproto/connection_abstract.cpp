@@ -98,6 +98,22 @@ mtpBuffer AbstractConnection::prepareSecurePacket(
 	return result;
 }
 
+void AbstractConnection::emitReceivedInPlace(bytes::span packet) {
+	Expects(packet.size() % sizeof(mtpPrime) == 0);
+	Expects(reinterpret_cast<std::uintptr_t>(packet.data())
+		% alignof(mtpPrime) == 0);
+
+	_receivedInPlace = packet;
+	emit receivedData();
+	if (base::take(_receivedInPlace).empty()) {
+		return;
+	}
+	auto copy = mtpBuffer(packet.size() / sizeof(mtpPrime));
+	bytes::copy(bytes::make_span(copy), packet);
+	_receivedQueue.push_back(std::move(copy));
+	_receivedBytesCopied += packet.size();
+}
+
 gsl::span<const mtpPrime> AbstractConnection::parseNotSecureResponse(
 		const mtpBuffer &buffer) const {
 	const auto answer = buffer.data();
@@ -11,6 +11,16 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "base/bytes.h"
 
 namespace MTP {
+
+// Encrypted packets received from a dc and bytes of received packets
+// copied by the transports before the packets were handled.
+struct ReceiveStats {
+	int64 packets = 0;
+	int64 inPlacePackets = 0;
+	int64 receivedBytes = 0;
+	int64 copiedBytes = 0;
+};
+
 namespace internal {
 
 struct ConnectionOptions;
@@ -102,6 +112,18 @@ public:
 		return _receivedQueue;
 	}
 
+	// A packet still lying in the transport read buffer, aligned for
+	// mtpPrime access. It is valid only inside receivedData() handlers
+	// and may be decrypted in place. Queued packets go before it.
+	[[nodiscard]] bytes::span takeReceivedInPlace() {
+		return base::take(_receivedInPlace);
+	}
+
+	// Bytes of received packets copied since the last call.
+	[[nodiscard]] int64 takeReceivedBytesCopied() {
+		return base::take(_receivedBytesCopied);
+	}
+
 	template <typename Request>
 	mtpBuffer prepareNotSecurePacket(
 		const Request &request,
@@ -129,7 +151,13 @@ signals:
 	void syncTimeRequest();
 
 protected:
+	// Emits receivedData() with the packet available in place,
+	// queues a copy of it if no handler took it.
+	void emitReceivedInPlace(bytes::span packet);
+
 	BuffersQueue _receivedQueue; // list of received packets, not processed yet
+	bytes::span _receivedInPlace;
+	int64 _receivedBytesCopied = 0;
 	bool _sentEncrypted = false;
 	int _pingTime = 0;
 	ProxyData _proxy;
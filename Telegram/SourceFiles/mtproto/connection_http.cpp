@@ -165,7 +165,8 @@ void HttpConnection::requestFinished(QNetworkReply *reply) {
 			emit error(data[0]);
 		} else if (!data.isEmpty()) {
 			if (_status == Status::Ready) {
-				_receivedQueue.push_back(data);
+				_receivedBytesCopied += data.size() * sizeof(mtpPrime);
+				_receivedQueue.push_back(std::move(data));
 				emit receivedData();
 			} else if (const auto res_pq = readPQFakeReply(data)) {
 				const auto &data = res_pq->c_resPQ();
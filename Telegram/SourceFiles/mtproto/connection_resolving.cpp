@@ -162,7 +162,13 @@ void ResolvingConnection::handleReceivedData() {
 		my.push_back(std::move(item));
 	}
 	his.clear();
-	emit receivedData();
+	_receivedBytesCopied += _child->takeReceivedBytesCopied();
+	const auto packet = _child->takeReceivedInPlace();
+	if (!packet.empty()) {
+		emitReceivedInPlace(packet);
+	} else {
+		emit receivedData();
+	}
 }
 
 void ResolvingConnection::handleConnected() {
@@ -22,10 +22,20 @@ namespace {
 
 constexpr auto kPacketSizeMax = int(0x01000000 * sizeof(mtpPrime));
 constexpr auto kFullConnectionTimeout = 8 * crl::time(1000);
-constexpr auto kSmallBufferSize = 256 * 1024;
-constexpr auto kMinPacketBuffer = 256;
 constexpr auto kConnectionStartPrefixSize = 64;
 
+// Packets with non-zero auth_key_id, not error codes or quick acks.
+bool IsEncryptedPacket(bytes::const_span packet) {
+	constexpr auto kMinSize = 3 * sizeof(mtpPrime);
+	if (packet.size() < kMinSize) {
+		return false;
+	}
+	auto keyId = uint64();
+	bytes::copy(bytes::object_as_span(&keyId), packet.subspan(0, sizeof(keyId)));
+	return (keyId != 0);
+}
+
+
 } // namespace
 
 class TcpConnection::Protocol {
@@ -42,7 +52,8 @@ public:
 	static constexpr auto kUnknownSize = -1;
 	static constexpr auto kInvalidSize = -2;
 	virtual int readPacketLength(bytes::const_span bytes) const = 0;
-	virtual bytes::const_span readPacket(bytes::const_span bytes) const = 0;
+	virtual int readPacketHeaderSize(bytes::const_span bytes) const = 0;
+	virtual bytes::span readPacket(bytes::span bytes) const = 0;
 
 	virtual ~Protocol() = default;
 
@@ -63,7 +74,8 @@ public:
 	bytes::span finalizePacket(mtpBuffer &buffer) override;
 
 	int readPacketLength(bytes::const_span bytes) const override;
-	bytes::const_span readPacket(bytes::const_span bytes) const override;
+	int readPacketHeaderSize(bytes::const_span bytes) const override;
+	bytes::span readPacket(bytes::span bytes) const override;
 
 };
 
@@ -128,13 +140,20 @@ int TcpConnection::Protocol::Version0::readPacketLength(
 	return kInvalidSize;
 }
 
-bytes::const_span TcpConnection::Protocol::Version0::readPacket(
+int TcpConnection::Protocol::Version0::readPacketHeaderSize(
 		bytes::const_span bytes) const {
+	Expects(!bytes.empty());
+
+	return (static_cast<char>(bytes[0]) == 0x7F) ? 4 : 1;
+}
+
+bytes::span TcpConnection::Protocol::Version0::readPacket(
+		bytes::span bytes) const {
 	const auto size = readPacketLength(bytes);
 	Assert(size != kUnknownSize
 		&& size != kInvalidSize
 		&& size <= bytes.size());
-	const auto sizeLength = (static_cast<char>(bytes[0]) == 0x7F) ? 4 : 1;
+	const auto sizeLength = readPacketHeaderSize(bytes);
 	return bytes.subspan(sizeLength, size - sizeLength);
 }
 
@@ -175,7 +194,8 @@ public:
 	bytes::span finalizePacket(mtpBuffer &buffer) override;
 
 	int readPacketLength(bytes::const_span bytes) const override;
-	bytes::const_span readPacket(bytes::const_span bytes) const override;
+	int readPacketHeaderSize(bytes::const_span bytes) const override;
+	bytes::span readPacket(bytes::span bytes) const override;
 
 };
 
@@ -213,13 +233,18 @@ int TcpConnection::Protocol::VersionD::readPacketLength(
 		: kInvalidSize;
 }
 
-bytes::const_span TcpConnection::Protocol::VersionD::readPacket(
+int TcpConnection::Protocol::VersionD::readPacketHeaderSize(
 		bytes::const_span bytes) const {
+	return 4;
+}
+
+bytes::span TcpConnection::Protocol::VersionD::readPacket(
+		bytes::span bytes) const {
 	const auto size = readPacketLength(bytes);
 	Assert(size != kUnknownSize
 		&& size != kInvalidSize
 		&& size <= bytes.size());
-	const auto sizeLength = 4;
+	const auto sizeLength = readPacketHeaderSize(bytes);
 	return bytes.subspan(sizeLength, size - sizeLength);
 }
 
@@ -251,120 +276,50 @@ ConnectionPointer TcpConnection::clone(const ProxyData &proxy) {
 	return ConnectionPointer::New<TcpConnection>(_instance, thread(), proxy);
 }
 
-void TcpConnection::ensureAvailableInBuffer(int amount) {
-	auto &buffer = _usingLargeBuffer ? _largeBuffer : _smallBuffer;
-	const auto full = bytes::make_span(buffer).subspan(
-		_offsetBytes);
-	if (full.size() >= amount) {
-		return;
-	}
-	const auto read = full.subspan(0, _readBytes);
-	if (amount <= _smallBuffer.size()) {
-		if (_usingLargeBuffer) {
-			bytes::copy(_smallBuffer, read);
-			_usingLargeBuffer = false;
-			_largeBuffer.clear();
-		} else {
-			bytes::move(_smallBuffer, read);
-		}
-	} else if (amount <= _largeBuffer.size()) {
-		Assert(_usingLargeBuffer);
-		bytes::move(_largeBuffer, read);
-	} else {
-		auto enough = bytes::vector(amount);
-		bytes::copy(enough, read);
-		_largeBuffer = std::move(enough);
-		_usingLargeBuffer = true;
-	}
-	_offsetBytes = 0;
-}
-
 void TcpConnection::socketRead() {
-	Expects(_leftBytes > 0 || !_usingLargeBuffer);
-
 	if (!_socket || !_socket->isConnected()) {
 		LOG(("MTP Error: Socket not connected in socketRead()"));
 		emit error(kErrorCodeOther);
 		return;
 	}
 
-	if (_smallBuffer.empty()) {
-		_smallBuffer.resize(kSmallBufferSize);
-	}
+	const auto readLength = [&](bytes::const_span bytes) {
+		return _protocol->readPacketLength(bytes);
+	};
+	const auto readHeaderSize = [&](bytes::const_span bytes) {
+		return _protocol->readPacketHeaderSize(bytes);
+	};
+	const auto packet = [&](bytes::span bytes) {
+		socketPacket(bytes);
+		return _socket && _socket->isConnected();
+	};
 	do {
-		const auto readLimit = (_leftBytes > 0)
-			? _leftBytes
-			: (kSmallBufferSize - _offsetBytes - _readBytes);
-		Assert(readLimit > 0);
-
-		auto &buffer = _usingLargeBuffer ? _largeBuffer : _smallBuffer;
-		const auto full = bytes::make_span(buffer).subspan(_offsetBytes);
-		const auto free = full.subspan(_readBytes);
-		const auto readCount = _socket->read(free.subspan(0, readLimit));
+		const auto free = _readBuffer.prepareRead();
+		const auto readCount = _socket->read(free);
 		if (readCount > 0) {
 			const auto read = free.subspan(0, readCount);
 			aesCtrEncrypt(read, _receiveKey, &_receiveState);
 			TCP_LOG(("TCP Info: read %1 bytes").arg(readCount));
 
-			_readBytes += readCount;
-			if (_leftBytes > 0) {
-				Assert(readCount <= _leftBytes);
-				_leftBytes -= readCount;
-				if (!_leftBytes) {
-					socketPacket(full.subspan(0, _readBytes));
-					if (!_socket || !_socket->isConnected()) {
-						return;
-					}
-
-					_usingLargeBuffer = false;
-					_largeBuffer.clear();
-					_offsetBytes = _readBytes = 0;
-				} else {
-					TCP_LOG(("TCP Info: not enough %1 for packet! read %2"
-						).arg(_leftBytes
-						).arg(_readBytes));
-					emit receivedSome();
-				}
-			} else {
-				auto available = full.subspan(0, _readBytes);
-				while (_readBytes > 0) {
-					const auto packetSize = _protocol->readPacketLength(
-						available);
-					if (packetSize == Protocol::kUnknownSize) {
-						// Not enough bytes yet.
-						break;
-					} else if (packetSize <= 0) {
-						LOG(("TCP Error: bad packet size in 4 bytes: %1"
-							).arg(packetSize));
-						emit error(kErrorCodeOther);
-						return;
-					} else if (available.size() >= packetSize) {
-						socketPacket(available.subspan(0, packetSize));
-						if (!_socket || !_socket->isConnected()) {
-							return;
-						}
-
-						available = available.subspan(packetSize);
-						_offsetBytes += packetSize;
-						_readBytes -= packetSize;
-
-						// If we have too little space left in the buffer.
-						ensureAvailableInBuffer(kMinPacketBuffer);
-					} else {
-						_leftBytes = packetSize - available.size();
-
-						// If the next packet won't fit in the buffer.
-						ensureAvailableInBuffer(packetSize);
-
-						TCP_LOG(("TCP Info: not enough %1 for packet! "
-							"full size %2 read %3"
-							).arg(_leftBytes
-							).arg(packetSize
-							).arg(available.size()));
-						emit receivedSome();
-						break;
-					}
-				}
+			const auto result = _readBuffer.received(
+				int(readCount),
+				readLength,
+				readHeaderSize,
+				packet);
+			_receivedBytesCopied += _readBuffer.takeCopiedBytes();
+			switch (result) {
+			case TcpReadBuffer::Result::Stopped: return;
+			case TcpReadBuffer::Result::BadLength: {
+				LOG(("TCP Error: bad packet size in 4 bytes."));
+				emit error(kErrorCodeOther);
+			} return;
+			case TcpReadBuffer::Result::Partial: {
+				TCP_LOG(("TCP Info: not enough %1 for packet! read %2"
+					).arg(_readBuffer.leftBytes()
+					).arg(_readBuffer.readBytes()));
+				emit receivedSome();
+			} break;
+			case TcpReadBuffer::Result::Complete: break;
 			}
 		} else if (readCount < 0) {
 			LOG(("TCP Error: socket read return %1").arg(readCount));
@@ -379,10 +334,7 @@ void TcpConnection::socketRead() {
 		&& _socket->hasBytesAvailable());
 }
 
-mtpBuffer TcpConnection::parsePacket(bytes::const_span bytes) {
-	const auto packet = _protocol->readPacket(bytes);
-	TCP_LOG(("TCP Info: packet received, size = %1"
-		).arg(packet.size()));
+mtpBuffer TcpConnection::parsePacket(bytes::const_span packet) {
 	const auto ints = gsl::make_span(
 		reinterpret_cast<const mtpPrime*>(packet.data()),
 		packet.size() / sizeof(mtpPrime));
@@ -402,6 +354,7 @@ mtpBuffer TcpConnection::parsePacket(bytes::const_span bytes) {
 	}
 	auto result = mtpBuffer(ints.size());
 	memcpy(result.data(), ints.data(), ints.size() * sizeof(mtpPrime));
+	_receivedBytesCopied += ints.size() * sizeof(mtpPrime);
 	return result;
 }
 
@@ -582,11 +535,21 @@ crl::time TcpConnection::fullConnectTimeout() const {
 	return kFullConnectionTimeout;
 }
 
-void TcpConnection::socketPacket(bytes::const_span bytes) {
+void TcpConnection::socketPacket(bytes::span bytes) {
 	Expects(_socket != nullptr);
 
+	const auto packet = _protocol->readPacket(bytes);
+	TCP_LOG(("TCP Info: packet received, size = %1"
+		).arg(packet.size()));
+	if (_status == Status::Ready && IsEncryptedPacket(packet)) {
+		// Handle it right in the read buffer, without copying.
+		const auto full = packet.size() - (packet.size() % sizeof(mtpPrime));
+		emitReceivedInPlace(_readBuffer.alignPacket(packet.subspan(0, full)));
+		return;
+	}
+
 	// old quickack?..
-	const auto data = parsePacket(bytes);
+	auto data = parsePacket(packet);
 	if (data.size() == 1) {
 		if (data[0] != 0) {
 			emit error(data[0]);
@@ -596,7 +559,7 @@ void TcpConnection::socketPacket(bytes::const_span bytes) {
 	//} else if (data.size() == 2) {
 		// new quickack?..
 	} else if (_status == Status::Ready) {
-		_receivedQueue.push_back(data);
+		_receivedQueue.push_back(std::move(data));
 		emit receivedData();
 	} else if (_status == Status::Waiting) {
 		if (const auto res_pq = readPQFakeReply(data)) {
@@ -9,6 +9,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 #include "mtproto/connection_abstract.h"
 #include "mtproto/auth_key.h"
+#include "mtproto/mtp_tcp_read_buffer.h"
 
 namespace MTP {
 namespace internal {
@@ -54,14 +55,13 @@ private:
 	void socketRead();
 	bytes::const_span prepareConnectionStartPrefix(bytes::span buffer);
 
-	void socketPacket(bytes::const_span bytes);
+	void socketPacket(bytes::span bytes);
 
 	void socketConnected();
 	void socketDisconnected();
 	void socketError();
 
-	mtpBuffer parsePacket(bytes::const_span bytes);
-	void ensureAvailableInBuffer(int amount);
+	mtpBuffer parsePacket(bytes::const_span packet);
 	static uint32 fourCharsToUInt(char ch1, char ch2, char ch3, char ch4) {
 		char ch[4] = { ch1, ch2, ch3, ch4 };
 		return *reinterpret_cast<uint32*>(ch);
@@ -71,12 +71,7 @@ private:
 	std::unique_ptr<AbstractSocket> _socket;
 	bool _connectionStarted = false;
 
-	int _offsetBytes = 0;
-	int _readBytes = 0;
-	int _leftBytes = 0;
-	bytes::vector _smallBuffer;
-	bytes::vector _largeBuffer;
-	bool _usingLargeBuffer = false;
+	TcpReadBuffer _readBuffer;
 
 	uchar _sendKey[CTRState::KeySize];
 	CTRState _sendState;
@@ -57,5 +57,33 @@ void Dcenter::destroyKey() {
 	setKey(AuthKeyPtr());
 }
 
+void Dcenter::addGzipPacked(int64 originalBytes, int64 packedBytes) {
+	QMutexLocker lock(&gzipStatsLock);
+	++_gzipStats.requests;
+	_gzipStats.originalBytes += originalBytes;
+	_gzipStats.packedBytes += packedBytes;
+}
+
+GzipPackStats Dcenter::gzipPackStats() const {
+	QMutexLocker lock(&gzipStatsLock);
+	return _gzipStats;
+}
+
+void Dcenter::addReceiveStats(const ReceiveStats &stats) {
+	if (!stats.packets && !stats.copiedBytes) {
+		return;
+	}
+	QMutexLocker lock(&receiveStatsLock);
+	_receiveStats.packets += stats.packets;
+	_receiveStats.inPlacePackets += stats.inPlacePackets;
+	_receiveStats.receivedBytes += stats.receivedBytes;
+	_receiveStats.copiedBytes += stats.copiedBytes;
+}
+
+ReceiveStats Dcenter::receiveStats() const {
+	QMutexLocker lock(&receiveStatsLock);
+	return _receiveStats;
+}
+
 } // namespace internal
 } // namespace MTP
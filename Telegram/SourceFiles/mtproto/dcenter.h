@@ -7,6 +7,9 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 */
 #pragma once
 
+#include "mtproto/mtp_gzip.h"
+#include "mtproto/connection_abstract.h"
+
 namespace MTP {
 
 class Instance;
@@ -35,6 +38,12 @@ public:
 		_connectionInited = connectionInited;
 	}
 
+	// Called from the connection threads of all the sessions of this dc.
+	void addGzipPacked(int64 originalBytes, int64 packedBytes);
+	GzipPackStats gzipPackStats() const;
+	void addReceiveStats(const ReceiveStats &stats);
+	ReceiveStats receiveStats() const;
+
 signals:
 	void authKeyCreated();
 	void connectionWasInited();
@@ -45,10 +54,14 @@ private slots:
 private:
 	mutable QReadWriteLock keyLock;
 	mutable QMutex initLock;
+	mutable QMutex gzipStatsLock;
+	mutable QMutex receiveStatsLock;
 	not_null<Instance*> _instance;
 	DcId _id = 0;
 	AuthKeyPtr _key;
 	bool _connectionInited = false;
+	GzipPackStats _gzipStats;
+	ReceiveStats _receiveStats;
 
 };
 
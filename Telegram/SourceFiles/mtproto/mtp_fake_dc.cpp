@@ -0,0 +1,2319 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "mtproto/mtp_fake_dc.h"
+
+#include "base/openssl_help.h"
+
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtNetwork/QHostAddress>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+#include <chrono>
+#include <cmath>
+
+extern "C" {
+#include <openssl/rsa.h>
+#include <openssl/pem.h>
+#include <openssl/bio.h>
+} // extern "C"
+
+namespace MTP {
+namespace internal {
+namespace {
+
+constexpr auto kIntSize = int(sizeof(mtpPrime));
+constexpr auto kStartNonceSize = 64;
+constexpr auto kAbridgedProtocol = 0xEFEFEFEFU;
+constexpr auto kPaddedProtocol = 0xDDDDDDDDU;
+constexpr auto kProtocolDcId = int16(2);
+constexpr auto kMaxPacketSize = 16 * 1024 * 1024;
+constexpr auto kRsaSize = 256;
+constexpr auto kAuthKeySize = 256;
+constexpr auto kDhGenerator = 3;
+constexpr auto kBadServerSaltCode = 48;
+constexpr auto kAuthKeyNotFoundCode = mtpPrime(-404);
+constexpr auto kMaxAcksCount = 8192;
+constexpr auto kMaxFutureSalts = 64;
+constexpr auto kFutureSaltDuration = 3600;
+constexpr auto kMaxFactorizeSteps = 1 << 20;
+
+// The scheme is not linked here, so the constructors used by the fake dc
+// are taken from mtproto.tl and api.tl.
+constexpr auto kReqPq = mtpTypeId(0x60469778);
+constexpr auto kReqPqMulti = mtpTypeId(0xbe7e8ef1);
+constexpr auto kResPq = mtpTypeId(0x05162463);
+constexpr auto kPqInnerData = mtpTypeId(0x83c95aec);
+constexpr auto kPqInnerDataDc = mtpTypeId(0xa9f55f95);
+constexpr auto kReqDhParams = mtpTypeId(0xd712e4be);
+constexpr auto kServerDhParamsOk = mtpTypeId(0xd0e8075c);
+constexpr auto kServerDhInnerData = mtpTypeId(0xb5890dba);
+constexpr auto kSetClientDhParams = mtpTypeId(0xf5045f1f);
+constexpr auto kClientDhInnerData = mtpTypeId(0x6643b654);
+constexpr auto kDhGenOk = mtpTypeId(0x3bcbf734);
+constexpr auto kMsgsAck = mtpTypeId(0x62d6b459);
+constexpr auto kBadServerSalt = mtpTypeId(0xedab447b);
+constexpr auto kNewSessionCreated = mtpTypeId(0x9ec20908);
+constexpr auto kRpcError = mtpTypeId(0x2144ca19);
+constexpr auto kPing = mtpTypeId(0x7abe77ec);
+constexpr auto kPingDelayDisconnect = mtpTypeId(0xf3427b8c);
+constexpr auto kPong = mtpTypeId(0x347773c5);
+constexpr auto kGetFutureSalts = mtpTypeId(0xb921bd04);
+constexpr auto kFutureSalts = mtpTypeId(0xae500895);
+constexpr auto kInvokeAfterMsg = mtpTypeId(0xcb9f372d);
+constexpr auto kInvokeWithLayer = mtpTypeId(0xda9b0d0d);
+constexpr auto kInvokeWithoutUpdates = mtpTypeId(0xbf9459b7);
+constexpr auto kInitConnection = mtpTypeId(0x785188b8);
+constexpr auto kInputClientProxy = mtpTypeId(0x75588b3f);
+
+// The same prime ConnectionPrivate accepts without checks for g = 3.
+constexpr unsigned char kDhPrime[] = {
+	0xC7, 0x1C, 0xAE, 0xB9, 0xC6, 0xB1, 0xC9, 0x04, 0x8E, 0x6C, 0x52, 0x2F, 0x70, 0xF1, 0x3F, 0x73,
+	0x98, 0x0D, 0x40, 0x23, 0x8E, 0x3E, 0x21, 0xC1, 0x49, 0x34, 0xD0, 0x37, 0x56, 0x3D, 0x93, 0x0F,
+	0x48, 0x19, 0x8A, 0x0A, 0xA7, 0xC1, 0x40, 0x58, 0x22, 0x94, 0x93, 0xD2, 0x25, 0x30, 0xF4, 0xDB,
+	0xFA, 0x33, 0x6F, 0x6E, 0x0A, 0xC9, 0x25, 0x13, 0x95, 0x43, 0xAE, 0xD4, 0x4C, 0xCE, 0x7C, 0x37,
+	0x20, 0xFD, 0x51, 0xF6, 0x94, 0x58, 0x70, 0x5A, 0xC6, 0x8C, 0xD4, 0xFE, 0x6B, 0x6B, 0x13, 0xAB,
+	0xDC, 0x97, 0x46, 0x51, 0x29, 0x69, 0x32, 0x84, 0x54, 0xF1, 0x8F, 0xAF, 0x8C, 0x59, 0x5F, 0x64,
+	0x24, 0x77, 0xFE, 0x96, 0xBB, 0x2A, 0x94, 0x1D, 0x5B, 0xCD, 0x1D, 0x4A, 0xC8, 0xCC, 0x49, 0x88,
+	0x07, 0x08, 0xFA, 0x9B, 0x37, 0x8E, 0x3C, 0x4F, 0x3A, 0x90, 0x60, 0xBE, 0xE6, 0x7C, 0xF9, 0xA4,
+	0xA4, 0xA6, 0x95, 0x81, 0x10, 0x51, 0x90, 0x7E, 0x16, 0x27, 0x53, 0xB5, 0x6B, 0x0F, 0x6B, 0x41,
+	0x0D, 0xBA, 0x74, 0xD8, 0xA8, 0x4B, 0x2A, 0x14, 0xB3, 0x14, 0x4E, 0x0E, 0xF1, 0x28, 0x47, 0x54,
+	0xFD, 0x17, 0xED, 0x95, 0x0D, 0x59, 0x65, 0xB4, 0xB9, 0xDD, 0x46, 0x58, 0x2D, 0xB1, 0x17, 0x8D,
+	0x16, 0x9C, 0x6B, 0xC4, 0x65, 0xB0, 0xD6, 0xFF, 0x9C, 0xA3, 0x92, 0x8F, 0xEF, 0x5B, 0x9A, 0xE4,
+	0xE4, 0x18, 0xFC, 0x15, 0xE8, 0x3E, 0xBE, 0xA0, 0xF8, 0x7F, 0xA9, 0xFF, 0x5E, 0xED, 0x70, 0x05,
+	0x0D, 0xED, 0x28, 0x49, 0xF4, 0x7B, 0xF9, 0x59, 0xD9, 0x56, 0x85, 0x0C, 0xE9, 0x29, 0x85, 0x1F,
+	0x0D, 0x81, 0x15, 0xF6, 0x35, 0xB1, 0x05, 0xEE, 0x2E, 0x4E, 0x15, 0xD0, 0x4B, 0x24, 0x54, 0xBF,
+	0x6F, 0x4F, 0xAD, 0xF0, 0x34, 0xB1, 0x04, 0x03, 0x11, 0x9C, 0xD8, 0xE3, 0xB9, 0x2F, 0xCC, 0x5B };
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L || (defined(LIBRESSL_VERSION_NUMBER) && LIBRESSL_VERSION_NUMBER < 0x2070000fL)
+
+// This is a key getter for compatibility with OpenSSL 1.0
+void RSA_get0_key(const RSA *r, const BIGNUM **n, const BIGNUM **e, const BIGNUM **d) {
+	if (n != nullptr) {
+		*n = r->n;
+	}
+	if (e != nullptr) {
+		*e = r->e;
+	}
+	if (d != nullptr) {
+		*d = r->d;
+	}
+}
+
+#endif
+
+bytes::const_span DhPrime() {
+	return bytes::make_span(kDhPrime, sizeof(kDhPrime));
+}
+
+uint64 ReadLong(const void *data) {
+	auto result = uint64();
+	memcpy(&result, data, sizeof(result));
+	return result;
+}
+
+uint64 RandomLong() {
+	auto result = uint64();
+	bytes::set_random(bytes::object_as_span(&result));
+	return result;
+}
+
+void WriteType(mtpBuffer &to, mtpTypeId type) {
+	to.push_back(mtpPrime(type));
+}
+
+void WriteLong(mtpBuffer &to, uint64 value) {
+	to.push_back(mtpPrime(value & 0xFFFFFFFFULL));
+	to.push_back(mtpPrime(value >> 32));
+}
+
+void WriteRaw(mtpBuffer &to, bytes::const_span data) {
+	Expects(data.size() % kIntSize == 0);
+
+	const auto offset = to.size();
+	to.resize(offset + data.size() / kIntSize);
+	bytes::copy(bytes::make_span(to).subspan(offset * kIntSize), data);
+}
+
+void WriteRaw(mtpBuffer &to, const mtpPrime *from, const mtpPrime *end) {
+	const auto offset = to.size();
+	to.resize(offset + (end - from));
+	memcpy(to.data() + offset, from, (end - from) * sizeof(mtpPrime));
+}
+
+void WriteBytes(mtpBuffer &to, bytes::const_span data) {
+	const auto size = int(data.size());
+	const auto header = (size < 254) ? 1 : 4;
+	const auto ints = (header + size + kIntSize - 1) / kIntSize;
+	const auto offset = to.size();
+	to.resize(offset + ints);
+	const auto raw = reinterpret_cast<uchar*>(to.data() + offset);
+	memset(raw, 0, ints * kIntSize);
+	if (header == 1) {
+		raw[0] = uchar(size);
+	} else {
+		raw[0] = uchar(254);
+		raw[1] = uchar(size & 0xFF);
+		raw[2] = uchar((size >> 8) & 0xFF);
+		raw[3] = uchar((size >> 16) & 0xFF);
+	}
+	memcpy(raw + header, data.data(), size);
+}
+
+void WriteString(mtpBuffer &to, const char *text) {
+	WriteBytes(to, bytes::make_span(text, strlen(text)));
+}
+
+class Reader {
+public:
+	Reader(const mtpPrime *from, const mtpPrime *end)
+	: _from(from)
+	, _end(end) {
+	}
+
+	[[nodiscard]] bool failed() const {
+		return _failed;
+	}
+	[[nodiscard]] const mtpPrime *current() const {
+		return _from;
+	}
+
+	mtpPrime readInt() {
+		if (!check(1)) {
+			return 0;
+		}
+		return *_from++;
+	}
+	mtpTypeId readType() {
+		return mtpTypeId(readInt());
+	}
+	uint64 readLong() {
+		if (!check(2)) {
+			return 0;
+		}
+		const auto result = ReadLong(_from);
+		_from += 2;
+		return result;
+	}
+	bytes::const_span readRaw(int size) {
+		Expects(size % kIntSize == 0);
+
+		if (!check(size / kIntSize)) {
+			return {};
+		}
+		const auto result = bytes::make_span(_from, size / kIntSize);
+		_from += size / kIntSize;
+		return result;
+	}
+	bytes::const_span readBytes() {
+		if (!check(1)) {
+			return {};
+		}
+		const auto start = reinterpret_cast<const uchar*>(_from);
+		const auto available = (_end - _from) * kIntSize;
+		auto header = 1;
+		auto length = int(start[0]);
+		if (length == 254) {
+			header = 4;
+			length = int(start[1])
+				| (int(start[2]) << 8)
+				| (int(start[3]) << 16);
+		} else if (length > 254) {
+			_failed = true;
+			return {};
+		}
+		if (header + length > available) {
+			_failed = true;
+			return {};
+		}
+		_from += (header + length + kIntSize - 1) / kIntSize;
+		return bytes::make_span(start + header, length);
+	}
+	void skip(int ints) {
+		if (check(ints)) {
+			_from += ints;
+		}
+	}
+
+private:
+	bool check(int ints) {
+		if (_failed || ints < 0 || _end - _from < ints) {
+			_failed = true;
+		}
+		return !_failed;
+	}
+
+	const mtpPrime *_from = nullptr;
+	const mtpPrime *_end = nullptr;
+	bool _failed = false;
+
+};
+
+bytes::vector BigEndian(uint64 value, int minimalSize = 0) {
+	auto result = bytes::vector();
+	while (value || int(result.size()) < minimalSize) {
+		result.insert(result.begin(), bytes::type(value & 0xFF));
+		value >>= 8;
+	}
+	return result;
+}
+
+uint64 FromBigEndian(bytes::const_span data) {
+	auto result = uint64();
+	if (data.size() > sizeof(result)) {
+		return 0;
+	}
+	for (const auto byte : data) {
+		result = (result << 8) | uint64(static_cast<uchar>(byte));
+	}
+	return result;
+}
+
+bool IsSmallPrime(uint64 value) {
+	if (value < 2) {
+		return false;
+	}
+	for (auto divisor = uint64(2); divisor * divisor <= value; ++divisor) {
+		if (!(value % divisor)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+uint64 NextSmallPrime(uint64 from) {
+	auto result = from | 1;
+	while (!IsSmallPrime(result)) {
+		result += 2;
+	}
+	return result;
+}
+
+// Primes are close, so Fermat's method finds them in one step,
+// the same way ConnectionPrivate does it.
+bool FactorizePq(uint64 pq, uint64 &p, uint64 &q) {
+	auto root = uint64(std::sqrt(double(pq)));
+	while (root * root > pq) --root;
+	while (root * root < pq) ++root;
+	for (auto i = 0; i != kMaxFactorizeSteps; ++i, ++root) {
+		const auto square = root * root - pq;
+		auto y = uint64(std::sqrt(double(square)));
+		while (y * y > square) --y;
+		while (y * y < square) ++y;
+		if (y * y == square) {
+			p = root - y;
+			q = root + y;
+			return (p > 1);
+		}
+	}
+	return false;
+}
+
+bool IsGoodModExp(const openssl::BigNum &value, const openssl::BigNum &prime) {
+	const auto diff = openssl::BigNum::Sub(prime, value);
+	constexpr auto kMinDiffBitsCount = kAuthKeySize * 8 - 64;
+	return !value.failed()
+		&& !diff.failed()
+		&& !diff.isNegative()
+		&& diff.bitsSize() >= kMinDiffBitsCount
+		&& value.bitsSize() >= kMinDiffBitsCount
+		&& value.bytesSize() <= kAuthKeySize;
+}
+
+// Generates g^power mod prime, fills the power.
+bytes::vector GenerateModExp(bytes::vector &power) {
+	using openssl::BigNum;
+
+	const auto prime = BigNum(DhPrime());
+	power.resize(kAuthKeySize);
+	while (true) {
+		bytes::set_random(power);
+		const auto result = BigNum::ModExp(
+			BigNum(kDhGenerator),
+			BigNum(power),
+			prime);
+		if (IsGoodModExp(result, prime)) {
+			return result.getBytes();
+		}
+	}
+}
+
+bytes::vector ComputeAuthKey(
+		bytes::const_span modexp,
+		bytes::const_span power) {
+	using openssl::BigNum;
+
+	const auto prime = BigNum(DhPrime());
+	const auto first = BigNum(modexp);
+	if (!IsGoodModExp(first, prime)) {
+		return {};
+	}
+	const auto computed = BigNum::ModExp(first, BigNum(power), prime);
+	const auto data = computed.getBytes();
+	if (data.empty() || data.size() > kAuthKeySize) {
+		return {};
+	}
+	auto result = bytes::vector(kAuthKeySize);
+	bytes::copy(
+		bytes::make_span(result).subspan(kAuthKeySize - data.size()),
+		data);
+	return result;
+}
+
+uint64 ComputeKeyId(bytes::const_span authKey) {
+	const auto hash = openssl::Sha1(authKey);
+	return ReadLong(hash.data() + 12);
+}
+
+uint64 ComputeServerSalt(
+		bytes::const_span newNonce,
+		bytes::const_span serverNonce) {
+	return ReadLong(newNonce.data()) ^ ReadLong(serverNonce.data());
+}
+
+// new_nonce_hash1 for number 1, new_nonce_hash2 for 2, etc.
+bytes::vector ComputeNewNonceHash(
+		bytes::const_span newNonce,
+		uchar number,
+		bytes::const_span authKey) {
+	const auto keyHash = openssl::Sha1(authKey);
+	const auto hash = openssl::Sha1(
+		newNonce,
+		bytes::make_span(&number, 1),
+		bytes::make_span(keyHash).subspan(0, 8));
+	return bytes::make_vector(bytes::make_span(hash).subspan(4, 16));
+}
+
+uint64 ComputeFingerprint(const RSA *rsa) {
+	const auto toBytes = [](const BIGNUM *number) {
+		auto result = bytes::vector(BN_num_bytes(number));
+		BN_bn2bin(number, reinterpret_cast<unsigned char*>(result.data()));
+		return result;
+	};
+	const BIGNUM *n = nullptr;
+	const BIGNUM *e = nullptr;
+	RSA_get0_key(rsa, &n, &e, nullptr);
+
+	auto serialized = mtpBuffer();
+	WriteBytes(serialized, toBytes(n));
+	WriteBytes(serialized, toBytes(e));
+	const auto hash = openssl::Sha1(bytes::make_span(serialized));
+	return ReadLong(hash.data() + 12);
+}
+
+void AesIge(
+		bytes::const_span source,
+		bytes::span destination,
+		bytes::const_span key,
+		bytes::const_span iv,
+		bool encrypt) {
+	Expects(source.size() % AES_BLOCK_SIZE == 0);
+	Expects(destination.size() >= source.size());
+	Expects(key.size() == 32 && iv.size() == 32);
+
+	auto aes = AES_KEY();
+	const auto keyData = reinterpret_cast<const uchar*>(key.data());
+	if (encrypt) {
+		AES_set_encrypt_key(keyData, 256, &aes);
+	} else {
+		AES_set_decrypt_key(keyData, 256, &aes);
+	}
+	uchar ivCopy[32];
+	memcpy(ivCopy, iv.data(), sizeof(ivCopy));
+	AES_ige_encrypt(
+		reinterpret_cast<const uchar*>(source.data()),
+		reinterpret_cast<uchar*>(destination.data()),
+		source.size(),
+		&aes,
+		ivCopy,
+		encrypt ? AES_ENCRYPT : AES_DECRYPT);
+}
+
+// Key and iv for handshake data encrypted with new_nonce and server_nonce.
+void PrepareTemporaryAes(
+		bytes::const_span newNonce,
+		bytes::const_span serverNonce,
+		bytes::vector &key,
+		bytes::vector &iv) {
+	const auto ns = openssl::Sha1(newNonce, serverNonce);
+	const auto sn = openssl::Sha1(serverNonce, newNonce);
+	const auto nn = openssl::Sha1(newNonce, newNonce);
+	key = bytes::concatenate(ns, bytes::make_span(sn).subspan(0, 12));
+	iv = bytes::concatenate(
+		bytes::make_span(sn).subspan(12, 8),
+		nn,
+		newNonce.subspan(0, 4));
+}
+
+// SHA1 of the data, the data and random padding, encrypted with AES-IGE.
+bytes::vector EncryptWithHash(
+		const mtpBuffer &data,
+		bytes::const_span key,
+		bytes::const_span iv) {
+	const auto serialized = bytes::make_span(data);
+	const auto hash = openssl::Sha1(serialized);
+	const auto unpadded = int(hash.size() + serialized.size());
+	const auto full = (unpadded + AES_BLOCK_SIZE - 1)
+		/ AES_BLOCK_SIZE
+		* AES_BLOCK_SIZE;
+	auto plain = bytes::vector(full);
+	bytes::copy(plain, hash);
+	bytes::copy(bytes::make_span(plain).subspan(hash.size()), serialized);
+	bytes::set_random(bytes::make_span(plain).subspan(unpadded));
+
+	auto result = bytes::vector(full);
+	AesIge(plain, result, key, iv, true);
+	return result;
+}
+
+// Leaves the random padding in the end of the data,
+// the hash should be checked after the data is parsed.
+bool DecryptWithHash(
+		bytes::const_span encrypted,
+		bytes::const_span key,
+		bytes::const_span iv,
+		mtpBuffer &data,
+		bytes::vector &hash) {
+	constexpr auto kHashSize = 20;
+	if (encrypted.size() <= kHashSize
+		|| encrypted.size() % AES_BLOCK_SIZE) {
+		return false;
+	}
+	auto plain = bytes::vector(encrypted.size());
+	AesIge(encrypted, plain, key, iv, false);
+	hash = bytes::make_vector(bytes::make_span(plain).subspan(0, kHashSize));
+	data.resize((plain.size() - kHashSize) / kIntSize);
+	bytes::copy(
+		bytes::make_span(data),
+		bytes::make_span(plain).subspan(kHashSize, data.size() * kIntSize));
+	return true;
+}
+
+bool CheckHash(
+		bytes::const_span hash,
+		const mtpBuffer &data,
+		const mtpPrime *end) {
+	const auto size = (end - data.constData()) * kIntSize;
+	const auto computed = openssl::Sha1(
+		bytes::make_span(data).subspan(0, size));
+	return !bytes::compare(hash, computed);
+}
+
+// msg_key for the MTProto 2.0, x is 0 for client messages, 8 for server ones.
+bytes::vector ComputeMsgKey(
+		bytes::const_span authKey,
+		bytes::const_span plain,
+		int x) {
+	const auto hash = openssl::Sha256(authKey.subspan(88 + x, 32), plain);
+	return bytes::make_vector(bytes::make_span(hash).subspan(8, 16));
+}
+
+// The same as AuthKey::prepareAES().
+void PrepareAes(
+		bytes::const_span authKey,
+		bytes::const_span msgKey,
+		int x,
+		bytes::array<32> &key,
+		bytes::array<32> &iv) {
+	const auto a = openssl::Sha256(msgKey, authKey.subspan(x, 36));
+	const auto b = openssl::Sha256(authKey.subspan(40 + x, 36), msgKey);
+	const auto aSpan = bytes::make_span(a);
+	const auto bSpan = bytes::make_span(b);
+	const auto keySpan = bytes::make_span(key);
+	const auto ivSpan = bytes::make_span(iv);
+	bytes::copy(keySpan, aSpan.subspan(0, 8));
+	bytes::copy(keySpan.subspan(8), bSpan.subspan(8, 16));
+	bytes::copy(keySpan.subspan(24), aSpan.subspan(24, 8));
+	bytes::copy(ivSpan, bSpan.subspan(0, 8));
+	bytes::copy(ivSpan.subspan(8), aSpan.subspan(8, 16));
+	bytes::copy(ivSpan.subspan(24), bSpan.subspan(24, 8));
+}
+
+mtpBuffer PlainPacket(uint64 msgId, const mtpBuffer &body) {
+	auto result = mtpBuffer();
+	result.reserve(5 + body.size());
+	WriteLong(result, 0);
+	WriteLong(result, msgId);
+	result.push_back(body.size() * kIntSize);
+	result += body;
+	return result;
+}
+
+bool ReadPlainPacket(
+		const mtpBuffer &packet,
+		const mtpPrime *&from,
+		const mtpPrime *&end) {
+	if (packet.size() < 5 || packet[0] || packet[1]) {
+		return false;
+	}
+	const auto length = packet[4];
+	if (length < 0
+		|| length % kIntSize
+		|| length / kIntSize > packet.size() - 5) {
+		return false;
+	}
+	from = packet.constData() + 5;
+	end = from + length / kIntSize;
+	return true;
+}
+
+mtpBuffer EncryptedPacket(
+		bytes::const_span authKey,
+		uint64 keyId,
+		int x,
+		uint64 salt,
+		uint64 sessionId,
+		uint64 msgId,
+		int32 seqNo,
+		const mtpBuffer &body) {
+	constexpr auto kHeaderSize = 32;
+	constexpr auto kMinPadding = 12;
+	const auto bodySize = body.size() * kIntSize;
+	const auto unpadded = kHeaderSize + bodySize;
+	const auto padding = kMinPadding
+		+ ((AES_BLOCK_SIZE - ((unpadded + kMinPadding) % AES_BLOCK_SIZE))
+			% AES_BLOCK_SIZE);
+
+	auto plain = mtpBuffer();
+	plain.reserve((unpadded + padding) / kIntSize);
+	WriteLong(plain, salt);
+	WriteLong(plain, sessionId);
+	WriteLong(plain, msgId);
+	plain.push_back(seqNo);
+	plain.push_back(bodySize);
+	plain += body;
+	plain.resize((unpadded + padding) / kIntSize);
+	bytes::set_random(bytes::make_span(plain).subspan(unpadded));
+
+	const auto plainBytes = bytes::make_span(plain);
+	const auto msgKey = ComputeMsgKey(authKey, plainBytes, x);
+	auto key = bytes::array<32>();
+	auto iv = bytes::array<32>();
+	PrepareAes(authKey, msgKey, x, key, iv);
+
+	auto result = mtpBuffer(6 + plain.size());
+	const auto resultBytes = bytes::make_span(result);
+	bytes::copy(resultBytes, bytes::object_as_span(&keyId));
+	bytes::copy(resultBytes.subspan(8), msgKey);
+	AesIge(plainBytes, resultBytes.subspan(24), key, iv, true);
+	return result;
+}
+
+struct DecryptedMessage {
+	mtpBuffer plain;
+	uint64 salt = 0;
+	uint64 sessionId = 0;
+	uint64 msgId = 0;
+	int32 seqNo = 0;
+	int length = 0;
+
+	const mtpPrime *from() const {
+		return plain.constData() + 8;
+	}
+	const mtpPrime *end() const {
+		return from() + length;
+	}
+};
+
+bool DecryptPacket(
+		bytes::const_span authKey,
+		int x,
+		const mtpBuffer &packet,
+		DecryptedMessage &result) {
+	constexpr auto kMinPadding = 12;
+	constexpr auto kMaxPadding = 1024;
+
+	// auth_key_id, msg_key and at least the header of the message.
+	if (packet.size() < 6 + 8 || (packet.size() - 6) % 4) {
+		return false;
+	}
+	const auto packetBytes = bytes::make_span(packet);
+	const auto msgKey = packetBytes.subspan(8, 16);
+	const auto encrypted = packetBytes.subspan(24);
+	auto key = bytes::array<32>();
+	auto iv = bytes::array<32>();
+	PrepareAes(authKey, msgKey, x, key, iv);
+
+	auto &plain = result.plain;
+	plain.resize(encrypted.size() / kIntSize);
+	AesIge(encrypted, bytes::make_span(plain), key, iv, false);
+	const auto computed = ComputeMsgKey(authKey, bytes::make_span(plain), x);
+	if (bytes::compare(computed, msgKey)) {
+		return false;
+	}
+	const auto length = plain[7];
+	if (length < 0
+		|| length % kIntSize
+		|| length / kIntSize > plain.size() - 8) {
+		return false;
+	}
+	const auto padding = (plain.size() - 8) * kIntSize - length;
+	if (padding < kMinPadding || padding > kMaxPadding) {
+		return false;
+	}
+	result.salt = ReadLong(plain.constData());
+	result.sessionId = ReadLong(plain.constData() + 2);
+	result.msgId = ReadLong(plain.constData() + 4);
+	result.seqNo = plain[6];
+	result.length = length / kIntSize;
+	return true;
+}
+
+// Message ids grow with time, the lowest bits tell who sent the message.
+uint64 NextMsgId(uint64 &last, int remainder) {
+	using namespace std::chrono;
+
+	const auto now = duration_cast<nanoseconds>(
+		system_clock::now().time_since_epoch()).count();
+	const auto seconds = uint64(now / 1000000000);
+	const auto fraction = uint64(now % 1000000000) * (1ULL << 32)
+		/ 1000000000;
+	auto result = ((seconds << 32) | fraction) & ~uint64(3);
+	result |= uint64(remainder);
+	while (result <= last) {
+		result += 4;
+	}
+	last = result;
+	return result;
+}
+
+bytes::const_span StripSecret(const bytes::vector &secret) {
+	const auto span = bytes::make_span(secret);
+	return (secret.size() == 17 && secret[0] == bytes::type(0xDD))
+		? span.subspan(1)
+		: span;
+}
+
+bytes::vector PrepareObfuscationKey(
+		bytes::const_span source,
+		bytes::const_span secret) {
+	return secret.empty()
+		? bytes::make_vector(source)
+		: openssl::Sha256(source, secret);
+}
+
+bool IsGoodStartNonce(bytes::const_span nonce) {
+	const auto zero = static_cast<uchar>(nonce[0]);
+	const auto first = uint32(ReadLong(nonce.data()) & 0xFFFFFFFFULL);
+	const auto second = uint32(ReadLong(nonce.data()) >> 32);
+	return (zero != 0xEF)
+		&& (first != 0x44414548U)
+		&& (first != 0x54534F50U)
+		&& (first != 0x20544547U)
+		&& (first != 0xEEEEEEEEU)
+		&& (first != 0xDDDDDDDDU)
+		&& (first != 0x02010316U)
+		&& (second != 0U);
+}
+
+class CtrStream {
+public:
+	void init(bytes::const_span key, bytes::const_span iv) {
+		Expects(key.size() == 32 && iv.size() == AES_BLOCK_SIZE);
+
+		AES_set_encrypt_key(
+			reinterpret_cast<const uchar*>(key.data()),
+			256,
+			&_key);
+		memcpy(_ivec, iv.data(), AES_BLOCK_SIZE);
+		memset(_ecount, 0, AES_BLOCK_SIZE);
+		_num = 0;
+	}
+	void apply(bytes::span data) {
+		CRYPTO_ctr128_encrypt(
+			reinterpret_cast<const uchar*>(data.data()),
+			reinterpret_cast<uchar*>(data.data()),
+			data.size(),
+			&_key,
+			_ivec,
+			_ecount,
+			&_num,
+			(block128_f)AES_encrypt);
+	}
+
+private:
+	AES_KEY _key = AES_KEY();
+	uchar _ivec[AES_BLOCK_SIZE] = { 0 };
+	uchar _ecount[AES_BLOCK_SIZE] = { 0 };
+	uint32 _num = 0;
+
+};
+
+// The obfuscated tcp transport, see TcpConnection.
+class Obfuscation {
+public:
+	// Client side, returns the connection start prefix.
+	bytes::vector start(bytes::const_span secret, uint32 protocol) {
+		auto nonce = bytes::vector(kStartNonceSize);
+		do {
+			bytes::set_random(nonce);
+		} while (!IsGoodStartNonce(nonce));
+
+		const auto span = bytes::make_span(nonce);
+		auto reversed = bytes::make_vector(span.subspan(8, 48));
+		std::reverse(reversed.begin(), reversed.end());
+		_send.init(
+			PrepareObfuscationKey(span.subspan(8, 32), secret),
+			span.subspan(40, 16));
+		_receive.init(
+			PrepareObfuscationKey(
+				bytes::make_span(reversed).subspan(0, 32),
+				secret),
+			bytes::make_span(reversed).subspan(32, 16));
+
+		const auto dcId = kProtocolDcId;
+		bytes::copy(span.subspan(56), bytes::object_as_span(&protocol));
+		bytes::copy(span.subspan(60), bytes::object_as_span(&dcId));
+
+		auto encrypted = nonce;
+		_send.apply(encrypted);
+		bytes::copy(span.subspan(56), bytes::make_span(encrypted).subspan(56));
+		return nonce;
+	}
+
+	// Server side, returns the protocol id from the prefix.
+	uint32 accept(bytes::const_span prefix, bytes::const_span secret) {
+		Expects(prefix.size() >= kStartNonceSize);
+
+		auto reversed = bytes::make_vector(prefix.subspan(8, 48));
+		std::reverse(reversed.begin(), reversed.end());
+		_receive.init(
+			PrepareObfuscationKey(prefix.subspan(8, 32), secret),
+			prefix.subspan(40, 16));
+		_send.init(
+			PrepareObfuscationKey(
+				bytes::make_span(reversed).subspan(0, 32),
+				secret),
+			bytes::make_span(reversed).subspan(32, 16));
+
+		auto decrypted = bytes::make_vector(
+			prefix.subspan(0, kStartNonceSize));
+		_receive.apply(decrypted);
+		auto result = uint32();
+		memcpy(&result, decrypted.data() + 56, sizeof(result));
+		return result;
+	}
+
+	void encrypt(bytes::span data) {
+		_send.apply(data);
+	}
+	void decrypt(bytes::span data) {
+		_receive.apply(data);
+	}
+
+private:
+	CtrStream _send;
+	CtrStream _receive;
+
+};
+
+bytes::vector FramePacket(uint32 protocol, const mtpBuffer &packet) {
+	const auto payload = bytes::make_span(packet);
+	if (protocol == kPaddedProtocol) {
+		auto random = uchar();
+		bytes::set_random(bytes::object_as_span(&random));
+		const auto padding = int(random & 0x0F);
+		const auto length = uint32(payload.size() + padding);
+		auto result = bytes::vector(4 + length);
+		const auto span = bytes::make_span(result);
+		bytes::copy(span, bytes::object_as_span(&length));
+		bytes::copy(span.subspan(4), payload);
+		bytes::set_random(span.subspan(4 + payload.size()));
+		return result;
+	}
+	const auto ints = uint32(packet.size());
+	const auto header = (ints < 0x7F) ? 1 : 4;
+	auto result = bytes::vector(header + payload.size());
+	if (header == 1) {
+		result[0] = bytes::type(ints);
+	} else {
+		result[0] = bytes::type(0x7F);
+		result[1] = bytes::type(ints & 0xFF);
+		result[2] = bytes::type((ints >> 8) & 0xFF);
+		result[3] = bytes::type((ints >> 16) & 0xFF);
+	}
+	bytes::copy(bytes::make_span(result).subspan(header), payload);
+	return result;
+}
+
+// Returns the full frame size, 0 if more bytes are needed, -1 for bad data.
+int ReadFrameSize(uint32 protocol, bytes::const_span data, int &header) {
+	if (protocol == kPaddedProtocol) {
+		if (data.size() < 4) {
+			return 0;
+		}
+		auto length = uint32();
+		memcpy(&length, data.data(), sizeof(length));
+		header = 4;
+		return (length >= 4 && length < kMaxPacketSize)
+			? int(length) + 4
+			: -1;
+	}
+	if (data.empty()) {
+		return 0;
+	}
+	const auto first = static_cast<uchar>(data[0]);
+	if (first == 0x7F) {
+		if (data.size() < 4) {
+			return 0;
+		}
+		const auto ints = uint32(static_cast<uchar>(data[1]))
+			| (uint32(static_cast<uchar>(data[2])) << 8)
+			| (uint32(static_cast<uchar>(data[3])) << 16);
+		header = 4;
+		return (ints >= 0x7F && ints * kIntSize < kMaxPacketSize)
+			? int(ints * kIntSize) + 4
+			: -1;
+	} else if (first > 0 && first < 0x7F) {
+		header = 1;
+		return int(first) * kIntSize + 1;
+	}
+	return -1;
+}
+
+// Drops the random padding of the padded intermediate framing.
+mtpBuffer PacketToBuffer(bytes::const_span payload) {
+	auto size = int(payload.size());
+	if (size >= 24) {
+		const auto keyId = ReadLong(payload.data());
+		if (keyId) {
+			size = 24 + ((size - 24) / AES_BLOCK_SIZE) * AES_BLOCK_SIZE;
+		} else {
+			auto length = int32();
+			memcpy(&length, payload.data() + 16, sizeof(length));
+			if (length >= 0 && length <= size - 20) {
+				size = 20 + length;
+			}
+		}
+	}
+	size -= size % kIntSize;
+	auto result = mtpBuffer(size / kIntSize);
+	memcpy(result.data(), payload.data(), size);
+	return result;
+}
+
+// Skips invokeWithLayer, initConnection and other wrappers.
+const mtpPrime *SkipWrappers(const mtpPrime *from, const mtpPrime *end) {
+	while (from < end) {
+		auto reader = Reader(from, end);
+		switch (reader.readType()) {
+		case kInvokeWithLayer: reader.readInt(); break;
+		case kInvokeWithoutUpdates: break;
+		case kInvokeAfterMsg: reader.readLong(); break;
+		case kInitConnection: {
+			const auto flags = reader.readInt();
+			reader.readInt(); // api_id
+			for (auto i = 0; i != 6; ++i) {
+				reader.readBytes();
+			}
+			if (flags & 1) {
+				if (reader.readType() != kInputClientProxy) {
+					return nullptr;
+				}
+				reader.readBytes();
+				reader.readInt();
+			}
+		} break;
+		default: return from;
+		}
+		if (reader.failed()) {
+			return nullptr;
+		}
+		from = reader.current();
+	}
+	return nullptr;
+}
+
+} // namespace
+
+class FakeDc::Server final : public QThread {
+public:
+	Server(Options options, FakeDcHandler handler);
+	~Server();
+
+	bool startServer();
+	int port() const;
+	QByteArray publicKey() const;
+	void rotateSalts();
+	FakeDcStats stats() const;
+
+protected:
+	void run() override;
+
+private:
+	struct AuthKey {
+		bytes::vector data;
+		uint64 salt = 0;
+	};
+	struct Session {
+		int32 contentMessages = 0;
+		bool announced = false;
+	};
+	struct Handshake {
+		bytes::vector nonce;
+		bytes::vector serverNonce;
+		bytes::vector newNonce;
+		bytes::vector power;
+		bytes::vector key;
+		bytes::vector iv;
+		uint64 p = 0;
+		uint64 q = 0;
+	};
+	struct Connection {
+		QTcpSocket *socket = nullptr;
+		Obfuscation obfuscation;
+		uint32 protocol = 0;
+		bytes::vector buffer;
+		std::unique_ptr<Handshake> handshake;
+		bool closed = false;
+	};
+	struct Outgoing {
+		uint64 msgId = 0;
+		int32 seqNo = 0;
+		mtpBuffer body;
+	};
+	struct Context {
+		not_null<Connection*> connection;
+		uint64 keyId = 0;
+		not_null<AuthKey*> key;
+		uint64 sessionId = 0;
+		not_null<Session*> session;
+		std::vector<Outgoing> outgoing;
+		std::vector<uint64> acks;
+	};
+
+	bool generateRsaKey();
+	void count(int64 FakeDcStats::*field, int64 value = 1);
+	void acceptConnections(not_null<QTcpServer*> server);
+	void read(not_null<Connection*> connection);
+	bool readPackets(not_null<Connection*> connection);
+	void close(not_null<Connection*> connection);
+	void sendPacket(not_null<Connection*> connection, const mtpBuffer &packet);
+
+	bool handlePacket(
+		not_null<Connection*> connection,
+		const mtpBuffer &packet);
+	bool handlePlain(
+		not_null<Connection*> connection,
+		const mtpBuffer &packet);
+	bool handleReqPq(not_null<Connection*> connection, Reader &reader);
+	bool handleReqDhParams(not_null<Connection*> connection, Reader &reader);
+	bool handleSetClientDhParams(
+		not_null<Connection*> connection,
+		Reader &reader);
+	void sendPlain(not_null<Connection*> connection, const mtpBuffer &body);
+
+	bool handleEncrypted(
+		not_null<Connection*> connection,
+		const mtpBuffer &packet);
+	bool handleMessage(
+		Context &context,
+		uint64 msgId,
+		int32 seqNo,
+		const mtpPrime *from,
+		const mtpPrime *end);
+	void respond(Context &context, mtpBuffer &&body, bool content);
+	mtpBuffer rpcResult(uint64 requestId, const mtpBuffer &result);
+	void sendEncrypted(Context &context);
+	void applySaltRotations();
+
+	const Options _options;
+	const FakeDcHandler _handler;
+	const bytes::vector _secret;
+
+	RSA *_rsa = nullptr;
+	QByteArray _publicKey;
+	uint64 _fingerprint = 0;
+
+	mutable QMutex _mutex;
+	QWaitCondition _startedCondition;
+	bool _started = false;
+	int _port = 0;
+	int _saltRotations = 0;
+	FakeDcStats _stats;
+
+	// Accessed only from the server thread.
+	std::vector<std::unique_ptr<Connection>> _connections;
+	std::map<uint64, AuthKey> _authKeys;
+	std::map<uint64, Session> _sessions;
+	GzipUnpacker _unpacker;
+	GzipPacker _packer;
+	mtpBuffer _packed;
+	uint64 _lastMsgId = 0;
+	int _appliedSaltRotations = 0;
+
+};
+
+FakeDc::Server::Server(Options options, FakeDcHandler handler)
+: _options(std::move(options))
+, _handler(std::move(handler))
+, _secret(bytes::make_vector(StripSecret(_options.secret))) {
+}
+
+FakeDc::Server::~Server() {
+	quit();
+	wait();
+	if (_rsa) {
+		RSA_free(_rsa);
+	}
+}
+
+bool FakeDc::Server::generateRsaKey() {
+	const auto exponent = BN_new();
+	if (!exponent) {
+		return false;
+	}
+	BN_set_word(exponent, RSA_F4);
+	_rsa = RSA_new();
+	const auto generated = _rsa
+		&& RSA_generate_key_ex(_rsa, kRsaSize * 8, exponent, nullptr);
+	BN_free(exponent);
+	if (!generated) {
+		return false;
+	}
+
+	const auto bio = BIO_new(BIO_s_mem());
+	if (!bio) {
+		return false;
+	}
+	const auto guard = gsl::finally([&] { BIO_free(bio); });
+	if (!PEM_write_bio_RSAPublicKey(bio, _rsa)) {
+		return false;
+	}
+	char *data = nullptr;
+	const auto size = BIO_get_mem_data(bio, &data);
+	_publicKey = QByteArray(data, int(size));
+	_fingerprint = ComputeFingerprint(_rsa);
+	return true;
+}
+
+bool FakeDc::Server::startServer() {
+	if (!generateRsaKey()) {
+		return false;
+	}
+	start();
+
+	QMutexLocker lock(&_mutex);
+	while (!_started) {
+		_startedCondition.wait(&_mutex);
+	}
+	return (_port != 0);
+}
+
+int FakeDc::Server::port() const {
+	QMutexLocker lock(&_mutex);
+	return _port;
+}
+
+QByteArray FakeDc::Server::publicKey() const {
+	return _publicKey;
+}
+
+void FakeDc::Server::rotateSalts() {
+	QMutexLocker lock(&_mutex);
+	++_saltRotations;
+}
+
+FakeDcStats FakeDc::Server::stats() const {
+	QMutexLocker lock(&_mutex);
+	return _stats;
+}
+
+void FakeDc::Server::count(int64 FakeDcStats::*field, int64 value) {
+	QMutexLocker lock(&_mutex);
+	_stats.*field += value;
+}
+
+void FakeDc::Server::run() {
+	QTcpServer server;
+	const auto listening = server.listen(QHostAddress::LocalHost, 0);
+	{
+		QMutexLocker lock(&_mutex);
+		_port = listening ? int(server.serverPort()) : 0;
+		_started = true;
+		_startedCondition.wakeAll();
+	}
+	if (!listening) {
+		return;
+	}
+	QObject::connect(&server, &QTcpServer::newConnection, [&] {
+		acceptConnections(&server);
+	});
+	exec();
+
+	for (const auto &connection : _connections) {
+		connection->socket->abort();
+	}
+	_connections.clear();
+}
+
+void FakeDc::Server::acceptConnections(not_null<QTcpServer*> server) {
+	// Forget closed connections only here, not in their own handlers.
+	for (auto i = begin(_connections); i != end(_connections);) {
+		if ((*i)->closed) {
+			const auto socket = (*i)->socket;
+			QObject::disconnect(socket, nullptr, nullptr, nullptr);
+			socket->deleteLater();
+			i = _connections.erase(i);
+		} else {
+			++i;
+		}
+	}
+	while (const auto socket = server->nextPendingConnection()) {
+		count(&FakeDcStats::connections);
+		socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+
+		_connections.push_back(std::make_unique<Connection>());
+		const auto connection = _connections.back().get();
+		connection->socket = socket;
+		QObject::connect(socket, &QTcpSocket::readyRead, [=] {
+			read(connection);
+		});
+		QObject::connect(socket, &QTcpSocket::disconnected, [=] {
+			connection->closed = true;
+		});
+	}
+}
+
+void FakeDc::Server::close(not_null<Connection*> connection) {
+	if (!connection->closed) {
+		connection->closed = true;
+		connection->socket->abort();
+	}
+}
+
+void FakeDc::Server::read(not_null<Connection*> connection) {
+	const auto socket = connection->socket;
+	auto &buffer = connection->buffer;
+	while (!connection->closed && socket->bytesAvailable() > 0) {
+		const auto offset = buffer.size();
+		const auto available = socket->bytesAvailable();
+		buffer.resize(offset + available);
+		const auto read = socket->read(
+			reinterpret_cast<char*>(buffer.data() + offset),
+			available);
+		if (read <= 0) {
+			buffer.resize(offset);
+			return close(connection);
+		}
+		buffer.resize(offset + read);
+
+		auto received = bytes::make_span(buffer).subspan(offset);
+		if (!connection->protocol) {
+			if (buffer.size() < kStartNonceSize) {
+				continue;
+			}
+			const auto protocol = connection->obfuscation.accept(
+				buffer,
+				_secret);
+			if (protocol != kAbridgedProtocol
+				&& protocol != kPaddedProtocol) {
+				return close(connection);
+			}
+			connection->protocol = protocol;
+			buffer.erase(begin(buffer), begin(buffer) + kStartNonceSize);
+			received = bytes::make_span(buffer);
+		}
+		connection->obfuscation.decrypt(received);
+		if (!readPackets(connection)) {
+			return close(connection);
+		}
+	}
+}
+
+bool FakeDc::Server::readPackets(not_null<Connection*> connection) {
+	auto &buffer = connection->buffer;
+	auto offset = 0;
+	while (!connection->closed) {
+		auto header = 0;
+		const auto available = bytes::make_span(buffer).subspan(offset);
+		const auto size = ReadFrameSize(
+			connection->protocol,
+			available,
+			header);
+		if (size < 0) {
+			return false;
+		} else if (!size || size > int(available.size())) {
+			break;
+		}
+		const auto packet = PacketToBuffer(
+			available.subspan(header, size - header));
+		offset += size;
+		count(&FakeDcStats::packets);
+		if (!handlePacket(connection, packet)) {
+			return false;
+		}
+	}
+	buffer.erase(begin(buffer), begin(buffer) + offset);
+	return true;
+}
+
+void FakeDc::Server::sendPacket(
+		not_null<Connection*> connection,
+		const mtpBuffer &packet) {
+	if (connection->closed) {
+		return;
+	}
+	auto framed = FramePacket(connection->protocol, packet);
+	connection->obfuscation.encrypt(framed);
+	connection->socket->write(
+		reinterpret_cast<const char*>(framed.data()),
+		framed.size());
+}
+
+bool FakeDc::Server::handlePacket(
+		not_null<Connection*> connection,
+		const mtpBuffer &packet) {
+	if (packet.size() < 2) {
+		return false;
+	} else if (!packet[0] && !packet[1]) {
+		return handlePlain(connection, packet);
+	}
+	return handleEncrypted(connection, packet);
+}
+
+bool FakeDc::Server::handlePlain(
+		not_null<Connection*> connection,
+		const mtpBuffer &packet) {
+	const mtpPrime *from = nullptr;
+	const mtpPrime *end = nullptr;
+	if (!ReadPlainPacket(packet, from, end)) {
+		return false;
+	}
+	auto reader = Reader(from, end);
+	switch (reader.readType()) {
+	case kReqPq:
+	case kReqPqMulti: return handleReqPq(connection, reader);
+	case kReqDhParams: return handleReqDhParams(connection, reader);
+	case kSetClientDhParams:
+		return handleSetClientDhParams(connection, reader);
+	}
+	return false;
+}
+
+void FakeDc::Server::sendPlain(
+		not_null<Connection*> connection,
+		const mtpBuffer &body) {
+	sendPacket(connection, PlainPacket(NextMsgId(_lastMsgId, 1), body));
+}
+
+bool FakeDc::Server::handleReqPq(
+		not_null<Connection*> connection,
+		Reader &reader) {
+	const auto nonce = reader.readRaw(16);
+	if (reader.failed()) {
+		return false;
+	}
+	auto handshake = std::make_unique<Handshake>();
+	handshake->nonce = bytes::make_vector(nonce);
+	handshake->serverNonce = bytes::vector(16);
+	bytes::set_random(handshake->serverNonce);
+
+	auto random = uint32();
+	bytes::set_random(bytes::object_as_span(&random));
+	handshake->p = NextSmallPrime(0x40000000U + (random & 0x3FFFFFFFU) / 2);
+	handshake->q = NextSmallPrime(handshake->p + 2);
+
+	auto body = mtpBuffer();
+	WriteType(body, kResPq);
+	WriteRaw(body, handshake->nonce);
+	WriteRaw(body, handshake->serverNonce);
+	WriteBytes(body, BigEndian(handshake->p * handshake->q));
+	WriteType(body, mtpc_vector);
+	body.push_back(1);
+	WriteLong(body, _fingerprint);
+
+	connection->handshake = std::move(handshake);
+	sendPlain(connection, body);
+	return true;
+}
+
+bool FakeDc::Server::handleReqDhParams(
+		not_null<Connection*> connection,
+		Reader &reader) {
+	const auto handshake = connection->handshake.get();
+	const auto nonce = reader.readRaw(16);
+	const auto serverNonce = reader.readRaw(16);
+	const auto p = reader.readBytes();
+	const auto q = reader.readBytes();
+	const auto fingerprint = reader.readLong();
+	const auto encrypted = reader.readBytes();
+	if (reader.failed()
+		|| !handshake
+		|| bytes::compare(nonce, handshake->nonce)
+		|| bytes::compare(serverNonce, handshake->serverNonce)
+		|| FromBigEndian(p) != handshake->p
+		|| FromBigEndian(q) != handshake->q
+		|| fingerprint != _fingerprint
+		|| encrypted.size() != kRsaSize) {
+		return false;
+	}
+
+	// Zero byte, SHA1 of p_q_inner_data, p_q_inner_data and random bytes.
+	auto decrypted = bytes::vector(kRsaSize);
+	const auto size = RSA_private_decrypt(
+		kRsaSize,
+		reinterpret_cast<const uchar*>(encrypted.data()),
+		reinterpret_cast<uchar*>(decrypted.data()),
+		_rsa,
+		RSA_NO_PADDING);
+	if (size <= 0 || size > kRsaSize) {
+		return false;
+	} else if (size < kRsaSize) {
+		const auto span = bytes::make_span(decrypted);
+		bytes::move(span.subspan(kRsaSize - size), span.subspan(0, size));
+		bytes::set_with_const(
+			span.subspan(0, kRsaSize - size),
+			bytes::type());
+	}
+	constexpr auto kInnerOffset = 21;
+	auto inner = mtpBuffer((kRsaSize - kInnerOffset) / kIntSize);
+	bytes::copy(
+		bytes::make_span(inner),
+		bytes::make_span(decrypted).subspan(
+			kInnerOffset,
+			inner.size() * kIntSize));
+
+	auto innerReader = Reader(inner.constData(), inner.constData() + inner.size());
+	const auto type = innerReader.readType();
+	const auto pq = innerReader.readBytes();
+	innerReader.readBytes();
+	innerReader.readBytes();
+	const auto innerNonce = innerReader.readRaw(16);
+	const auto innerServerNonce = innerReader.readRaw(16);
+	const auto newNonce = innerReader.readRaw(32);
+	if (type == kPqInnerDataDc) {
+		innerReader.readInt();
+	} else if (type != kPqInnerData) {
+		return false;
+	}
+	if (innerReader.failed()
+		|| decrypted[0] != bytes::type()
+		|| !CheckHash(
+			bytes::make_span(decrypted).subspan(1, 20),
+			inner,
+			innerReader.current())
+		|| FromBigEndian(pq) != handshake->p * handshake->q
+		|| bytes::compare(innerNonce, handshake->nonce)
+		|| bytes::compare(innerServerNonce, handshake->serverNonce)) {
+		return false;
+	}
+	handshake->newNonce = bytes::make_vector(newNonce);
+	PrepareTemporaryAes(
+		handshake->newNonce,
+		handshake->serverNonce,
+		handshake->key,
+		handshake->iv);
+
+	const auto modexp = GenerateModExp(handshake->power);
+	const auto now = std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+
+	auto answer = mtpBuffer();
+	WriteType(answer, kServerDhInnerData);
+	WriteRaw(answer, handshake->nonce);
+	WriteRaw(answer, handshake->serverNonce);
+	answer.push_back(kDhGenerator);
+	WriteBytes(answer, DhPrime());
+	WriteBytes(answer, modexp);
+	answer.push_back(mtpPrime(now));
+
+	auto body = mtpBuffer();
+	WriteType(body, kServerDhParamsOk);
+	WriteRaw(body, handshake->nonce);
+	WriteRaw(body, handshake->serverNonce);
+	WriteBytes(body, EncryptWithHash(answer, handshake->key, handshake->iv));
+	sendPlain(connection, body);
+	return true;
+}
+
+bool FakeDc::Server::handleSetClientDhParams(
+		not_null<Connection*> connection,
+		Reader &reader) {
+	const auto handshake = connection->handshake.get();
+	const auto nonce = reader.readRaw(16);
+	const auto serverNonce = reader.readRaw(16);
+	const auto encrypted = reader.readBytes();
+	if (reader.failed()
+		|| !handshake
+		|| handshake->newNonce.empty()
+		|| bytes::compare(nonce, handshake->nonce)
+		|| bytes::compare(serverNonce, handshake->serverNonce)) {
+		return false;
+	}
+	auto inner = mtpBuffer();
+	auto hash = bytes::vector();
+	if (!DecryptWithHash(
+			encrypted,
+			handshake->key,
+			handshake->iv,
+			inner,
+			hash)) {
+		return false;
+	}
+	auto innerReader = Reader(inner.constData(), inner.constData() + inner.size());
+	const auto type = innerReader.readType();
+	const auto innerNonce = innerReader.readRaw(16);
+	const auto innerServerNonce = innerReader.readRaw(16);
+	innerReader.readLong(); // retry_id
+	const auto modexp = innerReader.readBytes();
+	if (innerReader.failed()
+		|| type != kClientDhInnerData
+		|| !CheckHash(hash, inner, innerReader.current())
+		|| bytes::compare(innerNonce, handshake->nonce)
+		|| bytes::compare(innerServerNonce, handshake->serverNonce)) {
+		return false;
+	}
+	auto authKey = ComputeAuthKey(modexp, handshake->power);
+	if (authKey.empty()) {
+		return false;
+	}
+	const auto keyId = ComputeKeyId(authKey);
+
+	auto body = mtpBuffer();
+	WriteType(body, kDhGenOk);
+	WriteRaw(body, handshake->nonce);
+	WriteRaw(body, handshake->serverNonce);
+	WriteRaw(body, ComputeNewNonceHash(handshake->newNonce, 1, authKey));
+
+	auto &key = _authKeys[keyId];
+	key.salt = ComputeServerSalt(handshake->newNonce, handshake->serverNonce);
+	key.data = std::move(authKey);
+	connection->handshake = nullptr;
+	count(&FakeDcStats::authKeys);
+
+	sendPlain(connection, body);
+	return true;
+}
+
+void FakeDc::Server::applySaltRotations() {
+	auto rotations = 0;
+	{
+		QMutexLocker lock(&_mutex);
+		rotations = _saltRotations;
+	}
+	if (_appliedSaltRotations != rotations) {
+		_appliedSaltRotations = rotations;
+		for (auto &[keyId, key] : _authKeys) {
+			key.salt = RandomLong();
+		}
+	}
+}
+
+bool FakeDc::Server::handleEncrypted(
+		not_null<Connection*> connection,
+		const mtpBuffer &packet) {
+	applySaltRotations();
+
+	const auto keyId = ReadLong(packet.constData());
+	const auto i = _authKeys.find(keyId);
+	if (i == end(_authKeys)) {
+		sendPacket(connection, mtpBuffer(1, kAuthKeyNotFoundCode));
+		return true;
+	}
+	auto &key = i->second;
+	auto message = DecryptedMessage();
+	if (!DecryptPacket(key.data, 0, packet, message)) {
+		return false;
+	}
+	auto &session = _sessions[message.sessionId];
+	auto context = Context{
+		connection,
+		keyId,
+		&key,
+		message.sessionId,
+		&session };
+	if (message.salt != key.salt) {
+		count(&FakeDcStats::badSalts);
+
+		auto body = mtpBuffer();
+		WriteType(body, kBadServerSalt);
+		WriteLong(body, message.msgId);
+		body.push_back(message.seqNo);
+		body.push_back(kBadServerSaltCode);
+		WriteLong(body, key.salt);
+		respond(context, std::move(body), false);
+		sendEncrypted(context);
+		return true;
+	}
+	if (!session.announced) {
+		session.announced = true;
+		count(&FakeDcStats::newSessions);
+
+		auto body = mtpBuffer();
+		WriteType(body, kNewSessionCreated);
+		WriteLong(body, message.msgId);
+		WriteLong(body, RandomLong());
+		WriteLong(body, key.salt);
+		respond(context, std::move(body), true);
+	}
+	if (!handleMessage(
+			context,
+			message.msgId,
+			message.seqNo,
+			message.from(),
+			message.end())) {
+		return false;
+	}
+	sendEncrypted(context);
+	return true;
+}
+
+bool FakeDc::Server::handleMessage(
+		Context &context,
+		uint64 msgId,
+		int32 seqNo,
+		const mtpPrime *from,
+		const mtpPrime *end) {
+	if (seqNo & 1) {
+		context.acks.push_back(msgId);
+	}
+	auto reader = Reader(from, end);
+	switch (reader.readType()) {
+	case mtpc_msg_container: {
+		count(&FakeDcStats::containers);
+		const auto messages = reader.readInt();
+		for (auto i = 0; i != messages && !reader.failed(); ++i) {
+			const auto innerMsgId = reader.readLong();
+			const auto innerSeqNo = reader.readInt();
+			const auto length = reader.readInt();
+			if (length < 0 || length % kIntSize) {
+				return false;
+			}
+			const auto innerFrom = reader.current();
+			reader.skip(length / kIntSize);
+			if (reader.failed()
+				|| !handleMessage(
+					context,
+					innerMsgId,
+					innerSeqNo,
+					innerFrom,
+					reader.current())) {
+				return false;
+			}
+		}
+	} break;
+
+	case mtpc_gzip_packed: {
+		count(&FakeDcStats::gzippedRequests);
+		auto unpacked = mtpBuffer();
+		const auto error = _unpacker.unpack(
+			reader.current(),
+			end,
+			unpacked);
+		return (error == GzipError::None)
+			&& handleMessage(
+				context,
+				msgId,
+				seqNo & ~1,
+				unpacked.constData(),
+				unpacked.constData() + unpacked.size());
+	} break;
+
+	case kMsgsAck: {
+		if (reader.readType() != mtpc_vector) {
+			return false;
+		}
+		const auto acks = reader.readInt();
+		reader.skip(acks * 2);
+		count(&FakeDcStats::acks, acks);
+	} break;
+
+	case kPing:
+	case kPingDelayDisconnect: {
+		const auto pingId = reader.readLong();
+		auto body = mtpBuffer();
+		WriteType(body, kPong);
+		WriteLong(body, msgId);
+		WriteLong(body, pingId);
+		respond(context, std::move(body), true);
+	} break;
+
+	case kGetFutureSalts: {
+		const auto requested = std::clamp(reader.readInt(), 1, kMaxFutureSalts);
+		const auto now = std::chrono::duration_cast<std::chrono::seconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+		auto body = mtpBuffer();
+		WriteType(body, kFutureSalts);
+		WriteLong(body, msgId);
+		body.push_back(mtpPrime(now));
+		body.push_back(requested);
+		for (auto i = 0; i != requested; ++i) {
+			const auto since = now + i * kFutureSaltDuration;
+			body.push_back(mtpPrime(since));
+			body.push_back(mtpPrime(since + kFutureSaltDuration));
+			WriteLong(body, i ? RandomLong() : context.key->salt);
+		}
+		respond(context, std::move(body), true);
+	} break;
+
+	default: {
+		count(&FakeDcStats::requests);
+		const auto query = SkipWrappers(from, end);
+		auto result = query ? _handler(query, end) : mtpBuffer();
+		respond(context, rpcResult(msgId, result), true);
+	} break;
+	}
+	return !reader.failed();
+}
+
+mtpBuffer FakeDc::Server::rpcResult(uint64 requestId, const mtpBuffer &result) {
+	auto body = mtpBuffer();
+	WriteType(body, mtpc_rpc_result);
+	WriteLong(body, requestId);
+	if (result.isEmpty()) {
+		WriteType(body, kRpcError);
+		body.push_back(500);
+		WriteString(body, "FAKE_DC_NO_RESULT");
+		return body;
+	}
+	const auto from = result.constData();
+	const auto end = from + result.size();
+	const auto threshold = _options.gzipThreshold;
+	if (threshold > 0
+		&& result.size() * kIntSize >= threshold
+		&& _packer.pack(from, end, _packed)) {
+		count(&FakeDcStats::gzippedResults);
+		body += _packed;
+	} else {
+		body += result;
+	}
+	return body;
+}
+
+void FakeDc::Server::respond(Context &context, mtpBuffer &&body, bool content) {
+	auto &messages = context.session->contentMessages;
+	const auto seqNo = content ? (messages++ * 2 + 1) : (messages * 2);
+	context.outgoing.push_back({
+		NextMsgId(_lastMsgId, 1),
+		seqNo,
+		std::move(body) });
+}
+
+void FakeDc::Server::sendEncrypted(Context &context) {
+	for (auto i = 0; i < int(context.acks.size()); i += kMaxAcksCount) {
+		const auto till = std::min(int(context.acks.size()), i + kMaxAcksCount);
+		auto body = mtpBuffer();
+		body.reserve(3 + (till - i) * 2);
+		WriteType(body, kMsgsAck);
+		WriteType(body, mtpc_vector);
+		body.push_back(till - i);
+		for (auto j = i; j != till; ++j) {
+			WriteLong(body, context.acks[j]);
+		}
+		respond(context, std::move(body), false);
+	}
+	context.acks.clear();
+
+	auto outgoing = base::take(context.outgoing);
+	if (outgoing.empty()) {
+		return;
+	}
+	const auto send = [&](uint64 msgId, int32 seqNo, const mtpBuffer &body) {
+		sendPacket(context.connection, EncryptedPacket(
+			context.key->data,
+			context.keyId,
+			8,
+			context.key->salt,
+			context.sessionId,
+			msgId,
+			seqNo,
+			body));
+	};
+	if (outgoing.size() == 1) {
+		const auto &message = outgoing.front();
+		send(message.msgId, message.seqNo, message.body);
+		return;
+	}
+	auto container = mtpBuffer();
+	WriteType(container, mtpc_msg_container);
+	container.push_back(int(outgoing.size()));
+	for (const auto &message : outgoing) {
+		WriteLong(container, message.msgId);
+		container.push_back(message.seqNo);
+		container.push_back(message.body.size() * kIntSize);
+		container += message.body;
+	}
+	const auto seqNo = context.session->contentMessages * 2;
+	send(NextMsgId(_lastMsgId, 1), seqNo, container);
+}
+
+FakeDc::FakeDc(Options options, FakeDcHandler handler)
+: _server(std::make_unique<Server>(std::move(options), std::move(handler))) {
+}
+
+FakeDc::~FakeDc() = default;
+
+bool FakeDc::start() {
+	return _server->startServer();
+}
+
+int FakeDc::port() const {
+	return _server->port();
+}
+
+QByteArray FakeDc::publicKey() const {
+	return _server->publicKey();
+}
+
+void FakeDc::rotateSalts() {
+	_server->rotateSalts();
+}
+
+FakeDcStats FakeDc::stats() const {
+	return _server->stats();
+}
+
+struct FakeDcClient::Transport {
+	Obfuscation obfuscation;
+	uint32 protocol = 0;
+
+	// Already decrypted received bytes.
+	bytes::vector buffer;
+};
+
+FakeDcClient::FakeDcClient(int port, bytes::vector secret)
+: _port(port)
+, _secret(std::move(secret)) {
+}
+
+FakeDcClient::~FakeDcClient() = default;
+
+bool FakeDcClient::connectToServer(int timeout) {
+	_socket = std::make_unique<QTcpSocket>();
+	_socket->connectToHost(QHostAddress::LocalHost, quint16(_port));
+	if (!_socket->waitForConnected(timeout)) {
+		return false;
+	}
+	_socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+
+	const auto secret = StripSecret(_secret);
+	_transport = std::make_unique<Transport>();
+	_transport->protocol = (secret.size() == _secret.size())
+		? kAbridgedProtocol
+		: kPaddedProtocol;
+	const auto prefix = _transport->obfuscation.start(
+		secret,
+		_transport->protocol);
+	_sessionId = RandomLong();
+	return _socket->write(
+		reinterpret_cast<const char*>(prefix.data()),
+		prefix.size()) == prefix.size();
+}
+
+bool FakeDcClient::createAuthKey(const QByteArray &publicKey, int timeout) {
+	const auto bio = BIO_new_mem_buf(
+		const_cast<char*>(publicKey.constData()),
+		publicKey.size());
+	if (!bio) {
+		return false;
+	}
+	const auto rsa = PEM_read_bio_RSAPublicKey(bio, nullptr, nullptr, nullptr);
+	BIO_free(bio);
+	if (!rsa) {
+		return false;
+	}
+	const auto guard = gsl::finally([&] { RSA_free(rsa); });
+	const auto fingerprint = ComputeFingerprint(rsa);
+
+	auto nonce = bytes::vector(16);
+	bytes::set_random(nonce);
+	auto request = mtpBuffer();
+	WriteType(request, kReqPqMulti);
+	WriteRaw(request, nonce);
+	auto answer = mtpBuffer();
+	if (!sendPlain(request) || !readPlain(answer, timeout)) {
+		return false;
+	}
+
+	auto reader = Reader(answer.constData(), answer.constData() + answer.size());
+	const auto resPqType = reader.readType();
+	const auto resPqNonce = reader.readRaw(16);
+	const auto serverNonce = bytes::make_vector(reader.readRaw(16));
+	const auto pqBytes = bytes::make_vector(reader.readBytes());
+	const auto fingerprintsType = reader.readType();
+	const auto fingerprints = reader.readInt();
+	auto fingerprintFound = false;
+	for (auto i = 0; i < fingerprints && !reader.failed(); ++i) {
+		if (reader.readLong() == fingerprint) {
+			fingerprintFound = true;
+		}
+	}
+	auto p = uint64();
+	auto q = uint64();
+	if (reader.failed()
+		|| resPqType != kResPq
+		|| fingerprintsType != mtpc_vector
+		|| !fingerprintFound
+		|| bytes::compare(resPqNonce, nonce)
+		|| !FactorizePq(FromBigEndian(pqBytes), p, q)) {
+		return false;
+	}
+
+	auto newNonce = bytes::vector(32);
+	bytes::set_random(newNonce);
+	auto inner = mtpBuffer();
+	WriteType(inner, kPqInnerDataDc);
+	WriteBytes(inner, pqBytes);
+	WriteBytes(inner, BigEndian(p, 4));
+	WriteBytes(inner, BigEndian(q, 4));
+	WriteRaw(inner, nonce);
+	WriteRaw(inner, serverNonce);
+	WriteRaw(inner, newNonce);
+	inner.push_back(kProtocolDcId);
+
+	// Zero byte, SHA1 of p_q_inner_data, p_q_inner_data and random bytes.
+	constexpr auto kInnerOffset = 21;
+	const auto innerBytes = bytes::make_span(inner);
+	if (kInnerOffset + innerBytes.size() > kRsaSize) {
+		return false;
+	}
+	auto block = bytes::vector(kRsaSize);
+	const auto blockSpan = bytes::make_span(block);
+	bytes::set_random(blockSpan);
+	block[0] = bytes::type();
+	bytes::copy(blockSpan.subspan(1), openssl::Sha1(innerBytes));
+	bytes::copy(blockSpan.subspan(kInnerOffset), innerBytes);
+	auto encrypted = bytes::vector(kRsaSize);
+	const auto encryptedSize = RSA_public_encrypt(
+		kRsaSize,
+		reinterpret_cast<const uchar*>(block.data()),
+		reinterpret_cast<uchar*>(encrypted.data()),
+		rsa,
+		RSA_NO_PADDING);
+	if (encryptedSize != kRsaSize) {
+		return false;
+	}
+
+	request.clear();
+	WriteType(request, kReqDhParams);
+	WriteRaw(request, nonce);
+	WriteRaw(request, serverNonce);
+	WriteBytes(request, BigEndian(p, 4));
+	WriteBytes(request, BigEndian(q, 4));
+	WriteLong(request, fingerprint);
+	WriteBytes(request, encrypted);
+	if (!sendPlain(request) || !readPlain(answer, timeout)) {
+		return false;
+	}
+
+	reader = Reader(answer.constData(), answer.constData() + answer.size());
+	const auto dhParamsType = reader.readType();
+	const auto dhParamsNonce = reader.readRaw(16);
+	const auto dhParamsServerNonce = reader.readRaw(16);
+	const auto encryptedAnswer = reader.readBytes();
+	if (reader.failed()
+		|| dhParamsType != kServerDhParamsOk
+		|| bytes::compare(dhParamsNonce, nonce)
+		|| bytes::compare(dhParamsServerNonce, serverNonce)) {
+		return false;
+	}
+	auto key = bytes::vector();
+	auto iv = bytes::vector();
+	PrepareTemporaryAes(newNonce, serverNonce, key, iv);
+	auto hash = bytes::vector();
+	if (!DecryptWithHash(encryptedAnswer, key, iv, inner, hash)) {
+		return false;
+	}
+	reader = Reader(inner.constData(), inner.constData() + inner.size());
+	const auto innerType = reader.readType();
+	const auto innerNonce = reader.readRaw(16);
+	const auto innerServerNonce = reader.readRaw(16);
+	const auto g = reader.readInt();
+	const auto prime = reader.readBytes();
+	const auto modexp = bytes::make_vector(reader.readBytes());
+	reader.readInt(); // server_time
+	if (reader.failed()
+		|| innerType != kServerDhInnerData
+		|| !CheckHash(hash, inner, reader.current())
+		|| bytes::compare(innerNonce, nonce)
+		|| bytes::compare(innerServerNonce, serverNonce)
+		|| g != kDhGenerator
+		|| bytes::compare(prime, DhPrime())) {
+		return false;
+	}
+
+	auto power = bytes::vector();
+	const auto clientModexp = GenerateModExp(power);
+	auto authKey = ComputeAuthKey(modexp, power);
+	if (authKey.empty()) {
+		return false;
+	}
+	auto clientInner = mtpBuffer();
+	WriteType(clientInner, kClientDhInnerData);
+	WriteRaw(clientInner, nonce);
+	WriteRaw(clientInner, serverNonce);
+	WriteLong(clientInner, 0); // retry_id
+	WriteBytes(clientInner, clientModexp);
+
+	request.clear();
+	WriteType(request, kSetClientDhParams);
+	WriteRaw(request, nonce);
+	WriteRaw(request, serverNonce);
+	WriteBytes(request, EncryptWithHash(clientInner, key, iv));
+	if (!sendPlain(request) || !readPlain(answer, timeout)) {
+		return false;
+	}
+
+	reader = Reader(answer.constData(), answer.constData() + answer.size());
+	const auto genType = reader.readType();
+	const auto genNonce = reader.readRaw(16);
+	const auto genServerNonce = reader.readRaw(16);
+	const auto newNonceHash = reader.readRaw(16);
+	if (reader.failed()
+		|| genType != kDhGenOk
+		|| bytes::compare(genNonce, nonce)
+		|| bytes::compare(genServerNonce, serverNonce)
+		|| bytes::compare(
+			newNonceHash,
+			ComputeNewNonceHash(newNonce, 1, authKey))) {
+		return false;
+	}
+	_authKeyId = ComputeKeyId(authKey);
+	_authKey = std::move(authKey);
+	_salt = ComputeServerSalt(newNonce, serverNonce);
+	return true;
+}
+
+uint64 FakeDcClient::authKeyId() const {
+	return _authKeyId;
+}
+
+void FakeDcClient::send(mtpBuffer &&request, Done done) {
+	_queued.push_back({ std::move(request), std::move(done) });
+}
+
+bool FakeDcClient::flush() {
+	struct Message {
+		uint64 msgId = 0;
+		int32 seqNo = 0;
+		mtpBuffer body;
+	};
+	auto messages = std::vector<Message>();
+	messages.reserve(_queued.size() + 1);
+	for (auto i = 0; i < int(_acks.size()); i += kMaxAcksCount) {
+		const auto till = std::min(int(_acks.size()), i + kMaxAcksCount);
+		auto body = mtpBuffer();
+		body.reserve(3 + (till - i) * 2);
+		WriteType(body, kMsgsAck);
+		WriteType(body, mtpc_vector);
+		body.push_back(till - i);
+		for (auto j = i; j != till; ++j) {
+			WriteLong(body, _acks[j]);
+		}
+		messages.push_back({ nextMsgId(), nextSeqNo(false), std::move(body) });
+	}
+	_acks.clear();
+
+	auto queued = base::take(_queued);
+	auto requestIds = std::vector<uint64>();
+	requestIds.reserve(queued.size());
+	for (auto &request : queued) {
+		const auto msgId = nextMsgId();
+		requestIds.push_back(msgId);
+		messages.push_back({ msgId, nextSeqNo(true), request.body });
+	}
+
+	auto result = true;
+	auto request = begin(queued);
+	auto requestId = begin(requestIds);
+	for (auto i = 0; i < int(messages.size()); i += kMaxContainerMessages) {
+		const auto till = std::min(
+			int(messages.size()),
+			i + kMaxContainerMessages);
+		auto containerId = uint64();
+		if (till - i == 1) {
+			const auto &message = messages[i];
+			result = sendEncrypted(message.msgId, message.seqNo, message.body)
+				&& result;
+		} else {
+			auto container = mtpBuffer();
+			WriteType(container, mtpc_msg_container);
+			container.push_back(till - i);
+			for (auto j = i; j != till; ++j) {
+				const auto &message = messages[j];
+				WriteLong(container, message.msgId);
+				container.push_back(message.seqNo);
+				container.push_back(message.body.size() * kIntSize);
+				container += message.body;
+			}
+			containerId = nextMsgId();
+			result = sendEncrypted(containerId, nextSeqNo(false), container)
+				&& result;
+		}
+		for (auto j = i; j != till; ++j) {
+			if (requestId != end(requestIds)
+				&& *requestId == messages[j].msgId) {
+				request->containerId = containerId;
+				_sent.emplace(*requestId, std::move(*request));
+				++request;
+				++requestId;
+			}
+		}
+	}
+	_socket->flush();
+	return result;
+}
+
+bool FakeDcClient::receive(int timeout) {
+	auto packet = mtpBuffer();
+	if (!readPacket(packet, timeout) || !handlePacket(packet)) {
+		return false;
+	}
+	while (hasPacket()) {
+		if (!readPacket(packet, timeout) || !handlePacket(packet)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int FakeDcClient::waiting() const {
+	return int(_queued.size() + _sent.size());
+}
+
+int64 FakeDcClient::resent() const {
+	return _resent;
+}
+
+int64 FakeDcClient::newSessions() const {
+	return _newSessions;
+}
+
+bool FakeDcClient::sendPacket(mtpBuffer &&packet) {
+	auto framed = FramePacket(_transport->protocol, packet);
+	_transport->obfuscation.encrypt(framed);
+	return _socket->write(
+		reinterpret_cast<const char*>(framed.data()),
+		framed.size()) == framed.size();
+}
+
+bool FakeDcClient::sendPlain(const mtpBuffer &body) {
+	if (!sendPacket(PlainPacket(nextMsgId(), body))) {
+		return false;
+	}
+	_socket->flush();
+	return true;
+}
+
+bool FakeDcClient::readPacket(mtpBuffer &packet, int timeout) {
+	auto &buffer = _transport->buffer;
+	while (true) {
+		auto header = 0;
+		const auto size = ReadFrameSize(
+			_transport->protocol,
+			buffer,
+			header);
+		if (size < 0) {
+			return false;
+		} else if (size > 0 && size <= int(buffer.size())) {
+			packet = PacketToBuffer(
+				bytes::make_span(buffer).subspan(header, size - header));
+			buffer.erase(begin(buffer), begin(buffer) + size);
+			return true;
+		}
+		if (!_socket->bytesAvailable()
+			&& !_socket->waitForReadyRead(timeout)) {
+			return false;
+		}
+		const auto offset = buffer.size();
+		const auto available = _socket->bytesAvailable();
+		buffer.resize(offset + available);
+		const auto read = _socket->read(
+			reinterpret_cast<char*>(buffer.data() + offset),
+			available);
+		if (read < 0) {
+			return false;
+		}
+		buffer.resize(offset + read);
+		_transport->obfuscation.decrypt(
+			bytes::make_span(buffer).subspan(offset));
+	}
+}
+
+bool FakeDcClient::readPlain(mtpBuffer &body, int timeout) {
+	auto packet = mtpBuffer();
+	const mtpPrime *from = nullptr;
+	const mtpPrime *end = nullptr;
+	if (!readPacket(packet, timeout)
+		|| !ReadPlainPacket(packet, from, end)) {
+		return false;
+	}
+	body = mtpBuffer(end - from);
+	memcpy(body.data(), from, (end - from) * sizeof(mtpPrime));
+	return true;
+}
+
+bool FakeDcClient::hasPacket() const {
+	if (_socket->bytesAvailable() > 0) {
+		return true;
+	}
+	auto header = 0;
+	const auto &buffer = _transport->buffer;
+	const auto size = ReadFrameSize(_transport->protocol, buffer, header);
+	return (size != 0) && (size <= int(buffer.size()));
+}
+
+bool FakeDcClient::sendEncrypted(
+		uint64 msgId,
+		int32 seqNo,
+		const mtpBuffer &body) {
+	return sendPacket(EncryptedPacket(
+		_authKey,
+		_authKeyId,
+		0,
+		_salt,
+		_sessionId,
+		msgId,
+		seqNo,
+		body));
+}
+
+bool FakeDcClient::handlePacket(const mtpBuffer &packet) {
+	auto message = DecryptedMessage();
+	if (packet.size() < 2
+		|| ReadLong(packet.constData()) != _authKeyId
+		|| !DecryptPacket(_authKey, 8, packet, message)
+		|| message.sessionId != _sessionId) {
+		return false;
+	}
+	return handleMessage(
+		message.msgId,
+		message.seqNo,
+		message.from(),
+		message.end());
+}
+
+bool FakeDcClient::handleMessage(
+		uint64 msgId,
+		int32 seqNo,
+		const mtpPrime *from,
+		const mtpPrime *end) {
+	if (seqNo & 1) {
+		_acks.push_back(msgId);
+	}
+	auto reader = Reader(from, end);
+	switch (reader.readType()) {
+	case mtpc_msg_container: {
+		const auto messages = reader.readInt();
+		for (auto i = 0; i != messages && !reader.failed(); ++i) {
+			const auto innerMsgId = reader.readLong();
+			const auto innerSeqNo = reader.readInt();
+			const auto length = reader.readInt();
+			if (length < 0 || length % kIntSize) {
+				return false;
+			}
+			const auto innerFrom = reader.current();
+			reader.skip(length / kIntSize);
+			if (reader.failed()
+				|| !handleMessage(
+					innerMsgId,
+					innerSeqNo,
+					innerFrom,
+					reader.current())) {
+				return false;
+			}
+		}
+	} break;
+
+	case mtpc_gzip_packed: {
+		auto unpacked = mtpBuffer();
+		const auto error = _unpacker.unpack(
+			reader.current(),
+			end,
+			unpacked);
+		return (error == GzipError::None)
+			&& handleMessage(
+				msgId,
+				seqNo & ~1,
+				unpacked.constData(),
+				unpacked.constData() + unpacked.size());
+	} break;
+
+	case mtpc_rpc_result: {
+		const auto requestId = reader.readLong();
+		if (reader.failed()) {
+			return false;
+		}
+		handleResult(requestId, reader.current(), end);
+	} break;
+
+	case kBadServerSalt: {
+		const auto badMsgId = reader.readLong();
+		reader.readInt(); // bad_msg_seqno
+		const auto code = reader.readInt();
+		const auto salt = reader.readLong();
+		if (reader.failed() || code != kBadServerSaltCode) {
+			return false;
+		}
+		_salt = salt;
+		resend(badMsgId);
+	} break;
+
+	case kNewSessionCreated: {
+		reader.readLong(); // first_msg_id
+		reader.readLong(); // unique_id
+		const auto salt = reader.readLong();
+		if (reader.failed()) {
+			return false;
+		}
+		_salt = salt;
+		++_newSessions;
+	} break;
+	}
+	return !reader.failed();
+}
+
+void FakeDcClient::handleResult(
+		uint64 requestId,
+		const mtpPrime *from,
+		const mtpPrime *end) {
+	const auto i = _sent.find(requestId);
+	if (i == _sent.end()) {
+		return;
+	}
+	const auto done = std::move(i->second.done);
+	_sent.erase(i);
+	if (!done) {
+		return;
+	} else if (from < end && mtpTypeId(*from) == mtpc_gzip_packed) {
+		auto unpacked = mtpBuffer();
+		if (_unpacker.unpack(from + 1, end, unpacked) == GzipError::None) {
+			done(
+				unpacked.constData(),
+				unpacked.constData() + unpacked.size());
+		}
+		return;
+	}
+	done(from, end);
+}
+
+void FakeDcClient::resend(uint64 msgId) {
+	for (auto i = _sent.begin(); i != _sent.end();) {
+		if (i->first == msgId || i->second.containerId == msgId) {
+			++_resent;
+			_queued.push_back(std::move(i->second));
+			_queued.back().containerId = 0;
+			i = _sent.erase(i);
+		} else {
+			++i;
+		}
+	}
+}
+
+uint64 FakeDcClient::nextMsgId() {
+	return NextMsgId(_lastMsgId, 0);
+}
+
+int32 FakeDcClient::nextSeqNo(bool content) {
+	return content ? (_contentMessages++ * 2 + 1) : (_contentMessages * 2);
+}
+
+} // namespace internal
+} // namespace MTP
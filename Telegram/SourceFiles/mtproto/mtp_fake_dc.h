@@ -0,0 +1,186 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "mtproto/core_types.h"
+#include "mtproto/mtp_gzip.h"
+
+#include <map>
+
+class QTcpSocket;
+
+namespace MTP {
+namespace internal {
+
+// Answers one request, the result is sent back in rpc_result.
+// An empty result is sent back as rpc_error.
+//
+// [from, end) is the request without invokeWithLayer, initConnection,
+// invokeWithoutUpdates and invokeAfterMsg wrappers.
+using FakeDcHandler = Fn<mtpBuffer(const mtpPrime *from, const mtpPrime *end)>;
+
+struct FakeDcStats {
+	int64 connections = 0;
+	int64 authKeys = 0;
+	int64 packets = 0;
+	int64 requests = 0;
+	int64 containers = 0;
+	int64 gzippedRequests = 0;
+	int64 gzippedResults = 0;
+	int64 acks = 0;
+	int64 badSalts = 0;
+	int64 newSessions = 0;
+};
+
+// Loopback stand-in for a data center, for transport tests and benchmarks.
+//
+// Listens on 127.0.0.1 in its own thread and speaks the obfuscated tcp
+// transport the way TcpConnection does (abridged or padded intermediate
+// framing, with an optional secret). Auth keys are created with the
+// regular DH handshake signed by a RSA key generated at start. After that
+// it checks server salts, announces new sessions, acknowledges content
+// messages, reads containers and gzip_packed requests, answers pings and
+// get_future_salts and packs larger results into gzip_packed.
+//
+// Http and tls transports are not supported.
+//
+// MTP::Instance and ConnectionPrivate can't be linked into the tests
+// without the whole application yet, so the tests and benchmarks talk
+// to it through FakeDcClient instead.
+class FakeDc final {
+public:
+	struct Options {
+		// Empty, 16 bytes or 0xDD + 16 bytes, like the proxy secrets.
+		bytes::vector secret;
+
+		// Results of this size (in bytes) or larger are sent packed,
+		// zero disables packing.
+		int gzipThreshold = 1024;
+	};
+
+	// The handler is called on the fake dc thread.
+	FakeDc(Options options, FakeDcHandler handler);
+	FakeDc(const FakeDc &other) = delete;
+	FakeDc &operator=(const FakeDc &other) = delete;
+	~FakeDc();
+
+	// Generates the RSA key and starts listening on a random port.
+	[[nodiscard]] bool start();
+	[[nodiscard]] int port() const;
+
+	// "-----BEGIN RSA PUBLIC KEY----- ..." to be trusted by clients.
+	[[nodiscard]] QByteArray publicKey() const;
+
+	// All auth keys get new salts, so the next messages with the
+	// old ones are answered with bad_server_salt.
+	void rotateSalts();
+
+	[[nodiscard]] FakeDcStats stats() const;
+
+private:
+	class Server;
+
+	std::unique_ptr<Server> _server;
+
+};
+
+// Minimal blocking client for the fake dc.
+//
+// Creates an auth key, sends queued requests in containers (together with
+// acks for the received messages), resends them after bad_server_salt and
+// unpacks gzip_packed results. Everything runs in the calling thread, the
+// socket is used without an event loop.
+class FakeDcClient final {
+public:
+	using Done = Fn<void(const mtpPrime *from, const mtpPrime *end)>;
+
+	FakeDcClient(int port, bytes::vector secret = {});
+	FakeDcClient(const FakeDcClient &other) = delete;
+	FakeDcClient &operator=(const FakeDcClient &other) = delete;
+	~FakeDcClient();
+
+	[[nodiscard]] bool connectToServer(int timeout);
+
+	// Runs the DH handshake, trusting only the given RSA key.
+	[[nodiscard]] bool createAuthKey(const QByteArray &publicKey, int timeout);
+	[[nodiscard]] uint64 authKeyId() const;
+
+	// Requests are queued until flush().
+	void send(mtpBuffer &&request, Done done);
+	[[nodiscard]] bool flush();
+
+	// Waits for at least one packet and handles all the received ones.
+	[[nodiscard]] bool receive(int timeout);
+
+	// Sent or queued requests without results.
+	[[nodiscard]] int waiting() const;
+
+	// Requests sent once more after bad_server_salt.
+	[[nodiscard]] int64 resent() const;
+
+	// new_session_created messages received.
+	[[nodiscard]] int64 newSessions() const;
+
+	// Keeps at most this many messages in one container.
+	static constexpr auto kMaxContainerMessages = 1020;
+
+private:
+	struct Transport;
+	struct Request {
+		mtpBuffer body;
+		Done done;
+		uint64 containerId = 0;
+	};
+
+	[[nodiscard]] bool sendPacket(mtpBuffer &&packet);
+	[[nodiscard]] bool sendPlain(const mtpBuffer &body);
+	[[nodiscard]] bool readPacket(mtpBuffer &packet, int timeout);
+	[[nodiscard]] bool readPlain(mtpBuffer &body, int timeout);
+	[[nodiscard]] bool hasPacket() const;
+	[[nodiscard]] bool sendEncrypted(
+		uint64 msgId,
+		int32 seqNo,
+		const mtpBuffer &body);
+	[[nodiscard]] bool handlePacket(const mtpBuffer &packet);
+	[[nodiscard]] bool handleMessage(
+		uint64 msgId,
+		int32 seqNo,
+		const mtpPrime *from,
+		const mtpPrime *end);
+	void handleResult(
+		uint64 requestId,
+		const mtpPrime *from,
+		const mtpPrime *end);
+	void resend(uint64 msgId);
+
+	[[nodiscard]] uint64 nextMsgId();
+	[[nodiscard]] int32 nextSeqNo(bool content);
+
+	int _port = 0;
+	bytes::vector _secret;
+	std::unique_ptr<QTcpSocket> _socket;
+	std::unique_ptr<Transport> _transport;
+
+	bytes::vector _authKey;
+	uint64 _authKeyId = 0;
+	uint64 _salt = 0;
+	uint64 _sessionId = 0;
+	uint64 _lastMsgId = 0;
+	int32 _contentMessages = 0;
+
+	std::vector<Request> _queued;
+	std::map<uint64, Request> _sent;
+	std::vector<uint64> _acks;
+	GzipUnpacker _unpacker;
+	int64 _resent = 0;
+	int64 _newSessions = 0;
+
+};
+
+} // namespace internal
+} // namespace MTP
@@ -0,0 +1,404 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "mtproto/mtp_fake_dc.h"
+#include "base/openssl_help.h"
+#include "base/mpsc_queue.h"
+#include <QtCore/QCoreApplication>
+#include <QtCore/QMutex>
+#include <QtCore/QMap>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+using namespace MTP::internal;
+
+const auto DisableBenchmarkTests = true;
+
+namespace {
+
+constexpr auto kTimeout = 10000;
+
+// Not a real constructor: [type, count, seed] is answered with a vector
+// of count small numbers, so that large answers are easily packed.
+constexpr auto kTestRequest = mtpTypeId(0x7e57da7a);
+constexpr auto kInvokeWithLayer = mtpTypeId(0xda9b0d0d);
+
+void EnsureApplication() {
+	// The fake dc thread needs an event loop.
+	if (!QCoreApplication::instance()) {
+		static auto argc = 1;
+		static char name[] = "tests_mtproto";
+		static char *argv[] = { name, nullptr };
+		static QCoreApplication application(argc, argv);
+	}
+}
+
+mtpBuffer TestRequest(int count, int seed) {
+	return { mtpPrime(kTestRequest), count, seed };
+}
+
+mtpBuffer TestHandler(const mtpPrime *from, const mtpPrime *end) {
+	if (end - from < 3 || mtpTypeId(from[0]) != kTestRequest) {
+		return {};
+	}
+	const auto count = from[1];
+	const auto seed = from[2];
+	auto result = mtpBuffer();
+	result.reserve(2 + count);
+	result.push_back(mtpc_vector);
+	result.push_back(count);
+	for (auto i = 0; i != count; ++i) {
+		result.push_back((seed + i) % 16);
+	}
+	return result;
+}
+
+bool CheckTestResult(
+		const mtpPrime *from,
+		const mtpPrime *end,
+		int count,
+		int seed) {
+	if (end - from != 2 + count
+		|| mtpTypeId(from[0]) != mtpc_vector
+		|| from[1] != count) {
+		return false;
+	}
+	for (auto i = 0; i != count; ++i) {
+		if (from[2 + i] != (seed + i) % 16) {
+			return false;
+		}
+	}
+	return true;
+}
+
+std::unique_ptr<FakeDc> StartFakeDc(FakeDc::Options options = {}) {
+	EnsureApplication();
+	auto result = std::make_unique<FakeDc>(std::move(options), TestHandler);
+	REQUIRE(result->start());
+	REQUIRE(result->port() > 0);
+	return result;
+}
+
+std::unique_ptr<FakeDcClient> ConnectClient(
+		not_null<FakeDc*> dc,
+		bytes::vector secret = {}) {
+	auto result = std::make_unique<FakeDcClient>(dc->port(), secret);
+	REQUIRE(result->connectToServer(kTimeout));
+	REQUIRE(result->createAuthKey(dc->publicKey(), kTimeout));
+	return result;
+}
+
+void ReceiveAll(not_null<FakeDcClient*> client) {
+	while (client->waiting() > 0) {
+		REQUIRE(client->flush());
+		REQUIRE(client->receive(kTimeout));
+	}
+}
+
+} // namespace
+
+TEST_CASE("fake dc auth keys", "[mtp_fake_dc]") {
+	const auto dc = StartFakeDc();
+	const auto first = ConnectClient(dc.get());
+	const auto second = ConnectClient(dc.get());
+	REQUIRE(first->authKeyId() != 0);
+	REQUIRE(first->authKeyId() != second->authKeyId());
+
+	const auto stats = dc->stats();
+	REQUIRE(stats.connections == 2);
+	REQUIRE(stats.authKeys == 2);
+}
+
+TEST_CASE("fake dc requests", "[mtp_fake_dc]") {
+	const auto dc = StartFakeDc();
+	const auto client = ConnectClient(dc.get());
+
+	SECTION("containers are answered") {
+		constexpr auto kCount = 100;
+		auto answered = 0;
+		for (auto i = 0; i != kCount; ++i) {
+			client->send(TestRequest(16, i), [&, i](
+					const mtpPrime *from,
+					const mtpPrime *end) {
+				REQUIRE(CheckTestResult(from, end, 16, i));
+				++answered;
+			});
+		}
+		ReceiveAll(client.get());
+		REQUIRE(answered == kCount);
+		REQUIRE(client->newSessions() == 1);
+
+		// Acks for the results go with the next requests.
+		client->send(TestRequest(1, 0), nullptr);
+		ReceiveAll(client.get());
+
+		const auto stats = dc->stats();
+		REQUIRE(stats.requests == kCount + 1);
+		REQUIRE(stats.containers > 0);
+		REQUIRE(stats.acks >= kCount);
+		REQUIRE(stats.newSessions == 1);
+	}
+	SECTION("wrappers are skipped") {
+		auto request = mtpBuffer{ mtpPrime(kInvokeWithLayer), 91 };
+		request += TestRequest(4, 1);
+		auto done = false;
+		client->send(std::move(request), [&](
+				const mtpPrime *from,
+				const mtpPrime *end) {
+			REQUIRE(CheckTestResult(from, end, 4, 1));
+			done = true;
+		});
+		ReceiveAll(client.get());
+		REQUIRE(done);
+	}
+	SECTION("unknown requests get rpc_error") {
+		auto error = mtpTypeId();
+		client->send({ 0x01020304, 0 }, [&](
+				const mtpPrime *from,
+				const mtpPrime *end) {
+			REQUIRE(end > from);
+			error = mtpTypeId(*from);
+		});
+		ReceiveAll(client.get());
+		REQUIRE(error == mtpTypeId(0x2144ca19));
+	}
+}
+
+TEST_CASE("fake dc salts", "[mtp_fake_dc]") {
+	const auto dc = StartFakeDc();
+	const auto client = ConnectClient(dc.get());
+
+	auto answered = 0;
+	const auto done = [&](const mtpPrime *from, const mtpPrime *end) {
+		REQUIRE(CheckTestResult(from, end, 8, 3));
+		++answered;
+	};
+	client->send(TestRequest(8, 3), done);
+	ReceiveAll(client.get());
+	REQUIRE(answered == 1);
+
+	dc->rotateSalts();
+	for (auto i = 0; i != 10; ++i) {
+		client->send(TestRequest(8, 3), done);
+	}
+	ReceiveAll(client.get());
+	REQUIRE(answered == 11);
+	REQUIRE(client->resent() == 10);
+	REQUIRE(dc->stats().badSalts == 1);
+}
+
+TEST_CASE("fake dc gzip", "[mtp_fake_dc]") {
+	auto options = FakeDc::Options();
+	options.gzipThreshold = 1024;
+	const auto dc = StartFakeDc(std::move(options));
+	const auto client = ConnectClient(dc.get());
+
+	SECTION("large results are packed") {
+		auto small = false;
+		auto large = false;
+		client->send(TestRequest(16, 5), [&](
+				const mtpPrime *from,
+				const mtpPrime *end) {
+			small = CheckTestResult(from, end, 16, 5);
+		});
+		client->send(TestRequest(100000, 7), [&](
+				const mtpPrime *from,
+				const mtpPrime *end) {
+			large = CheckTestResult(from, end, 100000, 7);
+		});
+		ReceiveAll(client.get());
+		REQUIRE(small);
+		REQUIRE(large);
+		REQUIRE(dc->stats().gzippedResults == 1);
+	}
+	SECTION("packed requests are unpacked") {
+		GzipPacker packer;
+		auto request = mtpBuffer{ mtpPrime(kTestRequest), 12, 0 };
+		request.resize(4096);
+		std::fill(request.begin() + 3, request.end(), 0);
+		auto packed = mtpBuffer();
+		REQUIRE(packer.pack(
+			request.constData(),
+			request.constData() + request.size(),
+			packed));
+
+		auto done = false;
+		client->send(std::move(packed), [&](
+				const mtpPrime *from,
+				const mtpPrime *end) {
+			done = CheckTestResult(from, end, 12, 0);
+		});
+		ReceiveAll(client.get());
+		REQUIRE(done);
+		REQUIRE(dc->stats().gzippedRequests == 1);
+	}
+}
+
+TEST_CASE("fake dc secret", "[mtp_fake_dc]") {
+	auto secret = bytes::vector(17);
+	bytes::set_random(secret);
+	secret[0] = bytes::type(0xDD);
+
+	auto options = FakeDc::Options();
+	options.secret = secret;
+	const auto dc = StartFakeDc(std::move(options));
+
+	SECTION("padded intermediate with the secret works") {
+		const auto client = ConnectClient(dc.get(), secret);
+		auto done = false;
+		client->send(TestRequest(300, 1), [&](
+				const mtpPrime *from,
+				const mtpPrime *end) {
+			done = CheckTestResult(from, end, 300, 1);
+		});
+		ReceiveAll(client.get());
+		REQUIRE(done);
+	}
+	SECTION("abridged with the secret works") {
+		const auto stripped = bytes::vector(secret.begin() + 1, secret.end());
+		const auto client = ConnectClient(dc.get(), stripped);
+		auto done = false;
+		client->send(TestRequest(300, 1), [&](
+				const mtpPrime *from,
+				const mtpPrime *end) {
+			done = CheckTestResult(from, end, 300, 1);
+		});
+		ReceiveAll(client.get());
+		REQUIRE(done);
+	}
+	SECTION("wrong secret is rejected") {
+		FakeDcClient client(dc->port());
+		REQUIRE(client.connectToServer(kTimeout));
+		REQUIRE(!client.createAuthKey(dc->publicKey(), kTimeout));
+	}
+}
+
+TEST_CASE("fake dc benchmark", "[mtp_fake_dc]") {
+	if (DisableBenchmarkTests) {
+		return;
+	}
+	using namespace std::chrono;
+
+	const auto dc = StartFakeDc();
+	const auto client = ConnectClient(dc.get());
+
+	constexpr auto kTotal = 100000;
+	constexpr auto kInFlight = 4096;
+	constexpr auto kResultSize = 64;
+
+	auto sent = 0;
+	auto answered = 0;
+	auto durations = std::vector<int64>();
+	durations.reserve(kTotal);
+	const auto start = steady_clock::now();
+	while (answered < kTotal) {
+		while (sent < kTotal && sent - answered < kInFlight) {
+			const auto requested = steady_clock::now();
+			client->send(TestRequest(kResultSize, sent), [&, requested](
+					const mtpPrime *from,
+					const mtpPrime *end) {
+				durations.push_back(duration_cast<microseconds>(
+					steady_clock::now() - requested).count());
+				++answered;
+			});
+			++sent;
+		}
+		REQUIRE(client->flush());
+		REQUIRE(client->receive(kTimeout));
+	}
+	const auto ms = duration_cast<milliseconds>(
+		steady_clock::now() - start).count();
+	std::sort(begin(durations), end(durations));
+	const auto p50 = durations[durations.size() / 2];
+	const auto p99 = durations[durations.size() * 99 / 100];
+	const auto stats = dc->stats();
+	WARN("fake dc: "
+		<< kTotal << " requests in " << ms << " ms, "
+		<< (kTotal * 1000. / std::max(ms, decltype(ms)(1))) << " req/s, "
+		<< "p50 " << p50 << " us, p99 " << p99 << " us, "
+		<< stats.packets << " packets, "
+		<< stats.containers << " containers");
+}
+
+TEST_CASE("fake dc requests hand-off benchmark", "[mtp_fake_dc]") {
+	if (DisableBenchmarkTests) {
+		return;
+	}
+	using namespace std::chrono;
+
+	// Another thread adds requests one by one, like the main thread does
+	// in Session::sendPrepared(). This thread takes everything added so
+	// far before each packet, like ConnectionPrivate::tryToSend() does.
+	constexpr auto kTotal = 100000;
+	constexpr auto kResultSize = 4;
+
+	const auto dc = StartFakeDc();
+	const auto measure = [&](auto &&add, auto &&take, const char *name) {
+		const auto client = ConnectClient(dc.get());
+		auto answered = 0;
+		auto waitedAdd = int64();
+		const auto start = steady_clock::now();
+		auto adding = std::thread([&] {
+			for (auto i = 0; i != kTotal; ++i) {
+				const auto started = steady_clock::now();
+				add(i, TestRequest(kResultSize, i));
+				waitedAdd += duration_cast<nanoseconds>(
+					steady_clock::now() - started).count();
+			}
+		});
+		while (answered < kTotal) {
+			take([&](mtpBuffer &&request) {
+				client->send(std::move(request), [&](
+						const mtpPrime *from,
+						const mtpPrime *end) {
+					++answered;
+				});
+			});
+			REQUIRE(client->flush());
+			if (client->waiting() > 0) {
+				REQUIRE(client->receive(kTimeout));
+			} else {
+				std::this_thread::yield();
+			}
+		}
+		adding.join();
+		const auto ms = duration_cast<milliseconds>(
+			steady_clock::now() - start).count();
+		WARN(name
+			<< ": " << kTotal << " requests in " << ms << " ms, "
+			<< (kTotal * 1000. / std::max(ms, decltype(ms)(1))) << " req/s, "
+			<< (waitedAdd / kTotal) << " ns per add");
+	};
+
+	QMutex mutex;
+	auto locked = QMap<int, mtpBuffer>();
+	measure([&](int id, mtpBuffer &&request) {
+		QMutexLocker lock(&mutex);
+		locked.insert(id, std::move(request));
+	}, [&](auto &&send) {
+		auto taken = QMap<int, mtpBuffer>();
+		{
+			QMutexLocker lock(&mutex);
+			std::swap(taken, locked);
+		}
+		for (auto i = taken.begin(), e = taken.end(); i != e; ++i) {
+			send(std::move(i.value()));
+		}
+	}, "locked map");
+
+	base::mpsc_queue<mtpBuffer> queue;
+	measure([&](int id, mtpBuffer &&request) {
+		queue.push(std::move(request));
+	}, [&](auto &&send) {
+		while (auto request = queue.pop()) {
+			send(std::move(*request));
+		}
+	}, "mpsc queue");
+}
@@ -0,0 +1,266 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "mtproto/mtp_gzip.h"
+
+#include "zlib.h"
+
+namespace MTP {
+namespace internal {
+namespace {
+
+// Gzip header without optional fields and the trailer with crc and size.
+constexpr auto kGzipMinSize = 18;
+
+// Bytes field length is serialized in three bytes at most.
+constexpr auto kMaxBytesLength = 0xFFFFFF;
+
+// Don't trust the trailer more than this, it is only a size hint.
+constexpr auto kMaxSizeHint = 64 * 1024 * 1024;
+
+bool ReadBytes(
+		const mtpPrime *from,
+		const mtpPrime *end,
+		const uchar *&data,
+		int &length) {
+	if (from >= end) {
+		return false;
+	}
+	const auto start = reinterpret_cast<const uchar*>(from);
+	const auto available = (end - from) * sizeof(mtpPrime);
+	auto offset = 1;
+	if (start[0] < 254) {
+		length = start[0];
+	} else if (start[0] == 254) {
+		length = int(start[1])
+			| (int(start[2]) << 8)
+			| (int(start[3]) << 16);
+		offset = 4;
+	} else {
+		return false;
+	}
+	if (std::size_t(offset + length) > available) {
+		return false;
+	}
+	data = start + offset;
+	return true;
+}
+
+int UnpackedSizeHint(const uchar *data, int length) {
+	if (length < kGzipMinSize) {
+		return 0;
+	}
+	const auto trailer = data + length - 4;
+	const auto result = uint32(trailer[0])
+		| (uint32(trailer[1]) << 8)
+		| (uint32(trailer[2]) << 16)
+		| (uint32(trailer[3]) << 24);
+	return (result <= kMaxSizeHint) ? int(result) : 0;
+}
+
+} // namespace
+
+GzipUnpacker::GzipUnpacker() : _stream(std::make_unique<z_stream>()) {
+}
+
+GzipUnpacker::~GzipUnpacker() {
+	if (_initialized) {
+		inflateEnd(_stream.get());
+	}
+}
+
+bool GzipUnpacker::init() {
+	if (_initialized) {
+		_zlibCode = inflateReset(_stream.get());
+		return (_zlibCode == Z_OK);
+	}
+	_stream->zalloc = nullptr;
+	_stream->zfree = nullptr;
+	_stream->opaque = nullptr;
+	_stream->avail_in = 0;
+	_stream->next_in = nullptr;
+	_zlibCode = inflateInit2(_stream.get(), 16 + MAX_WBITS);
+	_initialized = (_zlibCode == Z_OK);
+	return _initialized;
+}
+
+void GzipUnpacker::grow(mtpBuffer &result, int size) {
+	const auto capacity = result.capacity();
+	result.resize(size);
+	if (result.capacity() != capacity) {
+		++_allocations;
+	}
+}
+
+GzipError GzipUnpacker::unpack(
+		const mtpPrime *from,
+		const mtpPrime *end,
+		mtpBuffer &result) {
+	result.resize(0);
+
+	auto packed = (const uchar*)nullptr;
+	auto packedLength = 0;
+	if (!ReadBytes(from, end, packed, packedLength)) {
+		return GzipError::BadPacked;
+	} else if (!init()) {
+		return GzipError::InitFailed;
+	}
+
+	// One more word, so that the end of the stream is always seen
+	// with some output space left and without a second round.
+	const auto hint = UnpackedSizeHint(packed, packedLength);
+	const auto expected = hint ? hint : (packedLength * 4);
+	grow(result, expected / sizeof(mtpPrime) + 1);
+
+	_stream->next_in = const_cast<Bytef*>(packed);
+	_stream->avail_in = packedLength;
+	_stream->next_out = reinterpret_cast<Bytef*>(result.data());
+	_stream->avail_out = result.size() * sizeof(mtpPrime);
+	while (true) {
+		const auto code = inflate(_stream.get(), Z_NO_FLUSH);
+		if (code == Z_STREAM_END) {
+			break;
+		} else if ((code != Z_OK && code != Z_BUF_ERROR)
+			|| _stream->avail_out) {
+			// Either an error or all the input is consumed too early.
+			_zlibCode = code;
+			result.resize(0);
+			return GzipError::InflateFailed;
+		}
+		const auto written = result.size();
+		grow(result, written * 2);
+		_stream->next_out = reinterpret_cast<Bytef*>(result.data() + written);
+		_stream->avail_out = (result.size() - written) * sizeof(mtpPrime);
+	}
+	const auto size = result.size() * sizeof(mtpPrime) - _stream->avail_out;
+	if (!size || (size % sizeof(mtpPrime))) {
+		result.resize(0);
+		return GzipError::BadLength;
+	}
+	result.resize(size / sizeof(mtpPrime));
+	return GzipError::None;
+}
+
+GzipPacker::GzipPacker() : _stream(std::make_unique<z_stream>()) {
+}
+
+GzipPacker::~GzipPacker() {
+	if (_initialized) {
+		deflateEnd(_stream.get());
+	}
+}
+
+bool GzipPacker::init() {
+	if (_initialized) {
+		_zlibCode = deflateReset(_stream.get());
+		return (_zlibCode == Z_OK);
+	}
+	_stream->zalloc = nullptr;
+	_stream->zfree = nullptr;
+	_stream->opaque = nullptr;
+	_zlibCode = deflateInit2(
+		_stream.get(),
+		Z_DEFAULT_COMPRESSION,
+		Z_DEFLATED,
+		16 + MAX_WBITS,
+		8,
+		Z_DEFAULT_STRATEGY);
+	_initialized = (_zlibCode == Z_OK);
+	return _initialized;
+}
+
+bool GzipPacker::pack(
+		const mtpPrime *from,
+		const mtpPrime *end,
+		mtpBuffer &result) {
+	result.resize(0);
+
+	// gzip_packed constructor and four bytes of length go first.
+	const auto words = int(end - from);
+	if (words * sizeof(mtpPrime) <= 2 * sizeof(mtpPrime) + kGzipMinSize) {
+		return false;
+	} else if (!init()) {
+		return false;
+	}
+
+	// Any finished stream that fits here makes the request smaller.
+	const auto available = std::min(
+		(words - 3) * int(sizeof(mtpPrime)),
+		kMaxBytesLength);
+	result.resize(words - 1);
+	const auto bytes = reinterpret_cast<uchar*>(result.data() + 1);
+	_stream->next_in = reinterpret_cast<Bytef*>(const_cast<mtpPrime*>(from));
+	_stream->avail_in = words * sizeof(mtpPrime);
+	_stream->next_out = bytes + 4;
+	_stream->avail_out = available;
+	const auto code = deflate(_stream.get(), Z_FINISH);
+	if (code != Z_STREAM_END) {
+		// Either an error or the output space is over, no gain anyway.
+		_zlibCode = code;
+		result.resize(0);
+		return false;
+	}
+	const auto length = available - int(_stream->avail_out);
+	auto offset = 1;
+	if (length < 254) {
+		bytes[0] = uchar(length);
+		memmove(bytes + 1, bytes + 4, length);
+	} else {
+		bytes[0] = uchar(254);
+		bytes[1] = uchar(length & 0xFF);
+		bytes[2] = uchar((length >> 8) & 0xFF);
+		bytes[3] = uchar((length >> 16) & 0xFF);
+		offset = 4;
+	}
+	const auto padded = (offset + length + 3) / int(sizeof(mtpPrime));
+	memset(
+		bytes + offset + length,
+		0,
+		padded * sizeof(mtpPrime) - offset - length);
+	result[0] = mtpc_gzip_packed;
+	result.resize(1 + padded);
+	return true;
+}
+
+bool GzipPacker::packMessage(
+		const mtpBuffer &message,
+		uint32 threshold,
+		mtpBuffer &result) {
+	constexpr auto kBodyPosition = SecureRequest::kMessageBodyPosition;
+	constexpr auto kLengthPosition = SecureRequest::kMessageLengthPosition;
+	constexpr auto kMessageIdPosition = SecureRequest::kSaltInts
+		+ SecureRequest::kSessionIdInts;
+
+	if (!threshold || message.size() <= kBodyPosition) {
+		return false;
+	}
+	const auto length = uint32(message[kLengthPosition]);
+	const auto from = message.constData() + kBodyPosition;
+	const auto msgId = *reinterpret_cast<const mtpMsgId*>(
+		message.constData() + kMessageIdPosition);
+	if (length < threshold
+		|| (length >> 2) > uint32(message.size() - kBodyPosition)
+		|| msgId
+		|| mtpTypeId(*from) == mtpc_gzip_packed
+		|| !pack(from, from + (length >> 2), _packed)) {
+		return false;
+	}
+	result.resize(kBodyPosition + _packed.size());
+	memcpy(
+		result.data(),
+		message.constData(),
+		kBodyPosition * sizeof(mtpPrime));
+	memcpy(
+		result.data() + kBodyPosition,
+		_packed.constData(),
+		_packed.size() * sizeof(mtpPrime));
+	result[kLengthPosition] = mtpPrime(_packed.size() * sizeof(mtpPrime));
+	return true;
+}
+
+} // namespace internal
+} // namespace MTP
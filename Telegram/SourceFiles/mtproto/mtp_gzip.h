@@ -0,0 +1,121 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "mtproto/core_types.h"
+
+struct z_stream_s;
+
+namespace MTP {
+
+// Outgoing requests sent wrapped in gzip_packed, counted per data center.
+struct GzipPackStats {
+	int64 requests = 0;
+	int64 originalBytes = 0;
+	int64 packedBytes = 0;
+
+	int64 savedBytes() const {
+		return originalBytes - packedBytes;
+	}
+};
+
+namespace internal {
+
+enum class GzipError {
+	None,
+	BadPacked,
+	InitFailed,
+	InflateFailed,
+	BadLength,
+};
+
+// Inflates gzip_packed contents right from the received buffer.
+//
+// The zlib context is created once and reset for each message, the
+// output size is taken from the gzip trailer, so usually the result
+// is allocated once (or not at all, if the caller reuses it).
+class GzipUnpacker {
+public:
+	GzipUnpacker();
+	GzipUnpacker(const GzipUnpacker &other) = delete;
+	GzipUnpacker &operator=(const GzipUnpacker &other) = delete;
+	~GzipUnpacker();
+
+	// [from, end) is the serialized bytes field following gzip_packed.
+	[[nodiscard]] GzipError unpack(
+		const mtpPrime *from,
+		const mtpPrime *end,
+		mtpBuffer &result);
+
+	// zlib result code of the last failed call.
+	int zlibCode() const {
+		return _zlibCode;
+	}
+
+	// How many times the result buffers had to be (re)allocated.
+	int64 allocations() const {
+		return _allocations;
+	}
+
+private:
+	bool init();
+	void grow(mtpBuffer &result, int size);
+
+	std::unique_ptr<z_stream_s> _stream;
+	bool _initialized = false;
+	int _zlibCode = 0;
+	int64 _allocations = 0;
+
+};
+
+// Deflates request bodies into gzip_packed for sending.
+//
+// The zlib context is created once and reset for each request. The
+// output space is limited by the original size, so a request that
+// doesn't compress well is given up as soon as it is clear.
+class GzipPacker {
+public:
+	GzipPacker();
+	GzipPacker(const GzipPacker &other) = delete;
+	GzipPacker &operator=(const GzipPacker &other) = delete;
+	~GzipPacker();
+
+	// [from, end) is a serialized request, the result is gzip_packed
+	// with the deflated request inside. Returns false and leaves the
+	// result empty if the packed request wouldn't be smaller.
+	[[nodiscard]] bool pack(
+		const mtpPrime *from,
+		const mtpPrime *end,
+		mtpBuffer &result);
+
+	// message is serialized like SecureRequest data. If its body is at
+	// least threshold bytes long and packs smaller, the result gets the
+	// same header with the packed body and its length. A message with
+	// msg_id already set is resent, it must go the way it was sent.
+	[[nodiscard]] bool packMessage(
+		const mtpBuffer &message,
+		uint32 threshold,
+		mtpBuffer &result);
+
+	// zlib result code of the last failed call.
+	int zlibCode() const {
+		return _zlibCode;
+	}
+
+private:
+	bool init();
+
+	std::unique_ptr<z_stream_s> _stream;
+	bool _initialized = false;
+	int _zlibCode = 0;
+	mtpBuffer _packed; // reused for packMessage()
+
+};
+
+} // namespace internal
+} // namespace MTP
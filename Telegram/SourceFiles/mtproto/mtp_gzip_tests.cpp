@@ -0,0 +1,368 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "mtproto/mtp_gzip.h"
+#include "zlib.h"
+#include <chrono>
+#include <random>
+
+using namespace MTP::internal;
+
+const auto DisableBenchmarkTests = true;
+
+namespace {
+
+// Something like a vector of messages: ids, dates and repeated texts.
+mtpBuffer GenerateResponse(int count, int seed) {
+	auto engine = std::mt19937(seed);
+	auto result = mtpBuffer();
+	result.reserve(count * 24);
+	for (auto i = 0; i != count; ++i) {
+		result.push_back(0x44f9b43d);
+		result.push_back(seed + i);
+		result.push_back(1500000000 + i * 7);
+		result.push_back(int(engine() % 16));
+		for (auto j = 0; j != 16; ++j) {
+			result.push_back(0x20746f6e + (i % 3) + (j % 5));
+		}
+	}
+	return result;
+}
+
+QByteArray Gzip(const char *data, int size) {
+	auto stream = z_stream();
+	REQUIRE(deflateInit2(
+		&stream,
+		Z_DEFAULT_COMPRESSION,
+		Z_DEFLATED,
+		16 + MAX_WBITS,
+		8,
+		Z_DEFAULT_STRATEGY) == Z_OK);
+	auto result = QByteArray(int(deflateBound(&stream, size)), Qt::Uninitialized);
+	stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+	stream.avail_in = size;
+	stream.next_out = reinterpret_cast<Bytef*>(result.data());
+	stream.avail_out = result.size();
+	REQUIRE(deflate(&stream, Z_FINISH) == Z_STREAM_END);
+	result.resize(result.size() - stream.avail_out);
+	deflateEnd(&stream);
+	return result;
+}
+
+// Serializes the bytes field the way gzip_packed carries it.
+mtpBuffer PackedBytes(const QByteArray &bytes) {
+	auto serialized = QByteArray();
+	if (bytes.size() < 254) {
+		serialized.append(char(bytes.size()));
+	} else {
+		serialized.append(char(254));
+		serialized.append(char(bytes.size() & 0xFF));
+		serialized.append(char((bytes.size() >> 8) & 0xFF));
+		serialized.append(char((bytes.size() >> 16) & 0xFF));
+	}
+	serialized.append(bytes);
+	while (serialized.size() % sizeof(mtpPrime)) {
+		serialized.append(char(0));
+	}
+	auto result = mtpBuffer(serialized.size() / sizeof(mtpPrime));
+	memcpy(result.data(), serialized.constData(), serialized.size());
+	return result;
+}
+
+// Serializes a message the way SecureRequest keeps it before sending.
+mtpBuffer Message(const mtpBuffer &body, mtpMsgId msgId = 0) {
+	using MTP::SecureRequest;
+	auto result = mtpBuffer(SecureRequest::kMessageBodyPosition);
+	result[0] = 0x01020304; // salt
+	result[1] = 0x05060708;
+	result[2] = 0x11121314; // session id
+	result[3] = 0x15161718;
+	*reinterpret_cast<mtpMsgId*>(result.data() + 4) = msgId;
+	result[SecureRequest::kSeqNoPosition] = msgId ? 3 : 0;
+	result[SecureRequest::kMessageLengthPosition] = body.size()
+		* sizeof(mtpPrime);
+	result.append(body);
+	return result;
+}
+
+mtpBuffer Packed(const mtpBuffer &response) {
+	return PackedBytes(Gzip(
+		reinterpret_cast<const char*>(response.constData()),
+		response.size() * sizeof(mtpPrime)));
+}
+
+// The previous implementation: copy the bytes out and grow the result
+// by the packed length on each inflate round.
+mtpBuffer LegacyUngzip(
+		const mtpPrime *from,
+		const mtpPrime *end,
+		int64 &allocations) {
+	REQUIRE(from < end);
+	const auto start = reinterpret_cast<const uchar*>(from);
+	const auto offset = (start[0] < 254) ? 1 : 4;
+	const auto length = (start[0] < 254)
+		? int(start[0])
+		: (int(start[1]) | (int(start[2]) << 8) | (int(start[3]) << 16));
+	const auto packed = QByteArray(
+		reinterpret_cast<const char*>(start + offset),
+		length);
+	++allocations;
+
+	auto result = mtpBuffer();
+	const auto chunk = (length + 3) / 4;
+	auto stream = z_stream();
+	REQUIRE(inflateInit2(&stream, 16 + MAX_WBITS) == Z_OK);
+	stream.avail_in = length;
+	stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(
+		packed.constData()));
+	stream.avail_out = 0;
+	while (!stream.avail_out) {
+		result.resize(result.size() + chunk);
+		++allocations;
+		stream.avail_out = chunk * sizeof(mtpPrime);
+		stream.next_out = (Bytef*)&result[result.size() - chunk];
+		const auto code = inflate(&stream, Z_NO_FLUSH);
+		REQUIRE((code == Z_OK || code == Z_STREAM_END));
+	}
+	result.resize(result.size() - (stream.avail_out >> 2));
+	inflateEnd(&stream);
+	return result;
+}
+
+} // namespace
+
+TEST_CASE("gzip_packed unpacking", "[mtp_gzip]") {
+	auto unpacker = GzipUnpacker();
+	auto result = mtpBuffer();
+
+	SECTION("small and large responses are unpacked") {
+		for (const auto count : { 1, 10, 1000, 20000 }) {
+			const auto response = GenerateResponse(count, count);
+			const auto packed = Packed(response);
+			REQUIRE(unpacker.unpack(
+				packed.constData(),
+				packed.constData() + packed.size(),
+				result) == GzipError::None);
+			REQUIRE(result == response);
+		}
+	}
+	SECTION("buffer is reused for the next response") {
+		const auto packed = Packed(GenerateResponse(1000, 1));
+		REQUIRE(unpacker.unpack(
+			packed.constData(),
+			packed.constData() + packed.size(),
+			result) == GzipError::None);
+		const auto allocations = unpacker.allocations();
+		REQUIRE(allocations == 1);
+		for (auto i = 0; i != 10; ++i) {
+			REQUIRE(unpacker.unpack(
+				packed.constData(),
+				packed.constData() + packed.size(),
+				result) == GzipError::None);
+		}
+		REQUIRE(unpacker.allocations() == allocations);
+	}
+	SECTION("broken data is rejected") {
+		const auto response = GenerateResponse(100, 3);
+		auto packed = Packed(response);
+		REQUIRE(unpacker.unpack(
+			packed.constData(),
+			packed.constData() + 1,
+			result) == GzipError::BadPacked);
+
+		packed[packed.size() / 2] ^= 0x5A5A5A5A;
+		REQUIRE(unpacker.unpack(
+			packed.constData(),
+			packed.constData() + packed.size(),
+			result) == GzipError::InflateFailed);
+		REQUIRE(result.isEmpty());
+
+		const auto good = Packed(response);
+		REQUIRE(unpacker.unpack(
+			good.constData(),
+			good.constData() + good.size(),
+			result) == GzipError::None);
+		REQUIRE(result == response);
+	}
+	SECTION("unaligned unpacked data is rejected") {
+		const auto data = QByteArray(7, 'a');
+		const auto packed = PackedBytes(Gzip(data.constData(), data.size()));
+		REQUIRE(unpacker.unpack(
+			packed.constData(),
+			packed.constData() + packed.size(),
+			result) == GzipError::BadLength);
+	}
+}
+
+TEST_CASE("gzip_packed packing", "[mtp_gzip]") {
+	auto packer = GzipPacker();
+	auto unpacker = GzipUnpacker();
+	auto packed = mtpBuffer();
+	auto result = mtpBuffer();
+
+	SECTION("compressible requests are packed and unpacked back") {
+		for (const auto count : { 1, 10, 1000, 20000 }) {
+			const auto request = GenerateResponse(count, count);
+			REQUIRE(packer.pack(
+				request.constData(),
+				request.constData() + request.size(),
+				packed));
+			REQUIRE(packed.size() < request.size());
+			REQUIRE(mtpTypeId(packed[0]) == mtpc_gzip_packed);
+			REQUIRE(unpacker.unpack(
+				packed.constData() + 1,
+				packed.constData() + packed.size(),
+				result) == GzipError::None);
+			REQUIRE(result == request);
+		}
+	}
+	SECTION("requests that don't shrink are left as is") {
+		auto engine = std::mt19937(5);
+		auto request = mtpBuffer();
+		for (auto i = 0; i != 1000; ++i) {
+			request.push_back(mtpPrime(engine()));
+		}
+		REQUIRE(!packer.pack(
+			request.constData(),
+			request.constData() + request.size(),
+			packed));
+		REQUIRE(packed.isEmpty());
+
+		const auto tiny = GenerateResponse(1, 1).mid(0, 4);
+		REQUIRE(!packer.pack(
+			tiny.constData(),
+			tiny.constData() + tiny.size(),
+			packed));
+
+		const auto good = GenerateResponse(100, 1);
+		REQUIRE(packer.pack(
+			good.constData(),
+			good.constData() + good.size(),
+			packed));
+	}
+}
+
+TEST_CASE("gzip_packed messages packing", "[mtp_gzip]") {
+	using MTP::SecureRequest;
+	constexpr auto kBodyPosition = SecureRequest::kMessageBodyPosition;
+	constexpr auto kLengthPosition = SecureRequest::kMessageLengthPosition;
+
+	auto packer = GzipPacker();
+	auto unpacker = GzipUnpacker();
+	auto packed = mtpBuffer();
+	auto result = mtpBuffer();
+	const auto body = GenerateResponse(1000, 7);
+	const auto message = Message(body);
+	const auto length = uint32(body.size() * sizeof(mtpPrime));
+
+	SECTION("large message is packed to a new buffer") {
+		const auto original = message;
+		REQUIRE(packer.packMessage(message, length, packed));
+		REQUIRE(message == original);
+		REQUIRE(packed.size() > kBodyPosition + 1);
+		REQUIRE(packed.size() < message.size());
+		REQUIRE(packed.mid(0, kLengthPosition)
+			== message.mid(0, kLengthPosition));
+		REQUIRE(uint32(packed[kLengthPosition])
+			== (packed.size() - kBodyPosition) * sizeof(mtpPrime));
+		REQUIRE(mtpTypeId(packed[kBodyPosition]) == mtpc_gzip_packed);
+		REQUIRE(unpacker.unpack(
+			packed.constData() + kBodyPosition + 1,
+			packed.constData() + packed.size(),
+			result) == GzipError::None);
+		REQUIRE(result == body);
+	}
+	SECTION("padded message is packed by its length field") {
+		auto padded = message;
+		padded.append(mtpBuffer(3, 0x7a7a7a7a));
+		REQUIRE(packer.packMessage(padded, length, packed));
+		REQUIRE(unpacker.unpack(
+			packed.constData() + kBodyPosition + 1,
+			packed.constData() + packed.size(),
+			result) == GzipError::None);
+		REQUIRE(result == body);
+	}
+	SECTION("small message is left as is") {
+		REQUIRE(!packer.packMessage(message, 0, packed));
+		REQUIRE(!packer.packMessage(message, length + 1, packed));
+	}
+	SECTION("resent message is left as is") {
+		const auto resent = Message(body, 0x5000000000000004ULL);
+		REQUIRE(!packer.packMessage(resent, length, packed));
+	}
+	SECTION("packed message is not packed again") {
+		REQUIRE(packer.packMessage(message, length, packed));
+		auto again = mtpBuffer();
+		REQUIRE(!packer.packMessage(packed, 1, again));
+	}
+	SECTION("broken length field is not trusted") {
+		auto broken = message;
+		broken[kLengthPosition] = length + sizeof(mtpPrime);
+		REQUIRE(!packer.packMessage(broken, 1, packed));
+	}
+}
+
+TEST_CASE("gzip_packed unpacking benchmark", "[mtp_gzip]") {
+	if (DisableBenchmarkTests) {
+		return;
+	}
+	auto packed = std::vector<mtpBuffer>();
+	auto unpackedSize = int64();
+	for (auto i = 0; i != 64; ++i) {
+		const auto response = GenerateResponse(500 + i * 500, i);
+		unpackedSize += response.size() * sizeof(mtpPrime);
+		packed.push_back(Packed(response));
+	}
+	const auto rounds = 20;
+	const auto measure = [&](auto &&unpack, const char *name) {
+		auto allocations = int64();
+		const auto start = std::chrono::steady_clock::now();
+		for (auto i = 0; i != rounds; ++i) {
+			for (const auto &buffer : packed) {
+				unpack(buffer, allocations);
+			}
+		}
+		const auto elapsed = std::chrono::steady_clock::now() - start;
+		const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+			elapsed).count();
+		WARN(name
+			<< ": "
+			<< (ms ? (unpackedSize * rounds / 1024 / ms) * 1000 / 1024 : 0)
+			<< " MB/s, "
+			<< (double(allocations) / (rounds * packed.size()))
+			<< " allocations per message");
+	};
+	measure([](const mtpBuffer &buffer, int64 &allocations) {
+		const auto result = LegacyUngzip(
+			buffer.constData(),
+			buffer.constData() + buffer.size(),
+			allocations);
+		REQUIRE(!result.isEmpty());
+	}, "copy and grow");
+
+	auto unpacker = GzipUnpacker();
+	measure([&](const mtpBuffer &buffer, int64 &allocations) {
+		auto result = mtpBuffer();
+		REQUIRE(unpacker.unpack(
+			buffer.constData(),
+			buffer.constData() + buffer.size(),
+			result) == GzipError::None);
+		allocations = unpacker.allocations();
+	}, "gzip unpacker");
+
+	auto reused = mtpBuffer();
+	auto pooled = GzipUnpacker();
+	measure([&](const mtpBuffer &buffer, int64 &allocations) {
+		REQUIRE(pooled.unpack(
+			buffer.constData(),
+			buffer.constData() + buffer.size(),
+			reused) == GzipError::None);
+		allocations = pooled.allocations();
+	}, "gzip unpacker with a reused buffer");
+}
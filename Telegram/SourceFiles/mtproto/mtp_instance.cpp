@@ -64,6 +64,11 @@ public:
 	void badConfigurationError();
 	void syncHttpUnixtime();
 
+	void setGzipPackThreshold(int bytes);
+	[[nodiscard]] int gzipPackThreshold() const;
+	[[nodiscard]] GzipPackStats gzipPackStats(DcId dcId) const;
+	[[nodiscard]] ReceiveStats receiveStats(DcId dcId) const;
+
 	void restart();
 	void restart(ShiftedDcId shiftedDcId);
 	[[nodiscard]] int32 dcstate(ShiftedDcId shiftedDcId = 0);
@@ -178,6 +183,7 @@ private:
 
 	QString _deviceModel;
 	QString _systemVersion;
+	int _gzipPackThreshold = 0;
 
 	internal::Session *_mainSession = nullptr;
 	std::map<ShiftedDcId, std::unique_ptr<internal::Session>> _sessions;
@@ -734,6 +740,30 @@ QString Instance::Private::systemVersion() const {
 	return _systemVersion;
 }
 
+void Instance::Private::setGzipPackThreshold(int bytes) {
+	if (_gzipPackThreshold == bytes) {
+		return;
+	}
+	_gzipPackThreshold = bytes;
+	for (auto &session : _sessions) {
+		session.second->refreshOptions();
+	}
+}
+
+int Instance::Private::gzipPackThreshold() const {
+	return _gzipPackThreshold;
+}
+
+GzipPackStats Instance::Private::gzipPackStats(DcId dcId) const {
+	const auto i = _dcenters.find(BareDcId(dcId));
+	return (i != _dcenters.end()) ? i->second->gzipPackStats() : GzipPackStats();
+}
+
+ReceiveStats Instance::Private::receiveStats(DcId dcId) const {
+	const auto i = _dcenters.find(BareDcId(dcId));
+	return (i != _dcenters.end()) ? i->second->receiveStats() : ReceiveStats();
+}
+
 void Instance::Private::unpaused() {
 	for (auto &session : _sessions) {
 		session.second->unpaused();
@@ -1682,6 +1712,22 @@ QString Instance::systemVersion() const {
 	return _private->systemVersion();
 }
 
+void Instance::setGzipPackThreshold(int bytes) {
+	_private->setGzipPackThreshold(bytes);
+}
+
+int Instance::gzipPackThreshold() const {
+	return _private->gzipPackThreshold();
+}
+
+GzipPackStats Instance::gzipPackStats(DcId dcId) const {
+	return _private->gzipPackStats(dcId);
+}
+
+ReceiveStats Instance::receiveStats(DcId dcId) const {
+	return _private->receiveStats(dcId);
+}
+
 void Instance::unpaused() {
 	_private->unpaused();
 }
@@ -10,8 +10,12 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include <map>
 #include <set>
 #include "mtproto/rpc_sender.h"
+#include "mtproto/mtp_gzip.h"
 
 namespace MTP {
+
+struct ReceiveStats;
+
 namespace internal {
 class Dcenter;
 class Session;
@@ -182,6 +186,22 @@ public:
 
 	void syncHttpUnixtime();
 
+	// Requests with bodies of at least this many bytes are sent packed
+	// with gzip_packed if it makes them smaller, 0 turns packing off.
+	// The options of all the sessions are updated, each connection uses
+	// the new value after it connects to the server again.
+	//
+	// Off by default: large requests are mostly file parts of already
+	// compressed media, deflating them would be wasted before each send.
+	void setGzipPackThreshold(int bytes);
+	[[nodiscard]] int gzipPackThreshold() const;
+
+	// Bytes saved on outgoing requests by packing them, for a dc.
+	[[nodiscard]] GzipPackStats gzipPackStats(DcId dcId) const;
+
+	// Received packets and bytes copied before handling them, for a dc.
+	[[nodiscard]] ReceiveStats receiveStats(DcId dcId) const;
+
 	~Instance();
 
 public slots:
@@ -0,0 +1,162 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "mtproto/mtp_tcp_read_buffer.h"
+
+#include "mtproto/core_types.h"
+
+namespace MTP {
+namespace internal {
+namespace {
+
+constexpr auto kPacketAlignment = int(alignof(mtpPrime));
+
+} // namespace
+
+TcpReadBuffer::TcpReadBuffer(int smallSize)
+: _smallSize(smallSize) {
+	Expects(_smallSize >= kMinPacketBuffer);
+}
+
+bytes::vector &TcpReadBuffer::buffer() {
+	return _usingLargeBuffer ? _largeBuffer : _smallBuffer;
+}
+
+bytes::span TcpReadBuffer::prepareRead() {
+	Expects(_leftBytes > 0 || !_usingLargeBuffer);
+
+	if (_smallBuffer.empty()) {
+		_smallBuffer.resize(_smallSize);
+	}
+	const auto readLimit = (_leftBytes > 0)
+		? _leftBytes
+		: (_smallSize - _offsetBytes - _readBytes);
+	Assert(readLimit > 0);
+
+	return bytes::make_span(buffer()).subspan(
+		_offsetBytes + _readBytes,
+		readLimit);
+}
+
+auto TcpReadBuffer::received(
+		int count,
+		const ReadLength &readLength,
+		const ReadHeaderSize &readHeaderSize,
+		const Packet &packet) -> Result {
+	Expects(count > 0);
+
+	_readBytes += count;
+	if (_leftBytes > 0) {
+		Assert(count <= _leftBytes);
+
+		_leftBytes -= count;
+		if (_leftBytes > 0) {
+			return Result::Partial;
+		}
+		const auto full = bytes::make_span(buffer()).subspan(
+			_offsetBytes,
+			_readBytes);
+		if (!packet(full)) {
+			return Result::Stopped;
+		}
+		_usingLargeBuffer = false;
+		_largeBuffer.clear();
+		_offsetBytes = _readBytes = 0;
+		return Result::Complete;
+	}
+	while (_readBytes > 0) {
+		const auto available = bytes::make_span(buffer()).subspan(
+			_offsetBytes,
+			_readBytes);
+		const auto packetSize = readLength(available);
+		if (packetSize == kUnknownSize) {
+			// Not enough bytes yet.
+			break;
+		} else if (packetSize <= 0) {
+			return Result::BadLength;
+		} else if (available.size() >= packetSize) {
+			if (!packet(available.subspan(0, packetSize))) {
+				return Result::Stopped;
+			}
+			_offsetBytes += packetSize;
+			_readBytes -= packetSize;
+
+			// If we have too little space left in the buffer.
+			// The rest of the bytes may be moved here.
+			ensureAvailable(kMinPacketBuffer);
+		} else {
+			_leftBytes = packetSize - available.size();
+
+			// If the next packet won't fit in the buffer or its payload
+			// won't be aligned. Only the first part of the packet is
+			// moved, if it is needed.
+			ensureAvailable(packetSize, readHeaderSize(available));
+			return Result::Partial;
+		}
+	}
+	return Result::Complete;
+}
+
+void TcpReadBuffer::ensureAvailable(int amount, int headerSize) {
+	const auto full = bytes::make_span(buffer()).subspan(_offsetBytes);
+
+	// Packet payload should start aligned to be handled in place.
+	const auto shift = headerSize
+		? ((kPacketAlignment - (headerSize % kPacketAlignment))
+			% kPacketAlignment)
+		: 0;
+	const auto aligned = !headerSize
+		|| ((_offsetBytes + headerSize) % kPacketAlignment == 0);
+	if (full.size() >= amount && aligned) {
+		return;
+	}
+	const auto read = full.subspan(0, _readBytes);
+	const auto required = shift + amount;
+	if (required <= _smallBuffer.size()) {
+		const auto destination = bytes::make_span(_smallBuffer).subspan(
+			shift);
+		if (_usingLargeBuffer) {
+			bytes::copy(destination, read);
+			_usingLargeBuffer = false;
+			_largeBuffer.clear();
+		} else {
+			bytes::move(destination, read);
+		}
+	} else if (required <= _largeBuffer.size()) {
+		Assert(_usingLargeBuffer);
+		bytes::move(bytes::make_span(_largeBuffer).subspan(shift), read);
+	} else {
+		auto enough = bytes::vector(required);
+		bytes::copy(bytes::make_span(enough).subspan(shift), read);
+		_largeBuffer = std::move(enough);
+		_usingLargeBuffer = true;
+	}
+	_offsetBytes = shift;
+	_copiedBytes += read.size();
+}
+
+bytes::span TcpReadBuffer::alignPacket(bytes::span packet) {
+	const auto misalignment = int(
+		reinterpret_cast<std::uintptr_t>(packet.data()) % kPacketAlignment);
+	if (!misalignment) {
+		return packet;
+	}
+	// Bytes before the packet are its header and already handled packets.
+	auto &buffer = this->buffer();
+	const auto offset = int(packet.data() - buffer.data());
+	Assert(offset >= misalignment);
+
+	const auto result = bytes::make_span(buffer).subspan(
+		offset - misalignment,
+		packet.size());
+	bytes::move(result, packet);
+	_copiedBytes += packet.size();
+	return result;
+}
+
+} // namespace internal
+} // namespace MTP
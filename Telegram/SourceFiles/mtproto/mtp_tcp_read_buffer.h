@@ -0,0 +1,87 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "base/algorithm.h"
+#include "base/basic_types.h"
+#include "base/bytes.h"
+
+namespace MTP {
+namespace internal {
+
+// Socket read buffer of TcpConnection, split into framed packets.
+//
+// The bytes are read to a small buffer, a larger one is allocated only
+// for a packet that doesn't fit. Complete packets are handed out right
+// from the buffer, the first part of an incomplete packet is moved so
+// that the payload after its length header starts aligned to mtpPrime.
+class TcpReadBuffer final {
+public:
+	static constexpr auto kDefaultSmallSize = 256 * 1024;
+	static constexpr auto kMinPacketBuffer = 256;
+
+	// Return kUnknownSize if more bytes are needed.
+	static constexpr auto kUnknownSize = -1;
+	using ReadLength = Fn<int(bytes::const_span bytes)>;
+	using ReadHeaderSize = Fn<int(bytes::const_span bytes)>;
+
+	// Returns false if the reading should stop.
+	using Packet = Fn<bool(bytes::span bytes)>;
+
+	enum class Result {
+		Complete,
+		Partial,
+		BadLength,
+		Stopped,
+	};
+
+	explicit TcpReadBuffer(int smallSize = kDefaultSmallSize);
+
+	// Place for the next socket read, the read bytes should be
+	// decrypted right there and passed to received().
+	[[nodiscard]] bytes::span prepareRead();
+	[[nodiscard]] Result received(
+		int count,
+		const ReadLength &readLength,
+		const ReadHeaderSize &readHeaderSize,
+		const Packet &packet);
+
+	// Moves a misaligned payload of a packet handed out in received()
+	// back by a few bytes, over its own header.
+	[[nodiscard]] bytes::span alignPacket(bytes::span packet);
+
+	[[nodiscard]] int leftBytes() const {
+		return _leftBytes;
+	}
+	[[nodiscard]] int readBytes() const {
+		return _readBytes;
+	}
+	[[nodiscard]] bool usingLargeBuffer() const {
+		return _usingLargeBuffer;
+	}
+	[[nodiscard]] int64 takeCopiedBytes() {
+		return base::take(_copiedBytes);
+	}
+
+private:
+	[[nodiscard]] bytes::vector &buffer();
+	void ensureAvailable(int amount, int headerSize = 0);
+
+	const int _smallSize = 0;
+	int _offsetBytes = 0;
+	int _readBytes = 0;
+	int _leftBytes = 0;
+	bytes::vector _smallBuffer;
+	bytes::vector _largeBuffer;
+	bool _usingLargeBuffer = false;
+	int64 _copiedBytes = 0;
+
+};
+
+} // namespace internal
+} // namespace MTP
@@ -0,0 +1,211 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "mtproto/mtp_tcp_read_buffer.h"
+#include <algorithm>
+#include <random>
+
+using namespace MTP::internal;
+
+namespace {
+
+constexpr auto kSmallSize = 1024;
+constexpr auto kInvalidSize = -2;
+
+// The abridged framing: the length in ints in one byte,
+// or 0x7F and the length in the next three bytes.
+int ReadLength(bytes::const_span bytes) {
+	if (bytes.empty()) {
+		return TcpReadBuffer::kUnknownSize;
+	}
+	const auto first = static_cast<uchar>(bytes[0]);
+	if (first == 0x7F) {
+		if (bytes.size() < 4) {
+			return TcpReadBuffer::kUnknownSize;
+		}
+		const auto ints = int(static_cast<uchar>(bytes[1]))
+			| (int(static_cast<uchar>(bytes[2])) << 8)
+			| (int(static_cast<uchar>(bytes[3])) << 16);
+		return 4 + ints * 4;
+	}
+	return (first > 0 && first < 0x7F) ? (1 + first * 4) : kInvalidSize;
+}
+
+int ReadHeaderSize(bytes::const_span bytes) {
+	return (static_cast<uchar>(bytes[0]) == 0x7F) ? 4 : 1;
+}
+
+bytes::vector Payload(int ints, int seed) {
+	auto result = bytes::vector(ints * 4);
+	for (auto i = 0; i != result.size(); ++i) {
+		result[i] = bytes::type((seed * 7 + i) % 251);
+	}
+	return result;
+}
+
+void AppendFramed(bytes::vector &to, const bytes::vector &payload) {
+	const auto ints = int(payload.size() / 4);
+	if (ints < 0x7F) {
+		to.push_back(bytes::type(ints));
+	} else {
+		to.push_back(bytes::type(0x7F));
+		to.push_back(bytes::type(ints & 0xFF));
+		to.push_back(bytes::type((ints >> 8) & 0xFF));
+		to.push_back(bytes::type((ints >> 16) & 0xFF));
+	}
+	to.insert(end(to), begin(payload), end(payload));
+}
+
+// Handles packets the way TcpConnection::socketPacket does.
+class Receiver {
+public:
+	explicit Receiver(int smallSize = kSmallSize)
+	: _buffer(smallSize) {
+	}
+
+	// Passes the bytes in reads of at most chunk bytes.
+	TcpReadBuffer::Result feed(bytes::const_span data, int chunk) {
+		auto result = TcpReadBuffer::Result::Complete;
+		while (!data.empty()) {
+			const auto free = _buffer.prepareRead();
+			const auto count = std::min({
+				int(free.size()),
+				int(data.size()),
+				chunk });
+			bytes::copy(free, data.subspan(0, count));
+			data = data.subspan(count);
+			result = _buffer.received(
+				count,
+				ReadLength,
+				ReadHeaderSize,
+				[&](bytes::span packet) { return handle(packet); });
+			_usedLargeBuffer |= _buffer.usingLargeBuffer();
+			if (result == TcpReadBuffer::Result::BadLength
+				|| result == TcpReadBuffer::Result::Stopped) {
+				break;
+			}
+		}
+		return result;
+	}
+
+	TcpReadBuffer &buffer() {
+		return _buffer;
+	}
+	const std::vector<bytes::vector> &payloads() const {
+		return _payloads;
+	}
+	bool aligned() const {
+		return _aligned;
+	}
+	bool usedLargeBuffer() const {
+		return _usedLargeBuffer;
+	}
+
+private:
+	bool handle(bytes::span packet) {
+		REQUIRE(ReadLength(packet) == int(packet.size()));
+		const auto payload = _buffer.alignPacket(
+			packet.subspan(ReadHeaderSize(packet)));
+		_aligned = _aligned
+			&& (reinterpret_cast<std::uintptr_t>(payload.data()) % 4 == 0);
+		_payloads.push_back(bytes::make_vector(payload));
+		return true;
+	}
+
+	TcpReadBuffer _buffer;
+	std::vector<bytes::vector> _payloads;
+	bool _aligned = true;
+	bool _usedLargeBuffer = false;
+
+};
+
+} // namespace
+
+TEST_CASE("tcp read buffer", "[tcp_read_buffer]") {
+	auto payloads = std::vector<bytes::vector>();
+	auto stream = bytes::vector();
+	const auto add = [&](int ints) {
+		payloads.push_back(Payload(ints, int(payloads.size())));
+		AppendFramed(stream, payloads.back());
+	};
+
+	SECTION("packets split across reads") {
+		auto engine = std::mt19937(1);
+		for (auto i = 0; i != 300; ++i) {
+			add(1 + int(engine() % 200));
+		}
+		for (const auto chunk : { 1, 3, 7, 64, 1000, 1 << 20 }) {
+			auto receiver = Receiver();
+			const auto result = receiver.feed(stream, chunk);
+			REQUIRE(result == TcpReadBuffer::Result::Complete);
+			REQUIRE(receiver.payloads() == payloads);
+			REQUIRE(receiver.aligned());
+			REQUIRE(!receiver.usedLargeBuffer());
+			REQUIRE(receiver.buffer().readBytes() == 0);
+			REQUIRE(receiver.buffer().leftBytes() == 0);
+		}
+	}
+	SECTION("header at the end of the buffer") {
+		// 516 + 253 + 253 bytes, then two of the four header bytes
+		// of the last packet are read till the end of the buffer.
+		add(128);
+		add(63);
+		add(63);
+		add(200);
+		REQUIRE(stream.size() == kSmallSize - 2 + 4 + 800);
+
+		auto receiver = Receiver();
+		const auto first = bytes::make_span(stream).subspan(0, kSmallSize);
+		REQUIRE(receiver.feed(first, kSmallSize)
+			== TcpReadBuffer::Result::Complete);
+		REQUIRE(receiver.payloads().size() == 3);
+		REQUIRE(receiver.buffer().readBytes() == 2);
+		REQUIRE(receiver.buffer().takeCopiedBytes() > 0);
+
+		const auto rest = bytes::make_span(stream).subspan(kSmallSize);
+		REQUIRE(receiver.feed(rest, kSmallSize)
+			== TcpReadBuffer::Result::Complete);
+		REQUIRE(receiver.payloads() == payloads);
+		REQUIRE(receiver.aligned());
+	}
+	SECTION("oversize packets") {
+		add(10);
+		add(5000);
+		add(11);
+		add(3 * kSmallSize);
+		add(12);
+		for (const auto chunk : { 100, kSmallSize, 1 << 20 }) {
+			auto receiver = Receiver();
+			const auto result = receiver.feed(stream, chunk);
+			REQUIRE(result == TcpReadBuffer::Result::Complete);
+			REQUIRE(receiver.payloads() == payloads);
+			REQUIRE(receiver.aligned());
+			REQUIRE(receiver.usedLargeBuffer());
+			REQUIRE(!receiver.buffer().usingLargeBuffer());
+		}
+	}
+	SECTION("partial packet is reported") {
+		add(300);
+		auto receiver = Receiver();
+		const auto part = bytes::make_span(stream).subspan(0, 100);
+		REQUIRE(receiver.feed(part, kSmallSize)
+			== TcpReadBuffer::Result::Partial);
+		REQUIRE(receiver.buffer().leftBytes() == int(stream.size()) - 100);
+		REQUIRE(receiver.payloads().empty());
+	}
+	SECTION("bad packet length") {
+		add(10);
+		stream.push_back(bytes::type(0));
+		stream.resize(stream.size() + 64);
+		auto receiver = Receiver();
+		REQUIRE(receiver.feed(stream, kSmallSize)
+			== TcpReadBuffer::Result::BadLength);
+		REQUIRE(receiver.payloads().size() == 1);
+	}
+}
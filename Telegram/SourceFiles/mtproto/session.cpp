@@ -31,6 +31,9 @@ constexpr auto kResendThreshold = 1;
 // Container lives 10 minutes in haveSent map.
 constexpr auto kContainerLives = 600;
 
+// Don't look for the taken requests while there are only a few of them.
+constexpr auto kWaitingToSendMinPruneSize = 64;
+
 QString LogIds(const QVector<uint64> &ids) {
 	if (!ids.size()) return "[]";
 	auto idsStr = QString("[%1").arg(*ids.cbegin());
@@ -50,7 +53,8 @@ ConnectionOptions::ConnectionOptions(
 	bool useIPv4,
 	bool useIPv6,
 	bool useHttp,
-	bool useTcp)
+	bool useTcp,
+	int gzipPackThreshold)
 : systemLangCode(systemLangCode)
 , cloudLangCode(cloudLangCode)
 , langPackName(langPackName)
@@ -58,7 +62,8 @@ ConnectionOptions::ConnectionOptions(
 , useIPv4(useIPv4)
 , useIPv6(useIPv6)
 , useHttp(useHttp)
-, useTcp(useTcp) {
+, useTcp(useTcp)
+, gzipPackThreshold(gzipPackThreshold) {
 }
 
 void SessionData::setKey(const AuthKeyPtr &key) {
@@ -90,48 +95,103 @@ void SessionData::notifyConnectionInited(const ConnectionOptions &options) {
 	}
 }
 
-void SessionData::clear(Instance *instance) {
+void SessionData::addToSend(
+		const SecureRequest &request,
+		bool newRequest,
+		mtpMsgId resentMsgId) {
+	const auto requestId = request->requestId;
+	const auto sequence = ++_toSendAdded;
+	_waitingToSend[requestId] = sequence;
+	if (size_type(_waitingToSend.size()) >= _waitingToSendPruneSize) {
+		pruneWaitingToSend();
+	}
+	_toSendChanges.push(ToSendChange{
+		request,
+		requestId,
+		resentMsgId,
+		sequence,
+		newRequest });
+}
+
+void SessionData::cancelToSend(mtpRequestId requestId) {
+	_waitingToSend.erase(requestId);
+	_toSendChanges.push(ToSendChange{ SecureRequest(), requestId });
+}
+
+bool SessionData::waitingToSend(mtpRequestId requestId) const {
+	const auto i = _waitingToSend.find(requestId);
+	return (i != end(_waitingToSend))
+		&& (i->second > _toSendTakenTill.load(std::memory_order_acquire));
+}
+
+void SessionData::pruneWaitingToSend() {
+	const auto till = _toSendTakenTill.load(std::memory_order_acquire);
+	for (auto i = begin(_waitingToSend); i != end(_waitingToSend);) {
+		if (i->second <= till) {
+			i = _waitingToSend.erase(i);
+		} else {
+			++i;
+		}
+	}
+	_waitingToSendPruneSize = std::max(
+		size_type(_waitingToSend.size()) * 2,
+		size_type(kWaitingToSendMinPruneSize));
+}
+
+void SessionData::takeToSend() {
+	while (auto change = _toSendChanges.pop()) {
+		const auto &request = change->request;
+		if (!request) {
+			_toSend.remove(change->requestId);
+			continue;
+		}
+		if (change->newRequest) {
+			*(mtpMsgId*)(request->data() + 4) = 0;
+			*(request->data() + 6) = 0;
+		}
+		_toSend.insert(change->requestId, request);
+		if (change->resentMsgId) {
+			_toResend.emplace_or_assign(
+				change->resentMsgId,
+				change->requestId);
+		}
+		_toSendApplied = change->sequence;
+	}
+	toSendTaken();
+}
+
+void SessionData::toSendTaken() {
+	if (_toSend.isEmpty()) {
+		_toSendTakenTill.store(_toSendApplied, std::memory_order_release);
+	}
+}
+
+void SessionData::clear() {
 	auto clearCallbacks = std::vector<RPCCallbackClear>();
 	{
-		QReadLocker locker1(haveSentMutex()), locker2(toResendMutex()), locker3(haveReceivedMutex()), locker4(wereAckedMutex());
-		auto receivedResponsesEnd = _receivedResponses.cend();
-		clearCallbacks.reserve(_haveSent.size() + _wereAcked.size());
+		QReadLocker locker(haveSentMutex());
+		clearCallbacks.reserve(_haveSent.size() + _toResend.size() + _wereAcked.size());
 		for (auto i = _haveSent.cbegin(), e = _haveSent.cend(); i != e; ++i) {
-			auto requestId = i.value()->requestId;
-			if (!_receivedResponses.contains(requestId)) {
-				clearCallbacks.push_back(requestId);
-			}
+			clearCallbacks.push_back(i->second->requestId);
 		}
 		for (auto i = _toResend.cbegin(), e = _toResend.cend(); i != e; ++i) {
-			auto requestId = i.value();
-			if (!_receivedResponses.contains(requestId)) {
-				clearCallbacks.push_back(requestId);
-			}
+			clearCallbacks.push_back(i->second);
 		}
 		for (auto i = _wereAcked.cbegin(), e = _wereAcked.cend(); i != e; ++i) {
-			auto requestId = i.value();
-			if (!_receivedResponses.contains(requestId)) {
-				clearCallbacks.push_back(requestId);
-			}
+			clearCallbacks.push_back(i->second);
 		}
 	}
 	{
 		QWriteLocker locker(haveSentMutex());
 		_haveSent.clear();
 	}
-	{
-		QWriteLocker locker(toResendMutex());
-		_toResend.clear();
-	}
-	{
-		QWriteLocker locker(wereAckedMutex());
-		_wereAcked.clear();
-	}
+	_toResend.clear();
+	_wereAcked.clear();
 	{
 		QWriteLocker locker(receivedIdsMutex());
 		_receivedIds.clear();
 	}
-	instance->clearCallbacksDelayed(std::move(clearCallbacks));
+	owner()->clearCallbacksDelayed(std::move(clearCallbacks));
 }
 
 Session::Session(not_null<Instance*> instance, ShiftedDcId shiftedDcId) : QObject()
@@ -206,7 +266,8 @@ void Session::refreshOptions() {
 		useIPv4,
 		useIPv6,
 		useHttp,
-		useTcp));
+		useTcp,
+		_instance->gzipPackThreshold()));
 }
 
 void Session::reInitConnection() {
@@ -318,22 +379,22 @@ void Session::checkRequestsByTimer() {
 		const auto haveSentCount = haveSent.size();
 		auto ms = crl::now();
 		for (auto i = haveSent.begin(), e = haveSent.end(); i != e; ++i) {
-			auto &req = i.value();
+			auto &req = i->second;
 			if (req->msDate > 0) {
 				if (req->msDate + kCheckResendTimeout < ms) { // need to resend or check state
 					if (req.messageSize() < kResendThreshold) { // resend
 						resendingIds.reserve(haveSentCount);
-						resendingIds.push_back(i.key());
+						resendingIds.push_back(i->first);
 					} else {
 						req->msDate = ms;
 						stateRequestIds.reserve(haveSentCount);
-						stateRequestIds.push_back(i.key());
+						stateRequestIds.push_back(i->first);
 					}
 				}
 			} else if (base::unixtime::now()
-					> int32(i.key() >> 32) + kContainerLives) {
+					> int32(i->first >> 32) + kContainerLives) {
 				removingIds.reserve(haveSentCount);
-				removingIds.push_back(i.key());
+				removingIds.push_back(i->first);
 			}
 		}
 	}
@@ -362,8 +423,8 @@ void Session::checkRequestsByTimer() {
 			for (uint32 i = 0, l = removingIds.size(); i < l; ++i) {
 				auto j = haveSent.find(removingIds[i]);
 				if (j != haveSent.cend()) {
-					if (j.value()->requestId) {
-						clearCallbacks.push_back(j.value()->requestId);
+					if (j->second->requestId) {
+						clearCallbacks.push_back(j->second->requestId);
 					}
 					haveSent.erase(j);
 				}
@@ -383,8 +444,7 @@ void Session::onResetDone() {
 
 void Session::cancel(mtpRequestId requestId, mtpMsgId msgId) {
 	if (requestId) {
-		QWriteLocker locker(data.toSendMutex());
-		data.toSendMap().remove(requestId);
+		data.cancelToSend(requestId);
 	}
 	if (msgId) {
 		QWriteLocker locker(data.haveSentMutex());
@@ -420,14 +480,9 @@ int32 Session::requestState(mtpRequestId requestId) const {
 	}
 	if (!requestId) return MTP::RequestSent;
 
-	QWriteLocker locker(data.toSendMutex());
-	const auto &toSend = data.toSendMap();
-	const auto i = toSend.constFind(requestId);
-	if (i != toSend.cend()) {
-		return MTP::RequestSending;
-	} else {
-		return MTP::RequestSent;
-	}
+	return data.waitingToSend(requestId)
+		? MTP::RequestSending
+		: MTP::RequestSent;
 }
 
 int32 Session::getState() const {
@@ -480,7 +535,7 @@ mtpRequestId Session::resend(quint64 msgId, qint64 msCanWait, bool forceContaine
 			return 0;
 		}
 
-		request = i.value();
+		request = i->second;
 		haveSent.erase(i);
 	}
 	if (request.isSentContainer()) { // for container just resend all messages we can
@@ -492,11 +547,8 @@ mtpRequestId Session::resend(quint64 msgId, qint64 msCanWait, bool forceContaine
 		return 0xFFFFFFFF;
 	} else if (!request.isStateRequest()) {
 		request->msDate = forceContainer ? 0 : crl::now();
-		sendPrepared(request, msCanWait, false);
-		{
-			QWriteLocker locker(data.toResendMutex());
-			data.toResendMap().insert(msgId, request->requestId);
-		}
+		data.addToSend(request, false, msgId);
+		sendAnything(msCanWait);
 		return request->requestId;
 	} else {
 		return 0;
@@ -516,8 +568,8 @@ void Session::resendAll() {
 		const auto &haveSent = data.haveSentMap();
 		toResend.reserve(haveSent.size());
 		for (auto i = haveSent.cbegin(), e = haveSent.cend(); i != e; ++i) {
-			if (i.value()->requestId) {
-				toResend.push_back(i.key());
+			if (i->second->requestId) {
+				toResend.push_back(i->first);
 			}
 		}
 	}
@@ -532,15 +584,7 @@ void Session::sendPrepared(
 		bool newRequest) {
 	DEBUG_LOG(("MTP Info: adding request to toSendMap, msCanWait %1"
 		).arg(msCanWait));
-	{
-		QWriteLocker locker(data.toSendMutex());
-		data.toSendMap().insert(request->requestId, request);
-
-		if (newRequest) {
-			*(mtpMsgId*)(request->data() + 4) = 0;
-			*(request->data() + 6) = 0;
-		}
-	}
+	data.addToSend(request, newRequest);
 
 	DEBUG_LOG(("MTP Info: added, requestId %1").arg(request->requestId));
 
@@ -599,28 +643,22 @@ void Session::tryToReceive() {
 		return;
 	}
 	while (true) {
+		takeReceived();
+
 		auto requestId = mtpRequestId(0);
 		auto isUpdate = false;
 		auto message = SerializedMessage();
-		{
-			QWriteLocker locker(data.haveReceivedMutex());
-			auto &responses = data.haveReceivedResponses();
-			auto response = responses.begin();
-			if (response == responses.cend()) {
-				auto &updates = data.haveReceivedUpdates();
-				auto update = updates.begin();
-				if (update == updates.cend()) {
-					return;
-				} else {
-					message = std::move(*update);
-					isUpdate = true;
-					updates.pop_front();
-				}
-			} else {
-				requestId = response.key();
-				message = std::move(response.value());
-				responses.erase(response);
-			}
+		const auto response = _receivedResponses.begin();
+		if (response != _receivedResponses.end()) {
+			requestId = response->first;
+			message = std::move(response->second);
+			_receivedResponses.erase(response);
+		} else if (!_receivedUpdates.empty()) {
+			message = std::move(_receivedUpdates.front());
+			isUpdate = true;
+			_receivedUpdates.pop_front();
+		} else {
+			return;
 		}
 		if (isUpdate) {
 			if (dcWithShift == BareDcId(dcWithShift)) { // call globalCallback only in main session
@@ -632,6 +670,28 @@ void Session::tryToReceive() {
 	}
 }
 
+void Session::takeReceived() {
+	data.takeReceived([&](
+			mtpRequestId requestId,
+			SerializedMessage &&response) {
+		_receivedResponses.emplace_or_assign(requestId, std::move(response));
+	}, [&](SerializedMessage &&update) {
+		_receivedUpdates.push_back(std::move(update));
+	});
+}
+
+void Session::clearCallbacksDelayed(std::vector<RPCCallbackClear> &&ids) {
+	crl::on_main(this, [=, list = std::move(ids)]() mutable {
+		// Responses for these requests were received before the clear,
+		// so their callbacks should still be called.
+		takeReceived();
+		list.erase(ranges::remove_if(list, [&](const RPCCallbackClear &id) {
+			return _receivedResponses.contains(id.requestId);
+		}), end(list));
+		_instance->clearCallbacksDelayed(std::move(list));
+	});
+}
+
 Session::~Session() {
 	Assert(_connection == nullptr);
 }
@@ -8,6 +8,8 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #pragma once
 
 #include "base/timer.h"
+#include "base/mpsc_queue.h"
+#include "base/monotonic_map.h"
 #include "mtproto/rpc_sender.h"
 
 namespace MTP {
@@ -25,19 +27,16 @@ class Dcenter;
 class Connection;
 
 using PreRequestMap = QMap<mtpRequestId, SecureRequest>;
-using RequestMap = QMap<mtpMsgId, SecureRequest>;
+using RequestMap = base::monotonic_map<mtpMsgId, SecureRequest>;
 
-class RequestIdsMap : public QMap<mtpMsgId, mtpRequestId> {
+class RequestIdsMap : public base::monotonic_map<mtpMsgId, mtpRequestId> {
 public:
-	using ParentType = QMap<mtpMsgId, mtpRequestId>;
-
 	mtpMsgId min() const {
-		return size() ? cbegin().key() : 0;
+		return empty() ? 0 : front().first;
 	}
 
 	mtpMsgId max() const {
-		ParentType::const_iterator e(cend());
-		return size() ? (--e).key() : 0;
+		return empty() ? 0 : back().first;
 	}
 
 };
@@ -116,7 +115,8 @@ struct ConnectionOptions {
 		bool useIPv4,
 		bool useIPv6,
 		bool useHttp,
-		bool useTcp);
+		bool useTcp,
+		int gzipPackThreshold);
 	ConnectionOptions(const ConnectionOptions &other) = default;
 	ConnectionOptions &operator=(const ConnectionOptions &other) = default;
 
@@ -128,6 +128,7 @@ struct ConnectionOptions {
 	bool useIPv6 = true;
 	bool useHttp = true;
 	bool useTcp = true;
+	int gzipPackThreshold = 0; // 0 - don't pack outgoing requests
 	bool inited = false;
 
 };
@@ -192,28 +193,32 @@ public:
 
 	not_null<QReadWriteLock*> keyMutex() const;
 
-	not_null<QReadWriteLock*> toSendMutex() const {
-		return &_toSendLock;
-	}
 	not_null<QReadWriteLock*> haveSentMutex() const {
 		return &_haveSentLock;
 	}
-	not_null<QReadWriteLock*> toResendMutex() const {
-		return &_toResendLock;
-	}
-	not_null<QReadWriteLock*> wereAckedMutex() const {
-		return &_wereAckedLock;
-	}
 	not_null<QReadWriteLock*> receivedIdsMutex() const {
 		return &_receivedIdsLock;
 	}
-	not_null<QReadWriteLock*> haveReceivedMutex() const {
-		return &_haveReceivedLock;
-	}
 	not_null<QReadWriteLock*> stateRequestMutex() const {
 		return &_stateRequestLock;
 	}
 
+	// Called in the main thread, applied in the connection thread.
+	void addToSend(
+		const SecureRequest &request,
+		bool newRequest,
+		mtpMsgId resentMsgId = 0);
+	void cancelToSend(mtpRequestId requestId);
+
+	// Main thread only, true until the connection thread takes the
+	// request out of the requests waiting to be sent.
+	bool waitingToSend(mtpRequestId requestId) const;
+
+	// Connection thread only, toSend, toResend and wereAcked are owned
+	// by the connection thread and are used without locks.
+	void takeToSend();
+	void toSendTaken();
+
 	PreRequestMap &toSendMap() {
 		return _toSend;
 	}
@@ -244,17 +249,22 @@ public:
 	const RequestIdsMap &wereAckedMap() const {
 		return _wereAcked;
 	}
-	QMap<mtpRequestId, SerializedMessage> &haveReceivedResponses() {
-		return _receivedResponses;
+
+	// Called in the connection thread, taken in the main thread.
+	void addReceivedResponse(
+			mtpRequestId requestId,
+			SerializedMessage &&response) {
+		_receivedResponses.push(
+			ReceivedResponse{ requestId, std::move(response) });
 	}
-	const QMap<mtpRequestId, SerializedMessage> &haveReceivedResponses() const {
-		return _receivedResponses;
+	void addReceivedUpdate(SerializedMessage &&update) {
+		_receivedUpdates.push(std::move(update));
 	}
-	QList<SerializedMessage> &haveReceivedUpdates() {
-		return _receivedUpdates;
+	int receivedResponsesCount() const {
+		return _receivedResponses.size();
 	}
-	const QList<SerializedMessage> &haveReceivedUpdates() const {
-		return _receivedUpdates;
+	int receivedUpdatesCount() const {
+		return _receivedUpdates.size();
 	}
 	QMap<mtpMsgId, bool> &stateRequestMap() {
 		return _stateRequest;
@@ -277,9 +287,29 @@ public:
 		return result * 2 + (needAck ? 1 : 0);
 	}
 
-	void clear(Instance *instance);
+	// Takes received responses and updates, main thread only.
+	template <typename ResponseCallback, typename UpdateCallback>
+	void takeReceived(
+		ResponseCallback &&responseCallback,
+		UpdateCallback &&updateCallback);
+
+	void clear();
 
 private:
+	struct ReceivedResponse {
+		mtpRequestId requestId = 0;
+		SerializedMessage message;
+	};
+	struct ToSendChange {
+		SecureRequest request; // Cancel if empty.
+		mtpRequestId requestId = 0;
+		mtpMsgId resentMsgId = 0;
+		uint64 sequence = 0;
+		bool newRequest = false;
+	};
+
+	void pruneWaitingToSend();
+
 	uint64 _session = 0;
 	uint64 _salt = 0;
 
@@ -293,23 +323,26 @@ private:
 	ConnectionOptions _options;
 
 	PreRequestMap _toSend; // map of request_id -> request, that is waiting to be sent
-	RequestMap _haveSent; // map of msg_id -> request, that was sent, msDate = 0 for msgs_state_req (no resend / state req), msDate = 0, seqNo = 0 for containers
+	RequestMap _haveSent; // locked, resent by timer in the main thread; map of msg_id -> request, that was sent, msDate = 0 for msgs_state_req (no resend / state req), msDate = 0, seqNo = 0 for containers
 	RequestIdsMap _toResend; // map of msg_id -> request_id, that request_id -> request lies in toSend and is waiting to be resent
 	ReceivedMsgIds _receivedIds; // set of received msg_id's, for checking new msg_ids
 	RequestIdsMap _wereAcked; // map of msg_id -> request_id, this msg_ids already were acked or do not need ack
 	QMap<mtpMsgId, bool> _stateRequest; // set of msg_id's, whose state should be requested
 
-	QMap<mtpRequestId, SerializedMessage> _receivedResponses; // map of request_id -> response that should be processed in the main thread
-	QList<SerializedMessage> _receivedUpdates; // list of updates that should be processed in the main thread
+	base::mpsc_queue<ToSendChange> _toSendChanges; // requests added and cancelled in the main thread
+	std::map<mtpRequestId, uint64> _waitingToSend; // request_id -> sequence of the change that added it, main thread only
+	size_type _waitingToSendPruneSize = 0;
+	uint64 _toSendAdded = 0; // main thread only
+	uint64 _toSendApplied = 0; // connection thread only
+	std::atomic<uint64> _toSendTakenTill = { 0 }; // requests added up to this sequence were taken from toSend
+
+	base::mpsc_queue<ReceivedResponse> _receivedResponses; // request_id and response that should be processed in the main thread
+	base::mpsc_queue<SerializedMessage> _receivedUpdates; // updates that should be processed in the main thread
 
 	// mutexes
 	mutable QReadWriteLock _lock;
-	mutable QReadWriteLock _toSendLock;
 	mutable QReadWriteLock _haveSentLock;
-	mutable QReadWriteLock _toResendLock;
 	mutable QReadWriteLock _receivedIdsLock;
-	mutable QReadWriteLock _wereAckedLock;
-	mutable QReadWriteLock _haveReceivedLock;
 	mutable QReadWriteLock _stateRequestLock;
 
 };
@@ -348,6 +381,10 @@ public:
 		crl::time msCanWait = 0,
 		bool newRequest = true);
 
+	// May be called from any thread, keeps callbacks of received
+	// responses that are not processed yet.
+	void clearCallbacksDelayed(std::vector<RPCCallbackClear> &&ids);
+
 	~Session();
 
 signals:
@@ -377,6 +414,7 @@ public slots:
 
 private:
 	void createDcData();
+	void takeReceived();
 
 	bool rpcErrorOccured(mtpRequestId requestId, const RPCFailHandlerPtr &onFail, const RPCError &err);
 
@@ -388,6 +426,10 @@ private:
 
 	SessionData data;
 
+	// Taken from SessionData, waiting to be processed in the main thread.
+	base::monotonic_map<mtpRequestId, SerializedMessage> _receivedResponses;
+	std::deque<SerializedMessage> _receivedUpdates;
+
 	ShiftedDcId dcWithShift = 0;
 	std::shared_ptr<Dcenter> dc;
 
@@ -405,5 +447,17 @@ inline not_null<QReadWriteLock*> SessionData::keyMutex() const {
 	return _owner->keyMutex();
 }
 
+template <typename ResponseCallback, typename UpdateCallback>
+void SessionData::takeReceived(
+		ResponseCallback &&responseCallback,
+		UpdateCallback &&updateCallback) {
+	while (auto response = _receivedResponses.pop()) {
+		responseCallback(response->requestId, std::move(response->message));
+	}
+	while (auto update = _receivedUpdates.pop()) {
+		updateCallback(std::move(*update));
+	}
+}
+
 } // namespace internal
 } // namespace MTP
@@ -8,6 +8,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "observer_peer.h"
 
 #include "base/observer.h"
+#include "base/keyed_events.h"
 
 namespace Notify {
 namespace {
@@ -28,6 +29,28 @@ void FinishCallback() {
 
 base::Observable<PeerUpdate, PeerUpdatedHandler> PeerUpdatedObservable;
 
+// Viewers of a single peer get only the updates of that peer, through one
+// subscription to PeerUpdatedObservable instead of one for each viewer.
+base::keyed_events<
+	PeerData*,
+	PeerUpdate,
+	PeerUpdate::Flags> PeerViewers;
+base::Subscription PeerViewersSubscription;
+
+void SubscribePeerViewers() {
+	if (PeerViewersSubscription) {
+		return;
+	}
+	const auto all = PeerUpdate::Flags::from_raw(
+		~PeerUpdate::Flags::Type(0));
+	PeerViewersSubscription = PeerUpdatedObservable.add_subscription({
+		all,
+		[](const PeerUpdate &update) {
+			PeerViewers.fire(update.peer, update.flags, update);
+		}
+	});
+}
+
 } // namespace
 
 void mergePeerUpdate(PeerUpdate &mergeTo, const PeerUpdate &mergeFrom) {
@@ -108,11 +131,8 @@ rpl::producer<PeerUpdate> PeerUpdateViewer(
 rpl::producer<PeerUpdate> PeerUpdateViewer(
 		not_null<PeerData*> peer,
 		PeerUpdate::Flags flags) {
-	return PeerUpdateViewer(
-		flags
-	) | rpl::filter([=](const PeerUpdate &update) {
-		return (update.peer == peer);
-	});
+	SubscribePeerViewers();
+	return PeerViewers.events(peer, flags);
 }
 
 rpl::producer<PeerUpdate> PeerUpdateValue(
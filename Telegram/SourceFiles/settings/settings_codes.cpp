@@ -23,6 +23,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "window/themes/window_theme.h"
 #include "window/themes/window_theme_editor.h"
 #include "media/audio/media_audio_track.h"
+#include "ui/image/image.h"
 
 namespace Settings {
 
@@ -65,6 +66,22 @@ auto GenerateCodes() {
 		}
 		Ui::show(Box<InformBox>(DebugLogging::FileLoader() ? qsl("Enabled file download logging") : qsl("Disabled file download logging")));
 	});
+	codes.emplace(qsl("imagecache"), [](::Main::Session *session) {
+		const auto stats = Images::CurrentCacheStats();
+		const auto mb = [](int64 bytes) {
+			return QString::number(bytes / float64(1024 * 1024), 'f', 1);
+		};
+		Ui::show(Box<InformBox>(qsl("Images: %1 of %2 MB\n"
+			"Prepared pixmaps: %3 of %4 MB, %5 pixmaps\n"
+			"Pixmaps hit ratio: %6% of %7 requests"
+		).arg(mb(stats.usage)
+		).arg(mb(stats.limit)
+		).arg(mb(stats.pixmaps.usage)
+		).arg(mb(stats.pixmaps.limit)
+		).arg(stats.pixmaps.count
+		).arg(QString::number(stats.pixmaps.hitRatio() * 100., 'f', 1)
+		).arg(stats.pixmaps.hits + stats.pixmaps.misses)));
+	});
 	codes.emplace(qsl("crashplease"), [](::Main::Session *session) {
 		Unexpected("Crashed in Settings!");
 	});
@@ -38,7 +38,8 @@ std::optional<BasicHeader> BinlogWrapper::ReadHeader(
 		return {};
 	} else if (binlog.read(bytes::object_as_span(&result)) != sizeof(result)) {
 		return {};
-	} else if (result.getFormat() != Format::Format_0) {
+	} else if (result.getFormat() != Format::Format_0
+		&& result.getFormat() != Format::Format_1) {
 		return {};
 	} else if (settings.trackEstimatedTime
 		!= !!(result.flags & result.kTrackEstimatedTime)) {
@@ -70,7 +71,8 @@ bool BinlogWrapper::readPart() {
 		int64(_full.size() - _part.size()));
 	Assert(amount > 0);
 	const auto readBytes = _binlog.read(
-		_full.subspan(_part.size(), amount));
+		_full.subspan(_part.size(), amount),
+		_settings.readBlockThreads);
 	if (!readBytes) {
 		return no();
 	}
@@ -9,6 +9,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 #include "storage/cache/storage_cache_database_object.h"
 #include "storage/cache/storage_cache_binlog_reader.h"
+#include <deque>
 #include <unordered_set>
 
 namespace Storage {
@@ -28,6 +29,8 @@ public:
 		EncryptionKey &&key,
 		const Info &info);
 
+	void catchUp(base::binary_guard &&guard);
+
 private:
 	using Entry = DatabaseObject::Entry;
 	using Raw = DatabaseObject::Raw;
@@ -47,8 +50,9 @@ private:
 	void finalize();
 
 	std::vector<Key> readChunk();
-	bool readBlock(std::vector<Key> &result);
+	bool readBlock(std::deque<Key> &result);
 	void processValues(const std::vector<Raw> &values);
+	void reportProgress();
 
 	template <typename MultiRecord>
 	void initList();
@@ -74,7 +78,9 @@ private:
 	File _binlog;
 	File _compact;
 	BinlogWrapper _wrapper;
+	int64 _caughtUpTill = 0;
 	size_type _partSize = 0;
+	std::deque<Key> _keys;
 	std::unordered_set<Key> _written;
 	base::variant<
 		std::vector<MultiStore::Part>,
@@ -98,6 +104,7 @@ CompactorObject::CompactorObject(
 , _key(std::move(key))
 , _info(info)
 , _wrapper(_binlog, _settings, _info.till)
+, _caughtUpTill(_info.till)
 , _partSize(_settings.maxBundledRecords) { // Perhaps a better estimate?
 	Expects(_settings.compactChunkSize > 0);
 
@@ -174,9 +181,10 @@ void CompactorObject::fail() {
 
 void CompactorObject::done(int64 till) {
 	const auto path = compactPath();
-	_database.with([=, good = std::move(_guard)](DatabaseObject &database) {
+	_database.with([=, good = std::move(_guard)](
+			DatabaseObject &database) mutable {
 		if (good) {
-			database.compactorDone(path, till);
+			database.compactorDone(path, till, std::move(good));
 		}
 	});
 }
@@ -193,8 +201,8 @@ void CompactorObject::finalize() {
 	_binlog.close();
 	_compact.close();
 
-	auto lastCatchUp = 0;
-	auto from = _info.till;
+	auto lastCatchUp = int64(0);
+	auto from = _caughtUpTill;
 	while (true) {
 		const auto till = CatchUp(
 			compactPath(),
@@ -207,6 +215,7 @@ void CompactorObject::finalize() {
 			return;
 		} else if (till == from
 			|| (lastCatchUp > 0 && (till - from) >= lastCatchUp)) {
+			_caughtUpTill = till;
 			done(till);
 			return;
 		}
@@ -215,6 +224,11 @@ void CompactorObject::finalize() {
 	}
 }
 
+void CompactorObject::catchUp(base::binary_guard &&guard) {
+	_guard = std::move(guard);
+	finalize();
+}
+
 bool CompactorObject::writeList() {
 	if (_list.is<std::vector<MultiStore::Part>>()) {
 		return writeMultiStore<MultiStore>();
@@ -246,16 +260,21 @@ bool CompactorObject::writeMultiStore() {
 
 std::vector<Key> CompactorObject::readChunk() {
 	const auto limit = _settings.compactChunkSize;
-	auto result = std::vector<Key>();
-	while (result.size() < limit) {
-		if (!readBlock(result)) {
+	while (_keys.size() < limit) {
+		if (!readBlock(_keys)) {
 			break;
 		}
 	}
+
+	// One block may hold many more keys than a chunk, keep the rest
+	// for the next chunks so that each getManyRaw() stays bounded.
+	const auto count = std::min(limit, size_type(_keys.size()));
+	auto result = std::vector<Key>(begin(_keys), begin(_keys) + count);
+	_keys.erase(begin(_keys), begin(_keys) + count);
 	return result;
 }
 
-bool CompactorObject::readBlock(std::vector<Key> &result) {
+bool CompactorObject::readBlock(std::deque<Key> &result) {
 	const auto push = [&](const Store &store) {
 		result.push_back(store.key);
 		return true;
@@ -328,9 +347,19 @@ void CompactorObject::processValues(
 			return;
 		}
 	}
+	reportProgress();
 	parseChunk();
 }
 
+void CompactorObject::reportProgress() {
+	_database.with([
+		progress = _binlog.offset(),
+		total = _info.till
+	](DatabaseObject &database) {
+		database.compactorProgress(progress, total);
+	});
+}
+
 auto CompactorObject::fillList(RawSpan values) -> RawSpan {
 	return _list.match([&](auto &list) {
 		return fillList(list, values);
@@ -387,6 +416,13 @@ Compactor::Compactor(
 	info) {
 }
 
+void Compactor::catchUp(base::binary_guard &&guard) {
+	_wrapped.with([guard = std::move(guard)](
+			Implementation &unwrapped) mutable {
+		unwrapped.catchUp(std::move(guard));
+	});
+}
+
 Compactor::~Compactor() = default;
 
 int64 CatchUp(
@@ -35,6 +35,8 @@ public:
 		EncryptionKey &&key,
 		const Info &info);
 
+	void catchUp(base::binary_guard &&guard);
+
 	~Compactor();
 
 private:
@@ -8,49 +8,328 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "storage/cache/storage_cache_database.h"
 
 #include "storage/cache/storage_cache_database_object.h"
+#include "storage/storage_encryption.h"
+#include "base/algorithm.h"
+#include <rpl/combine.h>
+#include <rpl/map.h>
+#include <QtCore/QMutex>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QSaveFile>
 
 namespace Storage {
 namespace Cache {
+namespace {
+
+using Settings = Database::Settings;
+
+QString ShardPath(const QString &path, size_type index, size_type count) {
+	return (count > 1)
+		? (details::ComputeBasePath(path)
+			+ QStringLiteral("shards/")
+			+ QString::number(index))
+		: path;
+}
+
+int64 ShardSizeLimit(const Settings &settings, int64 totalSizeLimit) {
+	return (settings.shardsCount > 1 && totalSizeLimit > 0)
+		? std::max(
+			totalSizeLimit / settings.shardsCount,
+			int64(settings.maxDataSize) + 1)
+		: totalSizeLimit;
+}
+
+QString ShardsCountPath(const QString &base) {
+	return base + QStringLiteral("shards/count");
+}
+
+std::optional<size_type> ReadShardsCount(const QString &base) {
+	QFile file(ShardsCountPath(base));
+	if (!file.open(QIODevice::ReadOnly)) {
+		return std::nullopt;
+	}
+	auto value = qint32();
+	const auto data = file.read(sizeof(value));
+	if (data.size() != sizeof(value)) {
+		return std::nullopt;
+	}
+	bytes::copy(bytes::object_as_span(&value), bytes::make_span(data));
+	return size_type(value);
+}
+
+// Written by each shard on clear, so a file is replaced as a whole.
+bool WriteShardsCount(const QString &base, size_type count) {
+	if (!QDir().mkpath(base + QStringLiteral("shards"))) {
+		return false;
+	}
+	const auto value = qint32(count);
+	QSaveFile file(ShardsCountPath(base));
+	if (!file.open(QIODevice::WriteOnly)) {
+		return false;
+	} else if (file.write(
+			reinterpret_cast<const char*>(&value),
+			sizeof(value)) != sizeof(value)) {
+		return false;
+	}
+	return file.commit();
+}
+
+// Keys are found in the shards by their count, so a database written
+// with another shards count is not opened until it is cleared.
+//
+// Called on the queue of each shard before it is opened, only the
+// first shard writes the count of a new database.
+Error CheckShardsCount(
+		const QString &base,
+		size_type index,
+		size_type count) {
+	if (count == 1) {
+		return QFile::exists(ShardsCountPath(base))
+			? Error{ Error::Type::IO, ShardsCountPath(base) }
+			: Error::NoError();
+	} else if (const auto written = ReadShardsCount(base)) {
+		return (*written == count)
+			? Error::NoError()
+			: Error{ Error::Type::IO, ShardsCountPath(base) };
+	} else if (details::ReadVersionValue(base)) {
+		return Error{ Error::Type::IO, details::VersionFilePath(base) };
+	} else if (index > 0) {
+		return Error::NoError();
+	}
+	return WriteShardsCount(base, count)
+		? Error::NoError()
+		: Error{ Error::Type::IO, ShardsCountPath(base) };
+}
+
+// Makes the database look like it was written with this shards count.
+// Called on the queue of each shard before it is cleared, so that its
+// next open finds the new count. The first shard removes the data of
+// other shards count.
+void ResetShardsCount(const QString &base, size_type index, size_type count) {
+	if (count == 1) {
+		// The cleaner of the database removes the shards directory.
+		QFile(ShardsCountPath(base)).remove();
+		return;
+	}
+	QFile(details::VersionFilePath(base)).remove();
+	WriteShardsCount(base, count);
+	if (index > 0) {
+		return;
+	}
+	const auto shards = QStringLiteral("shards");
+	for (const auto &entry : QDir(base).entryList(
+			QDir::Dirs | QDir::NoDotAndDotDot)) {
+		if (entry != shards) {
+			QDir(base + entry).removeRecursively();
+		}
+	}
+	for (const auto &entry : QDir(base + shards).entryList(
+			QDir::Dirs | QDir::NoDotAndDotDot)) {
+		auto good = false;
+		const auto number = entry.toUInt(&good);
+		if (!good || number >= count) {
+			QDir(base + shards + '/' + entry).removeRecursively();
+		}
+	}
+}
+
+Settings ShardSettings(const Settings &settings, size_type index) {
+	auto result = settings;
+	result.totalSizeLimit = ShardSizeLimit(
+		settings,
+		settings.totalSizeLimit);
+	if (settings.shardsCount > 1 && !settings.tracePath.isEmpty()) {
+		result.tracePath += '.' + QString::number(index);
+	}
+	return result;
+}
+
+// Returns one callback for each shard, done is called after all of them
+// were called, with the first error reported by any shard.
+std::vector<FnMut<void(Error)>> JoinErrors(
+		size_type count,
+		FnMut<void(Error)> &&done) {
+	struct State {
+		QMutex mutex;
+		size_type left = 0;
+		Error error;
+		FnMut<void(Error)> done;
+	};
+	auto result = std::vector<FnMut<void(Error)>>(count);
+	if (!done) {
+		return result;
+	}
+	const auto state = std::make_shared<State>();
+	state->left = count;
+	state->done = std::move(done);
+	for (auto &callback : result) {
+		callback = [=](Error error) {
+			auto done = FnMut<void(Error)>();
+			{
+				QMutexLocker lock(&state->mutex);
+				if (state->error.type == Error::Type::None) {
+					state->error = error;
+				}
+				if (--state->left > 0) {
+					return;
+				}
+				done = std::move(state->done);
+			}
+			done(state->error);
+		};
+	}
+	return result;
+}
+
+std::vector<FnMut<void()>> JoinDone(size_type count, FnMut<void()> &&done) {
+	auto result = std::vector<FnMut<void()>>(count);
+	if (!done) {
+		return result;
+	}
+	auto errors = JoinErrors(count, [done = std::move(done)](
+			Error) mutable {
+		done();
+	});
+	for (auto i = size_type(0); i != count; ++i) {
+		result[i] = [callback = std::move(errors[i])]() mutable {
+			callback(Error::NoError());
+		};
+	}
+	return result;
+}
+
+Error ShardDestroyedError() {
+	return { Error::Type::IO, QString() };
+}
+
+Database::Stats SumStats(const std::vector<Database::Stats> &list) {
+	auto result = Database::Stats();
+	for (const auto &stats : list) {
+		result.full.count += stats.full.count;
+		result.full.totalSize += stats.full.totalSize;
+		for (const auto &[tag, summary] : stats.tagged) {
+			auto &sum = result.tagged[tag];
+			sum.count += summary.count;
+			sum.totalSize += summary.totalSize;
+		}
+		for (const auto &[tag, summary] : stats.compressed) {
+			auto &sum = result.compressed[tag];
+			sum.count += summary.count;
+			sum.originalSize += summary.originalSize;
+			sum.storedSize += summary.storedSize;
+		}
+		result.readsCount += stats.readsCount;
+		result.readAllocations += stats.readAllocations;
+		result.compactionsCount += stats.compactionsCount;
+		accumulate_max(
+			result.compactMaxChunkKeys,
+			stats.compactMaxChunkKeys);
+		accumulate_max(
+			result.compactMaxCatchUpBytes,
+			stats.compactMaxCatchUpBytes);
+		result.clearing = result.clearing || stats.clearing;
+		result.compacting = result.compacting || stats.compacting;
+		result.compactProgress += stats.compactProgress;
+		result.compactTotal += stats.compactTotal;
+	}
+	return result;
+}
+
+} // namespace
 
 Database::Database(const QString &path, const Settings &settings)
-: _wrapped(path, settings) {
+: _base(details::ComputeBasePath(path))
+, _settings(settings) {
+	Expects(settings.shardsCount > 0);
+
+	const auto count = settings.shardsCount;
+	_shards.reserve(count);
+	for (auto i = size_type(0); i != count; ++i) {
+		_shards.push_back(std::make_shared<Shard>(
+			ShardPath(path, i, count),
+			ShardSettings(settings, i)));
+	}
+}
+
+size_type Database::shardIndex(const Key &key) const {
+	// Keys with the same high part (streaming slices of the same file)
+	// should get into the same shard, because getWithSizes() expects it.
+	const auto count = uint64(_shards.size());
+	return (count > 1)
+		? size_type(((key.high * 0x9E3779B97F4A7C15ULL) >> 32) % count)
+		: 0;
+}
+
+auto Database::shard(const Key &key) -> Shard& {
+	return *_shards[shardIndex(key)];
 }
 
 void Database::reconfigure(const Settings &settings) {
-	_wrapped.with([settings](Implementation &unwrapped) mutable {
-		unwrapped.reconfigure(settings);
-	});
+	Expects(settings.shardsCount == size_type(_shards.size()));
+
+	_settings = settings;
+	for (auto i = 0, count = int(_shards.size()); i != count; ++i) {
+		_shards[i]->with([settings = ShardSettings(settings, i)](
+				Implementation &unwrapped) mutable {
+			unwrapped.reconfigure(settings);
+		});
+	}
 }
 
 void Database::updateSettings(const SettingsUpdate &update) {
-	_wrapped.with([update](Implementation &unwrapped) mutable {
-		unwrapped.updateSettings(update);
-	});
+	auto shardUpdate = update;
+	shardUpdate.totalSizeLimit = ShardSizeLimit(
+		_settings,
+		update.totalSizeLimit);
+	for (const auto &shard : _shards) {
+		shard->with([update = shardUpdate](Implementation &unwrapped) {
+			unwrapped.updateSettings(update);
+		});
+	}
 }
 
 void Database::open(EncryptionKey &&key, FnMut<void(Error)> &&done) {
-	_wrapped.with([
-		key = std::move(key),
-		done = std::move(done)
-	](Implementation &unwrapped) mutable {
-		unwrapped.open(std::move(key), std::move(done));
-	});
+	auto callbacks = JoinErrors(_shards.size(), std::move(done));
+	for (auto i = 0, count = int(_shards.size()); i != count; ++i) {
+		_shards[i]->with([
+			base = _base,
+			index = i,
+			count,
+			key = base::duplicate(key),
+			done = std::move(callbacks[i])
+		](Implementation &unwrapped) mutable {
+			const auto error = CheckShardsCount(base, index, count);
+			if (error.type != Error::Type::None) {
+				if (done) {
+					done(error);
+				}
+				return;
+			}
+			unwrapped.open(std::move(key), std::move(done));
+		});
+	}
 }
 
 void Database::close(FnMut<void()> &&done) {
-	_wrapped.with([
-		done = std::move(done)
-	](Implementation &unwrapped) mutable {
-		unwrapped.close(std::move(done));
-	});
+	auto callbacks = JoinDone(_shards.size(), std::move(done));
+	for (auto i = 0, count = int(_shards.size()); i != count; ++i) {
+		_shards[i]->with([
+			done = std::move(callbacks[i])
+		](Implementation &unwrapped) mutable {
+			unwrapped.close(std::move(done));
+		});
+	}
 }
 
 void Database::waitForCleaner(FnMut<void()> &&done) {
-	_wrapped.with([
-		done = std::move(done)
-	](Implementation &unwrapped) mutable {
-		unwrapped.waitForCleaner(std::move(done));
-	});
+	auto callbacks = JoinDone(_shards.size(), std::move(done));
+	for (auto i = 0, count = int(_shards.size()); i != count; ++i) {
+		_shards[i]->with([
+			done = std::move(callbacks[i])
+		](Implementation &unwrapped) mutable {
+			unwrapped.waitForCleaner(std::move(done));
+		});
+	}
 }
 
 void Database::put(
@@ -72,7 +351,7 @@ void Database::get(const Key &key, FnMut<void(QByteArray&&)> &&done) {
 }
 
 void Database::remove(const Key &key, FnMut<void(Error)> &&done) {
-	_wrapped.with([
+	shard(key).with([
 		key,
 		done = std::move(done)
 	](Implementation &unwrapped) mutable {
@@ -94,7 +373,17 @@ void Database::copyIfEmpty(
 		const Key &from,
 		const Key &to,
 		FnMut<void(Error)> &&done) {
-	_wrapped.with([
+	if (shardIndex(from) != shardIndex(to)) {
+		copyBetweenShards(from, to, [done = std::move(done)](
+				Error error,
+				bool copied) mutable {
+			if (done) {
+				done(error);
+			}
+		});
+		return;
+	}
+	shard(from).with([
 		from,
 		to,
 		done = std::move(done)
@@ -107,7 +396,31 @@ void Database::moveIfEmpty(
 		const Key &from,
 		const Key &to,
 		FnMut<void(Error)> &&done) {
-	_wrapped.with([
+	if (shardIndex(from) != shardIndex(to)) {
+		// Not atomic, the value is copied and then removed from the source.
+		const auto weak = std::weak_ptr<Shard>(_shards[shardIndex(from)]);
+		copyBetweenShards(from, to, [
+			from,
+			weak,
+			done = std::move(done)
+		](Error error, bool copied) mutable {
+			const auto strong = copied ? weak.lock() : nullptr;
+			if (!strong) {
+				if (done) {
+					done(copied ? ShardDestroyedError() : error);
+				}
+				return;
+			}
+			strong->with([
+				from,
+				done = std::move(done)
+			](Implementation &unwrapped) mutable {
+				unwrapped.remove(from, std::move(done));
+			});
+		});
+		return;
+	}
+	shard(from).with([
 		from,
 		to,
 		done = std::move(done)
@@ -116,11 +429,74 @@ void Database::moveIfEmpty(
 	});
 }
 
+void Database::copyBetweenShards(
+		const Key &from,
+		const Key &to,
+		FnMut<void(Error, bool)> &&done) {
+	Expects(done != nullptr);
+
+	const auto fromShard = std::weak_ptr<Shard>(_shards[shardIndex(from)]);
+	const auto toShard = std::weak_ptr<Shard>(_shards[shardIndex(to)]);
+	const auto put = [=](
+			TaggedValue &&value,
+			FnMut<void(Error, bool)> &&done) {
+		const auto strong = toShard.lock();
+		if (!strong) {
+			done(ShardDestroyedError(), false);
+			return;
+		}
+		strong->with([
+			to,
+			value = std::move(value),
+			done = std::move(done)
+		](Implementation &unwrapped) mutable {
+			// The target could get a value while the source was read.
+			if (unwrapped.contains(to)) {
+				done(Error::NoError(), false);
+				return;
+			}
+			unwrapped.put(to, std::move(value), [&](Error error) {
+				done(error, (error.type == Error::Type::None));
+			});
+		});
+	};
+	shard(to).with([
+		from,
+		to,
+		fromShard,
+		put,
+		done = std::move(done)
+	](Implementation &unwrapped) mutable {
+		if (unwrapped.contains(to)) {
+			done(Error::NoError(), false);
+			return;
+		}
+		const auto strong = fromShard.lock();
+		if (!strong) {
+			done(ShardDestroyedError(), false);
+			return;
+		}
+		strong->with([
+			from,
+			put,
+			done = std::move(done)
+		](Implementation &unwrapped) mutable {
+			unwrapped.get(from, [&](TaggedValue &&value) {
+				if (value.bytes.isEmpty()) {
+					done(Error::NoError(), false);
+				} else {
+					put(std::move(value), std::move(done));
+				}
+			});
+		});
+	});
+}
+
 void Database::put(
 		const Key &key,
 		TaggedValue &&value,
 		FnMut<void(Error)> &&done) {
-	_wrapped.with([
+	shard(key).with([
 		key,
 		value = std::move(value),
 		done = std::move(done)
@@ -133,7 +509,7 @@ void Database::putIfEmpty(
 		const Key &key,
 		TaggedValue &&value,
 		FnMut<void(Error)> &&done) {
-	_wrapped.with([
+	shard(key).with([
 		key,
 		value = std::move(value),
 		done = std::move(done)
@@ -145,7 +521,7 @@ void Database::putIfEmpty(
 void Database::getWithTag(
 		const Key &key,
 		FnMut<void(TaggedValue&&)> &&done) {
-	_wrapped.with([
+	shard(key).with([
 		key,
 		done = std::move(done)
 	](Implementation &unwrapped) mutable {
@@ -157,7 +533,7 @@ void Database::getWithSizes(
 		const Key &key,
 		std::vector<Key> &&keys,
 		FnMut<void(QByteArray&&, std::vector<int>&&)> &&done) {
-	_wrapped.with([
+	shard(key).with([
 		key,
 		keys = std::move(keys),
 		done = std::move(done)
@@ -166,35 +542,123 @@ void Database::getWithSizes(
 	});
 }
 
-auto Database::statsOnMain() const -> rpl::producer<Stats> {
-	return _wrapped.producer_on_main([](const Implementation &unwrapped) {
-		return unwrapped.stats();
+void Database::getMany(
+		std::vector<Key> &&keys,
+		FnMut<void(std::vector<TaggedValue>&&)> &&done) {
+	if (_shards.size() == 1 || keys.empty()) {
+		_shards.front()->with([
+			keys = std::move(keys),
+			done = std::move(done)
+		](Implementation &unwrapped) mutable {
+			unwrapped.getMany(std::move(keys), std::move(done));
+		});
+		return;
+	}
+	struct State {
+		QMutex mutex;
+		std::vector<TaggedValue> result;
+		int left = 0;
+		FnMut<void(std::vector<TaggedValue>&&)> done;
+	};
+	auto indices = std::vector<std::vector<size_type>>(_shards.size());
+	auto parts = std::vector<std::vector<Key>>(_shards.size());
+	const auto keysCount = size_type(keys.size());
+	for (auto i = size_type(0); i != keysCount; ++i) {
+		const auto index = shardIndex(keys[i]);
+		indices[index].push_back(i);
+		parts[index].push_back(keys[i]);
+	}
+	const auto state = std::make_shared<State>();
+	state->result.resize(keys.size());
+	state->left = ranges::count_if(parts, [](const auto &part) {
+		return !part.empty();
 	});
+	state->done = std::move(done);
+	for (auto i = 0, count = int(_shards.size()); i != count; ++i) {
+		if (parts[i].empty()) {
+			continue;
+		}
+		auto collect = [=, indices = std::move(indices[i])](
+				std::vector<TaggedValue> &&values) {
+			auto done = FnMut<void(std::vector<TaggedValue>&&)>();
+			{
+				QMutexLocker lock(&state->mutex);
+				auto index = begin(indices);
+				for (auto &value : values) {
+					state->result[*index++] = std::move(value);
+				}
+				if (--state->left > 0) {
+					return;
+				}
+				done = std::move(state->done);
+			}
+			if (done) {
+				done(std::move(state->result));
+			}
+		};
+		_shards[i]->with([
+			keys = std::move(parts[i]),
+			done = std::move(collect)
+		](Implementation &unwrapped) mutable {
+			unwrapped.getMany(std::move(keys), std::move(done));
+		});
+	}
+}
+
+auto Database::statsOnMain() const -> rpl::producer<Stats> {
+	const auto producer = [](const Shard &shard) -> rpl::producer<Stats> {
+		return shard.producer_on_main([](const Implementation &unwrapped) {
+			return unwrapped.stats();
+		});
+	};
+	if (_shards.size() == 1) {
+		return producer(*_shards.front());
+	}
+	auto list = std::vector<rpl::producer<Stats>>();
+	list.reserve(_shards.size());
+	for (const auto &shard : _shards) {
+		list.push_back(producer(*shard));
+	}
+	return rpl::combine(
+		std::move(list)
+	) | rpl::map(SumStats);
 }
 
 void Database::clear(FnMut<void(Error)> &&done) {
-	_wrapped.with([
-		done = std::move(done)
-	](Implementation &unwrapped) mutable {
-		unwrapped.clear(std::move(done));
-	});
+	auto callbacks = JoinErrors(_shards.size(), std::move(done));
+	for (auto i = 0, count = int(_shards.size()); i != count; ++i) {
+		_shards[i]->with([
+			base = _base,
+			index = i,
+			count,
+			done = std::move(callbacks[i])
+		](Implementation &unwrapped) mutable {
+			ResetShardsCount(base, index, count);
+			unwrapped.clear(std::move(done));
+		});
+	}
 }
 
 void Database::clearByTag(uint8 tag, FnMut<void(Error)> &&done) {
-	_wrapped.with([
-		tag,
-		done = std::move(done)
-	](Implementation &unwrapped) mutable {
-		unwrapped.clearByTag(tag, std::move(done));
-	});
+	auto callbacks = JoinErrors(_shards.size(), std::move(done));
+	for (auto i = 0, count = int(_shards.size()); i != count; ++i) {
+		_shards[i]->with([
+			tag,
+			done = std::move(callbacks[i])
+		](Implementation &unwrapped) mutable {
+			unwrapped.clearByTag(tag, std::move(done));
+		});
+	}
 }
 
 void Database::sync() {
-	auto semaphore = crl::semaphore();
-	_wrapped.with([&](Implementation &) {
-		semaphore.release();
-	});
-	semaphore.acquire();
+	for (const auto &shard : _shards) {
+		auto semaphore = crl::semaphore();
+		shard->with([&](Implementation &) {
+			semaphore.release();
+		});
+		semaphore.acquire();
+	}
 }
 
 Database::~Database() = default;
@@ -25,6 +25,7 @@ class Database {
 public:
 	using Settings = details::Settings;
 	using SettingsUpdate = details::SettingsUpdate;
+	using EvictionPolicy = details::EvictionPolicy;
 	Database(const QString &path, const Settings &settings);
 
 	void reconfigure(const Settings &settings);
@@ -69,6 +70,12 @@ public:
 		std::vector<Key> &&keys,
 		FnMut<void(QByteArray&&, std::vector<int>&&)> &&done);
 
+	// Values are delivered in the order of keys, empty for missing ones.
+	// Like the other callbacks done is called on the cache queue.
+	void getMany(
+		std::vector<Key> &&keys,
+		FnMut<void(std::vector<TaggedValue>&&)> &&done);
+
 	using Stats = details::Stats;
 	using TaggedSummary = details::TaggedSummary;
 	rpl::producer<Stats> statsOnMain() const;
@@ -83,7 +90,20 @@ public:
 
 private:
 	using Implementation = details::DatabaseObject;
-	crl::object_on_queue<Implementation> _wrapped;
+	using Shard = crl::object_on_queue<Implementation>;
+
+	Shard &shard(const Key &key);
+	size_type shardIndex(const Key &key) const;
+
+	// Calls done with true if the value was copied.
+	void copyBetweenShards(
+		const Key &from,
+		const Key &to,
+		FnMut<void(Error, bool)> &&done);
+
+	QString _base;
+	Settings _settings;
+	std::vector<std::shared_ptr<Shard>> _shards;
 
 };
 
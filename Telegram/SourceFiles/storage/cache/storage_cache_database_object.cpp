@@ -16,9 +16,10 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "base/algorithm.h"
 #include <crl/crl.h>
 #include <xxhash.h>
+#include <lz4.h>
 #include <QtCore/QDir>
-#include <unordered_map>
 #include <set>
+#include <limits>
 
 namespace Storage {
 namespace Cache {
@@ -26,6 +27,12 @@ namespace details {
 namespace {
 
 constexpr auto kMaxDelayAfterFailure = 24 * 60 * 60 * crl::time(1000);
+constexpr auto kMaxCompactorCatchUpRounds = 8;
+constexpr auto kCompactorCatchUpRetryDelay = crl::time(1000);
+constexpr auto kAgeAccessCountsEvery = 8;
+constexpr auto kMinAgeAccessCountsAfter = size_type(1024);
+constexpr auto kReadBuffersCount = 4;
+constexpr auto kReadBufferSizeLimit = size_type(1024 * 1024);
 
 uint32 CountChecksum(bytes::const_span data) {
 	const auto seed = uint32(0);
@@ -54,6 +61,50 @@ QString PlaceFromId(PlaceId place) {
 	return result;
 }
 
+// Compressed value is the original size followed by the LZ4 block.
+// Returns an empty array if the compression doesn't make it smaller.
+QByteArray Compress(const QByteArray &data) {
+	const auto size = qint32(data.size());
+	const auto header = int(sizeof(qint32));
+	auto result = QByteArray(
+		header + LZ4_compressBound(size),
+		Qt::Uninitialized);
+	const auto compressed = LZ4_compress_default(
+		data.constData(),
+		result.data() + header,
+		size,
+		result.size() - header);
+	if (compressed <= 0 || header + compressed >= size) {
+		return QByteArray();
+	}
+	result.resize(header + compressed);
+	bytes::copy(
+		bytes::make_detached_span(result),
+		bytes::object_as_span(&size));
+	return result;
+}
+
+QByteArray Decompress(const QByteArray &data) {
+	auto size = qint32();
+	const auto header = int(sizeof(qint32));
+	if (data.size() <= header) {
+		return QByteArray();
+	}
+	bytes::copy(
+		bytes::object_as_span(&size),
+		bytes::make_span(data).subspan(0, header));
+	if (size <= 0 || size >= kDataSizeLimit) {
+		return QByteArray();
+	}
+	auto result = QByteArray(size, Qt::Uninitialized);
+	const auto decompressed = LZ4_decompress_safe(
+		data.constData() + header,
+		result.data(),
+		data.size() - header,
+		size);
+	return (decompressed == size) ? result : QByteArray();
+}
+
 int32 GetUnixtime() {
 	return std::max(int32(time(nullptr)), 1);
 }
@@ -81,7 +132,8 @@ DatabaseObject::DatabaseObject(
 , _base(ComputeBasePath(path))
 , _settings(settings)
 , _writeBundlesTimer(_weak, [=] { writeBundles(); checkCompactor(); })
-, _pruneTimer(_weak, [=] { prune(); }) {
+, _pruneTimer(_weak, [=] { prune(); })
+, _compactorCatchUpTimer(_weak, [=] { compactorCatchUp(); }) {
 	checkSettings();
 }
 
@@ -102,6 +154,8 @@ void DatabaseObject::updateSettings(const SettingsUpdate &update) {
 
 void DatabaseObject::checkSettings() {
 	Expects(_settings.staleRemoveChunk > 0);
+	Expects(_settings.compressTags.empty()
+		|| _settings.compressTags.back() <= kMaxValueTag);
 	Expects(_settings.maxDataSize > 0
 		&& _settings.maxDataSize < kDataSizeLimit);
 	Expects(_settings.maxBundledRecords > 0
@@ -131,6 +185,8 @@ void DatabaseObject::open(EncryptionKey &&key, FnMut<void(Error)> &&done) {
 	const auto error = openSomeBinlog(std::move(key));
 	if (error.type != Error::Type::None) {
 		close(nullptr);
+	} else if (!_settings.tracePath.isEmpty()) {
+		_trace = std::make_unique<TraceWriter>(_settings.tracePath);
 	}
 	invokeCallback(done, error);
 }
@@ -220,6 +276,7 @@ File::Result DatabaseObject::openBinlog(
 bool DatabaseObject::readHeader() {
 	if (const auto header = BinlogWrapper::ReadHeader(_binlog, _settings)) {
 		_time.setRelative((_time.system = header->systemTime));
+		_compressionAllowed = (header->getFormat() == Format::Format_1);
 		return true;
 	}
 	return false;
@@ -232,6 +289,12 @@ bool DatabaseObject::writeHeader() {
 	if (_settings.trackEstimatedTime) {
 		header.flags |= header.kTrackEstimatedTime;
 	}
+
+	// Older versions can't read compressed values and reject this format.
+	_compressionAllowed = !_settings.compressTags.empty();
+	if (_compressionAllowed) {
+		header.setFormat(Format::Format_1);
+	}
 	return _binlog.write(bytes::object_as_span(&header));
 }
 
@@ -315,6 +378,8 @@ bool DatabaseObject::startDelayedPruning() {
 		} else if ((!_minimalEntryTime && !_map.empty())
 			|| _minimalEntryTime <= before) {
 			return true;
+		} else if (tagSizeLimitExceeded()) {
+			return true;
 		}
 		return false;
 	}();
@@ -343,6 +408,7 @@ void DatabaseObject::prune() {
 	auto stale = base::flat_set<Key>();
 	auto staleTotalSize = int64();
 	collectTimeStale(stale, staleTotalSize);
+	collectTagStale(stale, staleTotalSize);
 	collectSizeStale(stale, staleTotalSize);
 	if (stale.size() <= _settings.staleRemoveChunk) {
 		clearStaleNow(stale);
@@ -368,7 +434,7 @@ void DatabaseObject::clearStaleNow(const base::flat_set<Key> &stale) {
 	pushStats();
 
 	for (const auto &key : stale) {
-		remove(key, nullptr);
+		removeEntry(key, nullptr);
 	}
 
 	// Report correct status async.
@@ -396,7 +462,7 @@ void DatabaseObject::clearStaleChunk() {
 	const auto count = size_type(stale.size());
 	const auto clear = std::min(count, _settings.staleRemoveChunk);
 	for (const auto &key : stale.subspan(count - clear)) {
-		remove(key, nullptr);
+		removeEntry(key, nullptr);
 	}
 	_stale.resize(count - clear);
 	if (_stale.empty()) {
@@ -433,6 +499,42 @@ void DatabaseObject::collectTimeStale(
 	}
 }
 
+bool DatabaseObject::tagSizeLimitExceeded() const {
+	for (const auto &[tag, limit] : _settings.tagSizeLimits) {
+		const auto i = _taggedStats.find(tag);
+		if (i != end(_taggedStats) && i->second.totalSize > limit) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void DatabaseObject::collectTagStale(
+		base::flat_set<Key> &stale,
+		int64 &staleTotalSize) {
+	for (const auto &[tag, limit] : _settings.tagSizeLimits) {
+		const auto i = _taggedStats.find(tag);
+		if (i == end(_taggedStats) || i->second.totalSize <= limit) {
+			continue;
+		}
+		auto staleTagSize = int64();
+		for (const auto &key : stale) {
+			const auto j = _map.find(key);
+			if (j != end(_map) && valueTag(j->second) == tag) {
+				staleTagSize += j->second.size;
+			}
+		}
+		const auto removeSize = i->second.totalSize - staleTagSize - limit;
+		if (removeSize <= 0) {
+			continue;
+		}
+		const auto tagged = [=, tag = tag](const Entry &entry) {
+			return (valueTag(entry) == tag);
+		};
+		staleTotalSize += collectLowPriority(stale, removeSize, tagged);
+	}
+}
+
 void DatabaseObject::collectSizeStale(
 		base::flat_set<Key> &stale,
 		int64 &staleTotalSize) {
@@ -442,44 +544,59 @@ void DatabaseObject::collectSizeStale(
 	if (removeSize <= 0) {
 		return;
 	}
+	const auto any = [](const Entry &) {
+		return true;
+	};
+	staleTotalSize += collectLowPriority(stale, removeSize, any);
+}
 
-	using Bucket = std::pair<const Key, Entry>;
-	auto oldest = base::flat_multi_map<
+template <typename Filter>
+int64 DatabaseObject::collectLowPriority(
+		base::flat_set<Key> &stale,
+		int64 removeSize,
+		Filter &&filter) const {
+	using Bucket = Map::value_type;
+	auto lowest = base::flat_multi_map<
 		int64,
 		const Bucket*,
 		std::greater<>>();
-	auto oldestTotalSize = int64();
+	auto lowestTotalSize = int64();
 
-	const auto canRemoveFirst = [&](const Entry &adding) {
-		const auto totalSizeAfterAdd = oldestTotalSize + adding.size;
-		const auto &first = oldest.begin()->second->second;
-		return (adding.useTime <= first.useTime
-			&& (totalSizeAfterAdd - removeSize >= first.size));
+	const auto canRemoveFirst = [&](int64 priority, const Entry &adding) {
+		const auto totalSizeAfterAdd = lowestTotalSize + adding.size;
+		const auto &[firstPriority, first] = *lowest.begin();
+		return (priority <= firstPriority
+			&& (totalSizeAfterAdd - removeSize >= first->second.size));
 	};
 
 	for (const auto &bucket : _map) {
 		const auto &entry = bucket.second;
-		if (stale.contains(bucket.first)) {
+		if (!filter(entry) || stale.contains(bucket.first)) {
 			continue;
 		}
-		const auto add = (oldestTotalSize < removeSize)
+		const auto priority = EvictionPriority(
+			_settings,
+			entry.useTime,
+			entry.size,
+			entry.accessCount);
+		const auto add = (lowestTotalSize < removeSize)
 			? true
-			: (entry.useTime < oldest.begin()->second->second.useTime);
+			: (priority < lowest.begin()->first);
 		if (!add) {
 			continue;
 		}
-		while (!oldest.empty() && canRemoveFirst(entry)) {
-			oldestTotalSize -= oldest.begin()->second->second.size;
-			oldest.erase(oldest.begin());
+		while (!lowest.empty() && canRemoveFirst(priority, entry)) {
+			lowestTotalSize -= lowest.begin()->second->second.size;
+			lowest.erase(lowest.begin());
 		}
-		oldestTotalSize += entry.size;
-		oldest.emplace(entry.useTime, &bucket);
+		lowestTotalSize += entry.size;
+		lowest.emplace(priority, &bucket);
 	}
 
-	for (const auto &pair : oldest) {
+	for (const auto &pair : lowest) {
 		stale.emplace(pair.second->first);
 	}
-	staleTotalSize += oldestTotalSize;
+	return lowestTotalSize;
 }
 
 void DatabaseObject::adjustRelativeTime() {
@@ -584,6 +701,7 @@ void DatabaseObject::setMapEntry(const Key &key, Entry &&entry) {
 	auto &already = _map[key];
 	updateStats(already, entry);
 	if (already.size != 0) {
+		entry.accessCount = already.accessCount;
 		_binlogExcessLength += _settings.trackEstimatedTime
 			? sizeof(StoreWithTime)
 			: sizeof(Store);
@@ -608,20 +726,22 @@ void DatabaseObject::setMapEntry(const Key &key, Entry &&entry) {
 
 void DatabaseObject::updateStats(const Entry &was, const Entry &now) {
 	_totalSize += now.size - was.size;
-	if (now.tag == was.tag) {
-		if (now.tag) {
-			auto &summary = _taggedStats[now.tag];
+	const auto nowTag = valueTag(now);
+	const auto wasTag = valueTag(was);
+	if (nowTag == wasTag) {
+		if (nowTag) {
+			auto &summary = _taggedStats[nowTag];
 			summary.count += (now.size ? 1 : 0) - (was.size ? 1 : 0);
 			summary.totalSize += now.size - was.size;
 		}
 	} else {
-		if (now.tag) {
-			auto &summary = _taggedStats[now.tag];
+		if (nowTag) {
+			auto &summary = _taggedStats[nowTag];
 			summary.count += (now.size ? 1 : 0);
 			summary.totalSize += now.size;
 		}
-		if (was.tag) {
-			auto &summary = _taggedStats[was.tag];
+		if (wasTag) {
+			auto &summary = _taggedStats[wasTag];
 			summary.count -= (was.size ? 1 : 0);
 			summary.totalSize -= was.size;
 		}
@@ -629,6 +749,17 @@ void DatabaseObject::updateStats(const Entry &was, const Entry &now) {
 	pushStatsDelayed();
 }
 
+void DatabaseObject::updateCompressionStats(
+		uint8 tag,
+		size_type originalSize,
+		size_type storedSize) {
+	auto &summary = _compressionStats[tag];
+	++summary.count;
+	summary.originalSize += originalSize;
+	summary.storedSize += storedSize;
+	pushStatsDelayed();
+}
+
 void DatabaseObject::pushStatsDelayed() {
 	if (_pushingStats) {
 		return;
@@ -680,11 +811,27 @@ void DatabaseObject::applyTimePoint(EstimatedTimePoint time) {
 
 void DatabaseObject::compactorDone(
 		const QString &path,
-		int64 originalReadTill) {
+		int64 originalReadTill,
+		base::binary_guard &&guard) {
 	const auto size = _binlog.size();
 	const auto binlog = binlogPath();
 	const auto ready = compactReadyPath();
+	if (size - originalReadTill > _settings.compactCatchUpLimit) {
+		// Don't block the queue copying a long tail of the binlog,
+		// let the compactor catch up once more on its own queue.
+		// If the writes are still ahead of it, try again a bit later.
+		if (_compactor.catchUpRounds < kMaxCompactorCatchUpRounds) {
+			++_compactor.catchUpRounds;
+			_compactor.object->catchUp(std::move(guard));
+		} else {
+			_compactor.catchUpRounds = 0;
+			_compactor.catchUpGuard = std::move(guard);
+			_compactorCatchUpTimer.callOnce(kCompactorCatchUpRetryDelay);
+		}
+		return;
+	}
 	if (originalReadTill != size) {
+		accumulate_max(_compactMaxCatchUpBytes, size - originalReadTill);
 		originalReadTill = CatchUp(
 			path,
 			binlog,
@@ -719,6 +866,22 @@ void DatabaseObject::compactorDone(
 	}
 	_binlogExcessLength -= _compactor.excessLength;
 	Assert(_binlogExcessLength >= 0);
+	++_compactionsCount;
+}
+
+void DatabaseObject::compactorCatchUp() {
+	if (_compactor.object && _compactor.catchUpGuard) {
+		_compactor.object->catchUp(base::take(_compactor.catchUpGuard));
+	}
+}
+
+void DatabaseObject::compactorProgress(int64 progress, int64 total) {
+	if (!_compactor.object) {
+		return;
+	}
+	_compactor.progress = progress;
+	_compactor.total = total;
+	pushStatsDelayed();
 }
 
 void DatabaseObject::compactorFail() {
@@ -736,6 +899,7 @@ void DatabaseObject::close(FnMut<void()> &&done) {
 		writeBundles();
 		_binlog.close();
 	}
+	_trace = nullptr;
 	invokeCallback(done);
 	clearState();
 }
@@ -752,10 +916,20 @@ void DatabaseObject::clearState() {
 	_totalSize = 0;
 	_minimalEntryTime = 0;
 	_entriesWithMinimalTimeCount = 0;
+	_accessesSinceAging = 0;
 	_taggedStats = {};
+	_compressionStats = {};
+	_readBuffers = {};
+	_readsCount = 0;
+	_readAllocations = 0;
+	_compactionsCount = 0;
+	_compactMaxChunkKeys = 0;
+	_compactMaxCatchUpBytes = 0;
+	_compressionAllowed = false;
 	_pushingStats = false;
 	_writeBundlesTimer.cancel();
 	_pruneTimer.cancel();
+	_compactorCatchUpTimer.cancel();
 	_compactor = CompactorWrap();
 }
 
@@ -766,10 +940,26 @@ void DatabaseObject::put(
 	if (value.bytes.isEmpty()) {
 		remove(key, std::move(done));
 		return;
+	} else if (_compressionAllowed && value.tag > kMaxValueTag) {
+		// The high bit would be read as the compressed flag.
+		invokeCallback(done, Error{ Error::Type::WrongTag, binlogPath() });
+		return;
 	}
+	trace(TraceOperation::Put, key, value.bytes.size(), value.tag);
 	_removing.erase(key);
 	_stale.erase(ranges::remove(_stale, key), end(_stale));
 
+	const auto tag = value.tag;
+	const auto originalSize = size_type(value.bytes.size());
+	const auto compress = _compressionAllowed
+		&& _settings.compressTags.contains(tag);
+	if (compress) {
+		if (auto compressed = Compress(value.bytes); !compressed.isEmpty()) {
+			value.bytes = std::move(compressed);
+			value.tag |= kCompressedTagFlag;
+		}
+	}
+
 	const auto checksum = CountChecksum(bytes::make_span(value.bytes));
 	const auto maybepath = writeKeyPlace(key, value, checksum);
 	if (!maybepath) {
@@ -786,12 +976,12 @@ void DatabaseObject::put(
 	const auto result = data.open(path, File::Mode::Write, _key);
 	switch (result) {
 	case File::Result::Failed:
-		remove(key, nullptr);
+		removeEntry(key, nullptr);
 		invokeCallback(done, ioError(path));
 		break;
 
 	case File::Result::LockFailed:
-		remove(key, nullptr);
+		removeEntry(key, nullptr);
 		invokeCallback(done, Error{ Error::Type::LockFailed, path });
 		break;
 
@@ -800,10 +990,13 @@ void DatabaseObject::put(
 			bytes::make_detached_span(value.bytes));
 		if (!success) {
 			data.close();
-			remove(key, nullptr);
+			removeEntry(key, nullptr);
 			invokeCallback(done, ioError(path));
 		} else {
 			data.flush();
+			if (compress) {
+				updateCompressionStats(tag, originalSize, value.bytes.size());
+			}
 			invokeCallback(done, Error::NoError());
 			optimize();
 		}
@@ -937,6 +1130,7 @@ void DatabaseObject::get(
 		FnMut<void(TaggedValue&&)> &&done) {
 	const auto i = _map.find(key);
 	if (i == _map.end()) {
+		trace(TraceOperation::Get, key);
 		invokeCallback(done, TaggedValue());
 		return;
 	}
@@ -944,12 +1138,27 @@ void DatabaseObject::get(
 
 	auto bytes = readValueData(entry.place, entry.size);
 	if (bytes.isEmpty()) {
-		remove(key, nullptr);
+		trace(TraceOperation::Get, key);
+		removeEntry(key, nullptr);
 		invokeCallback(done, TaggedValue());
 	} else if (CountChecksum(bytes::make_span(bytes)) != entry.checksum) {
-		remove(key, nullptr);
+		trace(TraceOperation::Get, key);
+		removeEntry(key, nullptr);
 		invokeCallback(done, TaggedValue());
+	} else if (compressed(entry)) {
+		auto decompressed = Decompress(bytes);
+		if (decompressed.isEmpty()) {
+			trace(TraceOperation::Get, key);
+			removeEntry(key, nullptr);
+			invokeCallback(done, TaggedValue());
+			return;
+		}
+		const auto tag = valueTag(entry);
+		trace(TraceOperation::Get, key, decompressed.size(), tag);
+		invokeCallback(done, TaggedValue(std::move(decompressed), tag));
+		recordEntryAccess(key);
 	} else {
+		trace(TraceOperation::Get, key, bytes.size(), entry.tag);
 		invokeCallback(done, TaggedValue(std::move(bytes), entry.tag));
 		recordEntryAccess(key);
 	}
@@ -967,16 +1176,67 @@ void DatabaseObject::getWithSizes(
 
 		auto sizes = keys | ranges::view::transform([&](const Key &sizeKey) {
 			const auto i = _map.find(sizeKey);
-			return (i != end(_map)) ? int(i->second.size) : 0;
+			return (i != end(_map)) ? int(readValueSize(i->second)) : 0;
 		}) | ranges::to_vector;
 
 		invokeCallback(done, std::move(value.bytes), std::move(sizes));
 	});
 }
 
-QByteArray DatabaseObject::readValueData(
-		PlaceId place,
-		size_type size) const {
+void DatabaseObject::getMany(
+		std::vector<Key> &&keys,
+		FnMut<void(std::vector<TaggedValue>&&)> &&done) {
+	auto result = std::vector<TaggedValue>(keys.size());
+
+	// Read place files in the order of their paths for better locality.
+	auto order = std::vector<std::pair<PlaceId, size_type>>();
+	order.reserve(keys.size());
+	const auto count = size_type(keys.size());
+	for (auto i = size_type(0); i != count; ++i) {
+		if (const auto j = _map.find(keys[i]); j != end(_map)) {
+			order.emplace_back(j->second.place, i);
+		}
+	}
+	ranges::sort(order);
+	for (const auto &[place, index] : order) {
+		get(keys[index], [&](TaggedValue &&value) {
+			result[index] = std::move(value);
+		});
+	}
+	invokeCallback(done, std::move(result));
+}
+
+bool DatabaseObject::compressed(const Entry &entry) const {
+	return _compressionAllowed && (entry.tag & kCompressedTagFlag);
+}
+
+uint8 DatabaseObject::valueTag(const Entry &entry) const {
+	return compressed(entry)
+		? uint8(entry.tag & ~kCompressedTagFlag)
+		: entry.tag;
+}
+
+size_type DatabaseObject::readValueSize(const Entry &entry) const {
+	if (!compressed(entry)) {
+		return entry.size;
+	}
+
+	// The original size is in front of the compressed value.
+	File data;
+	const auto result = data.open(
+		placePath(entry.place),
+		File::Mode::Read,
+		_key);
+	auto size = qint32();
+	if (result != File::Result::Success
+		|| (data.readWithPadding(bytes::object_as_span(&size))
+			!= sizeof(size))) {
+		return 0;
+	}
+	return (size > 0 && size < kDataSizeLimit) ? size : 0;
+}
+
+QByteArray DatabaseObject::readValueData(PlaceId place, size_type size) {
 	const auto path = placePath(place);
 	File data;
 	const auto result = data.open(path, File::Mode::Read, _key);
@@ -984,19 +1244,52 @@ QByteArray DatabaseObject::readValueData(
 	case File::Result::Failed:
 	case File::Result::WrongKey: return QByteArray();
 	case File::Result::Success: {
-		auto result = QByteArray(size, Qt::Uninitialized);
+		auto result = takeReadBuffer(size);
 		const auto bytes = bytes::make_detached_span(result);
-		const auto read = data.readWithPadding(bytes);
-		if (read != size) {
+		if (data.readWithPadding(bytes) != size) {
 			return QByteArray();
 		}
+		keepReadBuffer(result);
 		return result;
 	} break;
 	}
 	Unexpected("Result in DatabaseObject::get.");
 }
 
+QByteArray DatabaseObject::takeReadBuffer(size_type size) {
+	++_readsCount;
+	if (_settings.reuseReadBuffers && size <= kReadBufferSizeLimit) {
+		for (auto i = begin(_readBuffers); i != end(_readBuffers); ++i) {
+			// Detached means the reader of this value has released it.
+			if (i->isDetached() && i->capacity() >= size) {
+				auto result = std::move(*i);
+				_readBuffers.erase(i);
+				result.resize(size);
+				return result;
+			}
+		}
+	}
+	++_readAllocations;
+	return QByteArray(size, Qt::Uninitialized);
+}
+
+void DatabaseObject::keepReadBuffer(const QByteArray &buffer) {
+	if (!_settings.reuseReadBuffers || buffer.size() > kReadBufferSizeLimit) {
+		return;
+	} else if (_readBuffers.size() < kReadBuffersCount) {
+		_readBuffers.push_back(buffer);
+		return;
+	}
+	for (auto &already : _readBuffers) {
+		if (already.isDetached() && already.capacity() < buffer.size()) {
+			already = buffer;
+			return;
+		}
+	}
+}
+
 void DatabaseObject::recordEntryAccess(const Key &key) {
+	countEntryAccess(key);
 	if (!_settings.trackEstimatedTime) {
 		return;
 	}
@@ -1005,7 +1298,49 @@ void DatabaseObject::recordEntryAccess(const Key &key) {
 	optimize();
 }
 
+void DatabaseObject::countEntryAccess(const Key &key) {
+	if (_settings.evictionPolicy != EvictionPolicy::FrequencyAware) {
+		return;
+	}
+	const auto i = _map.find(key);
+	if (i == end(_map)) {
+		return;
+	}
+	auto &count = i->second.accessCount;
+	if (count < std::numeric_limits<uint16>::max()) {
+		++count;
+	}
+
+	// Halve all the counters from time to time, so that the values
+	// that were read a lot long ago don't stay in the cache forever.
+	const auto ageAfter = kAgeAccessCountsEvery
+		* std::max(_map.size(), kMinAgeAccessCountsAfter);
+	if (++_accessesSinceAging >= ageAfter) {
+		_accessesSinceAging = 0;
+		for (auto &bucket : _map) {
+			bucket.second.accessCount /= 2;
+		}
+	}
+}
+
+void DatabaseObject::trace(
+		TraceOperation operation,
+		const Key &key,
+		size_type size,
+		uint8 tag) {
+	if (_trace) {
+		_trace->write(operation, key, size, tag);
+	}
+}
+
 void DatabaseObject::remove(const Key &key, FnMut<void(Error)> &&done) {
+	trace(TraceOperation::Remove, key);
+	removeEntry(key, std::move(done));
+}
+
+void DatabaseObject::removeEntry(
+		const Key &key,
+		FnMut<void(Error)> &&done) {
 	const auto i = _map.find(key);
 	if (i != _map.end()) {
 		_removing.emplace(key);
@@ -1023,6 +1358,10 @@ void DatabaseObject::remove(const Key &key, FnMut<void(Error)> &&done) {
 	}
 }
 
+bool DatabaseObject::contains(const Key &key) const {
+	return (_map.find(key) != end(_map));
+}
+
 void DatabaseObject::putIfEmpty(
 		const Key &key,
 		TaggedValue &&value,
@@ -1082,9 +1421,18 @@ rpl::producer<Stats> DatabaseObject::stats() const {
 Stats DatabaseObject::collectStats() const {
 	auto result = Stats();
 	result.tagged = _taggedStats;
+	result.compressed = _compressionStats;
 	result.full.count = _map.size();
 	result.full.totalSize = _totalSize;
 	result.clearing = (_cleaner.object != nullptr) || !_stale.empty();
+	result.compacting = (_compactor.object != nullptr);
+	result.compactProgress = _compactor.progress;
+	result.compactTotal = _compactor.total;
+	result.readsCount = _readsCount;
+	result.readAllocations = _readAllocations;
+	result.compactionsCount = _compactionsCount;
+	result.compactMaxChunkKeys = _compactMaxChunkKeys;
+	result.compactMaxCatchUpBytes = _compactMaxCatchUpBytes;
 	return result;
 }
 
@@ -1223,6 +1571,8 @@ void DatabaseObject::checkCompactor() {
 		base::duplicate(_key),
 		info);
 	_compactor.excessLength = _binlogExcessLength;
+	_compactor.total = info.till;
+	pushStatsDelayed();
 }
 
 void DatabaseObject::clear(FnMut<void(Error)> &&done) {
@@ -1246,7 +1596,7 @@ void DatabaseObject::clear(FnMut<void(Error)> &&done) {
 void DatabaseObject::clearByTag(uint8 tag, FnMut<void(Error)> &&done) {
 	const auto hadStale = !_stale.empty();
 	for (const auto &[key, entry] : _map) {
-		if (entry.tag == tag) {
+		if (valueTag(entry) == tag) {
 			_stale.push_back(key);
 		}
 	}
@@ -1267,8 +1617,10 @@ void DatabaseObject::waitForCleaner(FnMut<void()> &&done) {
 	}
 }
 
-auto DatabaseObject::getManyRaw(const std::vector<Key> &keys) const
+auto DatabaseObject::getManyRaw(const std::vector<Key> &keys)
 -> std::vector<Raw> {
+	accumulate_max(_compactMaxChunkKeys, int64(keys.size()));
+
 	auto result = std::vector<Raw>();
 	result.reserve(keys.size());
 	for (const auto &key : keys) {
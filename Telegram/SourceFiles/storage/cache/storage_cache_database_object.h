@@ -8,6 +8,8 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #pragma once
 
 #include "storage/cache/storage_cache_database.h"
+#include "storage/cache/storage_cache_key_map.h"
+#include "storage/cache/storage_cache_trace.h"
 #include "storage/storage_encrypted_file.h"
 #include "base/binary_guard.h"
 #include "base/concurrent_timer.h"
@@ -42,6 +44,7 @@ public:
 		FnMut<void(Error)> &&done);
 	void get(const Key &key, FnMut<void(TaggedValue&&)> &&done);
 	void remove(const Key &key, FnMut<void(Error)> &&done);
+	bool contains(const Key &key) const;
 
 	void putIfEmpty(
 		const Key &key,
@@ -60,6 +63,9 @@ public:
 		const Key &key,
 		std::vector<Key> &&keys,
 		FnMut<void(QByteArray&&, std::vector<int>&&)> &&done);
+	void getMany(
+		std::vector<Key> &&keys,
+		FnMut<void(std::vector<TaggedValue>&&)> &&done);
 
 	rpl::producer<Stats> stats() const;
 
@@ -70,8 +76,13 @@ public:
 	static QString BinlogFilename();
 	static QString CompactReadyFilename();
 
-	void compactorDone(const QString &path, int64 originalReadTill);
+	void compactorDone(
+		const QString &path,
+		int64 originalReadTill,
+		base::binary_guard &&guard);
+	void compactorProgress(int64 progress, int64 total);
 	void compactorFail();
+	void compactorCatchUp();
 
 	struct Entry {
 		Entry() = default;
@@ -87,9 +98,10 @@ public:
 		uint32 checksum = 0;
 		PlaceId place = { { 0 } };
 		uint8 tag = 0;
+		uint16 accessCount = 0; // Not saved, counted for eviction.
 	};
 	using Raw = std::pair<Key, Entry>;
-	std::vector<Raw> getManyRaw(const std::vector<Key> &keys) const;
+	std::vector<Raw> getManyRaw(const std::vector<Key> &keys);
 
 	~DatabaseObject();
 
@@ -102,11 +114,15 @@ private:
 	struct CompactorWrap {
 		std::unique_ptr<Compactor> object;
 		int64 excessLength = 0;
+		int64 progress = 0;
+		int64 total = 0;
+		int catchUpRounds = 0;
+		base::binary_guard catchUpGuard;
 		crl::time nextAttempt = 0;
 		crl::time delayAfterFailure = 10 * crl::time(1000);
 		base::binary_guard guard;
 	};
-	using Map = std::unordered_map<Key, Entry>;
+	using Map = KeyMap<Entry>;
 
 	template <typename Callback, typename ...Args>
 	void invokeCallback(Callback &&callback, Args &&...args) const;
@@ -165,23 +181,50 @@ private:
 	void collectTimeStale(
 		base::flat_set<Key> &stale,
 		int64 &staleTotalSize);
+	void collectTagStale(
+		base::flat_set<Key> &stale,
+		int64 &staleTotalSize);
 	void collectSizeStale(
 		base::flat_set<Key> &stale,
 		int64 &staleTotalSize);
+	template <typename Filter>
+	int64 collectLowPriority(
+		base::flat_set<Key> &stale,
+		int64 removeSize,
+		Filter &&filter) const;
+	bool tagSizeLimitExceeded() const;
 	void startStaleClear();
 	void clearStaleNow(const base::flat_set<Key> &stale);
 	void clearStaleChunkDelayed();
 	void clearStaleChunk();
 
 	void updateStats(const Entry &was, const Entry &now);
+	void updateCompressionStats(
+		uint8 tag,
+		size_type originalSize,
+		size_type storedSize);
 	Stats collectStats() const;
 	void pushStatsDelayed();
 	void pushStats();
 
 	void setMapEntry(const Key &key, Entry &&entry);
 	void eraseMapEntry(const Map::const_iterator &i);
+	void removeEntry(const Key &key, FnMut<void(Error)> &&done);
 	void recordEntryAccess(const Key &key);
-	QByteArray readValueData(PlaceId place, size_type size) const;
+	void trace(
+		TraceOperation operation,
+		const Key &key,
+		size_type size = 0,
+		uint8 tag = 0);
+	void countEntryAccess(const Key &key);
+
+	// The tag high bit is the compressed flag only in Format_1 binlogs.
+	bool compressed(const Entry &entry) const;
+	uint8 valueTag(const Entry &entry) const;
+	size_type readValueSize(const Entry &entry) const;
+	QByteArray readValueData(PlaceId place, size_type size);
+	QByteArray takeReadBuffer(size_type size);
+	void keepReadBuffer(const QByteArray &buffer);
 
 	Version findAvailableVersion() const;
 	QString versionPath() const;
@@ -237,18 +280,36 @@ private:
 	int64 _totalSize = 0;
 	uint64 _minimalEntryTime = 0;
 	size_type _entriesWithMinimalTimeCount = 0;
+	size_type _accessesSinceAging = 0;
 
 	base::flat_map<uint8, TaggedSummary> _taggedStats;
+	base::flat_map<uint8, CompressionSummary> _compressionStats;
 	rpl::event_stream<Stats> _stats;
+
+	// With Settings::reuseReadBuffers the values are read to these buffers,
+	// a buffer is reused when the reader of its previous value drops it.
+	std::vector<QByteArray> _readBuffers;
+	int64 _readsCount = 0;
+	int64 _readAllocations = 0;
+
+	// The most work a compaction has done on this queue in one task.
+	int64 _compactionsCount = 0;
+	int64 _compactMaxChunkKeys = 0;
+	int64 _compactMaxCatchUpBytes = 0;
+
+	bool _compressionAllowed = false;
 	bool _pushingStats = false;
 	bool _clearingStale = false;
 
 	base::ConcurrentTimer _writeBundlesTimer;
 	base::ConcurrentTimer _pruneTimer;
+	base::ConcurrentTimer _compactorCatchUpTimer;
 
 	CleanerWrap _cleaner;
 	CompactorWrap _compactor;
 
+	std::unique_ptr<TraceWriter> _trace;
+
 };
 
 } // namespace details
@@ -8,19 +8,25 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "catch.hpp"
 
 #include "storage/cache/storage_cache_database.h"
+#include "storage/cache/storage_cache_database_object.h"
+#include "storage/cache/storage_cache_trace.h"
 #include "storage/storage_encryption.h"
 #include "storage/storage_encrypted_file.h"
 #include "base/concurrent_timer.h"
 #include <crl/crl.h>
 #include <QtCore/QFile>
+#include <QtCore/QDir>
 #include <QtWidgets/QApplication>
 #include <thread>
+#include <chrono>
+#include <random>
 
 using namespace Storage::Cache;
 
 const auto DisableLimitsTests = false;
 const auto DisableCompactTests = false;
 const auto DisableLargeTest = true;
+const auto DisableBenchmarkTests = true;
 
 const auto key = Storage::EncryptionKey(bytes::make_vector(
 	bytes::make_span("\
@@ -59,6 +65,20 @@ QString GetBinlogPath() {
 	return name + '/' + QString::number(version) + "/binlog";
 }
 
+std::optional<details::Format> GetBinlogFormat() {
+	auto file = Storage::File();
+	const auto result = file.open(
+		GetBinlogPath(),
+		Storage::File::Mode::Read,
+		key);
+	auto header = details::BasicHeader();
+	if (result != Storage::File::Result::Success
+		|| file.read(bytes::object_as_span(&header)) != sizeof(header)) {
+		return std::nullopt;
+	}
+	return header.getFormat();
+}
+
 const auto Test1 = [] {
 	static auto result = QByteArray("testbytetestbyt");
 	return result;
@@ -117,6 +137,20 @@ Database::TaggedValue GetWithTag(Database &db, const Key &key) {
 	return ValueWithTag;
 }
 
+auto Values = std::vector<Database::TaggedValue>();
+const auto GetValues = [](std::vector<Database::TaggedValue> &&values) {
+	Values = std::move(values);
+	Semaphore.release();
+};
+
+std::vector<Database::TaggedValue> GetMany(
+		Database &db,
+		std::vector<Key> &&keys) {
+	db.getMany(std::move(keys), GetValues);
+	Semaphore.acquire();
+	return Values;
+}
+
 Error Put(Database &db, const Key &key, QByteArray &&value) {
 	db.put(key, std::move(value), GetResult);
 	Semaphore.acquire();
@@ -383,6 +417,109 @@ TEST_CASE("compacting db", "[storage_cache_database]") {
 	}
 }
 
+TEST_CASE("compacting db in bounded tasks", "[storage_cache_database]") {
+	if (DisableCompactTests || !DisableLargeTest) {
+		return;
+	}
+	using Object = crl::object_on_queue<details::DatabaseObject>;
+
+	auto settings = Settings;
+	settings.writeBundleDelay = crl::time(100);
+	settings.maxBundledRecords = 16;
+	settings.compactAfterExcess = 8 * 1024;
+	settings.compactChunkSize = 64;
+	settings.compactCatchUpLimit = 4 * 1024;
+	{
+		Database db(name, settings);
+		REQUIRE(Clear(db).type == Error::Type::None);
+	}
+
+	auto object = Object(name, settings);
+	const auto put = [&](uint32 i, QByteArray value) {
+		object.with([=](details::DatabaseObject &unwrapped) mutable {
+			unwrapped.put(
+				Key{ i, i + 1 },
+				Database::TaggedValue(std::move(value), 0),
+				GetResult);
+		});
+		Semaphore.acquire();
+		REQUIRE(Result.type == Error::Type::None);
+	};
+	const auto remove = [&](uint32 i) {
+		object.with([=](details::DatabaseObject &unwrapped) {
+			unwrapped.remove(Key{ i, i + 1 }, GetResult);
+		});
+		Semaphore.acquire();
+	};
+	const auto get = [&](uint32 i) {
+		object.with([=](details::DatabaseObject &unwrapped) {
+			unwrapped.get(Key{ i, i + 1 }, GetValueWithTag);
+		});
+		Semaphore.acquire();
+		return ValueWithTag.bytes;
+	};
+	const auto stats = [&] {
+		auto result = Database::Stats();
+		object.with([&](details::DatabaseObject &unwrapped) {
+			auto lifetime = rpl::lifetime();
+			unwrapped.stats(
+			) | rpl::start_with_next([&](Database::Stats &&value) {
+				result = std::move(value);
+			}, lifetime);
+			Semaphore.release();
+		});
+		Semaphore.acquire();
+		return result;
+	};
+	const auto value = [](uint32 i, uint32 round) {
+		auto result = (round % 2) ? Test2() : Test1();
+		result[0] = char('A') + (i % 26);
+		return result;
+	};
+
+	object.with([](details::DatabaseObject &unwrapped) {
+		unwrapped.open(base::duplicate(key), GetResult);
+	});
+	Semaphore.acquire();
+	REQUIRE(Result.type == Error::Type::None);
+
+	// Each binlog block read by the compactor holds a lot more keys
+	// than a chunk, the writes keep going while it is working.
+	const auto kKeys = 512U;
+	const auto kRounds = 8U;
+	for (auto round = 0U; round != kRounds; ++round) {
+		for (auto i = 0U; i != kKeys; ++i) {
+			put(i, value(i, round));
+			if (i % 4 == 3) {
+				remove(i - 1);
+			}
+		}
+	}
+	for (auto waited = 0; !stats().compactionsCount; waited += 10) {
+		REQUIRE(waited < 5000);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	for (auto i = 0U; i != kKeys; ++i) {
+		if (i % 4 == 2) {
+			REQUIRE(get(i).isEmpty());
+		} else {
+			REQUIRE((get(i) == value(i, kRounds - 1)));
+		}
+	}
+
+	const auto result = stats();
+	REQUIRE(result.compactionsCount > 0);
+	REQUIRE(result.compactMaxChunkKeys > 0);
+	REQUIRE(result.compactMaxChunkKeys <= settings.compactChunkSize);
+	REQUIRE(result.compactMaxCatchUpBytes
+		<= settings.compactCatchUpLimit);
+
+	object.with([](details::DatabaseObject &unwrapped) {
+		unwrapped.close([] { Semaphore.release(); });
+	});
+	Semaphore.acquire();
+}
+
 TEST_CASE("encrypted cache db", "[storage_cache_database]") {
 	if (!DisableLargeTest) {
 		return;
@@ -448,6 +585,20 @@ TEST_CASE("encrypted cache db", "[storage_cache_database]") {
 		REQUIRE((Get(db, Key{ 1, 0 }) == Test2()));
 		Close(db);
 	}
+	SECTION("reading many values from db") {
+		Database db(name, Settings);
+
+		REQUIRE(Open(db, key).type == Error::Type::None);
+		const auto values = GetMany(
+			db,
+			{ Key{ 5, 2 }, Key{ 1, 1 }, Key{ 0, 1 }, Key{ 6, 3 } });
+		REQUIRE(values.size() == 4);
+		REQUIRE(((values[0].bytes == Test1()) && (values[0].tag == 2)));
+		REQUIRE(values[1].bytes.isEmpty());
+		REQUIRE((values[2].bytes == Test1()));
+		REQUIRE(((values[3].bytes == Test2()) && (values[3].tag == 3)));
+		Close(db);
+	}
 	SECTION("deleting in db by tag") {
 		Database db(name, Settings);
 
@@ -512,6 +663,304 @@ TEST_CASE("encrypted cache db", "[storage_cache_database]") {
 	}
 }
 
+TEST_CASE("sharded cache db", "[storage_cache_database]") {
+	if (!DisableLargeTest) {
+		return;
+	}
+	auto settings = Settings;
+	settings.shardsCount = 4;
+	const auto count = 64U;
+	SECTION("writing sharded db") {
+		Database db(name, settings);
+
+		REQUIRE(Clear(db).type == Error::Type::None);
+		REQUIRE(Open(db, key).type == Error::Type::None);
+		for (auto i = 0U; i != count; ++i) {
+			auto value = Test1();
+			value[0] = char('A') + (i % 26);
+			const auto result = Put(db, Key{ i, i * 2 }, std::move(value));
+			REQUIRE(result.type == Error::Type::None);
+		}
+		REQUIRE(CopyIfEmpty(db, Key{ 0, 0 }, Key{ count, 0 }).type
+			== Error::Type::None);
+		REQUIRE(MoveIfEmpty(db, Key{ 1, 2 }, Key{ count + 1, 0 }).type
+			== Error::Type::None);
+		Close(db);
+	}
+	SECTION("reading sharded db") {
+		Database db(name, settings);
+
+		REQUIRE(Open(db, key).type == Error::Type::None);
+		for (auto i = 0U; i != count; ++i) {
+			auto value = Test1();
+			value[0] = char('A') + (i % 26);
+			if (i == 1) {
+				REQUIRE(Get(db, Key{ i, i * 2 }).isEmpty());
+			} else {
+				REQUIRE((Get(db, Key{ i, i * 2 }) == value));
+			}
+		}
+		auto first = Test1();
+		first[0] = 'A';
+		auto second = Test1();
+		second[0] = 'B';
+		const auto values = GetMany(db, { Key{ 0, 0 }, Key{ 3, 6 } });
+		REQUIRE(values.size() == 2);
+		REQUIRE((values[0].bytes == first));
+		REQUIRE(values[1].bytes.size() == Test1().size());
+		REQUIRE((Get(db, Key{ count, 0 }) == first));
+		REQUIRE((Get(db, Key{ count + 1, 0 }) == second));
+		Close(db);
+	}
+	SECTION("copying and moving to existing values") {
+		Database db(name, settings);
+
+		// Most of these pairs of keys are in different shards.
+		REQUIRE(Open(db, key).type == Error::Type::None);
+		for (auto i = 2U; i != 10U; ++i) {
+			auto value = Test1();
+			value[0] = char('A') + (i % 26);
+			const auto from = Key{ i, i * 2 };
+			const auto existing = Key{ count + i, 1 };
+			const auto empty = Key{ 2 * count + i, 1 };
+			REQUIRE(Put(db, existing, Test2()).type == Error::Type::None);
+
+			REQUIRE(CopyIfEmpty(db, from, existing).type
+				== Error::Type::None);
+			REQUIRE((Get(db, existing) == Test2()));
+			REQUIRE(MoveIfEmpty(db, from, existing).type
+				== Error::Type::None);
+			REQUIRE((Get(db, existing) == Test2()));
+			REQUIRE((Get(db, from) == value));
+
+			REQUIRE(MoveIfEmpty(db, from, empty).type == Error::Type::None);
+			REQUIRE((Get(db, empty) == value));
+			REQUIRE(Get(db, from).isEmpty());
+			REQUIRE(CopyIfEmpty(db, from, existing).type
+				== Error::Type::None);
+			REQUIRE((Get(db, existing) == Test2()));
+		}
+		Close(db);
+	}
+	SECTION("opening with another shards count") {
+		auto other = settings;
+		other.shardsCount = 2;
+		{
+			Database db(name, other);
+			REQUIRE(Open(db, key).type == Error::Type::IO);
+		}
+		other.shardsCount = 1;
+		{
+			Database db(name, other);
+			REQUIRE(Open(db, key).type == Error::Type::IO);
+		}
+		{
+			Database db(name, settings);
+			REQUIRE(Open(db, key).type == Error::Type::None);
+			REQUIRE((Get(db, Key{ count, 0 }).size() == Test1().size()));
+			Close(db);
+		}
+		{
+			Database db(name, other);
+			REQUIRE(Clear(db).type == Error::Type::None);
+			REQUIRE(Open(db, key).type == Error::Type::None);
+			REQUIRE(Get(db, Key{ count, 0 }).isEmpty());
+			Close(db);
+		}
+		{
+			Database db(name, settings);
+			REQUIRE(Open(db, key).type == Error::Type::IO);
+		}
+	}
+}
+
+TEST_CASE("compressed cache db", "[storage_cache_database]") {
+	if (!DisableLargeTest) {
+		return;
+	}
+	auto settings = Settings;
+	settings.maxDataSize = 1024;
+	settings.compressTags = { 1 };
+	const auto repeated = QByteArray(1000, 'a') + Test1();
+	SECTION("writing compressed values") {
+		Database db(name, settings);
+
+		REQUIRE(Clear(db).type == Error::Type::None);
+		REQUIRE(Open(db, key).type == Error::Type::None);
+		REQUIRE(Put(db, Key{ 0, 1 }, Database::TaggedValue(
+			base::duplicate(repeated),
+			1)).type == Error::Type::None);
+		REQUIRE(Put(db, Key{ 0, 2 }, Database::TaggedValue(Test1(), 1)).type
+			== Error::Type::None);
+		REQUIRE(Put(db, Key{ 0, 3 }, Database::TaggedValue(
+			base::duplicate(repeated),
+			2)).type == Error::Type::None);
+
+		const auto compressed = GetWithTag(db, Key{ 0, 1 });
+		REQUIRE((compressed.bytes == repeated));
+		REQUIRE(compressed.tag == 1);
+		const auto small = GetWithTag(db, Key{ 0, 2 });
+		REQUIRE((small.bytes == Test1()));
+		REQUIRE(small.tag == 1);
+		Close(db);
+
+		// Older versions reject this binlog instead of misreading values.
+		REQUIRE(GetBinlogFormat() == details::Format::Format_1);
+	}
+	SECTION("reading compressed values") {
+		Database db(name, settings);
+
+		REQUIRE(Open(db, key).type == Error::Type::None);
+		const auto compressed = GetWithTag(db, Key{ 0, 1 });
+		REQUIRE((compressed.bytes == repeated));
+		REQUIRE(compressed.tag == 1);
+		const auto plain = GetWithTag(db, Key{ 0, 3 });
+		REQUIRE((plain.bytes == repeated));
+		REQUIRE(plain.tag == 2);
+
+		auto sizes = std::vector<int>();
+		db.getWithSizes(Key{ 0, 3 }, { Key{ 0, 1 }, Key{ 0, 2 } }, [&](
+				QByteArray &&value,
+				std::vector<int> &&result) {
+			sizes = std::move(result);
+			Semaphore.release();
+		});
+		Semaphore.acquire();
+		REQUIRE((sizes == std::vector<int>{
+			repeated.size(),
+			Test1().size()
+		}));
+		REQUIRE(CopyIfEmpty(db, Key{ 0, 1 }, Key{ 1, 1 }).type
+			== Error::Type::None);
+		REQUIRE(MoveIfEmpty(db, Key{ 0, 1 }, Key{ 2, 1 }).type
+			== Error::Type::None);
+		REQUIRE((Get(db, Key{ 1, 1 }) == repeated));
+		REQUIRE((Get(db, Key{ 2, 1 }) == repeated));
+		REQUIRE(Get(db, Key{ 0, 1 }).isEmpty());
+		Close(db);
+	}
+	SECTION("clearing compressed values by tag") {
+		Database db(name, settings);
+
+		REQUIRE(Open(db, key).type == Error::Type::None);
+		REQUIRE(ClearByTag(db, 1).type == Error::Type::None);
+		db.waitForCleaner([&] { Semaphore.release(); });
+		Semaphore.acquire();
+		REQUIRE(Get(db, Key{ 1, 1 }).isEmpty());
+		REQUIRE(Get(db, Key{ 2, 1 }).isEmpty());
+		REQUIRE(Get(db, Key{ 0, 2 }).isEmpty());
+		REQUIRE((Get(db, Key{ 0, 3 }) == repeated));
+		Close(db);
+	}
+	SECTION("keeping values plain in old format binlog") {
+		auto plain = settings;
+		plain.compressTags = {};
+		{
+			Database db(name, plain);
+
+			REQUIRE(Clear(db).type == Error::Type::None);
+			REQUIRE(Open(db, key).type == Error::Type::None);
+			REQUIRE(Put(db, Key{ 0, 1 }, Database::TaggedValue(
+				base::duplicate(repeated),
+				1)).type == Error::Type::None);
+			Close(db);
+		}
+		REQUIRE(GetBinlogFormat() == details::Format::Format_0);
+
+		Database db(name, settings);
+
+		REQUIRE(Open(db, key).type == Error::Type::None);
+		REQUIRE(Put(db, Key{ 0, 2 }, Database::TaggedValue(
+			base::duplicate(repeated),
+			1)).type == Error::Type::None);
+		REQUIRE((Get(db, Key{ 0, 1 }) == repeated));
+		REQUIRE((Get(db, Key{ 0, 2 }) == repeated));
+		Close(db);
+		REQUIRE(GetBinlogFormat() == details::Format::Format_0);
+	}
+	SECTION("tags with the high bit") {
+		auto plain = settings;
+		plain.compressTags = {};
+		{
+			Database db(name, plain);
+
+			REQUIRE(Clear(db).type == Error::Type::None);
+			REQUIRE(Open(db, key).type == Error::Type::None);
+			REQUIRE(Put(db, Key{ 0, 1 }, Database::TaggedValue(
+				base::duplicate(repeated),
+				0x80)).type == Error::Type::None);
+			REQUIRE(Put(db, Key{ 0, 2 }, Database::TaggedValue(Test1(), 0xFF))
+				.type == Error::Type::None);
+			Close(db);
+		}
+		{
+			Database db(name, plain);
+
+			REQUIRE(Open(db, key).type == Error::Type::None);
+			const auto first = GetWithTag(db, Key{ 0, 1 });
+			REQUIRE((first.bytes == repeated));
+			REQUIRE(first.tag == 0x80);
+			const auto second = GetWithTag(db, Key{ 0, 2 });
+			REQUIRE((second.bytes == Test1()));
+			REQUIRE(second.tag == 0xFF);
+			Close(db);
+		}
+
+		// Such tags would be read as compressed in the new format.
+		Database db(name, settings);
+
+		REQUIRE(Clear(db).type == Error::Type::None);
+		REQUIRE(Open(db, key).type == Error::Type::None);
+		REQUIRE(Put(db, Key{ 0, 1 }, Database::TaggedValue(
+			base::duplicate(repeated),
+			0x81)).type == Error::Type::WrongTag);
+		REQUIRE(Get(db, Key{ 0, 1 }).isEmpty());
+		REQUIRE(Put(db, Key{ 0, 2 }, Database::TaggedValue(Test1(), 0x7F))
+			.type == Error::Type::None);
+		REQUIRE((Get(db, Key{ 0, 2 }) == Test1()));
+		Close(db);
+	}
+}
+
+TEST_CASE("traced cache db", "[storage_cache_database]") {
+	if (!DisableLargeTest) {
+		return;
+	}
+	using details::TraceOperation;
+	const auto tracePath = QString("test.trace");
+	QFile(tracePath).remove();
+
+	auto settings = Settings;
+	settings.tracePath = tracePath;
+	{
+		Database db(name, settings);
+
+		REQUIRE(Clear(db).type == Error::Type::None);
+		REQUIRE(Open(db, key).type == Error::Type::None);
+		REQUIRE(Put(db, Key{ 0, 1 }, Database::TaggedValue(Test1(), 3)).type
+			== Error::Type::None);
+		REQUIRE((Get(db, Key{ 0, 1 }) == Test1()));
+		REQUIRE(Get(db, Key{ 0, 2 }).isEmpty());
+		Remove(db, Key{ 0, 1 });
+		Close(db);
+	}
+	const auto trace = details::ReadTrace(tracePath);
+	REQUIRE(trace.size() == 4);
+	REQUIRE(trace[0].operation == TraceOperation::Put);
+	REQUIRE(trace[0].key == Key{ 0, 1 });
+	REQUIRE(trace[0].size == Test1().size());
+	REQUIRE(trace[0].tag == 3);
+	REQUIRE(trace[1].operation == TraceOperation::Get);
+	REQUIRE(trace[1].size == Test1().size());
+	REQUIRE(trace[1].tag == 3);
+	REQUIRE(trace[2].operation == TraceOperation::Get);
+	REQUIRE(trace[2].key == Key{ 0, 2 });
+	REQUIRE(trace[2].size == 0);
+	REQUIRE(trace[3].operation == TraceOperation::Remove);
+	REQUIRE(trace[3].time >= trace[0].time);
+	QFile(tracePath).remove();
+}
+
 TEST_CASE("cache db remove", "[storage_cache_database]") {
 	if (!DisableLargeTest) {
 		return;
@@ -672,6 +1121,78 @@ TEST_CASE("cache db limits", "[storage_cache_database]") {
 		REQUIRE((Get(db, Key{ 2, 2 }) == Test2()));
 		Close(db);
 	}
+	SECTION("db tag size limit") {
+		auto settings = Settings;
+		settings.trackEstimatedTime = true;
+		settings.tagSizeLimits = { { uint8(1), int64(17 * 2 + 1) } };
+		Database db(name, settings);
+
+		db.clear(nullptr);
+		db.open(base::duplicate(key), nullptr);
+		db.put(Key{ 0, 1 }, Database::TaggedValue(Test2(), 1), nullptr);
+		db.put(Key{ 0, 2 }, Database::TaggedValue(Test2(), 2), nullptr);
+		AdvanceTime(2);
+		db.put(Key{ 1, 1 }, Database::TaggedValue(Test2(), 1), nullptr);
+		db.put(Key{ 1, 2 }, Database::TaggedValue(Test2(), 2), nullptr);
+		AdvanceTime(2);
+		db.put(Key{ 2, 1 }, Database::TaggedValue(Test2(), 1), nullptr);
+		AdvanceTime(2);
+
+		// Only the oldest value with the limited tag is removed.
+		REQUIRE(Get(db, Key{ 0, 1 }).isEmpty());
+		REQUIRE((Get(db, Key{ 0, 2 }) == Test2()));
+		REQUIRE((Get(db, Key{ 1, 1 }) == Test2()));
+		REQUIRE((Get(db, Key{ 1, 2 }) == Test2()));
+		REQUIRE((Get(db, Key{ 2, 1 }) == Test2()));
+		Close(db);
+	}
+	SECTION("db size aware eviction") {
+		auto settings = Settings;
+		settings.trackEstimatedTime = true;
+		settings.totalSizeLimit = 17 * 2 + 1;
+		settings.evictionPolicy = Database::EvictionPolicy::SizeAware;
+		Database db(name, settings);
+
+		db.clear(nullptr);
+		db.open(base::duplicate(key), nullptr);
+		db.put(Key{ 0, 1 }, QByteArray("ab"), nullptr);
+		AdvanceTime(2);
+		db.put(Key{ 0, 2 }, Test2(), nullptr);
+		AdvanceTime(2);
+		db.put(Key{ 0, 3 }, Test2(), nullptr);
+		AdvanceTime(2);
+
+		// The older large value is removed instead of the oldest one.
+		REQUIRE((Get(db, Key{ 0, 1 }) == QByteArray("ab")));
+		REQUIRE(Get(db, Key{ 0, 2 }).isEmpty());
+		REQUIRE((Get(db, Key{ 0, 3 }) == Test2()));
+		Close(db);
+	}
+	SECTION("db frequency aware eviction") {
+		auto settings = Settings;
+		settings.trackEstimatedTime = true;
+		settings.totalSizeLimit = 17 * 2 + 1;
+		settings.evictionPolicy = Database::EvictionPolicy::FrequencyAware;
+		Database db(name, settings);
+
+		db.clear(nullptr);
+		db.open(base::duplicate(key), nullptr);
+		db.put(Key{ 0, 1 }, Test1(), nullptr);
+		for (auto i = 0; i != 7; ++i) {
+			REQUIRE((Get(db, Key{ 0, 1 }) == Test1()));
+		}
+		AdvanceTime(2);
+		db.put(Key{ 0, 2 }, Test2(), nullptr);
+		AdvanceTime(2);
+		db.put(Key{ 0, 3 }, Test1(), nullptr);
+		AdvanceTime(2);
+
+		// The oldest value is kept, because it was read a lot.
+		REQUIRE((Get(db, Key{ 0, 1 }) == Test1()));
+		REQUIRE(Get(db, Key{ 0, 2 }).isEmpty());
+		REQUIRE((Get(db, Key{ 0, 3 }) == Test1()));
+		Close(db);
+	}
 	SECTION("db time limit") {
 		auto settings = Settings;
 		settings.trackEstimatedTime = true;
@@ -738,3 +1259,279 @@ TEST_CASE("large db", "[storage_cache_database]") {
 		Close(db);
 	}
 }
+
+// Gets of small stickers and avatars used again and again with video
+// scrolls of large values that are never read twice, in the trace format.
+std::vector<details::TraceRecord> GenerateMixedTrace(
+		int count,
+		crl::time duration) {
+	auto engine = std::mt19937_64(0);
+	auto result = std::vector<details::TraceRecord>();
+	result.reserve(count);
+	auto video = uint64(0);
+	const auto push = [&](Key key, size_type size, uint8 tag) {
+		auto record = details::TraceRecord();
+		record.time = uint64(result.size() * duration / count);
+		record.key = key;
+		record.size = uint32(size);
+		record.operation = details::TraceOperation::Get;
+		record.tag = tag;
+		result.push_back(record);
+	};
+	while (int(result.size()) < count) {
+		if (engine() % 50 == 0) {
+			const auto length = 50 + int(engine() % 250);
+			for (auto i = 0; i != length; ++i) {
+				const auto size = size_type(32 * 1024 + engine() % 512);
+				push(Key{ 4, ++video }, size, 4);
+			}
+			continue;
+		}
+
+		// Roughly geometric distribution of the small keys popularity.
+		auto index = uint64(0);
+		while (index < 4095 && (engine() % 8) != 0) {
+			index = index * 2 + (engine() % 2);
+		}
+		const auto sticker = (index % 2) != 0;
+		const auto size = sticker
+			? size_type(1024 + (index % 16) * 64)
+			: size_type(256 + (index % 8) * 32);
+		const auto tag = sticker ? uint8(2) : uint8(1);
+		push(Key{ tag, index }, size, tag);
+	}
+	result.resize(count);
+	return result;
+}
+
+// Replays the trace through a fresh database at the traced pace, a missed
+// value is put there as if it was downloaded. Returns the hit ratio.
+double ReplayHitRatio(
+		const std::vector<details::TraceRecord> &trace,
+		const Database::Settings &settings) {
+	Database db(name, settings);
+
+	REQUIRE(Clear(db).type == Error::Type::None);
+	REQUIRE(Open(db, key).type == Error::Type::None);
+	const auto value = [](const details::TraceRecord &record) {
+		return Database::TaggedValue(
+			QByteArray(int(record.size), char('A' + record.key.low % 26)),
+			record.tag);
+	};
+	const auto start = crl::now();
+	const auto first = trace.empty() ? uint64() : trace.front().time;
+	auto gets = 0;
+	auto hits = 0;
+	for (const auto &record : trace) {
+		const auto wait = start + crl::time(record.time - first) - crl::now();
+		if (wait > 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(wait));
+		}
+		switch (record.operation) {
+		case details::TraceOperation::Put:
+			db.put(record.key, value(record), nullptr);
+			break;
+		case details::TraceOperation::Get:
+			++gets;
+			if (!Get(db, record.key).isEmpty()) {
+				++hits;
+			} else if (record.size > 0) {
+				db.put(record.key, value(record), nullptr);
+			}
+			break;
+		case details::TraceOperation::Remove:
+			db.remove(record.key, nullptr);
+			break;
+		}
+	}
+	Close(db);
+	return gets ? (hits / double(gets)) : 0.;
+}
+
+TEST_CASE("cache db eviction benchmark", "[storage_cache_database]") {
+	if (DisableBenchmarkTests) {
+		return;
+	}
+
+	// A trace written with Settings::tracePath may be replayed instead.
+	const auto path = QString::fromLocal8Bit(qgetenv("CACHE_TRACE_PATH"));
+	const auto trace = path.isEmpty()
+		? GenerateMixedTrace(20 * 1000, 60 * crl::time(1000))
+		: details::ReadTrace(path);
+	REQUIRE(!trace.empty());
+
+	// The generated trace takes a minute instead of days of real use,
+	// so the values age faster too.
+	auto settings = Database::Settings();
+	settings.totalSizeLimit = 4 * 1024 * 1024;
+	settings.evictionAgePerDoubling = path.isEmpty()
+		? 2
+		: settings.evictionAgePerDoubling;
+	const auto measure = [&](const char *policy) {
+		const auto ratio = ReplayHitRatio(trace, settings);
+		WARN(policy << " hit ratio: " << (ratio * 100.) << "%");
+	};
+
+	settings.evictionPolicy = Database::EvictionPolicy::LeastRecentlyUsed;
+	measure("LRU");
+	settings.evictionPolicy = Database::EvictionPolicy::SizeAware;
+	measure("Size aware");
+	settings.evictionPolicy = Database::EvictionPolicy::FrequencyAware;
+	measure("Frequency aware");
+	settings.evictionPolicy = Database::EvictionPolicy::LeastRecentlyUsed;
+	settings.tagSizeLimits = { { uint8(4), int64(1024 * 1024) } };
+	measure("LRU with video tag limit");
+}
+
+TEST_CASE("cache db read benchmark", "[storage_cache_database]") {
+	if (DisableBenchmarkTests) {
+		return;
+	}
+	using Object = crl::object_on_queue<details::DatabaseObject>;
+
+	const auto kValuesCount = 1024U;
+	const auto kValueSize = 16 * 1024 + 5;
+	const auto kReadRounds = 16U;
+	const auto measure = [&](bool reuseReadBuffers) {
+		auto settings = Database::Settings();
+		settings.trackEstimatedTime = false;
+		settings.reuseReadBuffers = reuseReadBuffers;
+		{
+			Database db(name, settings);
+
+			REQUIRE(Clear(db).type == Error::Type::None);
+			REQUIRE(Open(db, key).type == Error::Type::None);
+			for (auto i = 0U; i != kValuesCount; ++i) {
+				auto value = QByteArray(kValueSize, char('A' + (i % 26)));
+				const auto result = Put(
+					db,
+					Key{ i, i + 1 },
+					std::move(value));
+				REQUIRE(result.type == Error::Type::None);
+			}
+			Close(db);
+		}
+
+		// Read through the object itself to get its read buffer counters.
+		auto object = Object(name, settings);
+		object.with([](details::DatabaseObject &unwrapped) {
+			unwrapped.open(base::duplicate(key), GetResult);
+		});
+		Semaphore.acquire();
+		REQUIRE(Result.type == Error::Type::None);
+
+		const auto start = crl::now();
+		for (auto round = 0U; round != kReadRounds; ++round) {
+			for (auto i = 0U; i != kValuesCount; ++i) {
+				object.with([=](details::DatabaseObject &unwrapped) {
+					unwrapped.get(Key{ i, i + 1 }, GetValueWithTag);
+				});
+				Semaphore.acquire();
+				REQUIRE(ValueWithTag.bytes.size() == kValueSize);
+			}
+		}
+		const auto elapsed = std::max(crl::now() - start, crl::time(1));
+
+		auto stats = Database::Stats();
+		object.with([&](details::DatabaseObject &unwrapped) {
+			auto lifetime = rpl::lifetime();
+			unwrapped.stats(
+			) | rpl::start_with_next([&](Database::Stats &&value) {
+				stats = std::move(value);
+			}, lifetime);
+			unwrapped.close([] { Semaphore.release(); });
+		});
+		Semaphore.acquire();
+
+		const auto reads = kValuesCount * kReadRounds;
+		const auto megabytes = double(reads) * kValueSize / (1024 * 1024);
+		REQUIRE(stats.readsCount == reads);
+		if (reuseReadBuffers) {
+			// The value held by the test keeps one more buffer busy.
+			REQUIRE(stats.readAllocations <= 2);
+		} else {
+			REQUIRE(stats.readAllocations == reads);
+		}
+		WARN((reuseReadBuffers ? "reused buffers" : "new buffers")
+			<< " reads: "
+			<< (reads * 1000 / elapsed)
+			<< " gets/s, "
+			<< (megabytes * 1000 / elapsed)
+			<< " MB/s, "
+			<< (stats.readAllocations / double(reads))
+			<< " value buffer allocations per get");
+	};
+	SECTION("place files read to new buffers") {
+		measure(false);
+	}
+	SECTION("place files read to reused buffers") {
+		measure(true);
+	}
+}
+
+TEST_CASE("cache db open benchmark", "[storage_cache_database]") {
+	if (DisableBenchmarkTests) {
+		return;
+	}
+	const auto kRecordsCount = 2 * 1024 * 1024;
+	const auto writeSyntheticBinlog = [&] {
+		using namespace details;
+
+		const auto base = ComputeBasePath(name);
+		REQUIRE(QDir(base).removeRecursively());
+		REQUIRE(WriteVersionValue(base, 0));
+
+		Storage::File binlog;
+		REQUIRE(binlog.open(base + "0/binlog", Storage::File::Mode::Write, key)
+			== Storage::File::Result::Success);
+		auto header = BasicHeader();
+		REQUIRE(binlog.write(bytes::object_as_span(&header)));
+
+		const auto bundle = int(Settings.maxBundledRecords);
+		auto list = std::vector<MultiStore::Part>(bundle);
+		for (auto i = 0; i < kRecordsCount; i += bundle) {
+			const auto count = std::min(bundle, kRecordsCount - i);
+			auto multi = MultiStore(count);
+			for (auto j = 0; j != count; ++j) {
+				auto &record = list[j];
+				record = MultiStore::Part();
+				record.key = Key{ uint64(i + j), uint64(i + j) * 3 };
+				record.setSize(Settings.maxDataSize);
+				bytes::set_random(bytes::object_as_span(&record.place));
+			}
+			REQUIRE(binlog.write(bytes::object_as_span(&multi)));
+			REQUIRE(binlog.write(bytes::make_span(list).subspan(
+				0,
+				count * sizeof(MultiStore::Part))));
+		}
+		binlog.close();
+	};
+	const auto measure = [&](int threads) {
+		auto settings = Settings;
+		settings.readBlockThreads = threads;
+		settings.totalSizeLimit = 0;
+		settings.compactAfterExcess = 0;
+		Database db(name, settings);
+
+		const auto start = crl::now();
+		REQUIRE(Open(db, key).type == Error::Type::None);
+		db.sync();
+		const auto elapsed = crl::now() - start;
+		Close(db);
+
+		WARN("binlog with "
+			<< kRecordsCount
+			<< " records opened with "
+			<< threads
+			<< " threads in "
+			<< elapsed
+			<< " ms");
+	};
+	writeSyntheticBinlog();
+	SECTION("open binlog single thread") {
+		measure(1);
+	}
+	SECTION("open binlog four threads") {
+		measure(4);
+	}
+}
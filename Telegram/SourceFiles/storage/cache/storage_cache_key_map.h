@@ -0,0 +1,299 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "storage/cache/storage_cache_types.h"
+#include <vector>
+#include <utility>
+
+namespace Storage {
+namespace Cache {
+namespace details {
+
+inline uint64 KeyHash(const Key &key) {
+	auto result = key.high * 0x9E3779B97F4A7C15ULL;
+	result ^= (key.low + (result >> 29)) * 0xBF58476D1CE4E5B9ULL;
+	return result ^ (result >> 32);
+}
+
+// Open addressing hash map with linear probing and backward shift erase.
+//
+// Slots are kept in one contiguous array without per-entry allocations,
+// a separate array of control bytes (zero for an empty slot, seven bits
+// of hash otherwise) makes most of the probes touch only one byte.
+//
+// Any insertion or erase invalidates all iterators and pointers.
+template <typename Value>
+class KeyMap {
+	template <bool Const>
+	class Iterator;
+
+public:
+	using key_type = Key;
+	using mapped_type = Value;
+	using value_type = std::pair<Key, Value>;
+	using iterator = Iterator<false>;
+	using const_iterator = Iterator<true>;
+
+	KeyMap() = default;
+
+	iterator begin() {
+		return iterator(this, 0);
+	}
+	iterator end() {
+		return iterator(this, capacity());
+	}
+	const_iterator begin() const {
+		return const_iterator(this, 0);
+	}
+	const_iterator end() const {
+		return const_iterator(this, capacity());
+	}
+	const_iterator cbegin() const {
+		return begin();
+	}
+	const_iterator cend() const {
+		return end();
+	}
+
+	friend iterator begin(KeyMap &map) {
+		return map.begin();
+	}
+	friend iterator end(KeyMap &map) {
+		return map.end();
+	}
+	friend const_iterator begin(const KeyMap &map) {
+		return map.begin();
+	}
+	friend const_iterator end(const KeyMap &map) {
+		return map.end();
+	}
+
+	size_type size() const {
+		return _size;
+	}
+	bool empty() const {
+		return !_size;
+	}
+	std::size_t capacity() const {
+		return _control.size();
+	}
+
+	iterator find(const Key &key) {
+		return iterator(this, findIndex(key));
+	}
+	const_iterator find(const Key &key) const {
+		return const_iterator(this, findIndex(key));
+	}
+	bool contains(const Key &key) const {
+		return findIndex(key) != capacity();
+	}
+
+	Value &operator[](const Key &key);
+	void erase(const_iterator i);
+	void erase(const Key &key) {
+		if (const auto i = find(key); i != end()) {
+			erase(i);
+		}
+	}
+
+	void reserve(size_type count);
+	void clear() {
+		_control.clear();
+		_slots.clear();
+		_size = 0;
+	}
+
+private:
+	static constexpr auto kMinCapacity = std::size_t(16);
+
+	static uint8 Control(uint64 hash) {
+		return uint8(0x80U | (hash >> 57));
+	}
+	std::size_t mask() const {
+		return capacity() - 1;
+	}
+	std::size_t findIndex(const Key &key) const;
+	std::size_t insertIndex(uint64 hash) const;
+	void rehash(std::size_t capacity);
+
+	std::vector<uint8> _control;
+	std::vector<value_type> _slots;
+	size_type _size = 0;
+
+};
+
+template <typename Value>
+template <bool Const>
+class KeyMap<Value>::Iterator {
+	using Map = std::conditional_t<Const, const KeyMap, KeyMap>;
+
+public:
+	using iterator_category = std::forward_iterator_tag;
+	using value_type = typename KeyMap::value_type;
+	using difference_type = std::ptrdiff_t;
+	using reference = std::conditional_t<
+		Const,
+		const value_type&,
+		value_type&>;
+	using pointer = std::conditional_t<
+		Const,
+		const value_type*,
+		value_type*>;
+
+	Iterator() = default;
+	Iterator(Map *map, std::size_t index) : _map(map), _index(index) {
+		skipEmpty();
+	}
+	template <
+		bool OtherConst,
+		typename = std::enable_if_t<Const && !OtherConst>>
+	Iterator(const Iterator<OtherConst> &other)
+	: _map(other._map)
+	, _index(other._index) {
+	}
+
+	reference operator*() const {
+		return _map->_slots[_index];
+	}
+	pointer operator->() const {
+		return &_map->_slots[_index];
+	}
+	Iterator &operator++() {
+		++_index;
+		skipEmpty();
+		return *this;
+	}
+	Iterator operator++(int) {
+		auto result = *this;
+		++*this;
+		return result;
+	}
+
+	friend inline bool operator==(const Iterator &a, const Iterator &b) {
+		return (a._index == b._index);
+	}
+	friend inline bool operator!=(const Iterator &a, const Iterator &b) {
+		return !(a == b);
+	}
+
+private:
+	friend class KeyMap;
+	template <bool OtherConst>
+	friend class Iterator;
+
+	void skipEmpty() {
+		const auto capacity = _map->capacity();
+		while (_index < capacity && !_map->_control[_index]) {
+			++_index;
+		}
+	}
+
+	Map *_map = nullptr;
+	std::size_t _index = 0;
+
+};
+
+template <typename Value>
+std::size_t KeyMap<Value>::findIndex(const Key &key) const {
+	if (!_size) {
+		return capacity();
+	}
+	const auto hash = KeyHash(key);
+	const auto control = Control(hash);
+	const auto mask = this->mask();
+	for (auto index = std::size_t(hash) & mask
+		; _control[index]
+		; index = (index + 1) & mask) {
+		if (_control[index] == control && _slots[index].first == key) {
+			return index;
+		}
+	}
+	return capacity();
+}
+
+template <typename Value>
+std::size_t KeyMap<Value>::insertIndex(uint64 hash) const {
+	const auto mask = this->mask();
+	auto index = std::size_t(hash) & mask;
+	while (_control[index]) {
+		index = (index + 1) & mask;
+	}
+	return index;
+}
+
+template <typename Value>
+Value &KeyMap<Value>::operator[](const Key &key) {
+	if (const auto index = findIndex(key); index != capacity()) {
+		return _slots[index].second;
+	}
+
+	// Keep the load factor under 3/4.
+	if (std::size_t(_size + 1) * 4 > capacity() * 3) {
+		rehash(std::max(capacity() * 2, kMinCapacity));
+	}
+	const auto hash = KeyHash(key);
+	const auto index = insertIndex(hash);
+	_control[index] = Control(hash);
+	_slots[index] = value_type(key, Value());
+	++_size;
+	return _slots[index].second;
+}
+
+template <typename Value>
+void KeyMap<Value>::erase(const_iterator i) {
+	Expects(i._index < capacity() && _control[i._index] != 0);
+
+	// Shift back the following entries of the probe sequence, so that
+	// we don't need tombstones and lookups don't degrade over time.
+	const auto mask = this->mask();
+	auto hole = i._index;
+	for (auto index = (hole + 1) & mask
+		; _control[index]
+		; index = (index + 1) & mask) {
+		const auto ideal = std::size_t(KeyHash(_slots[index].first)) & mask;
+		if (((index - ideal) & mask) >= ((index - hole) & mask)) {
+			_control[hole] = _control[index];
+			_slots[hole] = std::move(_slots[index]);
+			hole = index;
+		}
+	}
+	_control[hole] = 0;
+	_slots[hole] = value_type();
+	--_size;
+}
+
+template <typename Value>
+void KeyMap<Value>::reserve(size_type count) {
+	auto required = kMinCapacity;
+	while (std::size_t(count) * 4 > required * 3) {
+		required *= 2;
+	}
+	if (required > capacity()) {
+		rehash(required);
+	}
+}
+
+template <typename Value>
+void KeyMap<Value>::rehash(std::size_t capacity) {
+	Expects((capacity & (capacity - 1)) == 0);
+
+	auto control = std::exchange(_control, std::vector<uint8>(capacity));
+	auto slots = std::exchange(_slots, std::vector<value_type>(capacity));
+	for (auto i = std::size_t(0), count = control.size(); i != count; ++i) {
+		if (control[i]) {
+			const auto index = insertIndex(KeyHash(slots[i].first));
+			_control[index] = control[i];
+			_slots[index] = std::move(slots[i]);
+		}
+	}
+}
+
+} // namespace details
+} // namespace Cache
+} // namespace Storage
@@ -0,0 +1,155 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "storage/cache/storage_cache_key_map.h"
+#include <crl/crl_time.h>
+#include <unordered_map>
+#include <random>
+
+using namespace Storage::Cache;
+using details::KeyMap;
+
+const auto DisableKeyMapBenchmarks = true;
+
+namespace {
+
+struct Value {
+	uint64 useTime = 0;
+	size_type size = 0;
+	uint32 checksum = 0;
+	std::array<uint8, 7> place = { { 0 } };
+	uint8 tag = 0;
+};
+
+Key MakeKey(uint64 index) {
+	return Key{ index * 2, (index << 32) + 3 };
+}
+
+} // namespace
+
+TEST_CASE("key map keeps inserted values", "[storage_cache_key_map]") {
+	KeyMap<int> map;
+	REQUIRE(map.empty());
+	REQUIRE(map.find(MakeKey(0)) == map.end());
+
+	const auto count = 1000;
+	for (auto i = 0; i != count; ++i) {
+		map[MakeKey(i)] = i;
+	}
+	REQUIRE(map.size() == count);
+
+	SECTION("all values are found") {
+		for (auto i = 0; i != count; ++i) {
+			const auto j = map.find(MakeKey(i));
+			REQUIRE(j != map.end());
+			REQUIRE(j->first == MakeKey(i));
+			REQUIRE(j->second == i);
+		}
+		REQUIRE(map.find(MakeKey(count)) == map.end());
+	}
+	SECTION("iteration visits every value once") {
+		auto sum = 0LL;
+		auto visited = 0;
+		for (const auto &[key, value] : map) {
+			REQUIRE(key == MakeKey(value));
+			sum += value;
+			++visited;
+		}
+		REQUIRE(visited == count);
+		REQUIRE(sum == (count * (count - 1LL)) / 2);
+	}
+	SECTION("erase keeps other values reachable") {
+		for (auto i = 0; i < count; i += 3) {
+			map.erase(map.find(MakeKey(i)));
+		}
+		for (auto i = 0; i != count; ++i) {
+			const auto j = map.find(MakeKey(i));
+			if (i % 3) {
+				REQUIRE(j != map.end());
+				REQUIRE(j->second == i);
+			} else {
+				REQUIRE(j == map.end());
+			}
+		}
+		REQUIRE(map.size() == count - (count + 2) / 3);
+	}
+	SECTION("erase and insert again") {
+		for (auto i = 0; i != count; ++i) {
+			map.erase(MakeKey(i));
+		}
+		REQUIRE(map.empty());
+		REQUIRE(map.begin() == map.end());
+		map[MakeKey(7)] = 7;
+		REQUIRE(map.size() == 1);
+		REQUIRE(map.begin()->second == 7);
+	}
+}
+
+TEST_CASE("key map benchmark", "[storage_cache_key_map]") {
+	if (DisableKeyMapBenchmarks) {
+		return;
+	}
+	const auto count = 500 * 1000;
+	const auto lookups = 10 * count;
+	auto engine = std::mt19937_64(0);
+	auto keys = std::vector<Key>();
+	keys.reserve(count);
+	for (auto i = 0; i != count; ++i) {
+		keys.push_back(Key{ engine(), engine() });
+	}
+	auto order = std::vector<int>(lookups);
+	for (auto &index : order) {
+		index = int(engine() % count);
+	}
+
+	const auto measure = [&](auto &&map, const char *name) {
+		const auto insertStart = crl::now();
+		for (const auto &key : keys) {
+			map[key].size = 1;
+		}
+		const auto lookupStart = crl::now();
+		auto found = int64();
+		for (const auto index : order) {
+			found += map.find(keys[index])->second.size;
+		}
+		const auto scanStart = crl::now();
+		auto total = int64();
+		for (const auto &[key, value] : map) {
+			total += value.size;
+		}
+		const auto finish = crl::now();
+		REQUIRE(found == lookups);
+		REQUIRE(total == count);
+		WARN(name
+			<< ": insert "
+			<< (lookupStart - insertStart)
+			<< " ms, lookup "
+			<< (scanStart - lookupStart)
+			<< " ms, scan "
+			<< (finish - scanStart)
+			<< " ms");
+	};
+	SECTION("unordered_map") {
+		measure(std::unordered_map<Key, Value>(), "unordered_map");
+
+		// Node, cached hash and bucket pointer, malloc overhead ignored.
+		const auto perEntry = sizeof(std::pair<const Key, Value>)
+			+ 2 * sizeof(void*)
+			+ sizeof(std::size_t);
+		WARN("unordered_map: ~" << (perEntry * count) / 1024 << " KB");
+	}
+	SECTION("key map") {
+		auto map = KeyMap<Value>();
+		measure(map, "key map");
+
+		const auto bytes = map.capacity()
+			* (sizeof(KeyMap<Value>::value_type) + 1);
+		WARN("key map: " << bytes / 1024 << " KB");
+	}
+}
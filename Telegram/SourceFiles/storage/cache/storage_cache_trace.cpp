@@ -0,0 +1,118 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "storage/cache/storage_cache_trace.h"
+
+#include "base/bytes.h"
+#include <crl/crl_time.h>
+
+namespace Storage {
+namespace Cache {
+namespace details {
+namespace {
+
+constexpr auto kTraceMagic = uint32(0x54434454); // "TDCT"
+constexpr auto kTraceVersion = uint32(1);
+constexpr auto kBufferRecords = size_type(4096);
+
+struct TraceHeader {
+	uint32 magic = kTraceMagic;
+	uint32 version = kTraceVersion;
+	uint32 recordSize = sizeof(TraceRecord);
+	uint32 reserved = 0;
+};
+
+} // namespace
+
+TraceWriter::TraceWriter(const QString &path) : _file(path) {
+	if (!_file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+		return;
+	} else if (_file.size() == 0) {
+		const auto header = TraceHeader();
+		const auto bytes = bytes::object_as_span(&header);
+		const auto written = _file.write(
+			reinterpret_cast<const char*>(bytes.data()),
+			bytes.size());
+		if (written != bytes.size()) {
+			_file.close();
+			return;
+		}
+	}
+	_buffer.reserve(kBufferRecords);
+}
+
+bool TraceWriter::valid() const {
+	return _file.isOpen();
+}
+
+void TraceWriter::write(
+		TraceOperation operation,
+		const Key &key,
+		size_type size,
+		uint8 tag) {
+	if (!valid()) {
+		return;
+	}
+	auto &record = _buffer.emplace_back();
+	record.time = uint64(crl::now());
+	record.key = key;
+	record.size = uint32(size);
+	record.operation = operation;
+	record.tag = tag;
+	if (_buffer.size() == kBufferRecords) {
+		flush();
+	}
+}
+
+void TraceWriter::flush() {
+	if (!valid() || _buffer.empty()) {
+		return;
+	}
+	const auto size = int64(_buffer.size() * sizeof(TraceRecord));
+	const auto written = _file.write(
+		reinterpret_cast<const char*>(_buffer.data()),
+		size);
+	_buffer.clear();
+	if (written != size) {
+		_file.close();
+	} else {
+		_file.flush();
+	}
+}
+
+TraceWriter::~TraceWriter() {
+	flush();
+}
+
+std::vector<TraceRecord> ReadTrace(const QString &path) {
+	auto file = QFile(path);
+	if (!file.open(QIODevice::ReadOnly)) {
+		return {};
+	}
+	auto header = TraceHeader();
+	const auto bytes = bytes::object_as_span(&header);
+	const auto read = file.read(
+		reinterpret_cast<char*>(bytes.data()),
+		bytes.size());
+	if (read != bytes.size()
+		|| header.magic != kTraceMagic
+		|| header.version != kTraceVersion
+		|| header.recordSize != sizeof(TraceRecord)) {
+		return {};
+	}
+	const auto count = (file.size() - read) / sizeof(TraceRecord);
+	auto result = std::vector<TraceRecord>(count);
+	const auto size = int64(count * sizeof(TraceRecord));
+	if (file.read(reinterpret_cast<char*>(result.data()), size) != size) {
+		return {};
+	}
+	return result;
+}
+
+} // namespace details
+} // namespace Cache
+} // namespace Storage
@@ -0,0 +1,60 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "storage/cache/storage_cache_types.h"
+#include <QtCore/QFile>
+
+namespace Storage {
+namespace Cache {
+namespace details {
+
+enum class TraceOperation : uint8 {
+	Put = 0x01,
+	Get = 0x02,
+	Remove = 0x03,
+};
+
+struct TraceRecord {
+	uint64 time = 0; // crl::now() when the operation was requested.
+	Key key;
+	uint32 size = 0; // Zero for a missing value in Get.
+	TraceOperation operation = TraceOperation::Get;
+	uint8 tag = 0;
+	uint16 reserved = 0;
+};
+static_assert(sizeof(TraceRecord) == 32);
+
+// Appends fixed size records to a plain (not encrypted) trace file.
+class TraceWriter {
+public:
+	explicit TraceWriter(const QString &path);
+	TraceWriter(const TraceWriter &other) = delete;
+	TraceWriter &operator=(const TraceWriter &other) = delete;
+
+	[[nodiscard]] bool valid() const;
+	void write(
+		TraceOperation operation,
+		const Key &key,
+		size_type size,
+		uint8 tag);
+	void flush();
+
+	~TraceWriter();
+
+private:
+	QFile _file;
+	std::vector<TraceRecord> _buffer;
+
+};
+
+[[nodiscard]] std::vector<TraceRecord> ReadTrace(const QString &path);
+
+} // namespace details
+} // namespace Cache
+} // namespace Storage
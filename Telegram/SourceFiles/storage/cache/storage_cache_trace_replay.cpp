@@ -0,0 +1,162 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "storage/cache/storage_cache_database.h"
+#include "storage/cache/storage_cache_trace.h"
+#include "storage/storage_encryption.h"
+#include "base/concurrent_timer.h"
+#include <crl/crl.h>
+#include <QtCore/QCoreApplication>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+// Replays a trace written with Settings::tracePath against a fresh
+// database and reports operations per second, latency and hit ratio.
+//
+// Usage: storage_cache_replay <trace> [<database> [<size limit in MB>]]
+
+using namespace Storage::Cache;
+using details::TraceOperation;
+using details::TraceRecord;
+
+namespace {
+
+constexpr auto kDefaultDatabasePath = "replay.db";
+
+struct Result {
+	std::vector<int64> latencies; // Microseconds.
+	int64 gets = 0;
+	int64 hits = 0;
+	int64 tracedHits = 0;
+};
+
+int64 Percentile(std::vector<int64> &values, int percent) {
+	if (values.empty()) {
+		return 0;
+	}
+	const auto index = (values.size() - 1) * percent / 100;
+	std::nth_element(begin(values), begin(values) + index, end(values));
+	return values[index];
+}
+
+Result Replay(Database &db, const std::vector<TraceRecord> &trace) {
+	using Clock = std::chrono::steady_clock;
+
+	auto semaphore = crl::semaphore();
+	auto result = Result();
+	result.latencies.reserve(trace.size());
+	for (const auto &record : trace) {
+		const auto start = Clock::now();
+		switch (record.operation) {
+		case TraceOperation::Put: {
+			auto value = QByteArray(
+				int(record.size),
+				char('A' + (record.key.low % 26)));
+			db.put(
+				record.key,
+				Database::TaggedValue(std::move(value), record.tag),
+				[&](Error) { semaphore.release(); });
+		} break;
+		case TraceOperation::Get: {
+			++result.gets;
+			if (record.size > 0) {
+				++result.tracedHits;
+			}
+			db.get(record.key, [&](QByteArray &&value) {
+				if (!value.isEmpty()) {
+					++result.hits;
+				}
+				semaphore.release();
+			});
+		} break;
+		case TraceOperation::Remove: {
+			db.remove(record.key, [&](Error) { semaphore.release(); });
+		} break;
+		default: continue;
+		}
+		semaphore.acquire();
+		const auto elapsed = Clock::now() - start;
+		result.latencies.push_back(
+			std::chrono::duration_cast<std::chrono::microseconds>(
+				elapsed).count());
+	}
+	return result;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		std::cerr
+			<< "Usage: "
+			<< argv[0]
+			<< " <trace> [<database> [<size limit in MB>]]"
+			<< std::endl;
+		return -1;
+	}
+	QCoreApplication application(argc, argv);
+	base::ConcurrentTimerEnvironment environment;
+
+	const auto trace = details::ReadTrace(QFile::decodeName(argv[1]));
+	if (trace.empty()) {
+		std::cerr << "Could not read trace: " << argv[1] << std::endl;
+		return -1;
+	}
+	const auto path = (argc > 2)
+		? QFile::decodeName(argv[2])
+		: QString(kDefaultDatabasePath);
+	auto settings = Database::Settings();
+	if (argc > 3) {
+		settings.totalSizeLimit = QString(argv[3]).toLongLong()
+			* 1024 * 1024;
+	}
+	auto key = bytes::vector(Storage::EncryptionKey::kSize);
+	bytes::set_random(key);
+
+	Database db(path, settings);
+	auto semaphore = crl::semaphore();
+	db.clear([&](Error) { semaphore.release(); });
+	semaphore.acquire();
+	auto error = Error();
+	db.open(Storage::EncryptionKey(std::move(key)), [&](Error result) {
+		error = result;
+		semaphore.release();
+	});
+	semaphore.acquire();
+	if (error.type != Error::Type::None) {
+		std::cerr
+			<< "Could not open database: "
+			<< path.toStdString()
+			<< std::endl;
+		return -1;
+	}
+
+	const auto start = crl::now();
+	auto result = Replay(db, trace);
+	const auto elapsed = std::max(crl::now() - start, crl::time(1));
+
+	db.close([&] { semaphore.release(); });
+	semaphore.acquire();
+	db.clear([&](Error) { semaphore.release(); });
+	semaphore.acquire();
+
+	const auto ratio = [](int64 part, int64 total) {
+		return total ? (part * 100. / total) : 0.;
+	};
+	const auto operations = int64(result.latencies.size());
+	std::cout
+		<< "Operations: " << operations
+		<< ", " << (operations * 1000. / elapsed) << " ops/sec" << std::endl
+		<< "Latency p50: " << Percentile(result.latencies, 50) << " us"
+		<< ", p99: " << Percentile(result.latencies, 99) << " us"
+		<< std::endl
+		<< "Hit ratio: " << ratio(result.hits, result.gets) << "%"
+		<< " (traced: " << ratio(result.tracedHits, result.gets) << "%)"
+		<< std::endl;
+	return 0;
+}
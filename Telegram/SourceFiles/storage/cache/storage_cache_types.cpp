@@ -42,8 +42,35 @@ inline size_type ValidateStrictCount(const Packed &count) {
 	return (result != 0) ? result : -1;
 }
 
+int64 Log2(uint64 value) {
+	auto result = int64();
+	while (value > 1) {
+		value >>= 1;
+		++result;
+	}
+	return result;
+}
+
 } // namespace
 
+int64 EvictionPriority(
+		const Settings &settings,
+		uint64 useTime,
+		size_type size,
+		uint16 accessCount) {
+	const auto age = int64(settings.evictionAgePerDoubling);
+	const auto time = int64(useTime);
+	switch (settings.evictionPolicy) {
+	case EvictionPolicy::LeastRecentlyUsed:
+		return time;
+	case EvictionPolicy::SizeAware:
+		return time - age * Log2(uint64(std::max(size, size_type(1))));
+	case EvictionPolicy::FrequencyAware:
+		return time + age * Log2(uint64(accessCount) + 1);
+	}
+	Unexpected("Policy in EvictionPriority.");
+}
+
 TaggedValue::TaggedValue(QByteArray &&bytes, uint8 tag)
 : bytes(std::move(bytes)), tag(tag) {
 }
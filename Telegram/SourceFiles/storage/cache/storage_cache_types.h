@@ -9,6 +9,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 #include "base/basic_types.h"
 #include "base/flat_map.h"
+#include "base/flat_set.h"
 #include "base/optional.h"
 #include <crl/crl_time.h>
 #include <QtCore/QString>
@@ -40,6 +41,7 @@ struct Error {
 		IO,
 		WrongKey,
 		LockFailed,
+		WrongTag,
 	};
 	Type type = Type::None;
 	QString path;
@@ -47,6 +49,10 @@ struct Error {
 	static Error NoError();
 };
 
+// The high bit of a value tag is the compressed flag in databases with
+// Settings::compressTags, put() of larger tags fails there with WrongTag.
+constexpr auto kMaxValueTag = uint8(0x7F);
+
 inline Error Error::NoError() {
 	return Error();
 }
@@ -64,9 +70,20 @@ constexpr auto kBundledRecordsLimit
 	= size_type(1 << (RecordsCount().size() * 8));
 constexpr auto kDataSizeLimit = size_type(1 << (EntrySize().size() * 8));
 
+// Stored in the record tag of values written in the compressed form,
+// only in binlogs of Format::Format_1.
+constexpr auto kCompressedTagFlag = uint8(kMaxValueTag + 1);
+
+enum class EvictionPolicy {
+	LeastRecentlyUsed,
+	SizeAware, // Larger values are removed earlier.
+	FrequencyAware, // Values read more often are kept longer.
+};
+
 struct Settings {
 	size_type maxBundledRecords = 16 * 1024;
 	size_type readBlockSize = 8 * 1024 * 1024;
+	int readBlockThreads = 4; // Limited by the hardware concurrency.
 	size_type maxDataSize = (kDataSizeLimit - 1);
 	crl::time writeBundleDelay = 15 * 60 * crl::time(1000);
 	size_type staleRemoveChunk = 256;
@@ -74,6 +91,7 @@ struct Settings {
 	int64 compactAfterExcess = 8 * 1024 * 1024;
 	int64 compactAfterFullSize = 0;
 	size_type compactChunkSize = 16 * 1024;
+	int64 compactCatchUpLimit = 256 * 1024;
 
 	bool trackEstimatedTime = true;
 	int64 totalSizeLimit = 1024 * 1024 * 1024;
@@ -81,7 +99,30 @@ struct Settings {
 	crl::time pruneTimeout = 5 * crl::time(1000);
 	crl::time maxPruneCheckTimeout = 3600 * crl::time(1000);
 
+	// Each doubling of the value size (or of its reads count) counts as
+	// this many seconds of age in the non-LRU eviction policies.
+	EvictionPolicy evictionPolicy = EvictionPolicy::LeastRecentlyUsed;
+	size_type evictionAgePerDoubling = 60 * 60; // One hour in seconds.
+	base::flat_map<uint8, int64> tagSizeLimits;
+
 	bool clearOnWrongKey = false;
+
+	// Values up to 1 MB are read to a few buffers kept by the database,
+	// so a get() whose result is already dropped allocates nothing.
+	bool reuseReadBuffers = false;
+
+	// Each shard keeps its own binlog and works on its own queue.
+	// The count is stored with the database, a database written with
+	// another count fails to open until it is cleared.
+	size_type shardsCount = 1;
+
+	// Values with these tags are stored LZ4-compressed if it helps.
+	// Only new binlogs are created in the format that allows it, so
+	// an existing database starts compressing after it is cleared.
+	base::flat_set<uint8> compressTags;
+
+	// If not empty put / get / remove are logged to this file.
+	QString tracePath;
 };
 
 struct SettingsUpdate {
@@ -101,12 +142,41 @@ struct TaggedSummary {
 	size_type count = 0;
 	int64 totalSize = 0;
 };
+struct CompressionSummary {
+	size_type count = 0;
+	int64 originalSize = 0;
+	int64 storedSize = 0;
+};
 struct Stats {
 	TaggedSummary full;
 	base::flat_map<uint8, TaggedSummary> tagged;
+
+	// Values written since open with tags from Settings::compressTags.
+	base::flat_map<uint8, CompressionSummary> compressed;
+
+	// Values read since open and how many of them needed a new buffer.
+	int64 readsCount = 0;
+	int64 readAllocations = 0;
+
+	// Compactions finished since open and the most keys or binlog bytes
+	// one of them handled in a single task on the database queue.
+	int64 compactionsCount = 0;
+	int64 compactMaxChunkKeys = 0;
+	int64 compactMaxCatchUpBytes = 0;
+
 	bool clearing = false;
+	bool compacting = false;
+	int64 compactProgress = 0;
+	int64 compactTotal = 0;
 };
 
+// Values with lower priority are removed first when pruning.
+int64 EvictionPriority(
+	const Settings &settings,
+	uint64 useTime,
+	size_type size,
+	uint16 accessCount);
+
 using Version = int32;
 
 QString ComputeBasePath(const QString &original);
@@ -119,6 +189,7 @@ constexpr auto GoodForEncryption = ((sizeof(Record) & 0x0F) == 0);
 
 enum class Format : uint32 {
 	Format_0,
+	Format_1, // Store records may have kCompressedTagFlag in the tag.
 };
 
 struct BasicHeader {
@@ -28,9 +28,20 @@ namespace {
 // How much time without download causes additional session kill.
 constexpr auto kKillSessionTimeout = crl::time(5000);
 
-// Max 16 file parts downloaded at the same time, 128 KB each.
+// Start with 16 file parts downloaded at the same time, 128 KB each,
+// then DownloadScheduler adapts the limit to the connection.
 constexpr auto kMaxFileQueries = 16;
 
+// Files of up to 2 parts (or of unknown size) may use 2 more queries.
+constexpr auto kSmallFileParts = 2;
+constexpr auto kReservedFileQueries = 2;
+
+// Downloads of files from 1 MB are continued after a restart.
+constexpr auto kMinResumableSize = 1024 * 1024;
+
+// Journals of downloads without new parts for a week are removed.
+constexpr auto kStaleJournalDays = 7;
+
 // Max 8 http[s] files downloaded at the same time.
 constexpr auto kMaxWebFileQueries = 8;
 
@@ -45,6 +56,7 @@ constexpr auto kPartSize = 128 * 1024;
 Downloader::Downloader(not_null<ApiWrap*> api)
 : _api(api)
 , _killDownloadSessionsTimer([=] { killDownloadSessions(); })
+, _cacheReadsTimer([=] { sendCacheReads(); })
 , _queueForWeb(kMaxWebFileQueries) {
 }
 
@@ -55,17 +67,51 @@ void Downloader::clearPriorities() {
 void Downloader::requestedAmountIncrement(MTP::DcId dcId, int index, int amount) {
 	Expects(index >= 0 && index < MTP::kDownloadSessionsCount);
 
-	using namespace rpl::mappers;
-
-	auto it = _requestedBytesAmount.find(dcId);
-	if (it == _requestedBytesAmount.cend()) {
-		it = _requestedBytesAmount.emplace(dcId, RequestedInDc { { 0 } }).first;
-	}
-	it->second[index] += amount;
+	auto &scheduler = schedulerForDc(dcId);
+	scheduler.requestedAmountIncrement(index, amount);
 	if (amount > 0) {
 		killDownloadSessionsStop(dcId);
-	} else if (ranges::find_if(it->second, _1 > 0) == end(it->second)) {
-		killDownloadSessionsStart(dcId);
+		return;
+	}
+	for (auto i = 0; i != scheduler.sessionsCount(); ++i) {
+		if (scheduler.session(i).requestedBytes > 0) {
+			return;
+		}
+	}
+	killDownloadSessionsStart(dcId);
+}
+
+void Downloader::requestFinished(
+		MTP::DcId dcId,
+		int index,
+		int bytes,
+		crl::time duration) {
+	Expects(index >= 0 && index < MTP::kDownloadSessionsCount);
+
+	schedulerForDc(dcId).requestFinished(
+		index,
+		bytes,
+		duration,
+		crl::now());
+	updateQueriesLimit(dcId);
+}
+
+DownloadScheduler &Downloader::schedulerForDc(MTP::DcId dcId) {
+	const auto i = _schedulers.find(dcId);
+	return (i != end(_schedulers))
+		? i->second
+		: _schedulers.emplace(
+			dcId,
+			DownloadScheduler(
+				MTP::kDownloadSessionsCount,
+				kPartSize,
+				kMaxFileQueries)).first->second;
+}
+
+void Downloader::updateQueriesLimit(MTP::DcId dcId) {
+	const auto i = _queuesForDc.find(dcId);
+	if (i != end(_queuesForDc)) {
+		i->second.queriesLimit = schedulerForDc(dcId).queriesLimit();
 	}
 }
 
@@ -96,6 +142,12 @@ void Downloader::killDownloadSessions() {
 			for (int j = 0; j < MTP::kDownloadSessionsCount; ++j) {
 				MTP::stopSession(MTP::downloadDcId(i->first, j));
 			}
+
+			// New connections will start from the initial limits.
+			const auto dcId = i->first;
+			schedulerForDc(dcId).reset();
+			updateQueriesLimit(dcId);
+
 			i = _killDownloadSessionTimes.erase(i);
 		} else {
 			if (i->second - ms < left) {
@@ -110,23 +162,24 @@ void Downloader::killDownloadSessions() {
 }
 
 int Downloader::chooseDcIndexForRequest(MTP::DcId dcId) const {
-	auto result = 0;
-	auto it = _requestedBytesAmount.find(dcId);
-	if (it != _requestedBytesAmount.cend()) {
-		for (auto i = 1; i != MTP::kDownloadSessionsCount; ++i) {
-			if (it->second[i] < it->second[result]) {
-				result = i;
-			}
-		}
-	}
-	return result;
+	const auto i = _schedulers.find(dcId);
+	return (i != end(_schedulers)) ? i->second.chooseSession() : 0;
+}
+
+int64 Downloader::bytesPerSecond(MTP::DcId dcId) const {
+	const auto i = _schedulers.find(dcId);
+	return (i != end(_schedulers)) ? i->second.bytesPerSecond() : 0;
 }
 
 not_null<Downloader::Queue*> Downloader::queueForDc(MTP::DcId dcId) {
 	const auto i = _queuesForDc.find(dcId);
 	const auto result = (i != end(_queuesForDc))
 		? i
-		: _queuesForDc.emplace(dcId, Queue(kMaxFileQueries)).first;
+		: _queuesForDc.emplace(
+			dcId,
+			Queue(
+				schedulerForDc(dcId).queriesLimit(),
+				kReservedFileQueries)).first;
 	return &result->second;
 }
 
@@ -134,6 +187,37 @@ not_null<Downloader::Queue*> Downloader::queueForWeb() {
 	return &_queueForWeb;
 }
 
+DownloadJournal &Downloader::journal() {
+	if (!_journal) {
+		_journal = std::make_unique<DownloadJournal>(
+			Local::downloadJournalPath());
+		_journal->removeStale(
+			QDateTime::currentDateTime().addDays(-kStaleJournalDays));
+	}
+	return *_journal;
+}
+
+void Downloader::readFromCache(
+		const Cache::Key &key,
+		FnMut<void(QByteArray&&)> done) {
+	_cacheReadKeys.push_back(key);
+	_cacheReadCallbacks.push_back(std::move(done));
+	if (!_cacheReadsTimer.isActive()) {
+		_cacheReadsTimer.callOnce(0);
+	}
+}
+
+void Downloader::sendCacheReads() {
+	using Values = std::vector<Cache::Database::TaggedValue>;
+	_api->session().data().cache().getMany(base::take(_cacheReadKeys), [
+		callbacks = base::take(_cacheReadCallbacks)
+	](Values &&values) mutable {
+		for (auto i = 0, count = int(values.size()); i != count; ++i) {
+			callbacks[i](std::move(values[i].bytes));
+		}
+	});
+}
+
 Downloader::~Downloader() {
 	killDownloadSessions();
 }
@@ -142,6 +226,26 @@ Downloader::~Downloader() {
 
 namespace {
 
+// Images from 64 KB are decoded on a background thread when loaded.
+constexpr auto kMinAsyncImageSize = 64 * 1024;
+
+QImage ReadImage(
+		const QByteArray &data,
+		QByteArray *format,
+		const QSize &shrinkBox) {
+	auto image = App::readImage(data, format, false);
+	if (!image.isNull()
+		&& !shrinkBox.isEmpty()
+		&& (image.width() > shrinkBox.width()
+			|| image.height() > shrinkBox.height())) {
+		return image.scaled(
+			shrinkBox,
+			Qt::KeepAspectRatio,
+			Qt::SmoothTransformation);
+	}
+	return image;
+}
+
 QThread *_webLoadThread = nullptr;
 WebLoadManager *_webLoadManager = nullptr;
 WebLoadManager *webLoadManager() {
@@ -202,14 +306,18 @@ void FileLoader::finishWithBytes(const QByteArray &data) {
 }
 
 QByteArray FileLoader::imageFormat(const QSize &shrinkBox) const {
-	if (_imageFormat.isEmpty() && _locationType == UnknownFileLocation) {
+	if (_imageFormat.isEmpty()
+		&& !_imageReadFinished
+		&& _locationType == UnknownFileLocation) {
 		readImage(shrinkBox);
 	}
 	return _imageFormat;
 }
 
 QImage FileLoader::imageData(const QSize &shrinkBox) const {
-	if (_imageData.isNull() && _locationType == UnknownFileLocation) {
+	if (_imageData.isNull()
+		&& !_imageReadFinished
+		&& _locationType == UnknownFileLocation) {
 		readImage(shrinkBox);
 	}
 	return _imageData;
@@ -217,17 +325,47 @@ QImage FileLoader::imageData(const QSize &shrinkBox) const {
 
 void FileLoader::readImage(const QSize &shrinkBox) const {
 	auto format = QByteArray();
-	auto image = App::readImage(_data, &format, false);
+	auto image = ReadImage(_data, &format, shrinkBox);
 	if (!image.isNull()) {
-		if (!shrinkBox.isEmpty() && (image.width() > shrinkBox.width() || image.height() > shrinkBox.height())) {
-			_imageData = image.scaled(shrinkBox, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-		} else {
-			_imageData = std::move(image);
-		}
+		_imageData = std::move(image);
 		_imageFormat = format;
 	}
 }
 
+bool FileLoader::readImageAsync(const QSize &shrinkBox) {
+	Expects(_finished);
+
+	if (!_imageData.isNull()
+		|| _imageReadFinished
+		|| _locationType != UnknownFileLocation
+		|| _data.size() < kMinAsyncImageSize) {
+		return true;
+	} else if (_imageReading) {
+		return false;
+	}
+	crl::async([
+		=,
+		data = _data,
+		guard = _imageReading.make_guard()
+	]() mutable {
+		auto format = QByteArray();
+		auto image = ReadImage(data, &format, shrinkBox);
+		crl::on_main(std::move(guard), [
+			=,
+			image = std::move(image),
+			format = std::move(format)
+		]() mutable {
+			_imageReadFinished = true;
+			if (_imageData.isNull() && !image.isNull()) {
+				_imageData = std::move(image);
+				_imageFormat = std::move(format);
+			}
+			_downloader->taskFinished().notify();
+		});
+	});
+	return false;
+}
+
 Data::FileOrigin FileLoader::fileOrigin() const {
 	return Data::FileOrigin();
 }
@@ -262,12 +400,12 @@ void FileLoader::notifyAboutProgress() {
 }
 
 void FileLoader::LoadNextFromQueue(not_null<Queue*> queue) {
-	if (queue->queriesCount >= queue->queriesLimit) {
+	if (queue->full(true)) {
 		return;
 	}
 	for (auto i = queue->start; i;) {
-		if (i->loadPart()) {
-			if (queue->queriesCount >= queue->queriesLimit) {
+		if (!queue->full(i->smallFile()) && i->loadPart()) {
+			if (queue->full(true)) {
 				return;
 			}
 		} else {
@@ -276,6 +414,10 @@ void FileLoader::LoadNextFromQueue(not_null<Queue*> queue) {
 	}
 }
 
+bool FileLoader::smallFile() const {
+	return !_size || (_size <= Storage::kSmallFileParts * Storage::kPartSize);
+}
+
 void FileLoader::removeFromQueue() {
 	if (!_inQueue) return;
 	if (_next) {
@@ -325,7 +467,8 @@ void FileLoader::start() {
 	}
 
 	if (!_filename.isEmpty() && _toCache == LoadToFileOnly && !_fileIsOpen) {
-		_fileIsOpen = _file.open(QIODevice::WriteOnly);
+		_fileIsOpen = openFileResumed()
+			|| _file.open(QIODevice::WriteOnly);
 		if (!_fileIsOpen) {
 			return cancel(true);
 		}
@@ -415,7 +558,7 @@ void FileLoader::loadLocal(const Storage::Cache::Key &key) {
 				std::move(image));
 		});
 	};
-	session().data().cache().get(key, [=, callback = std::move(done)](
+	_downloader->readFromCache(key, [=, callback = std::move(done)](
 			QByteArray &&value) mutable {
 		if (readImage) {
 			crl::async([
@@ -478,6 +621,7 @@ void FileLoader::cancel(bool fail) {
 		_fileIsOpen = false;
 		_file.remove();
 	}
+	forgetJournal();
 	_data = QByteArray();
 	removeFromQueue();
 
@@ -499,7 +643,7 @@ void FileLoader::cancel(bool fail) {
 }
 
 void FileLoader::startLoading() {
-	if ((_queue->queriesCount >= _queue->queriesLimit) || _finished) {
+	if (_queue->full(smallFile()) || _finished) {
 		return;
 	}
 	loadPart();
@@ -527,6 +671,9 @@ bool FileLoader::writeResultPart(int offset, bytes::const_span buffer) {
 			cancel(true);
 			return false;
 		}
+		if (_journalEntry) {
+			journalPart(offset, buffer.size());
+		}
 		return true;
 	}
 	_data.reserve(offset + buffer.size());
@@ -572,6 +719,91 @@ QByteArray FileLoader::readLoadedPartBack(int offset, int size) {
 		: QByteArray();
 }
 
+bool FileLoader::openFileResumed() {
+	Expects(!_fileIsOpen);
+
+	if (!resumable()) {
+		return false;
+	}
+	auto &journal = _downloader->journal();
+	const auto key = cacheKey();
+	auto entry = journal.read(key);
+	if (entry
+		&& entry->size == _size
+		&& entry->partSize == Storage::kPartSize
+		&& entry->receivedBytes() > 0
+		&& moveResumedFile(entry->path)
+		&& _file.open(QIODevice::ReadWrite)) {
+		DEBUG_LOG(("Download Info: resuming '%1' with %2 of %3 bytes."
+			).arg(_filename
+			).arg(entry->receivedBytes()
+			).arg(_size));
+		entry->path = _filename;
+		_skippedBytes = _file.size() - entry->receivedBytes();
+	} else {
+		entry = Storage::DownloadJournal::Entry();
+		entry->path = _filename;
+		entry->size = _size;
+		entry->partSize = Storage::kPartSize;
+		entry->parts.resize(entry->partsCount(), false);
+		if (!_file.open(QIODevice::WriteOnly)) {
+			return false;
+		}
+	}
+	if (!journal.start(key, *entry)) {
+		LOG(("Download Error: could not write the journal for '%1'."
+			).arg(_filename));
+	}
+	_journalEntry = std::move(entry);
+	return true;
+}
+
+bool FileLoader::moveResumedFile(const QString &path) {
+	if (path == _filename) {
+		return true;
+	} else if (!QFile::exists(path)) {
+		return false;
+	} else if (!QFile::exists(_filename)) {
+		return QFile::rename(path, _filename);
+	}
+
+	// Keep the existing file until the partial one takes its place.
+	const auto replaced = _filename + qsl(".replaced");
+	QFile::remove(replaced);
+	if (!QFile::rename(_filename, replaced)) {
+		return false;
+	} else if (!QFile::rename(path, _filename)) {
+		QFile::rename(replaced, _filename);
+		return false;
+	}
+	QFile::remove(replaced);
+	return true;
+}
+
+void FileLoader::journalPart(int offset, int size) {
+	Expects(_journalEntry.has_value());
+
+	auto &entry = *_journalEntry;
+	const auto index = offset / entry.partSize;
+	if ((offset % entry.partSize)
+		|| index >= entry.partsCount()
+		|| entry.parts[index]
+		|| entry.partLength(index) != size) {
+		return;
+	}
+	entry.parts[index] = true;
+
+	// The part should be in the file before it is in the journal.
+	_file.flush();
+	_downloader->journal().partReceived(cacheKey(), offset);
+}
+
+void FileLoader::forgetJournal() {
+	if (base::take(_journalEntry)) {
+		_downloader->journal().remove(cacheKey());
+	}
+}
+
 bool FileLoader::finalizeResult() {
 	Expects(!_finished);
 
@@ -593,6 +825,7 @@ bool FileLoader::finalizeResult() {
 		Platform::File::PostprocessDownloaded(
 			QFileInfo(_file).absoluteFilePath());
 	}
+	forgetJournal();
 	removeFromQueue();
 
 	if (_localStatus == LocalStatus::NotFound) {
@@ -703,6 +936,20 @@ void mtpFileLoader::refreshFileReferenceFrom(
 }
 
 bool mtpFileLoader::loadPart() {
+	if (_journalEntry && !_finished) {
+		// Skip the parts received before the restart.
+		_nextRequestOffset = _journalEntry->nextMissing(_nextRequestOffset);
+		if (_nextRequestOffset >= _size
+			&& _sentRequests.empty()
+			&& _journalEntry->receivedBytes() == _size) {
+			crl::on_main(this, [=] {
+				if (!_finished && finalizeResult()) {
+					notifyAboutProgress();
+				}
+			});
+			return false;
+		}
+	}
 	if (_finished || _lastComplete || (!_sentRequests.empty() && !_size)) {
 		return false;
 	} else if (_size && _nextRequestOffset >= _size) {
@@ -714,6 +961,11 @@ bool mtpFileLoader::loadPart() {
 	return true;
 }
 
+bool mtpFileLoader::resumable() const {
+	return (_size >= Storage::kMinResumableSize)
+		&& (base::get_if<StorageFileLocation>(&_location) != nullptr);
+}
+
 MTP::DcId mtpFileLoader::dcId() const {
 	if (const auto storage = base::get_if<StorageFileLocation>(&_location)) {
 		return storage->dcId();
@@ -833,7 +1085,7 @@ void mtpFileLoader::normalPartLoaded(
 	Expects(!_finished);
 	Expects(result.type() == mtpc_upload_fileCdnRedirect || result.type() == mtpc_upload_file);
 
-	auto offset = finishSentRequestGetOffset(requestId);
+	auto offset = finishAnsweredRequestGetOffset(requestId);
 	if (result.type() == mtpc_upload_fileCdnRedirect) {
 		return switchToCDN(offset, result.c_upload_fileCdnRedirect());
 	}
@@ -845,7 +1097,7 @@ void mtpFileLoader::webPartLoaded(
 		const MTPupload_WebFile &result,
 		mtpRequestId requestId) {
 	result.match([&](const MTPDupload_webFile &data) {
-		const auto offset = finishSentRequestGetOffset(requestId);
+		const auto offset = finishAnsweredRequestGetOffset(requestId);
 		if (!_size) {
 			_size = data.vsize().v;
 		} else if (data.vsize().v != _size) {
@@ -863,7 +1115,7 @@ void mtpFileLoader::webPartLoaded(
 void mtpFileLoader::cdnPartLoaded(const MTPupload_CdnFile &result, mtpRequestId requestId) {
 	Expects(!_finished);
 
-	const auto offset = finishSentRequestGetOffset(requestId);
+	const auto offset = finishAnsweredRequestGetOffset(requestId);
 	result.match([&](const MTPDupload_cdnFileReuploadNeeded &data) {
 		auto requestData = RequestData();
 		requestData.dcId = dcId();
@@ -1011,7 +1263,8 @@ void mtpFileLoader::placeSentRequest(
 		requestData.dcIndex,
 		Storage::kPartSize);
 	++_queue->queriesCount;
-	_sentRequests.emplace(requestId, requestData);
+	const auto i = _sentRequests.emplace(requestId, requestData).first;
+	i->second.sent = crl::now();
 }
 
 int mtpFileLoader::finishSentRequestGetOffset(mtpRequestId requestId) {
@@ -1030,6 +1283,20 @@ int mtpFileLoader::finishSentRequestGetOffset(mtpRequestId requestId) {
 	return requestData.offset;
 }
 
+int mtpFileLoader::finishAnsweredRequestGetOffset(mtpRequestId requestId) {
+	const auto it = _sentRequests.find(requestId);
+	Assert(it != _sentRequests.cend());
+
+	const auto requestData = it->second;
+	const auto result = finishSentRequestGetOffset(requestId);
+	_downloader->requestFinished(
+		requestData.dcId,
+		requestData.dcIndex,
+		Storage::kPartSize,
+		crl::now() - requestData.sent);
+	return result;
+}
+
 bool mtpFileLoader::feedPart(int offset, bytes::const_span buffer) {
 	if (!writeResultPart(offset, buffer)) {
 		return false;
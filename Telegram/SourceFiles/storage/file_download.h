@@ -11,6 +11,8 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "base/timer.h"
 #include "base/binary_guard.h"
 #include "data/data_file_origin.h"
+#include "storage/storage_download_journal.h"
+#include "storage/storage_download_scheduler.h"
 
 class ApiWrap;
 
@@ -35,10 +37,21 @@ constexpr auto kMaxWallPaperDimension = 4096; // 4096x4096 is max area.
 class Downloader final {
 public:
 	struct Queue {
-		Queue(int queriesLimit) : queriesLimit(queriesLimit) {
+		Queue(int queriesLimit, int reservedQueries = 0)
+		: queriesLimit(queriesLimit)
+		, reservedQueries(reservedQueries) {
+		}
+		bool full(bool smallFile) const {
+			return queriesCount
+				>= queriesLimit + (smallFile ? reservedQueries : 0);
 		}
 		int queriesCount = 0;
 		int queriesLimit = 0;
+
+		// Small files may go over the limit by this count of queries,
+		// so that thumbnails don't wait for large files to finish.
+		int reservedQueries = 0;
+
 		FileLoader *start = nullptr;
 		FileLoader *end = nullptr;
 	};
@@ -60,23 +73,40 @@ public:
 	}
 
 	void requestedAmountIncrement(MTP::DcId dcId, int index, int amount);
+	void requestFinished(
+		MTP::DcId dcId,
+		int index,
+		int bytes,
+		crl::time duration);
 	int chooseDcIndexForRequest(MTP::DcId dcId) const;
+	int64 bytesPerSecond(MTP::DcId dcId) const;
 
 	not_null<Queue*> queueForDc(MTP::DcId dcId);
 	not_null<Queue*> queueForWeb();
 
+	DownloadJournal &journal();
+
+	// Cache reads requested while handling one event are sent together.
+	void readFromCache(
+		const Cache::Key &key,
+		FnMut<void(QByteArray&&)> done);
+
 private:
+	void sendCacheReads();
+
 	void killDownloadSessionsStart(MTP::DcId dcId);
 	void killDownloadSessionsStop(MTP::DcId dcId);
 	void killDownloadSessions();
 
+	DownloadScheduler &schedulerForDc(MTP::DcId dcId);
+	void updateQueriesLimit(MTP::DcId dcId);
+
 	not_null<ApiWrap*> _api;
 
 	base::Observable<void> _taskFinishedObservable;
 	int _priority = 1;
 
-	using RequestedInDc = std::array<int64, MTP::kDownloadSessionsCount>;
-	std::map<MTP::DcId, RequestedInDc> _requestedBytesAmount;
+	std::map<MTP::DcId, DownloadScheduler> _schedulers;
 
 	base::flat_map<MTP::DcId, crl::time> _killDownloadSessionTimes;
 	base::Timer _killDownloadSessionsTimer;
@@ -84,6 +114,12 @@ private:
 	std::map<MTP::DcId, Queue> _queuesForDc;
 	Queue _queueForWeb;
 
+	std::unique_ptr<DownloadJournal> _journal;
+
+	std::vector<Cache::Key> _cacheReadKeys;
+	std::vector<FnMut<void(QByteArray&&)>> _cacheReadCallbacks;
+	base::Timer _cacheReadsTimer;
+
 };
 
 } // namespace Storage
@@ -130,6 +166,10 @@ public:
 	}
 	QByteArray imageFormat(const QSize &shrinkBox = QSize()) const;
 	QImage imageData(const QSize &shrinkBox = QSize()) const;
+
+	// Starts decoding of a large loaded image on a background thread.
+	// Returns false until imageData() is ready without decoding.
+	bool readImageAsync(const QSize &shrinkBox = QSize());
 	QString fileName() const {
 		return _filename;
 	}
@@ -188,6 +228,16 @@ protected:
 	virtual std::optional<MediaKey> fileLocationKey() const = 0;
 	virtual void cancelRequests() = 0;
 
+	// Files written with the received parts journaled can be continued
+	// after the app is restarted.
+	virtual bool resumable() const {
+		return false;
+	}
+	bool openFileResumed();
+	bool moveResumedFile(const QString &path);
+	void journalPart(int offset, int size);
+	void forgetJournal();
+
 	void startLoading();
 	void removeFromQueue();
 	void cancel(bool failed);
@@ -195,6 +245,7 @@ protected:
 	void notifyAboutProgress();
 	static void LoadNextFromQueue(not_null<Queue*> queue);
 	virtual bool loadPart() = 0;
+	[[nodiscard]] bool smallFile() const;
 
 	bool writeResultPart(int offset, bytes::const_span buffer);
 	bool finalizeResult();
@@ -216,6 +267,7 @@ protected:
 	QString _filename;
 	QFile _file;
 	bool _fileIsOpen = false;
+	std::optional<Storage::DownloadJournal::Entry> _journalEntry;
 
 	LoadToCacheSetting _toCache;
 	LoadFromCloudSetting _fromCloud;
@@ -227,6 +279,8 @@ protected:
 	LocationType _locationType = LocationType();
 
 	base::binary_guard _localLoading;
+	base::binary_guard _imageReading;
+	bool _imageReadFinished = false;
 	mutable QByteArray _imageFormat;
 	mutable QImage _imageData;
 
@@ -278,6 +332,7 @@ private:
 		MTP::DcId dcId = 0;
 		int dcIndex = 0;
 		int offset = 0;
+		crl::time sent = 0;
 	};
 	struct CdnFileHash {
 		CdnFileHash(int limit, QByteArray hash) : limit(limit), hash(hash) {
@@ -288,6 +343,7 @@ private:
 	Storage::Cache::Key cacheKey() const override;
 	std::optional<MediaKey> fileLocationKey() const override;
 	void cancelRequests() override;
+	bool resumable() const override;
 
 	MTP::DcId dcId() const;
 	RequestData prepareRequest(int offset) const;
@@ -311,6 +367,7 @@ private:
 	mtpRequestId sendRequest(const RequestData &requestData);
 	void placeSentRequest(mtpRequestId requestId, const RequestData &requestData);
 	int finishSentRequestGetOffset(mtpRequestId requestId);
+	int finishAnsweredRequestGetOffset(mtpRequestId requestId);
 	void switchToCDN(int offset, const MTPDupload_fileCdnRedirect &redirect);
 	void addCdnHashes(const QVector<MTPFileHash> &hashes);
 	void changeCDNParams(int offset, MTP::DcId dcId, const QByteArray &token, const QByteArray &encryptionKey, const QByteArray &encryptionIV, const QVector<MTPFileHash> &hashes);
@@ -9,6 +9,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 #include "storage/localimageloader.h"
 #include "storage/file_download.h"
+#include "storage/storage_upload_reader.h"
 #include "mtproto/connection.h" // for MTP::kAckSendWaiting
 #include "data/data_document.h"
 #include "data/data_photo.h"
@@ -38,8 +39,8 @@ constexpr auto kDocumentUploadPartSize3 = 256 * 1024;
 // 512kb for large document ( <= 1500mb )
 constexpr auto kDocumentUploadPartSize4 = 512 * 1024;
 
-// One part each half second, if not uploaded faster.
-constexpr auto kUploadRequestInterval = crl::time(500);
+// Document parts are read and hashed up to 4mb ahead of the sent ones.
+constexpr auto kReadAheadSize = 4 * 1024 * 1024;
 
 // How much time without upload causes additional session kill.
 constexpr auto kKillSessionTimeout = crl::time(5000);
@@ -63,9 +64,7 @@ struct Uploader::File {
 	uint64 thumbId() const;
 	const QString &filename() const;
 
-	HashMd5 md5Hash;
-
-	std::unique_ptr<QFile> docFile;
+	std::unique_ptr<UploadReader> reader;
 	int32 docSentParts = 0;
 	int32 docSize = 0;
 	int32 docPartSize = 0;
@@ -142,8 +141,6 @@ const QString &Uploader::File::filename() const {
 
 Uploader::Uploader(not_null<ApiWrap*> api)
 : _api(api) {
-	nextTimer.setSingleShot(true);
-	connect(&nextTimer, SIGNAL(timeout()), this, SLOT(sendNext()));
 	stopSessionsTimer.setSingleShot(true);
 	connect(&stopSessionsTimer, SIGNAL(timeout()), this, SLOT(stopSessions()));
 }
@@ -290,13 +287,6 @@ void Uploader::sendNext() {
 	}
 	auto &uploadingData = i->second;
 
-	auto todc = 0;
-	for (auto dc = 1; dc != MTP::kUploadSessionsCount; ++dc) {
-		if (sentSizes[dc] < sentSizes[todc]) {
-			todc = dc;
-		}
-	}
-
 	auto &parts = uploadingData.file
 		? ((uploadingData.type() == SendMediaType::Photo
 			|| uploadingData.type() == SendMediaType::Secure)
@@ -309,7 +299,36 @@ void Uploader::sendNext() {
 			? uploadingData.file->id
 			: uploadingData.file->thumbId)
 		: uploadingData.media.thumbId;
-	if (parts.isEmpty()) {
+
+	// Send parts while there is room, not one part per call.
+	while (sentSize < kMaxUploadFileParallelSize) {
+		auto todc = 0;
+		for (auto dc = 1; dc != MTP::kUploadSessionsCount; ++dc) {
+			if (sentSizes[dc] < sentSizes[todc]) {
+				todc = dc;
+			}
+		}
+
+		if (!parts.isEmpty()) {
+			auto part = parts.begin();
+
+			const auto requestId = MTP::send(
+				MTPupload_SaveFilePart(
+					MTP_long(partsOfId),
+					MTP_int(part.key()),
+					MTP_bytes(part.value())),
+				rpcDone(&Uploader::partLoaded),
+				rpcFail(&Uploader::partFailed),
+				MTP::uploadDcId(todc));
+			requestsSent.emplace(requestId, part.value());
+			dcMap.emplace(requestId, todc);
+			sentSize += part.value().size();
+			sentSizes[todc] += part.value().size();
+
+			parts.erase(part);
+			continue;
+		}
+
 		if (uploadingData.docSentParts >= uploadingData.docPartsCount) {
 			if (requestsSent.empty() && docRequestsSent.empty()) {
 				const auto silent = uploadingData.file
@@ -336,8 +355,9 @@ void Uploader::sendNext() {
 				} else if (uploadingData.type() == SendMediaType::File
 					|| uploadingData.type() == SendMediaType::WallPaper
 					|| uploadingData.type() == SendMediaType::Audio) {
-					QByteArray docMd5(32, Qt::Uninitialized);
-					hashMd5Hex(uploadingData.md5Hash.result(), docMd5.data());
+					const auto docMd5 = uploadingData.reader
+						? uploadingData.reader->md5Hex()
+						: QByteArray();
 
 					const auto file = (uploadingData.docSize > kUseBigFilesFrom)
 						? MTP_inputFileBig(
@@ -387,50 +407,37 @@ void Uploader::sendNext() {
 			return;
 		}
 
-		auto &content = uploadingData.file
-			? uploadingData.file->content
-			: uploadingData.media.data;
-		QByteArray toSend;
-		if (content.isEmpty()) {
-			if (!uploadingData.docFile) {
-				const auto filepath = uploadingData.file
+		if (!uploadingData.reader) {
+			uploadingData.reader = std::make_unique<UploadReader>(
+				(uploadingData.file
 					? uploadingData.file->filepath
-					: uploadingData.media.file;
-				uploadingData.docFile = std::make_unique<QFile>(filepath);
-				if (!uploadingData.docFile->open(QIODevice::ReadOnly)) {
-					currentFailed();
-					return;
-				}
-			}
-			toSend = uploadingData.docFile->read(uploadingData.docPartSize);
-			if (uploadingData.docSize <= kUseBigFilesFrom) {
-				uploadingData.md5Hash.feed(toSend.constData(), toSend.size());
-			}
-		} else {
-			const auto offset = uploadingData.docSentParts
-				* uploadingData.docPartSize;
-			toSend = content.mid(offset, uploadingData.docPartSize);
-			if ((uploadingData.type() == SendMediaType::File
-				|| uploadingData.type() == SendMediaType::WallPaper
-				|| uploadingData.type() == SendMediaType::Audio)
-				&& uploadingData.docSentParts <= kUseBigFilesFrom) {
-				uploadingData.md5Hash.feed(toSend.constData(), toSend.size());
-			}
+					: uploadingData.media.file),
+				(uploadingData.file
+					? uploadingData.file->content
+					: uploadingData.media.data),
+				uploadingData.docPartSize,
+				uploadingData.docPartsCount,
+				(uploadingData.docSize <= kUseBigFilesFrom),
+				kReadAheadSize,
+				[=] { crl::on_main(this, [=] { sendNext(); }); });
 		}
-		if ((toSend.size() > uploadingData.docPartSize)
-			|| ((toSend.size() < uploadingData.docPartSize
-				&& uploadingData.docSentParts + 1 != uploadingData.docPartsCount))) {
-			currentFailed();
+		const auto part = uploadingData.reader->takePart();
+		if (!part) {
+			if (uploadingData.reader->failed()) {
+				currentFailed();
+			}
 			return;
 		}
+		Assert(part->index == uploadingData.docSentParts);
+
 		mtpRequestId requestId;
 		if (uploadingData.docSize > kUseBigFilesFrom) {
 			requestId = MTP::send(
 				MTPupload_SaveBigFilePart(
 					MTP_long(uploadingData.id()),
-					MTP_int(uploadingData.docSentParts),
+					MTP_int(part->index),
 					MTP_int(uploadingData.docPartsCount),
-					MTP_bytes(toSend)),
+					MTP_bytes(part->bytes)),
 				rpcDone(&Uploader::partLoaded),
 				rpcFail(&Uploader::partFailed),
 				MTP::uploadDcId(todc));
@@ -438,37 +445,19 @@ void Uploader::sendNext() {
 			requestId = MTP::send(
 				MTPupload_SaveFilePart(
 					MTP_long(uploadingData.id()),
-					MTP_int(uploadingData.docSentParts),
-					MTP_bytes(toSend)),
+					MTP_int(part->index),
+					MTP_bytes(part->bytes)),
 				rpcDone(&Uploader::partLoaded),
 				rpcFail(&Uploader::partFailed),
 				MTP::uploadDcId(todc));
 		}
-		docRequestsSent.emplace(requestId, uploadingData.docSentParts);
+		docRequestsSent.emplace(requestId, part->index);
 		dcMap.emplace(requestId, todc);
 		sentSize += uploadingData.docPartSize;
 		sentSizes[todc] += uploadingData.docPartSize;
 
 		uploadingData.docSentParts++;
-	} else {
-		auto part = parts.begin();
-
-		const auto requestId = MTP::send(
-			MTPupload_SaveFilePart(
-				MTP_long(partsOfId),
-				MTP_int(part.key()),
-				MTP_bytes(part.value())),
-			rpcDone(&Uploader::partLoaded),
-			rpcFail(&Uploader::partFailed),
-			MTP::uploadDcId(todc));
-		requestsSent.emplace(requestId, part.value());
-		dcMap.emplace(requestId, todc);
-		sentSize += part.value().size();
-		sentSizes[todc] += part.value().size();
-
-		parts.erase(part);
 	}
-	nextTimer.start(kUploadRequestInterval);
 }
 
 void Uploader::cancel(const FullMsgId &msgId) {
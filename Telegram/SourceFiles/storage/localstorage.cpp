@@ -3194,6 +3194,12 @@ QString cacheBigFilePath() {
 	return _userDbPath + "media_cache";
 }
 
+QString downloadJournalPath() {
+	Expects(!_userDbPath.isEmpty());
+
+	return _userDbPath + "downloads";
+}
+
 Storage::Cache::Database::Settings cacheBigFileSettings() {
 	auto result = Storage::Cache::Database::Settings();
 	result.clearOnWrongKey = true;
@@ -124,6 +124,8 @@ Storage::EncryptionKey cacheBigFileKey();
 QString cacheBigFilePath();
 Storage::Cache::Database::Settings cacheBigFileSettings();
 
+QString downloadJournalPath();
+
 void countVoiceWaveform(DocumentData *document);
 
 void cancelTask(TaskId id);
@@ -0,0 +1,189 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "storage/storage_download_journal.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <algorithm>
+
+namespace Storage {
+namespace {
+
+constexpr auto kJournalMagic = qint32(0x4A464454); // "TDFJ"
+constexpr auto kJournalVersion = qint32(1);
+
+QString KeyFileName(const Cache::Key &key) {
+	return QString("%1%2"
+	).arg(key.high, 16, 16, QChar('0')
+	).arg(key.low, 16, 16, QChar('0'));
+}
+
+} // namespace
+
+int DownloadJournal::Entry::partsCount() const {
+	return partSize ? ((size + partSize - 1) / partSize) : 0;
+}
+
+int DownloadJournal::Entry::partLength(int index) const {
+	Expects(index >= 0 && index < partsCount());
+
+	return std::min(partSize, size - index * partSize);
+}
+
+bool DownloadJournal::Entry::hasPart(int offset) const {
+	if (!partSize || offset < 0 || (offset % partSize)) {
+		return false;
+	}
+	const auto index = offset / partSize;
+	return (index < parts.size()) && parts[index];
+}
+
+int DownloadJournal::Entry::receivedBytes() const {
+	auto result = 0;
+	for (auto i = 0; i != parts.size(); ++i) {
+		if (parts[i]) {
+			result += partLength(i);
+		}
+	}
+	return result;
+}
+
+int DownloadJournal::Entry::nextMissing(int offset) const {
+	Expects(partSize > 0);
+	Expects(offset >= 0 && !(offset % partSize));
+
+	while (offset < size && hasPart(offset)) {
+		offset += partSize;
+	}
+	return std::min(offset, size);
+}
+
+DownloadJournal::DownloadJournal(const QString &folder)
+: _folder(folder.endsWith('/') ? folder : (folder + '/')) {
+}
+
+std::optional<DownloadJournal::Entry> DownloadJournal::read(
+		const Cache::Key &key) const {
+	return ReadFile(journalPath(key));
+}
+
+std::optional<DownloadJournal::Entry> DownloadJournal::ReadFile(
+		const QString &filePath) {
+	QFile file(filePath);
+	if (!file.open(QIODevice::ReadOnly)) {
+		return std::nullopt;
+	}
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_1);
+
+	auto magic = qint32();
+	auto version = qint32();
+	auto size = qint32();
+	auto partSize = qint32();
+	auto path = QString();
+	stream >> magic >> version >> size >> partSize >> path;
+	if (stream.status() != QDataStream::Ok
+		|| magic != kJournalMagic
+		|| version != kJournalVersion
+		|| size <= 0
+		|| partSize <= 0
+		|| path.isEmpty()) {
+		return std::nullopt;
+	}
+	auto result = Entry();
+	result.path = path;
+	result.size = size;
+	result.partSize = partSize;
+	result.parts.resize(result.partsCount(), false);
+
+	// The last record may be cut if the app was killed while writing it.
+	while (!stream.atEnd()) {
+		auto offset = qint32();
+		stream >> offset;
+		if (stream.status() != QDataStream::Ok) {
+			break;
+		} else if (offset < 0 || offset >= size || (offset % partSize)) {
+			return std::nullopt;
+		}
+		result.parts[offset / partSize] = true;
+	}
+
+	const auto info = QFileInfo(path);
+	const auto written = info.exists() ? info.size() : qint64(0);
+	for (auto i = 0; i != result.parts.size(); ++i) {
+		const auto end = qint64(i) * partSize + result.partLength(i);
+		if (end > written) {
+			result.parts[i] = false;
+		}
+	}
+	return result;
+}
+
+bool DownloadJournal::start(const Cache::Key &key, const Entry &entry) {
+	Expects(entry.size > 0 && entry.partSize > 0);
+	Expects(!entry.path.isEmpty());
+
+	if (!QDir().mkpath(_folder)) {
+		return false;
+	}
+	QFile file(journalPath(key));
+	if (!file.open(QIODevice::WriteOnly)) {
+		return false;
+	}
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_1);
+	stream
+		<< kJournalMagic
+		<< kJournalVersion
+		<< qint32(entry.size)
+		<< qint32(entry.partSize)
+		<< entry.path;
+	for (auto i = 0; i != entry.parts.size(); ++i) {
+		if (entry.parts[i]) {
+			stream << qint32(i * entry.partSize);
+		}
+	}
+	return (stream.status() == QDataStream::Ok) && file.flush();
+}
+
+bool DownloadJournal::partReceived(const Cache::Key &key, int offset) {
+	QFile file(journalPath(key));
+	if (!file.exists()
+		|| !file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+		return false;
+	}
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_1);
+	stream << qint32(offset);
+	return (stream.status() == QDataStream::Ok) && file.flush();
+}
+
+void DownloadJournal::remove(const Cache::Key &key) {
+	QFile::remove(journalPath(key));
+}
+
+void DownloadJournal::removeStale(const QDateTime &updatedBefore) {
+	const auto list = QDir(_folder).entryInfoList(QDir::Files);
+	for (const auto &info : list) {
+		const auto entry = ReadFile(info.filePath());
+		if (!entry
+			|| !QFile::exists(entry->path)
+			|| info.lastModified() < updatedBefore) {
+			QFile::remove(info.filePath());
+		}
+	}
+}
+
+QString DownloadJournal::journalPath(const Cache::Key &key) const {
+	return _folder + KeyFileName(key);
+}
+
+} // namespace Storage
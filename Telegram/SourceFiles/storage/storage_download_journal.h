@@ -0,0 +1,64 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "storage/cache/storage_cache_types.h"
+
+#include <vector>
+
+class QDateTime;
+
+namespace Storage {
+
+// Remembers which parts of large files were already written to disk,
+// so that downloads continue from there after the app is restarted.
+//
+// Every download has a small file in the journal folder: a header with
+// the path and sizes and then the offsets of received parts, appended
+// right after the part is written.
+class DownloadJournal final {
+public:
+	struct Entry {
+		QString path;
+		int size = 0;
+		int partSize = 0;
+		std::vector<bool> parts;
+
+		[[nodiscard]] int partsCount() const;
+		[[nodiscard]] int partLength(int index) const;
+		[[nodiscard]] bool hasPart(int offset) const;
+		[[nodiscard]] int receivedBytes() const;
+
+		// First offset not before 'offset' that is not received yet,
+		// 'size' if all the parts from 'offset' are received.
+		[[nodiscard]] int nextMissing(int offset) const;
+	};
+
+	explicit DownloadJournal(const QString &folder);
+
+	// Parts that are not fully present in the file are skipped.
+	[[nodiscard]] std::optional<Entry> read(const Cache::Key &key) const;
+
+	bool start(const Cache::Key &key, const Entry &entry);
+	bool partReceived(const Cache::Key &key, int offset);
+	void remove(const Cache::Key &key);
+
+	// Removes broken journals, journals of files that are gone and
+	// journals without new parts since the given time.
+	void removeStale(const QDateTime &updatedBefore);
+
+private:
+	[[nodiscard]] static std::optional<Entry> ReadFile(
+		const QString &filePath);
+	[[nodiscard]] QString journalPath(const Cache::Key &key) const;
+
+	QString _folder;
+
+};
+
+} // namespace Storage
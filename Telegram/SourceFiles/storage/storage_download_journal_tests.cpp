@@ -0,0 +1,217 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "storage/storage_download_journal.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryDir>
+#include <algorithm>
+#include <set>
+
+using Storage::DownloadJournal;
+
+namespace {
+
+constexpr auto kPartSize = 128 * 1024;
+constexpr auto kPartsCount = 20;
+constexpr auto kSize = kPartsCount * kPartSize - 1000;
+
+const auto Key = Storage::Cache::Key{ 0x0123456789ABCDEFULL, 42 };
+
+QByteArray PartData(int index, int size) {
+	return QByteArray(size, char('a' + index % 26));
+}
+
+DownloadJournal::Entry NewEntry(const QString &path) {
+	auto result = DownloadJournal::Entry();
+	result.path = path;
+	result.size = kSize;
+	result.partSize = kPartSize;
+	result.parts.resize(result.partsCount(), false);
+	return result;
+}
+
+// Writes the parts to the file and the journal the way FileLoader does.
+void Download(
+		DownloadJournal &journal,
+		QFile &file,
+		const DownloadJournal::Entry &entry,
+		const std::vector<int> &indices) {
+	for (const auto index : indices) {
+		const auto offset = index * kPartSize;
+		REQUIRE(file.seek(offset));
+		const auto data = PartData(index, entry.partLength(index));
+		REQUIRE(file.write(data) == data.size());
+		REQUIRE(file.flush());
+		REQUIRE(journal.partReceived(Key, offset));
+	}
+}
+
+// Offsets mtpFileLoader::loadPart() requests after the restart.
+std::set<int> RequestedOffsets(const DownloadJournal::Entry &entry) {
+	auto result = std::set<int>();
+	auto offset = 0;
+	while (true) {
+		offset = entry.nextMissing(offset);
+		if (offset >= entry.size) {
+			break;
+		}
+		result.emplace(offset);
+		offset += kPartSize;
+	}
+	return result;
+}
+
+} // namespace
+
+TEST_CASE("download journal", "[download_journal]") {
+	QTemporaryDir folder;
+	REQUIRE(folder.isValid());
+	const auto journalFolder = folder.filePath("downloads");
+	const auto path = folder.filePath("large.file");
+
+	SECTION("download killed halfway requests only missing parts") {
+		// Parts are received out of order when requested in parallel.
+		const auto received = std::vector<int>{
+			0, 2, 1, 3, 5, 4, 6, 8, 9, 7, kPartsCount - 1
+		};
+		{
+			auto journal = DownloadJournal(journalFolder);
+			const auto entry = NewEntry(path);
+			REQUIRE(journal.start(Key, entry));
+			QFile file(path);
+			REQUIRE(file.open(QIODevice::WriteOnly));
+			Download(journal, file, entry, received);
+
+			// Killed while writing the next record.
+			QFile raw(journalFolder + '/' + "0123456789abcdef000000000000002a");
+			REQUIRE(raw.open(QIODevice::WriteOnly | QIODevice::Append));
+			REQUIRE(raw.write("\0\0", 2) == 2);
+		}
+
+		auto journal = DownloadJournal(journalFolder);
+		const auto entry = journal.read(Key);
+		REQUIRE(entry.has_value());
+		REQUIRE(entry->path == path);
+		REQUIRE(entry->size == kSize);
+		REQUIRE(entry->receivedBytes()
+			== (int(received.size()) - 1) * kPartSize
+				+ entry->partLength(kPartsCount - 1));
+
+		auto expected = std::set<int>();
+		for (auto i = 0; i != kPartsCount; ++i) {
+			if (std::find(begin(received), end(received), i)
+				== end(received)) {
+				expected.emplace(i * kPartSize);
+			}
+		}
+		REQUIRE(RequestedOffsets(*entry) == expected);
+
+		// The rest is downloaded after the restart.
+		QFile file(path);
+		REQUIRE(file.open(QIODevice::ReadWrite));
+		auto rest = std::vector<int>();
+		for (const auto offset : expected) {
+			rest.push_back(offset / kPartSize);
+		}
+		Download(journal, file, *entry, rest);
+		file.close();
+
+		const auto finished = journal.read(Key);
+		REQUIRE(finished.has_value());
+		REQUIRE(finished->receivedBytes() == kSize);
+		REQUIRE(RequestedOffsets(*finished).empty());
+
+		REQUIRE(file.open(QIODevice::ReadOnly));
+		const auto content = file.readAll();
+		REQUIRE(content.size() == kSize);
+		for (auto i = 0; i != kPartsCount; ++i) {
+			const auto length = finished->partLength(i);
+			REQUIRE(content.mid(i * kPartSize, length)
+				== PartData(i, length));
+		}
+
+		journal.remove(Key);
+		REQUIRE(!journal.read(Key).has_value());
+	}
+	SECTION("parts missing in the file are requested again") {
+		auto journal = DownloadJournal(journalFolder);
+		const auto entry = NewEntry(path);
+		REQUIRE(journal.start(Key, entry));
+		{
+			QFile file(path);
+			REQUIRE(file.open(QIODevice::WriteOnly));
+			Download(journal, file, entry, { 0, 1, 2, 3 });
+			REQUIRE(file.resize(2 * kPartSize + 10));
+		}
+		const auto read = journal.read(Key);
+		REQUIRE(read.has_value());
+		REQUIRE(read->hasPart(0));
+		REQUIRE(read->hasPart(kPartSize));
+		REQUIRE(!read->hasPart(2 * kPartSize));
+		REQUIRE(!read->hasPart(3 * kPartSize));
+		REQUIRE(read->nextMissing(0) == 2 * kPartSize);
+	}
+	SECTION("restarted journal keeps the received parts") {
+		auto journal = DownloadJournal(journalFolder);
+		REQUIRE(journal.start(Key, NewEntry(path)));
+		{
+			QFile file(path);
+			REQUIRE(file.open(QIODevice::WriteOnly));
+			Download(journal, file, NewEntry(path), { 0, 1 });
+		}
+		auto moved = *journal.read(Key);
+		const auto other = folder.filePath("large (1).file");
+		REQUIRE(QFile::rename(path, other));
+		moved.path = other;
+		REQUIRE(journal.start(Key, moved));
+
+		const auto read = journal.read(Key);
+		REQUIRE(read.has_value());
+		REQUIRE(read->path == other);
+		REQUIRE(read->receivedBytes() == 2 * kPartSize);
+	}
+	SECTION("broken journal is ignored") {
+		auto journal = DownloadJournal(journalFolder);
+		REQUIRE(journal.start(Key, NewEntry(path)));
+		QFile raw(journalFolder + '/' + "0123456789abcdef000000000000002a");
+		REQUIRE(raw.open(QIODevice::WriteOnly));
+		REQUIRE(raw.write("garbage") == 7);
+		raw.close();
+		REQUIRE(!journal.read(Key).has_value());
+	}
+	SECTION("stale journals are removed") {
+		const auto gone = Storage::Cache::Key{ 1, 2 };
+		const auto broken = Storage::Cache::Key{ 3, 4 };
+		auto journal = DownloadJournal(journalFolder);
+		REQUIRE(journal.start(Key, NewEntry(path)));
+		REQUIRE(journal.start(gone, NewEntry(folder.filePath("gone.file"))));
+		REQUIRE(journal.start(broken, NewEntry(path)));
+		{
+			QFile file(path);
+			REQUIRE(file.open(QIODevice::WriteOnly));
+			Download(journal, file, NewEntry(path), { 0 });
+		}
+		QFile raw(journalFolder + '/' + "00000000000000030000000000000004");
+		REQUIRE(raw.open(QIODevice::WriteOnly));
+		REQUIRE(raw.write("garbage") == 7);
+		raw.close();
+
+		journal.removeStale(QDateTime::currentDateTime().addDays(-1));
+		REQUIRE(journal.read(Key).has_value());
+		REQUIRE(!QFile::exists(raw.fileName()));
+		REQUIRE(QDir(journalFolder).entryList(QDir::Files).size() == 1);
+
+		journal.removeStale(QDateTime::currentDateTime().addDays(1));
+		REQUIRE(!journal.read(Key).has_value());
+		REQUIRE(QDir(journalFolder).entryList(QDir::Files).isEmpty());
+	}
+}
@@ -0,0 +1,200 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "storage/storage_download_scheduler.h"
+
+#include <algorithm>
+
+namespace Storage {
+namespace {
+
+// Used for the sessions without answers yet.
+constexpr auto kInitialRtt = crl::time(500);
+
+// Round trips longer than twice the smallest one (and some more for
+// the server to read the part) mean that the requests are queued.
+constexpr auto kQueueingFactor = 2;
+constexpr auto kQueueingSlack = crl::time(100);
+
+// Speed is measured over a round trip, but not over less than that.
+constexpr auto kMinSpeedSample = crl::time(200);
+
+constexpr auto kDecreaseFactor = 0.75;
+
+} // namespace
+
+DownloadScheduler::DownloadScheduler(
+	int sessionsCount,
+	int partSize,
+	int initialQueries)
+: _partSize(partSize)
+, _initialWindow(std::clamp(
+	float64(initialQueries) / std::max(sessionsCount, 1),
+	float64(kMinWindow),
+	float64(kMaxWindow)))
+, _sessions(std::max(sessionsCount, 1)) {
+	Expects(partSize > 0);
+
+	reset();
+}
+
+void DownloadScheduler::requestedAmountIncrement(int index, int amount) {
+	Expects(index >= 0 && index < _sessions.size());
+
+	auto &session = _sessions[index];
+	session.requestedBytes += amount;
+	if (session.requestedBytes <= 0) {
+		session.requestedBytes = 0;
+
+		// Idle time is not counted in the speed.
+		session.sampleStart = 0;
+		session.sampleBytes = 0;
+	}
+}
+
+void DownloadScheduler::requestFinished(
+		int index,
+		int bytes,
+		crl::time duration,
+		crl::time now) {
+	Expects(index >= 0 && index < _sessions.size());
+
+	auto &session = _sessions[index];
+	duration = std::max(duration, crl::time(1));
+	updateRtt(session, duration);
+	updateSpeed(session, bytes, duration, now);
+
+	if (queueing(session, duration)) {
+		// Answers to the requests sent before the previous decrease
+		// are still delayed, wait for a round trip before the next one.
+		if (now - session.lastDecrease >= session.smoothedRtt) {
+			session.window = std::max(
+				session.window * kDecreaseFactor,
+				float64(kMinWindow));
+			session.threshold = session.window;
+			session.lastDecrease = now;
+		}
+		return;
+	}
+
+	// Don't grow windows that are not filled with requests.
+	const auto used = (session.requestedBytes + bytes)
+		>= (session.window - 1.) * _partSize;
+	if (!used) {
+		return;
+	}
+	const auto increment = (session.window < session.threshold)
+		? 1.
+		: (1. / session.window);
+	session.window = std::min(
+		session.window + increment,
+		float64(kMaxWindow));
+}
+
+void DownloadScheduler::reset() {
+	for (auto &session : _sessions) {
+		const auto requested = session.requestedBytes;
+		session = Session();
+		session.requestedBytes = requested;
+		session.window = _initialWindow;
+		session.threshold = kMaxWindow;
+	}
+}
+
+int DownloadScheduler::chooseSession() const {
+	auto result = 0;
+	for (auto i = 1; i != _sessions.size(); ++i) {
+		const auto &session = _sessions[i];
+		const auto &best = _sessions[result];
+		const auto full = windowFull(session);
+		if (full != windowFull(best)) {
+			if (!full) {
+				result = i;
+			}
+		} else if (expectedWait(session) < expectedWait(best)) {
+			result = i;
+		}
+	}
+	return result;
+}
+
+int DownloadScheduler::queriesLimit() const {
+	auto result = 0;
+	for (const auto &session : _sessions) {
+		result += int(session.window);
+	}
+	return result;
+}
+
+int DownloadScheduler::sessionsCount() const {
+	return _sessions.size();
+}
+
+auto DownloadScheduler::session(int index) const -> const Session & {
+	Expects(index >= 0 && index < _sessions.size());
+
+	return _sessions[index];
+}
+
+int64 DownloadScheduler::bytesPerSecond() const {
+	auto result = int64(0);
+	for (const auto &session : _sessions) {
+		result += session.bytesPerSecond;
+	}
+	return result;
+}
+
+bool DownloadScheduler::windowFull(const Session &session) const {
+	return (session.requestedBytes >= int64(session.window) * _partSize);
+}
+
+float64 DownloadScheduler::expectedWait(const Session &session) const {
+	const auto rtt = session.smoothedRtt
+		? session.smoothedRtt
+		: kInitialRtt;
+	const auto parts = float64(session.requestedBytes) / _partSize;
+	return (parts + 1.) * rtt / session.window;
+}
+
+bool DownloadScheduler::queueing(
+		const Session &session,
+		crl::time rtt) const {
+	return (rtt > session.minRtt * kQueueingFactor + kQueueingSlack);
+}
+
+void DownloadScheduler::updateRtt(Session &session, crl::time rtt) {
+	session.smoothedRtt = session.smoothedRtt
+		? ((7 * session.smoothedRtt + rtt) / 8)
+		: rtt;
+	if (!session.minRtt || rtt < session.minRtt) {
+		session.minRtt = rtt;
+	}
+}
+
+void DownloadScheduler::updateSpeed(
+		Session &session,
+		int bytes,
+		crl::time duration,
+		crl::time now) {
+	if (!session.sampleStart) {
+		session.sampleStart = now - duration;
+	}
+	session.sampleBytes += bytes;
+
+	const auto elapsed = now - session.sampleStart;
+	if (elapsed < std::max(session.smoothedRtt, kMinSpeedSample)) {
+		return;
+	}
+	const auto speed = session.sampleBytes * 1000 / elapsed;
+	session.bytesPerSecond = session.bytesPerSecond
+		? ((3 * session.bytesPerSecond + speed) / 4)
+		: speed;
+	session.sampleStart = now;
+	session.sampleBytes = 0;
+}
+
+} // namespace Storage
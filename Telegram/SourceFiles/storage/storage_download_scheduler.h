@@ -0,0 +1,86 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "base/basic_types.h"
+
+#include <crl/crl_time.h>
+#include <vector>
+
+namespace Storage {
+
+// Chooses how many file parts are requested at once through each of the
+// download sessions of a data center, like tcp congestion control does.
+//
+// Each session has a window of parts in flight. It grows by one part for
+// each answer received while the round trip time stays close to the
+// smallest one seen (doubling each round trip until the first slowdown,
+// by one part each round trip after that). When answers start to wait in
+// a queue somewhere the window is cut by a quarter, once a round trip.
+class DownloadScheduler final {
+public:
+	struct Session {
+		int64 requestedBytes = 0;
+		float64 window = 0.;
+		float64 threshold = 0.;
+		crl::time smoothedRtt = 0;
+		crl::time minRtt = 0;
+		int64 bytesPerSecond = 0;
+
+		crl::time lastDecrease = 0;
+		crl::time sampleStart = 0;
+		int64 sampleBytes = 0;
+	};
+
+	DownloadScheduler(int sessionsCount, int partSize, int initialQueries);
+
+	// Positive when requests are sent and negative when they are answered,
+	// failed or cancelled, like Downloader::requestedAmountIncrement.
+	void requestedAmountIncrement(int index, int amount);
+
+	// Round trip of an answered request, after the amount was decremented.
+	void requestFinished(
+		int index,
+		int bytes,
+		crl::time duration,
+		crl::time now);
+
+	// Sessions were recreated, the windows start from the beginning.
+	void reset();
+
+	// The session where a new request is expected to be answered first.
+	[[nodiscard]] int chooseSession() const;
+
+	// All windows together, in parts.
+	[[nodiscard]] int queriesLimit() const;
+
+	[[nodiscard]] int sessionsCount() const;
+	[[nodiscard]] const Session &session(int index) const;
+	[[nodiscard]] int64 bytesPerSecond() const;
+
+	static constexpr auto kMinWindow = 2;
+	static constexpr auto kMaxWindow = 32;
+
+private:
+	[[nodiscard]] bool windowFull(const Session &session) const;
+	[[nodiscard]] float64 expectedWait(const Session &session) const;
+	[[nodiscard]] bool queueing(const Session &session, crl::time rtt) const;
+	void updateRtt(Session &session, crl::time rtt);
+	void updateSpeed(
+		Session &session,
+		int bytes,
+		crl::time duration,
+		crl::time now);
+
+	int _partSize = 0;
+	float64 _initialWindow = 0.;
+	std::vector<Session> _sessions;
+
+};
+
+} // namespace Storage
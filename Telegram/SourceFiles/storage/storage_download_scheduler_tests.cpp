@@ -0,0 +1,248 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "storage/storage_download_scheduler.h"
+
+#include <algorithm>
+#include <array>
+#include <map>
+
+using Storage::DownloadScheduler;
+
+namespace {
+
+constexpr auto kPartSize = 128 * 1024;
+constexpr auto kSessionsCount = 2;
+constexpr auto kInitialQueries = 16;
+constexpr auto kThumbnailSize = 16 * 1024;
+
+// Simulated data center behind a throttled link: all the answers go one
+// after another through the link of the given speed, the requests and
+// the answers are delayed by half of the given round trip time each.
+class ThrottledDc final {
+public:
+	ThrottledDc(int64 bytesPerSecond, crl::time rtt)
+	: _bytesPerSecond(bytesPerSecond)
+	, _rtt(rtt) {
+	}
+
+	// Returns the time when the answer is received.
+	crl::time request(crl::time now, int bytes) {
+		const auto arrived = now + _rtt / 2;
+		const auto start = std::max(arrived, _linkFree);
+		_linkFree = start + (bytes * 1000 + _bytesPerSecond - 1)
+			/ _bytesPerSecond;
+		return _linkFree + _rtt / 2;
+	}
+
+private:
+	int64 _bytesPerSecond = 0;
+	crl::time _rtt = 0;
+	crl::time _linkFree = 0;
+
+};
+
+struct Result {
+	crl::time duration = 0;
+	crl::time thumbnail = 0;
+	int queriesLimit = 0;
+	int64 bytesPerSecond = 0;
+};
+
+// Downloads a file of 'parts' parts as Storage::Downloader does, limiting
+// the requests in flight by scheduler->queriesLimit() or by the initial
+// limit if no scheduler is given. Once the download is in progress for
+// 'thumbnailAt' a thumbnail is requested outside of the limit.
+Result Download(
+		ThrottledDc &dc,
+		DownloadScheduler *scheduler,
+		int parts,
+		crl::time thumbnailAt = -1) {
+	struct Request {
+		int index = 0;
+		int bytes = 0;
+		crl::time sent = 0;
+		bool thumbnail = false;
+	};
+	const auto start = crl::time(1000);
+	auto now = start;
+	auto inFlight = std::multimap<crl::time, Request>();
+	auto partsInFlight = 0;
+	auto sent = 0;
+	auto received = 0;
+	auto result = Result();
+	const auto limit = [&] {
+		return scheduler ? scheduler->queriesLimit() : kInitialQueries;
+	};
+	const auto send = [&](int bytes, bool thumbnail) {
+		const auto index = scheduler
+			? scheduler->chooseSession()
+			: (sent % kSessionsCount);
+		if (scheduler) {
+			scheduler->requestedAmountIncrement(index, bytes);
+		}
+		inFlight.emplace(
+			dc.request(now, bytes),
+			Request{ index, bytes, now, thumbnail });
+	};
+	while (received < parts) {
+		while (sent < parts && partsInFlight < limit()) {
+			send(kPartSize, false);
+			++sent;
+			++partsInFlight;
+		}
+		if (thumbnailAt >= 0 && now >= start + thumbnailAt) {
+			send(kThumbnailSize, true);
+			thumbnailAt = -1;
+		}
+		REQUIRE(!inFlight.empty());
+
+		const auto i = inFlight.begin();
+		const auto request = i->second;
+		now = i->first;
+		inFlight.erase(i);
+		if (scheduler) {
+			scheduler->requestedAmountIncrement(
+				request.index,
+				-request.bytes);
+			scheduler->requestFinished(
+				request.index,
+				request.bytes,
+				now - request.sent,
+				now);
+		}
+		if (request.thumbnail) {
+			result.thumbnail = now - request.sent;
+		} else {
+			++received;
+			--partsInFlight;
+		}
+	}
+	result.duration = now - start;
+	if (scheduler) {
+		result.queriesLimit = scheduler->queriesLimit();
+		result.bytesPerSecond = scheduler->bytesPerSecond();
+	}
+	return result;
+}
+
+DownloadScheduler MakeScheduler() {
+	return DownloadScheduler(kSessionsCount, kPartSize, kInitialQueries);
+}
+
+} // namespace
+
+TEST_CASE("download scheduler windows", "[download_scheduler]") {
+	auto scheduler = MakeScheduler();
+	REQUIRE(scheduler.queriesLimit() == kInitialQueries);
+
+	SECTION("requests are spread over sessions") {
+		auto counts = std::array<int, kSessionsCount>{ { 0 } };
+		for (auto i = 0; i != kInitialQueries; ++i) {
+			const auto index = scheduler.chooseSession();
+			scheduler.requestedAmountIncrement(index, kPartSize);
+			++counts[index];
+		}
+		REQUIRE(counts[0] == kInitialQueries / kSessionsCount);
+		REQUIRE(counts[1] == kInitialQueries / kSessionsCount);
+	}
+	SECTION("faster session gets more requests") {
+		for (auto i = 0; i != 4; ++i) {
+			scheduler.requestedAmountIncrement(0, kPartSize);
+			scheduler.requestFinished(0, kPartSize, 100, 1000 + i * 100);
+			scheduler.requestedAmountIncrement(0, -kPartSize);
+			scheduler.requestedAmountIncrement(1, kPartSize);
+			scheduler.requestFinished(1, kPartSize, 400, 1000 + i * 400);
+			scheduler.requestedAmountIncrement(1, -kPartSize);
+		}
+		auto counts = std::array<int, kSessionsCount>{ { 0 } };
+		for (auto i = 0; i != 8; ++i) {
+			const auto index = scheduler.chooseSession();
+			scheduler.requestedAmountIncrement(index, kPartSize);
+			++counts[index];
+		}
+		REQUIRE(counts[0] > counts[1]);
+	}
+	SECTION("unused windows don't grow") {
+		for (auto i = 0; i != 100; ++i) {
+			scheduler.requestedAmountIncrement(0, kPartSize);
+			scheduler.requestedAmountIncrement(0, -kPartSize);
+			scheduler.requestFinished(0, kPartSize, 100, 1000 + i * 100);
+		}
+		REQUIRE(scheduler.queriesLimit() == kInitialQueries);
+	}
+	SECTION("windows shrink when answers are queued") {
+		auto now = crl::time(1000);
+		for (auto i = 0; i != 8; ++i) {
+			scheduler.requestedAmountIncrement(0, kPartSize);
+		}
+		scheduler.requestedAmountIncrement(0, -kPartSize);
+		scheduler.requestFinished(0, kPartSize, 100, now);
+		for (auto i = 0; i != 7; ++i) {
+			now += 1000;
+			scheduler.requestedAmountIncrement(0, -kPartSize);
+			scheduler.requestFinished(0, kPartSize, 1000, now);
+		}
+		REQUIRE(scheduler.session(0).window
+			== DownloadScheduler::kMinWindow);
+		REQUIRE(scheduler.queriesLimit() < kInitialQueries);
+
+		scheduler.reset();
+		REQUIRE(scheduler.queriesLimit() == kInitialQueries);
+	}
+}
+
+TEST_CASE("download scheduler on a throttled dc", "[download_scheduler]") {
+	SECTION("fast link with a long round trip is saturated") {
+		// 8 MB/s with 400 ms round trip fit 25 parts in flight.
+		constexpr auto kSpeed = 8 * 1024 * 1024;
+		constexpr auto kRtt = crl::time(400);
+		constexpr auto kParts = 800;
+
+		auto fixedDc = ThrottledDc(kSpeed, kRtt);
+		const auto fixed = Download(fixedDc, nullptr, kParts);
+
+		auto scheduler = MakeScheduler();
+		auto adaptiveDc = ThrottledDc(kSpeed, kRtt);
+		const auto adaptive = Download(adaptiveDc, &scheduler, kParts);
+
+		const auto ideal = crl::time(int64(kParts) * kPartSize * 1000
+			/ kSpeed) + kRtt;
+		REQUIRE(adaptive.queriesLimit > kInitialQueries);
+		REQUIRE(adaptive.duration * 10 < fixed.duration * 8);
+		REQUIRE(adaptive.duration * 10 < ideal * 12);
+		REQUIRE(adaptive.bytesPerSecond * 2 > kSpeed);
+	}
+	SECTION("slow link is saturated without a long queue") {
+		// 1 MB/s with 100 ms round trip fit less than one part.
+		constexpr auto kSpeed = 1024 * 1024;
+		constexpr auto kRtt = crl::time(100);
+		constexpr auto kParts = 200;
+		constexpr auto kThumbnailAt = crl::time(20000);
+
+		auto fixedDc = ThrottledDc(kSpeed, kRtt);
+		const auto fixed = Download(fixedDc, nullptr, kParts, kThumbnailAt);
+
+		auto scheduler = MakeScheduler();
+		auto adaptiveDc = ThrottledDc(kSpeed, kRtt);
+		const auto adaptive = Download(
+			adaptiveDc,
+			&scheduler,
+			kParts,
+			kThumbnailAt);
+
+		const auto ideal = crl::time(int64(kParts) * kPartSize * 1000
+			/ kSpeed) + kRtt;
+		REQUIRE(adaptive.queriesLimit < kInitialQueries);
+		REQUIRE(adaptive.duration * 10 < ideal * 11);
+
+		// The thumbnail waits behind less parts of the large file.
+		REQUIRE(adaptive.thumbnail * 2 < fixed.thumbnail);
+	}
+}
@@ -180,10 +180,14 @@ size_type File::writePlain(bytes::const_span bytes) {
 		bytes.size());
 }
 
-void File::decrypt(bytes::span bytes) {
+void File::decrypt(bytes::span bytes, int threads) {
 	Expects(_state.has_value());
 
-	_state->decrypt(bytes, _encryptionOffset);
+	if (threads > 1) {
+		_state->decrypt(bytes, _encryptionOffset, threads);
+	} else {
+		_state->decrypt(bytes, _encryptionOffset);
+	}
 	_encryptionOffset += bytes.size();
 }
 
@@ -194,7 +198,7 @@ void File::encrypt(bytes::span bytes) {
 	_encryptionOffset += bytes.size();
 }
 
-size_type File::read(bytes::span bytes) {
+size_type File::read(bytes::span bytes, int decryptThreads) {
 	Expects(bytes.size() % kBlockSize == 0);
 
 	auto count = readPlain(bytes);
@@ -205,7 +209,7 @@ size_type File::read(bytes::span bytes) {
 		count += back;
 	}
 	if (count) {
-		decrypt(bytes.subspan(0, count));
+		decrypt(bytes.subspan(0, count), decryptThreads);
 	}
 	return count;
 }
@@ -29,7 +29,7 @@ public:
 	};
 	Result open(const QString &path, Mode mode, const EncryptionKey &key);
 
-	size_type read(bytes::span bytes);
+	size_type read(bytes::span bytes, int decryptThreads = 1);
 	bool write(bytes::span bytes);
 
 	size_type readWithPadding(bytes::span bytes);
@@ -57,7 +57,7 @@ private:
 
 	size_type readPlain(bytes::span bytes);
 	size_type writePlain(bytes::const_span bytes);
-	void decrypt(bytes::span bytes);
+	void decrypt(bytes::span bytes, int threads = 1);
 	void encrypt(bytes::span bytes);
 	void decryptBack(bytes::span bytes);
 
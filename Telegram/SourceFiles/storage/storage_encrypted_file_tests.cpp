@@ -8,6 +8,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "catch.hpp"
 
 #include "storage/storage_encrypted_file.h"
+#include "base/openssl_help.h"
 
 #include <QtCore/QThread>
 #include <QtCore/QCoreApplication>
@@ -17,6 +18,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #endif // Q_OS_WIN
 
 #include <QtCore/QProcess>
+#include <crl/crl_time.h>
 
 #include <thread>
 #ifdef Q_OS_MAC
@@ -40,6 +42,57 @@ const auto Name = QString("test.file");
 const auto Test1 = bytes::make_span("testbytetestbyte").subspan(0, 16);
 const auto Test2 = bytes::make_span("bytetestbytetest").subspan(0, 16);
 
+const auto DisableBenchmarkTests = true;
+
+bytes::vector LargeData(size_type size) {
+	auto result = bytes::vector(size);
+	for (auto i = size_type(0); i != size; ++i) {
+		result[i] = static_cast<bytes::type>((i * 7 + (i >> 11)) & 0xFF);
+	}
+	return result;
+}
+
+bytes::vector FromHex(const char *hex) {
+	auto result = bytes::vector();
+	const auto digit = [](char ch) {
+		return (ch >= 'a') ? (ch - 'a' + 10) : (ch - '0');
+	};
+	for (; hex[0] && hex[1]; hex += 2) {
+		result.push_back(static_cast<bytes::type>(
+			(digit(hex[0]) << 4) | digit(hex[1])));
+	}
+	return result;
+}
+
+// The way the data was encrypted before EVP: AES-256-CTR of the whole
+// stream from the first block, so data at an offset is the stream tail.
+bytes::vector ReferenceCtr(
+		bytes::const_span key,
+		bytes::const_span iv,
+		bytes::const_span data,
+		int64 offset) {
+	auto aes = AES_KEY();
+	AES_set_encrypt_key(
+		reinterpret_cast<const uchar*>(key.data()),
+		int(key.size()) * 8,
+		&aes);
+	auto counter = bytes::make_vector(iv);
+	auto ecount = bytes::vector(Storage::CtrState::kBlockSize);
+	auto num = uint32(0);
+	auto result = bytes::vector(offset + data.size());
+	bytes::copy(bytes::make_span(result).subspan(offset), data);
+	CRYPTO_ctr128_encrypt(
+		reinterpret_cast<const uchar*>(result.data()),
+		reinterpret_cast<uchar*>(result.data()),
+		result.size(),
+		&aes,
+		reinterpret_cast<uchar*>(counter.data()),
+		reinterpret_cast<uchar*>(ecount.data()),
+		&num,
+		(block128_f)AES_encrypt);
+	return bytes::make_vector(bytes::make_span(result).subspan(offset));
+}
+
 struct ForkInit {
 	static int Method() {
 		Storage::File file;
@@ -166,6 +219,185 @@ TEST_CASE("simple encrypted file", "[storage_encrypted_file]") {
 	}
 }
 
+TEST_CASE("large encrypted file", "[storage_encrypted_file]") {
+	// Large spans are encrypted on several threads at once,
+	// reading them back in small parts checks the counters match.
+	const auto size = size_type(16 * 1024 * 1024);
+	const auto part = size_type(64 * 1024);
+	const auto original = LargeData(size);
+	{
+		Storage::File file;
+		const auto result = file.open(
+			Name,
+			Storage::File::Mode::Write,
+			Key);
+		REQUIRE(result == Storage::File::Result::Success);
+
+		auto data = original;
+		REQUIRE(file.write(data));
+	}
+	SECTION("reading in small parts") {
+		Storage::File file;
+		const auto result = file.open(
+			Name,
+			Storage::File::Mode::Read,
+			Key);
+		REQUIRE(result == Storage::File::Result::Success);
+
+		auto data = bytes::vector(part);
+		for (auto offset = size_type(0); offset != size; offset += part) {
+			REQUIRE(file.read(data) == part);
+			REQUIRE(bytes::compare(
+				data,
+				bytes::make_span(original).subspan(offset, part)) == 0);
+		}
+	}
+	SECTION("reading at once") {
+		Storage::File file;
+		const auto result = file.open(
+			Name,
+			Storage::File::Mode::Read,
+			Key);
+		REQUIRE(result == Storage::File::Result::Success);
+
+		auto data = bytes::vector(size);
+		REQUIRE(file.read(data) == size);
+		REQUIRE(data == original);
+	}
+}
+
+TEST_CASE("ctr state known answers", "[storage_encrypted_file]") {
+	constexpr auto kBlockSize = Storage::CtrState::kBlockSize;
+
+	SECTION("nist sp 800-38a aes-256-ctr vectors") {
+		const auto key = FromHex("603deb1015ca71be2b73aef0857d7781"
+			"1f352c073b6108d72d9810a30914dff4");
+		const auto iv = FromHex("f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff");
+		const auto plain = FromHex("6bc1bee22e409f96e93d7e117393172a"
+			"ae2d8a571e03ac9c9eb76fac45af8e51"
+			"30c81c46a35ce411e5fbc1191a0a52ef"
+			"f69f2445df4f9b17ad2b417be66c3710");
+		const auto cipher = FromHex("601ec313775789a5b7a7f504bbf3d228"
+			"f443e3ca4d62b59aca84e990cacaf5c5"
+			"2b0930daa23de94ce87017ba2d84988d"
+			"dfc9c58db67aada613c2dd08457941a6");
+		REQUIRE(plain.size() == 4 * kBlockSize);
+
+		auto state = Storage::CtrState(key, iv);
+		for (const auto offset : { 0, 16, 48 }) {
+			auto data = bytes::make_vector(
+				bytes::make_span(plain).subspan(offset));
+			state.encrypt(data, offset);
+			REQUIRE(bytes::compare(
+				data,
+				bytes::make_span(cipher).subspan(offset)) == 0);
+			state.decrypt(data, offset);
+			REQUIRE(bytes::compare(
+				data,
+				bytes::make_span(plain).subspan(offset)) == 0);
+		}
+	}
+	SECTION("same as the old encryption at any block offset") {
+		const auto key = bytes::make_span(
+			"abcdefgh01234567abcdefgh01234567").subspan(0, 32);
+		const auto ivs = {
+			bytes::make_vector(
+				bytes::make_span("01234567abcdefgh").subspan(0, 16)),
+			FromHex("0123456789abcdeffffffffffffffffe"),
+			FromHex("ffffffffffffffffffffffffffffff00"),
+		};
+
+		// Sizes from 4 MB are processed in parallel parts.
+		const auto sizes = {
+			kBlockSize,
+			size_type(3 * 1024 + kBlockSize),
+			size_type(5 * 1024 * 1024 + 3 * kBlockSize),
+		};
+		const auto offsets = {
+			int64(0),
+			int64(kBlockSize),
+			int64(255 * kBlockSize),
+			int64(65537 * kBlockSize),
+		};
+		for (const auto &iv : ivs) {
+			auto state = Storage::CtrState(key, iv);
+			for (const auto size : sizes) {
+				const auto plain = LargeData(size);
+				for (const auto offset : offsets) {
+					const auto reference = ReferenceCtr(
+						key,
+						iv,
+						plain,
+						offset);
+
+					auto data = plain;
+					state.encrypt(data, offset);
+					REQUIRE(data == reference);
+
+					data = plain;
+					state.decrypt(data, offset, 3);
+					REQUIRE(data == reference);
+				}
+			}
+		}
+	}
+}
+
+TEST_CASE("encrypted file benchmark", "[storage_encrypted_file]") {
+	if (DisableBenchmarkTests) {
+		return;
+	}
+	const auto size = size_type(256 * 1024 * 1024);
+	const auto original = LargeData(size);
+	const auto measure = [&](size_type part) {
+		auto data = bytes::vector(part);
+		const auto writeStart = crl::now();
+		{
+			Storage::File file;
+			const auto result = file.open(
+				Name,
+				Storage::File::Mode::Write,
+				Key);
+			REQUIRE(result == Storage::File::Result::Success);
+			for (auto offset = size_type(0); offset != size; offset += part) {
+				bytes::copy(
+					data,
+					bytes::make_span(original).subspan(offset, part));
+				REQUIRE(file.write(data));
+			}
+			REQUIRE(file.flush());
+		}
+		const auto readStart = crl::now();
+		{
+			Storage::File file;
+			const auto result = file.open(
+				Name,
+				Storage::File::Mode::Read,
+				Key);
+			REQUIRE(result == Storage::File::Result::Success);
+			for (auto offset = size_type(0); offset != size; offset += part) {
+				REQUIRE(file.read(data) == part);
+			}
+		}
+		const auto finish = crl::now();
+		const auto speed = [&](crl::time ms) {
+			const auto megabytes = size / 1024. / 1024.;
+			return megabytes * 1000. / std::max(ms, crl::time(1));
+		};
+		WARN("Part "
+			<< (part / 1024)
+			<< " KB, write: "
+			<< speed(readStart - writeStart)
+			<< " MB/s, read: "
+			<< speed(finish - readStart)
+			<< " MB/s");
+	};
+	measure(64 * 1024);
+	measure(1024 * 1024);
+	measure(16 * 1024 * 1024);
+	QFile(Name).remove();
+}
+
 TEST_CASE("two process encrypted file", "[storage_encrypted_file]") {
 	SECTION("writing file") {
 		Storage::File file;
@@ -8,8 +8,18 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #include "storage/storage_encryption.h"
 
 #include "base/openssl_help.h"
+#include <algorithm>
+#include <thread>
 
 namespace Storage {
+namespace {
+
+constexpr auto kMinParallelPart = size_type(1024 * 1024);
+constexpr auto kAutoParallelSize = size_type(4 * 1024 * 1024);
+constexpr auto kMaxAutoParallelThreads = 4;
+constexpr auto kMaxEvpPart = size_type(1 << 30);
+
+} // namespace
 
 CtrState::CtrState(bytes::const_span key, bytes::const_span iv) {
 	Expects(key.size() == _key.size());
@@ -17,36 +27,112 @@ CtrState::CtrState(bytes::const_span key, bytes::const_span iv) {
 
 	bytes::copy(_key, key);
 	bytes::copy(_iv, iv);
+	_context = createContext();
+}
+
+void CtrState::ContextDeleter::operator()(
+		evp_cipher_ctx_st *context) const {
+	EVP_CIPHER_CTX_free(context);
+}
+
+auto CtrState::createContext() const -> Context {
+	auto result = Context(EVP_CIPHER_CTX_new());
+	Assert(result != nullptr);
+
+	const auto initialized = EVP_EncryptInit_ex(
+		result.get(),
+		EVP_aes_256_ctr(),
+		nullptr,
+		reinterpret_cast<const uchar*>(_key.data()),
+		nullptr);
+	Assert(initialized == 1);
+	return result;
 }
 
-template <typename Method>
-void CtrState::process(bytes::span data, int64 offset, Method method) {
+void CtrState::process(
+		evp_cipher_ctx_st *context,
+		bytes::span data,
+		int64 offset) const {
+	Expects(context != nullptr);
 	Expects((data.size() % kBlockSize) == 0);
 	Expects((offset % kBlockSize) == 0);
 
-	AES_KEY aes;
-	AES_set_encrypt_key(
-		reinterpret_cast<const uchar*>(_key.data()),
-		_key.size() * CHAR_BIT,
-		&aes);
-
-	unsigned char ecountBuf[kBlockSize] = { 0 };
-	unsigned int offsetInBlock = 0;
-	const auto blockIndex = offset / kBlockSize;
-	auto iv = incrementedIv(blockIndex);
-
-	CRYPTO_ctr128_encrypt(
-		reinterpret_cast<const uchar*>(data.data()),
-		reinterpret_cast<uchar*>(data.data()),
-		data.size(),
-		&aes,
-		reinterpret_cast<unsigned char*>(iv.data()),
-		ecountBuf,
-		&offsetInBlock,
-		(block128_f)method);
+	// EVP uses AES-NI where it is available, the counter is incremented
+	// as a big endian 128 bit number, the same way incrementedIv() does.
+	// Without the cipher and the key only the counter is reset here.
+	const auto iv = incrementedIv(offset / kBlockSize);
+	const auto initialized = EVP_EncryptInit_ex(
+		context,
+		nullptr,
+		nullptr,
+		nullptr,
+		reinterpret_cast<const uchar*>(iv.data()));
+	Assert(initialized == 1);
+
+	while (!data.empty()) {
+		const auto part = std::min(data.size(), kMaxEvpPart);
+		auto processed = 0;
+		const auto updated = EVP_EncryptUpdate(
+			context,
+			reinterpret_cast<uchar*>(data.data()),
+			&processed,
+			reinterpret_cast<const uchar*>(data.data()),
+			int(part));
+		Assert(updated == 1);
+		Assert(processed == int(part));
+		data = data.subspan(part);
+	}
 }
 
-auto CtrState::incrementedIv(int64 blockIndex)
+void CtrState::processParallel(
+		bytes::span data,
+		int64 offset,
+		int threads) {
+	Expects((data.size() % kBlockSize) == 0);
+
+	static const auto cores = std::max(
+		int(std::thread::hardware_concurrency()),
+		1);
+	const auto size = size_type(data.size());
+	const auto maxParts = int(size / kMinParallelPart);
+	const auto parts = std::min({ threads, maxParts, cores });
+	if (parts < 2) {
+		process(_context.get(), data, offset);
+		return;
+	}
+	const auto blocks = size / kBlockSize;
+	const auto part = ((blocks + parts - 1) / parts) * kBlockSize;
+
+	// Parts are processed on their own threads and not with crl::async,
+	// because the callers wait for them and often run on crl queues.
+	// A context can't be shared between threads, each part has its own.
+	auto workers = std::vector<std::thread>();
+	workers.reserve(parts - 1);
+	for (auto from = part; from < size; from += part) {
+		const auto chunk = data.subspan(from, std::min(part, size - from));
+		workers.emplace_back([=] {
+			process(createContext().get(), chunk, offset + from);
+		});
+	}
+	process(_context.get(), data.subspan(0, part), offset);
+	for (auto &worker : workers) {
+		worker.join();
+	}
+}
+
+void CtrState::processAuto(bytes::span data, int64 offset) {
+	if (data.size() < kAutoParallelSize) {
+		process(_context.get(), data, offset);
+	} else {
+		static const auto threads = std::clamp(
+			int(std::thread::hardware_concurrency()),
+			1,
+			kMaxAutoParallelThreads);
+		processParallel(data, offset, threads);
+	}
+}
+
+auto CtrState::incrementedIv(int64 blockIndex) const
 -> bytes::array<kIvSize> {
 	Expects(blockIndex >= 0);
 
@@ -66,11 +152,15 @@ auto CtrState::incrementedIv(int64 blockIndex)
 }
 
 void CtrState::encrypt(bytes::span data, int64 offset) {
-	return process(data, offset, AES_encrypt);
+	return processAuto(data, offset);
 }
 
 void CtrState::decrypt(bytes::span data, int64 offset) {
-	return process(data, offset, AES_encrypt);
+	return processAuto(data, offset);
+}
+
+void CtrState::decrypt(bytes::span data, int64 offset, int threads) {
+	return processParallel(data, offset, threads);
 }
 
 EncryptionKey::EncryptionKey(bytes::vector &&data)
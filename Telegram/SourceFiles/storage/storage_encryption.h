@@ -9,6 +9,8 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 
 #include "base/bytes.h"
 
+struct evp_cipher_ctx_st;
+
 namespace Storage {
 
 constexpr auto kSaltSize = size_type(64);
@@ -24,17 +26,31 @@ public:
 	void encrypt(bytes::span data, int64 offset);
 	void decrypt(bytes::span data, int64 offset);
 
+	// Splits the data in parts decrypted on several threads at once.
+	void decrypt(bytes::span data, int64 offset, int threads);
+
 private:
-	template <typename Method>
-	void process(bytes::span data, int64 offset, Method method);
+	struct ContextDeleter {
+		void operator()(evp_cipher_ctx_st *context) const;
+	};
+	using Context = std::unique_ptr<evp_cipher_ctx_st, ContextDeleter>;
 
-	bytes::array<kIvSize> incrementedIv(int64 blockIndex);
+	Context createContext() const;
+	void process(
+		evp_cipher_ctx_st *context,
+		bytes::span data,
+		int64 offset) const;
+	void processParallel(bytes::span data, int64 offset, int threads);
+	void processAuto(bytes::span data, int64 offset);
 
-	static constexpr auto EcountSize = kBlockSize;
+	bytes::array<kIvSize> incrementedIv(int64 blockIndex) const;
 
 	bytes::array<kKeySize> _key;
 	bytes::array<kIvSize> _iv;
 
+	// Created once with the key, only the counter is set for each call.
+	Context _context;
+
 };
 
 class EncryptionKey {
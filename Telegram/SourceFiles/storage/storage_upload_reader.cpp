@@ -0,0 +1,220 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "storage/storage_upload_reader.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QMutex>
+#include <deque>
+
+extern "C" {
+#include <openssl/md5.h>
+} // extern "C"
+
+namespace Storage {
+namespace details {
+
+struct UploadReaderShared {
+	QMutex mutex;
+	std::deque<UploadReader::Part> parts;
+	int partsBytes = 0;
+	bool paused = false;
+	bool failed = false;
+	QByteArray md5Hex;
+};
+
+class UploadReaderObject {
+public:
+	UploadReaderObject(
+		crl::weak_on_queue<UploadReaderObject> weak,
+		std::shared_ptr<UploadReaderShared> shared,
+		const QString &path,
+		const QByteArray &content,
+		int partSize,
+		int partsCount,
+		bool hashMd5,
+		int readAhead,
+		Fn<void()> ready);
+
+	void readMore();
+
+private:
+	[[nodiscard]] bool open();
+	[[nodiscard]] QByteArray readPart();
+	void finishHash();
+	void fail();
+
+	crl::weak_on_queue<UploadReaderObject> _weak;
+	const std::shared_ptr<UploadReaderShared> _shared;
+	const QByteArray _content;
+	QFile _file;
+	const int _partSize = 0;
+	const int _partsCount = 0;
+	const bool _hashMd5 = false;
+	const int _readAhead = 0;
+	const Fn<void()> _ready;
+
+	MD5_CTX _md5;
+	int _index = 0;
+
+};
+
+UploadReaderObject::UploadReaderObject(
+	crl::weak_on_queue<UploadReaderObject> weak,
+	std::shared_ptr<UploadReaderShared> shared,
+	const QString &path,
+	const QByteArray &content,
+	int partSize,
+	int partsCount,
+	bool hashMd5,
+	int readAhead,
+	Fn<void()> ready)
+: _weak(std::move(weak))
+, _shared(std::move(shared))
+, _content(content)
+, _file(path)
+, _partSize(partSize)
+, _partsCount(partsCount)
+, _hashMd5(hashMd5)
+, _readAhead(std::max(readAhead, partSize))
+, _ready(std::move(ready)) {
+	if (_hashMd5) {
+		MD5_Init(&_md5);
+	}
+	if (!open()) {
+		fail();
+	} else if (!_partsCount) {
+		finishHash();
+	} else {
+		readMore();
+	}
+}
+
+bool UploadReaderObject::open() {
+	return !_content.isEmpty() || _file.open(QIODevice::ReadOnly);
+}
+
+QByteArray UploadReaderObject::readPart() {
+	return _content.isEmpty()
+		? _file.read(_partSize)
+		: _content.mid(_index * _partSize, _partSize);
+}
+
+void UploadReaderObject::readMore() {
+	while (_index < _partsCount) {
+		{
+			QMutexLocker lock(&_shared->mutex);
+			if (_shared->failed) {
+				return;
+			} else if (_shared->partsBytes + _partSize > _readAhead) {
+				_shared->paused = true;
+				return;
+			}
+		}
+		auto bytes = readPart();
+		if ((bytes.size() > _partSize)
+			|| (bytes.size() < _partSize && _index + 1 != _partsCount)) {
+			fail();
+			return;
+		}
+		if (_hashMd5) {
+			MD5_Update(&_md5, bytes.constData(), bytes.size());
+		}
+		const auto index = _index++;
+		if (_index == _partsCount) {
+			finishHash();
+			_file.close();
+		}
+		{
+			QMutexLocker lock(&_shared->mutex);
+			_shared->partsBytes += bytes.size();
+			_shared->parts.push_back({ index, std::move(bytes) });
+		}
+		_ready();
+	}
+}
+
+void UploadReaderObject::finishHash() {
+	if (!_hashMd5) {
+		return;
+	}
+	uchar digest[MD5_DIGEST_LENGTH] = { 0 };
+	MD5_Final(digest, &_md5);
+	const auto hex = QByteArray::fromRawData(
+		reinterpret_cast<const char*>(digest),
+		MD5_DIGEST_LENGTH).toHex();
+
+	QMutexLocker lock(&_shared->mutex);
+	_shared->md5Hex = hex;
+}
+
+void UploadReaderObject::fail() {
+	{
+		QMutexLocker lock(&_shared->mutex);
+		_shared->failed = true;
+	}
+	_ready();
+}
+
+} // namespace details
+
+UploadReader::UploadReader(
+	const QString &path,
+	const QByteArray &content,
+	int partSize,
+	int partsCount,
+	bool hashMd5,
+	int readAhead,
+	Fn<void()> ready)
+: _shared(std::make_shared<Shared>())
+, _wrapped(
+	_shared,
+	path,
+	content,
+	partSize,
+	partsCount,
+	hashMd5,
+	readAhead,
+	std::move(ready)) {
+	Expects(partSize > 0);
+	Expects(partsCount >= 0);
+}
+
+UploadReader::~UploadReader() = default;
+
+std::optional<UploadReader::Part> UploadReader::takePart() {
+	auto result = std::optional<Part>();
+	auto resume = false;
+	{
+		QMutexLocker lock(&_shared->mutex);
+		if (_shared->parts.empty()) {
+			return std::nullopt;
+		}
+		result = std::move(_shared->parts.front());
+		_shared->parts.pop_front();
+		_shared->partsBytes -= result->bytes.size();
+		resume = base::take(_shared->paused);
+	}
+	if (resume) {
+		_wrapped.with([](Implementation &that) {
+			that.readMore();
+		});
+	}
+	return result;
+}
+
+bool UploadReader::failed() const {
+	QMutexLocker lock(&_shared->mutex);
+	return _shared->failed;
+}
+
+QByteArray UploadReader::md5Hex() const {
+	QMutexLocker lock(&_shared->mutex);
+	return _shared->parts.empty() ? _shared->md5Hex : QByteArray();
+}
+
+} // namespace Storage
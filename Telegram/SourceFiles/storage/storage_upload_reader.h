@@ -0,0 +1,67 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "base/basic_types.h"
+#include "base/optional.h"
+
+#include <crl/crl_object_on_queue.h>
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+namespace Storage {
+namespace details {
+
+struct UploadReaderShared;
+class UploadReaderObject;
+
+} // namespace details
+
+// Reads the parts of a document for the upload on a background queue,
+// staying at most 'readAhead' bytes ahead of the taken parts.
+//
+// The parts are read from the file at 'path' or from the 'content' if it
+// is not empty. If 'hashMd5' is set the MD5 of the content is computed
+// on the way and is available after the last part was taken.
+class UploadReader final {
+public:
+	struct Part {
+		int index = 0;
+		QByteArray bytes;
+	};
+
+	// 'ready' is called on the reader queue each time a part is ready
+	// to be taken or reading fails.
+	UploadReader(
+		const QString &path,
+		const QByteArray &content,
+		int partSize,
+		int partsCount,
+		bool hashMd5,
+		int readAhead,
+		Fn<void()> ready);
+	UploadReader(const UploadReader &other) = delete;
+	UploadReader &operator=(const UploadReader &other) = delete;
+	~UploadReader();
+
+	[[nodiscard]] std::optional<Part> takePart();
+	[[nodiscard]] bool failed() const;
+
+	// 32 hex digits, empty until all the parts were taken.
+	[[nodiscard]] QByteArray md5Hex() const;
+
+private:
+	using Shared = details::UploadReaderShared;
+	using Implementation = details::UploadReaderObject;
+
+	const std::shared_ptr<Shared> _shared;
+	crl::object_on_queue<Implementation> _wrapped;
+
+};
+
+} // namespace Storage
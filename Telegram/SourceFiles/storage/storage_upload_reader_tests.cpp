@@ -0,0 +1,436 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "storage/storage_upload_reader.h"
+#include "mtproto/mtp_fake_dc.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryDir>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+extern "C" {
+#include <openssl/md5.h>
+} // extern "C"
+
+using Storage::UploadReader;
+using namespace MTP::internal;
+
+const auto DisableBenchmarkTests = true;
+
+namespace {
+
+constexpr auto kTimeout = 10000;
+constexpr auto kPartSize = 128 * 1024;
+
+// As in Storage::Uploader.
+constexpr auto kReadAhead = 4 * 1024 * 1024;
+constexpr auto kInFlight = 2 * 512 * 1024;
+
+constexpr auto kSaveBigFilePart = mtpTypeId(0xde7b673d);
+constexpr auto kBoolTrue = mtpTypeId(0x997275b5);
+
+// Counts 'ready' calls from the reader queue. The reader object may
+// outlive the UploadReader for a while, so the state is shared.
+class ReadyWaiter final {
+public:
+	Fn<void()> callback() {
+		return [state = _state] {
+			std::unique_lock<std::mutex> lock(state->mutex);
+			++state->count;
+			state->condition.notify_all();
+		};
+	}
+
+	int count() {
+		std::unique_lock<std::mutex> lock(_state->mutex);
+		return _state->count;
+	}
+
+	bool wait(int count) {
+		std::unique_lock<std::mutex> lock(_state->mutex);
+		return _state->condition.wait_for(
+			lock,
+			std::chrono::milliseconds(kTimeout),
+			[&] { return _state->count >= count; });
+	}
+
+private:
+	struct State {
+		std::mutex mutex;
+		std::condition_variable condition;
+		int count = 0;
+	};
+	const std::shared_ptr<State> _state = std::make_shared<State>();
+
+};
+
+QByteArray TestContent(int size) {
+	auto result = QByteArray(size, Qt::Uninitialized);
+	for (auto i = 0; i != size; ++i) {
+		result[i] = char((i * 7 + (i >> 11)) & 0xFF);
+	}
+	return result;
+}
+
+QByteArray Md5Hex(const QByteArray &data) {
+	uchar digest[MD5_DIGEST_LENGTH] = { 0 };
+	MD5(
+		reinterpret_cast<const uchar*>(data.constData()),
+		data.size(),
+		digest);
+	return QByteArray::fromRawData(
+		reinterpret_cast<const char*>(digest),
+		MD5_DIGEST_LENGTH).toHex();
+}
+
+int PartsCount(int64 size, int partSize) {
+	return int((size + partSize - 1) / partSize);
+}
+
+// Takes all the parts, waiting for them if needed.
+QByteArray ReadAll(UploadReader &reader, ReadyWaiter &waiter, int parts) {
+	auto result = QByteArray();
+	for (auto index = 0; index != parts; ++index) {
+		auto part = reader.takePart();
+		while (!part) {
+			REQUIRE(!reader.failed());
+			REQUIRE(waiter.wait(waiter.count() + 1));
+			part = reader.takePart();
+		}
+		REQUIRE(part->index == index);
+		result.append(part->bytes);
+	}
+	return result;
+}
+
+void EnsureApplication() {
+	// The fake dc thread needs an event loop.
+	if (!QCoreApplication::instance()) {
+		static auto argc = 1;
+		static char name[] = "tests_storage";
+		static char *argv[] = { name, nullptr };
+		static QCoreApplication application(argc, argv);
+	}
+}
+
+void AppendBytes(mtpBuffer &to, const QByteArray &bytes) {
+	const auto size = bytes.size();
+	const auto header = (size < 254) ? 1 : 4;
+	const auto full = header + size;
+	const auto padded = (full + 3) & ~3;
+	const auto was = to.size();
+	to.resize(was + padded / sizeof(mtpPrime));
+	const auto data = reinterpret_cast<uchar*>(to.data() + was);
+	if (size < 254) {
+		data[0] = uchar(size);
+	} else {
+		data[0] = uchar(254);
+		data[1] = uchar(size & 0xFF);
+		data[2] = uchar((size >> 8) & 0xFF);
+		data[3] = uchar((size >> 16) & 0xFF);
+	}
+	memcpy(data + header, bytes.constData(), size);
+	memset(data + full, 0, padded - full);
+}
+
+int ReadBytesSize(const mtpPrime *from, const mtpPrime *end) {
+	if (from == end) {
+		return -1;
+	}
+	const auto data = reinterpret_cast<const uchar*>(from);
+	const auto size = (data[0] < 254)
+		? int(data[0])
+		: (int(data[1]) | (int(data[2]) << 8) | (int(data[3]) << 16));
+	const auto header = (data[0] < 254) ? 1 : 4;
+	const auto padded = (header + size + 3) & ~3;
+	return (padded <= (end - from) * int(sizeof(mtpPrime))) ? size : -1;
+}
+
+mtpBuffer SaveBigFilePart(
+		uint64 fileId,
+		int part,
+		int partsCount,
+		const QByteArray &bytes) {
+	auto result = mtpBuffer{
+		mtpPrime(kSaveBigFilePart),
+		mtpPrime(fileId & 0xFFFFFFFFULL),
+		mtpPrime(fileId >> 32),
+		part,
+		partsCount,
+	};
+	AppendBytes(result, bytes);
+	return result;
+}
+
+struct Result {
+	int64 ms = 0;
+	double megabytesPerSecond = 0.;
+};
+
+// Uploads the file to the fake dc with at most kInFlight bytes in flight,
+// reading the parts in the sending thread or with the UploadReader.
+Result Upload(
+		not_null<FakeDc*> dc,
+		const QString &path,
+		int64 size,
+		int partSize,
+		bool background) {
+	using namespace std::chrono;
+
+	FakeDcClient client(dc->port());
+	REQUIRE(client.connectToServer(kTimeout));
+	REQUIRE(client.createAuthKey(dc->publicKey(), kTimeout));
+
+	const auto partsCount = PartsCount(size, partSize);
+	const auto start = steady_clock::now();
+
+	auto waiter = ReadyWaiter();
+	auto reader = std::unique_ptr<UploadReader>();
+	QFile file(path);
+	if (background) {
+		reader = std::make_unique<UploadReader>(
+			path,
+			QByteArray(),
+			partSize,
+			partsCount,
+			false,
+			kReadAhead,
+			waiter.callback());
+	} else {
+		REQUIRE(file.open(QIODevice::ReadOnly));
+	}
+	const auto takePart = [&](int index) {
+		if (!background) {
+			return std::make_optional(UploadReader::Part{
+				index,
+				file.read(partSize) });
+		}
+		return reader->takePart();
+	};
+
+	auto sent = 0;
+	auto answered = 0;
+	while (answered < partsCount) {
+		while (sent < partsCount
+			&& (sent - answered) * partSize < kInFlight) {
+			auto part = takePart(sent);
+			if (!part) {
+				REQUIRE(!reader->failed());
+				if (sent > answered) {
+					break;
+				}
+				REQUIRE(waiter.wait(waiter.count() + 1));
+				continue;
+			}
+			REQUIRE(part->index == sent);
+			client.send(
+				SaveBigFilePart(0x1234, sent, partsCount, part->bytes),
+				[&](const mtpPrime *from, const mtpPrime *end) {
+					REQUIRE(end - from == 1);
+					REQUIRE(mtpTypeId(*from) == kBoolTrue);
+					++answered;
+				});
+			++sent;
+		}
+		REQUIRE(client.flush());
+		REQUIRE(client.receive(kTimeout));
+	}
+	const auto ms = int64(duration_cast<milliseconds>(
+		steady_clock::now() - start).count());
+	return {
+		ms,
+		(size / (1024. * 1024.)) * 1000. / std::max(ms, int64(1))
+	};
+}
+
+void WriteLargeFile(const QString &path, int64 size) {
+	QFile file(path);
+	REQUIRE(file.open(QIODevice::WriteOnly));
+	const auto chunk = TestContent(16 * 1024 * 1024);
+	for (auto written = int64(0); written < size;) {
+		const auto portion = int(std::min(
+			int64(chunk.size()),
+			size - written));
+		REQUIRE(file.write(chunk.constData(), portion) == portion);
+		written += portion;
+	}
+}
+
+} // namespace
+
+TEST_CASE("upload reader", "[upload_reader]") {
+	QTemporaryDir folder;
+	REQUIRE(folder.isValid());
+	const auto path = folder.filePath("upload.file");
+	const auto size = 10 * kPartSize + 1234;
+	const auto partsCount = PartsCount(size, kPartSize);
+	const auto content = TestContent(size);
+	{
+		QFile file(path);
+		REQUIRE(file.open(QIODevice::WriteOnly));
+		REQUIRE(file.write(content) == content.size());
+	}
+
+	SECTION("file is read in order and hashed") {
+		auto waiter = ReadyWaiter();
+		auto reader = UploadReader(
+			path,
+			QByteArray(),
+			kPartSize,
+			partsCount,
+			true,
+			kReadAhead,
+			waiter.callback());
+		REQUIRE(ReadAll(reader, waiter, partsCount) == content);
+		REQUIRE(!reader.takePart().has_value());
+		REQUIRE(reader.md5Hex() == Md5Hex(content));
+	}
+	SECTION("content is read in order and hashed") {
+		auto waiter = ReadyWaiter();
+		auto reader = UploadReader(
+			QString(),
+			content,
+			kPartSize,
+			partsCount,
+			true,
+			kReadAhead,
+			waiter.callback());
+		REQUIRE(ReadAll(reader, waiter, partsCount) == content);
+		REQUIRE(reader.md5Hex() == Md5Hex(content));
+	}
+	SECTION("reading stops at the read ahead limit") {
+		auto waiter = ReadyWaiter();
+		auto reader = UploadReader(
+			path,
+			QByteArray(),
+			kPartSize,
+			partsCount,
+			false,
+			2 * kPartSize,
+			waiter.callback());
+		REQUIRE(waiter.wait(2));
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		REQUIRE(waiter.count() == 2);
+
+		REQUIRE(reader.takePart().has_value());
+		REQUIRE(waiter.wait(3));
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		REQUIRE(waiter.count() == 3);
+
+		const auto rest = ReadAll(reader, waiter, partsCount - 1);
+		REQUIRE(rest.size() == size - kPartSize);
+		REQUIRE(reader.md5Hex().isEmpty());
+	}
+	SECTION("short file fails") {
+		auto waiter = ReadyWaiter();
+		auto reader = UploadReader(
+			path,
+			QByteArray(),
+			kPartSize,
+			partsCount + 2,
+			true,
+			kReadAhead,
+			waiter.callback());
+		while (!reader.failed()) {
+			REQUIRE(waiter.wait(waiter.count() + 1));
+		}
+
+		// The last part is too short for a part in the middle.
+		auto taken = 0;
+		while (reader.takePart()) {
+			++taken;
+		}
+		REQUIRE(taken == partsCount - 1);
+		REQUIRE(reader.md5Hex().isEmpty());
+	}
+	SECTION("missing file fails") {
+		auto waiter = ReadyWaiter();
+		auto reader = UploadReader(
+			folder.filePath("missing.file"),
+			QByteArray(),
+			kPartSize,
+			partsCount,
+			true,
+			kReadAhead,
+			waiter.callback());
+		REQUIRE(waiter.wait(1));
+		REQUIRE(reader.failed());
+		REQUIRE(!reader.takePart().has_value());
+	}
+}
+
+TEST_CASE("upload reader benchmark", "[upload_reader]") {
+	if (DisableBenchmarkTests) {
+		return;
+	}
+	EnsureApplication();
+
+	auto received = std::make_shared<std::atomic<int64>>(0);
+	FakeDc dc(FakeDc::Options(), [=](
+			const mtpPrime *from,
+			const mtpPrime *end) {
+		if (end - from < 5 || mtpTypeId(from[0]) != kSaveBigFilePart) {
+			return mtpBuffer();
+		}
+		const auto size = ReadBytesSize(from + 5, end);
+		if (size < 0) {
+			return mtpBuffer();
+		}
+		*received += size;
+		return mtpBuffer{ mtpPrime(kBoolTrue) };
+	});
+	REQUIRE(dc.start());
+
+	QTemporaryDir folder;
+	REQUIRE(folder.isValid());
+
+	struct Test {
+		int64 size = 0;
+		int partSize = 0;
+	};
+	const auto tests = {
+		Test{ 100 * 1024 * 1024, 128 * 1024 },
+		Test{ 1536 * 1024 * 1024LL, 512 * 1024 },
+	};
+	for (const auto &test : tests) {
+		const auto path = folder.filePath("large.file");
+		WriteLargeFile(path, test.size);
+
+		*received = 0;
+		const auto inPlace = Upload(
+			&dc,
+			path,
+			test.size,
+			test.partSize,
+			false);
+		REQUIRE(*received == test.size);
+
+		*received = 0;
+		const auto background = Upload(
+			&dc,
+			path,
+			test.size,
+			test.partSize,
+			true);
+		REQUIRE(*received == test.size);
+
+		WARN("upload of " << (test.size / (1024 * 1024)) << " MB: "
+			<< background.megabytesPerSecond << " MB/s ("
+			<< background.ms << " ms) with the upload reader, "
+			<< inPlace.megabytesPerSecond << " MB/s ("
+			<< inPlace.ms << " ms) reading in the sending thread");
+
+		QFile::remove(path);
+	}
+}
@@ -48,6 +48,109 @@ int64 ComputeUsage(const QImage &image) {
 	return Instance;
 }
 
+// Prepared pixmaps of all the images are counted in ActiveCache() as well.
+// The least recently used ones are dropped one by one after 64 MB, before
+// whole images with all their pixmaps are unloaded.
+constexpr auto kMemoryForPixmaps = 64 * 1024 * 1024;
+
+using Pixmaps = PixCache<const Image*, QPixmap>;
+
+[[nodiscard]] Pixmaps &PixmapsCache() {
+	static auto Instance = Pixmaps(kMemoryForPixmaps);
+	return Instance;
+}
+
+// Keeps the pixmaps usage in ActiveCache() up to date.
+template <typename Method>
+decltype(auto) ChangePixmaps(Method &&method) {
+	auto &pixmaps = PixmapsCache();
+	const auto was = pixmaps.usage();
+	const auto guard = gsl::finally([&] {
+		const auto now = pixmaps.usage();
+		if (now > was) {
+			ActiveCache().increment(now - was);
+		} else {
+			ActiveCache().decrement(was - now);
+		}
+	});
+	return method(pixmaps);
+}
+
+void ShrinkPixmapsLater() {
+	// Pixmaps are dropped after the current paint is finished, so the
+	// references to them returned from Image::pix*() stay valid.
+	static auto Shrink = SingleQueuedInvokation([] {
+		ChangePixmaps([](Pixmaps &pixmaps) { pixmaps.shrink(); });
+	});
+	Shrink.call();
+}
+
+const QPixmap &CachePixmap(
+		not_null<const Image*> image,
+		uint64 key,
+		QPixmap &&pixmap) {
+	const auto usage = ComputeUsage(pixmap);
+	const auto result = ChangePixmaps([&](Pixmaps &pixmaps) {
+		return &pixmaps.set(image, key, std::move(pixmap), usage);
+	});
+	if (PixmapsCache().overflown()) {
+		ShrinkPixmapsLater();
+	}
+	return *result;
+}
+
+bool ReplacePixmap(
+		not_null<const Image*> image,
+		uint64 key,
+		QPixmap &&pixmap) {
+	const auto usage = ComputeUsage(pixmap);
+	return ChangePixmaps([&](Pixmaps &pixmaps) {
+		return pixmaps.replace(image, key, std::move(pixmap), usage);
+	});
+}
+
+void RemovePixmaps(not_null<const Image*> image) {
+	ChangePixmaps([&](Pixmaps &pixmaps) { pixmaps.remove(image); });
+}
+
+void NotifyPixmapsPrepared() {
+	// Many sizes are usually prepared together, the widgets are repainted
+	// once for all the results that arrived till the next event loop.
+	static auto Notify = SingleQueuedInvokation([] {
+		if (Main::Session::Exists()) {
+			Auth().downloaderTaskFinished().notify();
+		}
+	});
+	Notify.call();
+}
+
+// Smooth scaling and rounding of larger images is done in the background,
+// while a fast scaled copy of the image is painted.
+constexpr auto kMinPixelsToPrepareAsync = 256 * 256;
+
+bool PrepareAsync(
+		const QImage &data,
+		int w,
+		int h,
+		Options options,
+		int outerw,
+		int outerh) {
+	if (!(options & Option::Smooth)
+		|| (options & Option::Blurred)
+		|| (options & Option::Colored)) {
+		return false;
+	} else if (outerw > 0
+		&& outerh > 0
+		&& !(options & Option::TransparentBackground)) {
+		// The background around the image is filled from the palette.
+		const auto factor = cIntRetinaFactor();
+		if (w < outerw * factor || h < outerh * factor) {
+			return false;
+		}
+	}
+	return (data.width() * data.height() >= kMinPixelsToPrepareAsync);
+}
+
 uint64 PixKey(int width, int height, Options options) {
 	return static_cast<uint64>(width)
 		| (static_cast<uint64>(height) << 24)
@@ -67,6 +170,14 @@ void ClearRemote() {
 	base::take(GeoPointImages);
 }
 
+CacheStats CurrentCacheStats() {
+	auto result = CacheStats();
+	result.usage = ActiveCache().usage();
+	result.limit = ActiveCache().limit();
+	result.pixmaps = PixmapsCache().stats();
+	return result;
+}
+
 void ClearAll() {
 	ActiveCache().clear();
 	base::take(LocalFileImages);
@@ -554,15 +665,13 @@ const QPixmap &Image::pix(
 		h *= cIntRetinaFactor();
 	}
 	auto options = Option::Smooth | Option::None;
-	auto k = PixKey(w, h, options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend()) {
-		auto p = pixNoCache(origin, w, h, options);
-		p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		ActiveCache().increment(ComputeUsage(*i));
+	const auto k = PixKey(w, h, options);
+	if (const auto cached = PixmapsCache().find(this, k)) {
+		return *cached;
 	}
-	return i.value();
+	auto p = preparePix(origin, k, w, h, options);
+	p.setDevicePixelRatio(cRetinaFactor());
+	return CachePixmap(this, k, std::move(p));
 }
 
 const QPixmap &Image::pixRounded(
@@ -593,15 +702,13 @@ const QPixmap &Image::pixRounded(
 	} else if (radius == ImageRoundRadius::Ellipse) {
 		options |= Option::Circled | cornerOptions(corners);
 	}
-	auto k = PixKey(w, h, options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend()) {
-		auto p = pixNoCache(origin, w, h, options);
-		p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		ActiveCache().increment(ComputeUsage(*i));
+	const auto k = PixKey(w, h, options);
+	if (const auto cached = PixmapsCache().find(this, k)) {
+		return *cached;
 	}
-	return i.value();
+	auto p = preparePix(origin, k, w, h, options);
+	p.setDevicePixelRatio(cRetinaFactor());
+	return CachePixmap(this, k, std::move(p));
 }
 
 const QPixmap &Image::pixCircled(
@@ -617,15 +724,13 @@ const QPixmap &Image::pixCircled(
 		h *= cIntRetinaFactor();
 	}
 	auto options = Option::Smooth | Option::Circled;
-	auto k = PixKey(w, h, options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend()) {
-		auto p = pixNoCache(origin, w, h, options);
-		p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		ActiveCache().increment(ComputeUsage(*i));
+	const auto k = PixKey(w, h, options);
+	if (const auto cached = PixmapsCache().find(this, k)) {
+		return *cached;
 	}
-	return i.value();
+	auto p = preparePix(origin, k, w, h, options);
+	p.setDevicePixelRatio(cRetinaFactor());
+	return CachePixmap(this, k, std::move(p));
 }
 
 const QPixmap &Image::pixBlurredCircled(
@@ -641,15 +746,13 @@ const QPixmap &Image::pixBlurredCircled(
 		h *= cIntRetinaFactor();
 	}
 	auto options = Option::Smooth | Option::Circled | Option::Blurred;
-	auto k = PixKey(w, h, options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend()) {
-		auto p = pixNoCache(origin, w, h, options);
-		p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		ActiveCache().increment(ComputeUsage(*i));
+	const auto k = PixKey(w, h, options);
+	if (const auto cached = PixmapsCache().find(this, k)) {
+		return *cached;
 	}
-	return i.value();
+	auto p = preparePix(origin, k, w, h, options);
+	p.setDevicePixelRatio(cRetinaFactor());
+	return CachePixmap(this, k, std::move(p));
 }
 
 const QPixmap &Image::pixBlurred(
@@ -665,15 +768,13 @@ const QPixmap &Image::pixBlurred(
 		h *= cIntRetinaFactor();
 	}
 	auto options = Option::Smooth | Option::Blurred;
-	auto k = PixKey(w, h, options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend()) {
-		auto p = pixNoCache(origin, w, h, options);
-		p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		ActiveCache().increment(ComputeUsage(*i));
+	const auto k = PixKey(w, h, options);
+	if (const auto cached = PixmapsCache().find(this, k)) {
+		return *cached;
 	}
-	return i.value();
+	auto p = preparePix(origin, k, w, h, options);
+	p.setDevicePixelRatio(cRetinaFactor());
+	return CachePixmap(this, k, std::move(p));
 }
 
 const QPixmap &Image::pixColored(
@@ -690,15 +791,13 @@ const QPixmap &Image::pixColored(
 		h *= cIntRetinaFactor();
 	}
 	auto options = Option::Smooth | Option::Colored;
-	auto k = PixKey(w, h, options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend()) {
-		auto p = pixColoredNoCache(origin, add, w, h, true);
-		p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		ActiveCache().increment(ComputeUsage(*i));
+	const auto k = PixKey(w, h, options);
+	if (const auto cached = PixmapsCache().find(this, k)) {
+		return *cached;
 	}
-	return i.value();
+	auto p = pixColoredNoCache(origin, add, w, h, true);
+	p.setDevicePixelRatio(cRetinaFactor());
+	return CachePixmap(this, k, std::move(p));
 }
 
 const QPixmap &Image::pixBlurredColored(
@@ -715,15 +814,13 @@ const QPixmap &Image::pixBlurredColored(
 		h *= cIntRetinaFactor();
 	}
 	auto options = Option::Blurred | Option::Smooth | Option::Colored;
-	auto k = PixKey(w, h, options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend()) {
-		auto p = pixBlurredColoredNoCache(origin, add, w, h);
-		p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		ActiveCache().increment(ComputeUsage(*i));
+	const auto k = PixKey(w, h, options);
+	if (const auto cached = PixmapsCache().find(this, k)) {
+		return *cached;
 	}
-	return i.value();
+	auto p = pixBlurredColoredNoCache(origin, add, w, h);
+	p.setDevicePixelRatio(cRetinaFactor());
+	return CachePixmap(this, k, std::move(p));
 }
 
 const QPixmap &Image::pixSingle(
@@ -762,18 +859,19 @@ const QPixmap &Image::pixSingle(
 		options |= Option::Colored;
 	}
 
-	auto k = SinglePixKey(options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend() || i->width() != (outerw * cIntRetinaFactor()) || i->height() != (outerh * cIntRetinaFactor())) {
-		if (i != _sizesCache.cend()) {
-			ActiveCache().decrement(ComputeUsage(*i));
-		}
-		auto p = pixNoCache(origin, w, h, options, outerw, outerh, colored);
-		p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		ActiveCache().increment(ComputeUsage(*i));
+	const auto k = SinglePixKey(options);
+	const auto outer = QSize(outerw, outerh) * cIntRetinaFactor();
+	const auto sameSize = [&](const QPixmap &pixmap) {
+		return (pixmap.size() == outer);
+	};
+	if (const auto cached = PixmapsCache().find(this, k, sameSize)) {
+		return *cached;
 	}
-	return i.value();
+	auto p = colored
+		? pixNoCache(origin, w, h, options, outerw, outerh, colored)
+		: preparePix(origin, k, w, h, options, outerw, outerh);
+	p.setDevicePixelRatio(cRetinaFactor());
+	return CachePixmap(this, k, std::move(p));
 }
 
 const QPixmap &Image::pixBlurredSingle(
@@ -808,18 +906,17 @@ const QPixmap &Image::pixBlurredSingle(
 		options |= Option::Circled | cornerOptions(corners);
 	}
 
-	auto k = SinglePixKey(options);
-	auto i = _sizesCache.constFind(k);
-	if (i == _sizesCache.cend() || i->width() != (outerw * cIntRetinaFactor()) || i->height() != (outerh * cIntRetinaFactor())) {
-		if (i != _sizesCache.cend()) {
-			ActiveCache().decrement(ComputeUsage(*i));
-		}
-		auto p = pixNoCache(origin, w, h, options, outerw, outerh);
-		p.setDevicePixelRatio(cRetinaFactor());
-		i = _sizesCache.insert(k, p);
-		ActiveCache().increment(ComputeUsage(*i));
+	const auto k = SinglePixKey(options);
+	const auto outer = QSize(outerw, outerh) * cIntRetinaFactor();
+	const auto sameSize = [&](const QPixmap &pixmap) {
+		return (pixmap.size() == outer);
+	};
+	if (const auto cached = PixmapsCache().find(this, k, sameSize)) {
+		return *cached;
 	}
-	return i.value();
+	auto p = preparePix(origin, k, w, h, options, outerw, outerh);
+	p.setDevicePixelRatio(cRetinaFactor());
+	return CachePixmap(this, k, std::move(p));
 }
 
 QPixmap Image::pixNoCache(
@@ -885,6 +982,68 @@ QPixmap Image::pixNoCache(
 	return App::pixmapFromImageInPlace(prepare(_data, w, h, options, outerw, outerh, colored));
 }
 
+QPixmap Image::preparePix(
+		Data::FileOrigin origin,
+		uint64 key,
+		int w,
+		int h,
+		Options options,
+		int outerw,
+		int outerh) const {
+	_preparing.finish(key);
+	if (!loading()) {
+		const_cast<Image*>(this)->load(origin);
+	}
+	checkSource();
+
+	if (_data.isNull()
+		|| isNull()
+		|| !PrepareAsync(_data, w, h, options, outerw, outerh)) {
+		return pixNoCache(origin, w, h, options, outerw, outerh);
+	}
+	crl::async([
+		=,
+		data = _data,
+		masks = CopyPrepareMasks(options),
+		guard = _preparing.start(key)
+	]() mutable {
+		if (!guard) {
+			return;
+		}
+		auto image = prepare(
+			std::move(data),
+			w,
+			h,
+			options,
+			outerw,
+			outerh,
+			masks);
+		crl::on_main(std::move(guard), [
+			=,
+			image = std::move(image)
+		]() mutable {
+			pixPrepared(key, std::move(image));
+		});
+	});
+	return pixNoCache(
+		origin,
+		w,
+		h,
+		options & ~Option::Smooth,
+		outerw,
+		outerh);
+}
+
+void Image::pixPrepared(uint64 key, QImage &&image) const {
+	_preparing.finish(key);
+
+	auto pixmap = App::pixmapFromImageInPlace(std::move(image));
+	pixmap.setDevicePixelRatio(cRetinaFactor());
+	if (ReplacePixmap(this, key, std::move(pixmap))) {
+		NotifyPixmapsPrepared();
+	}
+}
+
 QPixmap Image::pixColoredNoCache(
 		Data::FileOrigin origin,
 		style::color add,
@@ -1001,11 +1160,8 @@ void Image::setImageBytes(const QByteArray &bytes) {
 }
 
 void Image::invalidateSizeCache() const {
-	auto &cache = ActiveCache();
-	for (const auto &image : std::as_const(_sizesCache)) {
-		cache.decrement(ComputeUsage(image));
-	}
-	_sizesCache.clear();
+	RemovePixmaps(this);
+	_preparing.clear();
 }
 
 Image::~Image() {
@@ -8,6 +8,7 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 #pragma once
 
 #include "ui/image/image_prepare.h"
+#include "ui/image/image_pix_cache.h"
 
 class HistoryItem;
 
@@ -16,6 +17,13 @@ namespace Images {
 void ClearRemote();
 void ClearAll();
 
+struct CacheStats {
+	int64 usage = 0; // Images and their prepared pixmaps.
+	int64 limit = 0;
+	PixCacheStats pixmaps;
+};
+[[nodiscard]] CacheStats CurrentCacheStats();
+
 ImagePtr Create(const QString &file, QByteArray format);
 ImagePtr Create(const QString &url, QSize box);
 ImagePtr Create(const QString &url, int width, int height);
@@ -236,8 +244,20 @@ private:
 	void checkSource() const;
 	void invalidateSizeCache() const;
 
+	// Returns a fast scaled placeholder if the pixmap is prepared on
+	// a background thread, pixPrepared() replaces it in the cache.
+	QPixmap preparePix(
+		Data::FileOrigin origin,
+		uint64 key,
+		int w,
+		int h,
+		Images::Options options,
+		int outerw = -1,
+		int outerh = -1) const;
+	void pixPrepared(uint64 key, QImage &&image) const;
+
 	std::unique_ptr<Images::Source> _source;
-	mutable QMap<uint64, QPixmap> _sizesCache;
+	mutable Images::PixPreparing _preparing;
 	mutable QImage _data;
 
 };
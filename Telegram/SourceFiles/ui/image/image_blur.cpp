@@ -0,0 +1,330 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "ui/image/image_blur.h"
+
+#include <crl/crl.h>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QThread>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) \
+	|| defined(_M_X64) \
+	|| (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TDESKTOP_BLUR_SSE2
+#include <emmintrin.h>
+#endif // __SSE2__ || _M_X64 || _M_IX86_FP >= 2
+
+namespace Images {
+namespace {
+
+constexpr auto kStripWidth = 16;
+constexpr auto kMinParallelPixels = 256 * 256;
+constexpr auto kMaxParallelThreads = 8;
+
+// Sums of all the pixels are less than 255 * (kMaxBlurRadius + 1)^2.
+constexpr auto kSumBits = 24;
+
+static_assert(255 * (kMaxBlurRadius + 1) * (kMaxBlurRadius + 1)
+	< (1 << kSumBits));
+
+// Division by a constant through a multiplication, exact for the
+// numerators less than 2^kSumBits (Granlund and Montgomery).
+struct Divider {
+	explicit Divider(uint32 divisor) {
+		auto bits = 0;
+		while ((uint32(1) << bits) < divisor) {
+			++bits;
+		}
+		shift = kSumBits + bits;
+		multiplier = uint32((uint64(1) << shift) / divisor + 1);
+	}
+
+	uint32 multiplier = 0;
+	int shift = 0;
+};
+
+struct ScalarLanes {
+	struct Value {
+		Value &operator+=(const Value &other) {
+			for (auto i = 0; i != 4; ++i) {
+				channels[i] += other.channels[i];
+			}
+			return *this;
+		}
+		Value &operator-=(const Value &other) {
+			for (auto i = 0; i != 4; ++i) {
+				channels[i] -= other.channels[i];
+			}
+			return *this;
+		}
+
+		uint32 channels[4] = { 0 };
+	};
+
+	static TG_FORCE_INLINE Value Load(uint32 pixel) {
+		auto result = Value();
+		for (auto i = 0; i != 4; ++i) {
+			result.channels[i] = (pixel >> (i * 8)) & 0xFFU;
+		}
+		return result;
+	}
+
+	static TG_FORCE_INLINE uint32 Store(
+			const Value &value,
+			const Divider &divider) {
+		auto result = uint32(0);
+		for (auto i = 0; i != 4; ++i) {
+			const auto channel = uint32(
+				(uint64(value.channels[i]) * divider.multiplier)
+					>> divider.shift);
+			result |= channel << (i * 8);
+		}
+		return result;
+	}
+};
+
+#ifdef TDESKTOP_BLUR_SSE2
+
+// One pixel is four 32 bit lanes of one register.
+struct Sse2Lanes {
+	struct Value {
+		Value &operator+=(const Value &other) {
+			lanes = _mm_add_epi32(lanes, other.lanes);
+			return *this;
+		}
+		Value &operator-=(const Value &other) {
+			lanes = _mm_sub_epi32(lanes, other.lanes);
+			return *this;
+		}
+
+		__m128i lanes = _mm_setzero_si128();
+	};
+
+	static TG_FORCE_INLINE Value Load(uint32 pixel) {
+		const auto zero = _mm_setzero_si128();
+		const auto bytes = _mm_cvtsi32_si128(int(pixel));
+		auto result = Value();
+		result.lanes = _mm_unpacklo_epi16(
+			_mm_unpacklo_epi8(bytes, zero),
+			zero);
+		return result;
+	}
+
+	static TG_FORCE_INLINE uint32 Store(
+			const Value &value,
+			const Divider &divider) {
+		// There is no 32 bit lanes multiplication in SSE2, so the even
+		// and the odd lanes are multiplied to 64 bit separately.
+		const auto multiplier = _mm_set1_epi32(int(divider.multiplier));
+		const auto shift = _mm_cvtsi32_si128(divider.shift);
+		const auto even = _mm_srl_epi64(
+			_mm_mul_epu32(value.lanes, multiplier),
+			shift);
+		const auto odd = _mm_slli_epi64(
+			_mm_srl_epi64(
+				_mm_mul_epu32(_mm_srli_epi64(value.lanes, 32), multiplier),
+				shift),
+			32);
+		const auto words = _mm_packs_epi32(_mm_or_si128(even, odd), even);
+		return uint32(_mm_cvtsi128_si32(_mm_packus_epi16(words, words)));
+	}
+};
+
+using Lanes = Sse2Lanes;
+
+#else // TDESKTOP_BLUR_SSE2
+
+using Lanes = ScalarLanes;
+
+#endif // TDESKTOP_BLUR_SSE2
+
+// Blurs 'lines' lines of 'count' pixels each at the same time, the pixel
+// 'index' of the line 'line' is from[index * lines + line] and it is put
+// to to[index * step + line].
+void BlurLines(
+		const uint32 *from,
+		uint32 *to,
+		int lines,
+		int count,
+		int step,
+		int radius,
+		const Divider &divider) {
+	Expects(lines > 0 && lines <= kStripWidth);
+
+	using Value = Lanes::Value;
+
+	const auto last = count - 1;
+	const auto at = [&](int index) {
+		return from + std::clamp(index, 0, last) * lines;
+	};
+
+	// 'sum' is the weighted sum around the current pixel, 'outsum' is the
+	// sum of the current pixel and 'radius' pixels before it, they leave
+	// the kernel one by one. 'insum' is the sum of 'radius' pixels after
+	// the current one, they enter the kernel.
+	Value sum[kStripWidth];
+	Value outsum[kStripWidth];
+	Value insum[kStripWidth];
+	for (auto i = 0; i >= -radius; --i) {
+		const auto pixels = at(i);
+		for (auto line = 0; line != lines; ++line) {
+			outsum[line] += Lanes::Load(pixels[line]);
+			sum[line] += outsum[line];
+		}
+	}
+	for (auto i = 1; i <= radius; ++i) {
+		const auto pixels = at(i);
+		for (auto line = 0; line != lines; ++line) {
+			insum[line] += Lanes::Load(pixels[line]);
+			sum[line] += insum[line];
+		}
+	}
+	for (auto index = 0; index != count; ++index) {
+		const auto leaving = at(index - radius);
+		const auto entering = at(index + radius + 1);
+		const auto next = at(index + 1);
+		for (auto line = 0; line != lines; ++line) {
+			to[line] = Lanes::Store(sum[line], divider);
+
+			const auto nextPixel = Lanes::Load(next[line]);
+			sum[line] -= outsum[line];
+			outsum[line] -= Lanes::Load(leaving[line]);
+			outsum[line] += nextPixel;
+			insum[line] += Lanes::Load(entering[line]);
+			sum[line] += insum[line];
+			insum[line] -= nextPixel;
+		}
+		to += step;
+	}
+}
+
+void BlurRows(
+		uchar *bits,
+		int width,
+		int bytesPerLine,
+		int fromRow,
+		int tillRow,
+		int radius,
+		const Divider &divider) {
+	auto buffer = std::vector<uint32>(width);
+	for (auto y = fromRow; y != tillRow; ++y) {
+		const auto row = reinterpret_cast<uint32*>(bits + y * bytesPerLine);
+		memcpy(buffer.data(), row, width * sizeof(uint32));
+		BlurLines(buffer.data(), row, 1, width, 1, radius, divider);
+	}
+}
+
+// The columns are blurred by strips, so that the image is read and written
+// by whole cache lines, not by a pixel from each row.
+void BlurColumns(
+		uchar *bits,
+		int height,
+		int bytesPerLine,
+		int fromColumn,
+		int tillColumn,
+		int radius,
+		const Divider &divider) {
+	const auto step = bytesPerLine / int(sizeof(uint32));
+	const auto pixels = reinterpret_cast<uint32*>(bits);
+	auto buffer = std::vector<uint32>(height * kStripWidth);
+	for (auto x = fromColumn; x < tillColumn; x += kStripWidth) {
+		const auto columns = std::min(kStripWidth, tillColumn - x);
+		for (auto y = 0; y != height; ++y) {
+			memcpy(
+				buffer.data() + y * columns,
+				pixels + y * step + x,
+				columns * sizeof(uint32));
+		}
+		BlurLines(
+			buffer.data(),
+			pixels + x,
+			columns,
+			height,
+			step,
+			radius,
+			divider);
+	}
+}
+
+// Blurred backgrounds are prepared in crl::async() tasks, such a task
+// can't wait for other tasks, they could be queued behind it.
+bool InMainThread() {
+	const auto application = QCoreApplication::instance();
+	return application && (QThread::currentThread() == application->thread());
+}
+
+// Calls method(from, till) for the parts of [0, count). From the main
+// thread the first part runs on it and the rest through crl::async(),
+// other threads run all the parts themselves.
+template <typename Method>
+void ProcessParts(int count, int parts, int align, Method method) {
+	const auto part = ((count + parts * align - 1) / (parts * align))
+		* align;
+	if (parts < 2 || !InMainThread()) {
+		for (auto from = 0; from < count; from += part) {
+			method(from, std::min(from + part, count));
+		}
+		return;
+	}
+	auto semaphores = std::vector<std::unique_ptr<crl::semaphore>>();
+	semaphores.reserve(parts - 1);
+	for (auto from = part; from < count; from += part) {
+		const auto till = std::min(from + part, count);
+		const auto semaphore = semaphores.emplace_back(
+			std::make_unique<crl::semaphore>()).get();
+		crl::async([=] {
+			method(from, till);
+			semaphore->release();
+		});
+	}
+	method(0, std::min(part, count));
+	for (const auto &semaphore : semaphores) {
+		semaphore->acquire();
+	}
+}
+
+} // namespace
+
+void BlurPixels(
+		uchar *bits,
+		int width,
+		int height,
+		int bytesPerLine,
+		int radius) {
+	Expects(bits != nullptr);
+	Expects(width > 0 && height > 0);
+	Expects(bytesPerLine >= width * int(sizeof(uint32)));
+	Expects(bytesPerLine % int(sizeof(uint32)) == 0);
+	Expects(radius >= 0 && radius <= kMaxBlurRadius);
+
+	if (!radius) {
+		return;
+	}
+	static const auto threads = std::clamp(
+		int(std::thread::hardware_concurrency()),
+		1,
+		kMaxParallelThreads);
+	const auto parts = std::clamp(
+		(width * height) / kMinParallelPixels,
+		1,
+		threads);
+	const auto divider = Divider((radius + 1) * (radius + 1));
+
+	ProcessParts(height, parts, 1, [&](int from, int till) {
+		BlurRows(bits, width, bytesPerLine, from, till, radius, divider);
+	});
+	ProcessParts(width, parts, kStripWidth, [&](int from, int till) {
+		BlurColumns(bits, height, bytesPerLine, from, till, radius, divider);
+	});
+}
+
+} // namespace Images
@@ -0,0 +1,30 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "base/basic_types.h"
+
+namespace Images {
+
+inline constexpr auto kMaxBlurRadius = 255;
+
+// Stack blur of 32 bit pixels in place, all the four channels are blurred
+// the same way, so premultiplied ARGB stays premultiplied.
+//
+// Rows and then columns are blurred with a triangle kernel of
+// (2 * radius + 1) pixels, the edge pixels are repeated and the sums are
+// divided by (radius + 1)^2 rounding down. Large images are blurred on
+// several threads if this is called from the main thread.
+void BlurPixels(
+	uchar *bits,
+	int width,
+	int height,
+	int bytesPerLine,
+	int radius);
+
+} // namespace Images
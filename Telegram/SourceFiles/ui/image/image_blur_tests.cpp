@@ -0,0 +1,383 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "ui/image/image_blur.h"
+
+#include <crl/crl.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace Images;
+
+const auto DisableBenchmarkTests = true;
+
+namespace {
+
+struct Pixels {
+	int width = 0;
+	int height = 0;
+	std::vector<uint32> data;
+
+	uchar *bits() {
+		return reinterpret_cast<uchar*>(data.data());
+	}
+	int bytesPerLine() const {
+		return width * int(sizeof(uint32));
+	}
+};
+
+Pixels GeneratePixels(int width, int height, bool opaque, int seed) {
+	auto engine = std::mt19937(seed);
+	auto result = Pixels{
+		width,
+		height,
+		std::vector<uint32>(width * height),
+	};
+	for (auto &pixel : result.data) {
+		const auto alpha = opaque ? 255U : (engine() & 0xFFU);
+		const auto channel = [&] {
+			return alpha ? (engine() % (alpha + 1)) : 0U;
+		};
+		const auto red = channel();
+		const auto green = channel();
+		const auto blue = channel();
+		pixel = (alpha << 24) | (red << 16) | (green << 8) | blue;
+	}
+	return result;
+}
+
+// Straightforward two pass triangle kernel, the edge pixels are repeated.
+void ReferenceBlur(Pixels &image, int radius) {
+	const auto divisor = (radius + 1) * (radius + 1);
+	const auto line = [&](uint32 *pixels, int count, int step) {
+		const auto source = [&] {
+			auto result = std::vector<uint32>(count);
+			for (auto i = 0; i != count; ++i) {
+				result[i] = pixels[i * step];
+			}
+			return result;
+		}();
+		for (auto x = 0; x != count; ++x) {
+			auto result = uint32(0);
+			for (auto shift = 0; shift != 32; shift += 8) {
+				auto sum = 0;
+				for (auto i = -radius; i <= radius; ++i) {
+					const auto index = std::clamp(x + i, 0, count - 1);
+					const auto channel = (source[index] >> shift) & 0xFF;
+					sum += int(channel) * (radius + 1 - std::abs(i));
+				}
+				result |= uint32(sum / divisor) << shift;
+			}
+			pixels[x * step] = result;
+		}
+	};
+	for (auto y = 0; y != image.height; ++y) {
+		line(image.data.data() + y * image.width, image.width, 1);
+	}
+	for (auto x = 0; x != image.width; ++x) {
+		line(image.data.data() + x, image.height, image.width);
+	}
+}
+
+// Images::BlurLargeImage() as it was before BlurPixels(), without QImage.
+void LookupTableBlur(Pixels &image, int radius) {
+	const auto pixels = image.bits();
+	const auto width = image.width;
+	const auto height = image.height;
+
+	const auto width_m1 = width - 1;
+	const auto height_m1 = height - 1;
+	const auto widthxheight = width * height;
+	const auto div = 2 * radius + 1;
+	const auto radius_p1 = radius + 1;
+	const auto divsum = radius_p1 * radius_p1;
+
+	auto stack = std::vector<int>(div * 3);
+	auto vmin = std::vector<int>(std::max(width, height));
+	auto rgb = std::vector<int>(widthxheight * 3);
+	auto dv = std::vector<int>(256 * divsum);
+	for (auto i = 0; i != int(dv.size()); ++i) {
+		dv[i] = (i / divsum);
+	}
+
+	auto stackpointer = 0;
+	for (auto x = 0; x != width; ++x) {
+		vmin[x] = std::min(x + radius_p1, width_m1);
+	}
+	for (auto y = 0; y != height; ++y) {
+		int rinsum = 0, ginsum = 0, binsum = 0;
+		int routsum = 0, goutsum = 0, boutsum = 0;
+		int rsum = 0, gsum = 0, bsum = 0;
+
+		const auto y_width = y * width;
+		for (auto i = -radius; i != radius + 1; ++i) {
+			const auto sir = &stack[(i + radius) * 3];
+			const auto x = std::clamp(i, 0, width_m1);
+			const auto offset = (y_width + x) * 4;
+			sir[0] = pixels[offset];
+			sir[1] = pixels[offset + 1];
+			sir[2] = pixels[offset + 2];
+
+			const auto rbs = radius_p1 - std::abs(i);
+			rsum += sir[0] * rbs;
+			gsum += sir[1] * rbs;
+			bsum += sir[2] * rbs;
+			if (i > 0) {
+				rinsum += sir[0];
+				ginsum += sir[1];
+				binsum += sir[2];
+			} else {
+				routsum += sir[0];
+				goutsum += sir[1];
+				boutsum += sir[2];
+			}
+		}
+		stackpointer = radius;
+
+		for (auto x = 0; x != width; ++x) {
+			const auto position = (y_width + x) * 3;
+			rgb[position] = dv[rsum];
+			rgb[position + 1] = dv[gsum];
+			rgb[position + 2] = dv[bsum];
+
+			rsum -= routsum;
+			gsum -= goutsum;
+			bsum -= boutsum;
+
+			const auto stackstart = (stackpointer - radius + div) % div;
+			auto sir = &stack[stackstart * 3];
+
+			routsum -= sir[0];
+			goutsum -= sir[1];
+			boutsum -= sir[2];
+
+			const auto offset = (y_width + vmin[x]) * 4;
+			sir[0] = pixels[offset];
+			sir[1] = pixels[offset + 1];
+			sir[2] = pixels[offset + 2];
+			rinsum += sir[0];
+			ginsum += sir[1];
+			binsum += sir[2];
+
+			rsum += rinsum;
+			gsum += ginsum;
+			bsum += binsum;
+
+			stackpointer = (stackpointer + 1) % div;
+			sir = &stack[stackpointer * 3];
+
+			routsum += sir[0];
+			goutsum += sir[1];
+			boutsum += sir[2];
+
+			rinsum -= sir[0];
+			ginsum -= sir[1];
+			binsum -= sir[2];
+		}
+	}
+
+	for (auto y = 0; y != height; ++y) {
+		vmin[y] = std::min(y + radius_p1, height_m1) * width;
+	}
+	for (auto x = 0; x != width; ++x) {
+		int rinsum = 0, ginsum = 0, binsum = 0;
+		int routsum = 0, goutsum = 0, boutsum = 0;
+		int rsum = 0, gsum = 0, bsum = 0;
+		for (auto i = -radius; i != radius + 1; ++i) {
+			const auto y = std::clamp(i, 0, height_m1);
+			const auto position = (y * width + x) * 3;
+			const auto sir = &stack[(i + radius) * 3];
+
+			sir[0] = rgb[position];
+			sir[1] = rgb[position + 1];
+			sir[2] = rgb[position + 2];
+
+			const auto rbs = radius_p1 - std::abs(i);
+			rsum += sir[0] * rbs;
+			gsum += sir[1] * rbs;
+			bsum += sir[2] * rbs;
+			if (i > 0) {
+				rinsum += sir[0];
+				ginsum += sir[1];
+				binsum += sir[2];
+			} else {
+				routsum += sir[0];
+				goutsum += sir[1];
+				boutsum += sir[2];
+			}
+		}
+		stackpointer = radius;
+		for (auto y = 0; y != height; ++y) {
+			const auto offset = (y * width + x) * 4;
+			pixels[offset] = dv[rsum];
+			pixels[offset + 1] = dv[gsum];
+			pixels[offset + 2] = dv[bsum];
+			rsum -= routsum;
+			gsum -= goutsum;
+			bsum -= boutsum;
+
+			const auto stackstart = (stackpointer - radius + div) % div;
+			auto sir = &stack[stackstart * 3];
+
+			routsum -= sir[0];
+			goutsum -= sir[1];
+			boutsum -= sir[2];
+
+			const auto position = (vmin[y] + x) * 3;
+			sir[0] = rgb[position];
+			sir[1] = rgb[position + 1];
+			sir[2] = rgb[position + 2];
+
+			rinsum += sir[0];
+			ginsum += sir[1];
+			binsum += sir[2];
+
+			rsum += rinsum;
+			gsum += ginsum;
+			bsum += binsum;
+
+			stackpointer = (stackpointer + 1) % div;
+			sir = &stack[stackpointer * 3];
+
+			routsum += sir[0];
+			goutsum += sir[1];
+			boutsum += sir[2];
+
+			rinsum -= sir[0];
+			ginsum -= sir[1];
+			binsum -= sir[2];
+		}
+	}
+}
+
+void Blur(Pixels &image, int radius) {
+	BlurPixels(
+		image.bits(),
+		image.width,
+		image.height,
+		image.bytesPerLine(),
+		radius);
+}
+
+} // namespace
+
+TEST_CASE("blur pixels", "[blur]") {
+	SECTION("blur matches the reference kernel") {
+		const auto sizes = { 1, 2, 3, 7, 16, 33, 70 };
+		const auto radii = { 1, 2, 3, 8, 24 };
+		auto seed = 0;
+		for (const auto width : sizes) {
+			for (const auto height : sizes) {
+				for (const auto radius : radii) {
+					auto image = GeneratePixels(width, height, false, ++seed);
+					auto expected = image;
+					Blur(image, radius);
+					ReferenceBlur(expected, radius);
+					REQUIRE(image.data == expected.data);
+				}
+			}
+		}
+	}
+	SECTION("opaque blur matches the lookup table blur") {
+		for (const auto radius : { 1, 3, 24, 100, kMaxBlurRadius }) {
+			auto image = GeneratePixels(520, 280, true, radius);
+			auto expected = image;
+			Blur(image, radius);
+			LookupTableBlur(expected, radius);
+			REQUIRE(image.data == expected.data);
+		}
+	}
+	SECTION("large images are blurred in parts the same way") {
+		auto image = GeneratePixels(1030, 770, false, 1);
+		auto expected = image;
+		Blur(image, 24);
+		ReferenceBlur(expected, 24);
+		REQUIRE(image.data == expected.data);
+	}
+	SECTION("large images are blurred in crl::async() tasks") {
+		// More tasks than the pool threads, each blurs on its own thread.
+		constexpr auto kTasks = 32;
+		const auto source = GeneratePixels(1030, 770, false, 1);
+		auto expected = source;
+		ReferenceBlur(expected, 24);
+		auto images = std::vector<Pixels>(kTasks, source);
+		crl::semaphore semaphore;
+		for (auto &image : images) {
+			crl::async([&] {
+				Blur(image, 24);
+				semaphore.release();
+			});
+		}
+		for (auto i = 0; i != kTasks; ++i) {
+			semaphore.acquire();
+		}
+		for (const auto &image : images) {
+			REQUIRE(image.data == expected.data);
+		}
+	}
+	SECTION("padding after the rows is not touched") {
+		constexpr auto kPadding = 3;
+		const auto width = 40;
+		const auto height = 30;
+		auto image = GeneratePixels(width + kPadding, height, false, 2);
+		auto expected = image;
+		BlurPixels(
+			image.bits(),
+			width,
+			height,
+			image.bytesPerLine(),
+			5);
+		for (auto y = 0; y != height; ++y) {
+			const auto row = y * image.width;
+			for (auto x = width; x != image.width; ++x) {
+				REQUIRE(image.data[row + x] == expected.data[row + x]);
+			}
+		}
+	}
+	SECTION("zero radius does nothing") {
+		auto image = GeneratePixels(20, 20, false, 3);
+		const auto copy = image.data;
+		Blur(image, 0);
+		REQUIRE(image.data == copy);
+	}
+}
+
+TEST_CASE("blur pixels benchmark", "[blur]") {
+	if (DisableBenchmarkTests) {
+		return;
+	}
+	using namespace std::chrono;
+
+	constexpr auto kSize = 4096;
+	constexpr auto kRadius = 24;
+	constexpr auto kRuns = 3;
+	const auto source = GeneratePixels(kSize, kSize, true, 4);
+	const auto measure = [&](auto &&blur) {
+		auto total = int64(0);
+		for (auto i = 0; i != kRuns; ++i) {
+			auto image = source;
+			const auto start = steady_clock::now();
+			blur(image);
+			total += duration_cast<milliseconds>(
+				steady_clock::now() - start).count();
+		}
+		return total / kRuns;
+	};
+	const auto now = measure([](Pixels &image) {
+		Blur(image, kRadius);
+	});
+	const auto was = measure([](Pixels &image) {
+		LookupTableBlur(image, kRadius);
+	});
+	WARN("blur of " << kSize << "x" << kSize << " with radius " << kRadius
+		<< ": " << now << " ms, lookup table blur: " << was << " ms");
+}
@@ -0,0 +1,213 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#pragma once
+
+#include "base/basic_types.h"
+#include "base/binary_guard.h"
+#include "base/flat_map.h"
+
+#include <list>
+#include <map>
+#include <utility>
+
+namespace Images {
+
+struct PixCacheStats {
+	int64 usage = 0;
+	int64 limit = 0;
+	int count = 0;
+	int64 hits = 0;
+	int64 misses = 0;
+
+	[[nodiscard]] float64 hitRatio() const {
+		const auto total = hits + misses;
+		return total ? (hits / float64(total)) : 0.;
+	}
+};
+
+// Prepared pixmaps of all the images in one cache, by the image and the
+// key of the size and options. The least recently used values are dropped
+// by shrink() while the usage is above the limit.
+//
+// Values are not moved in memory, a reference to a value is valid until
+// it is replaced or removed.
+template <typename Owner, typename Value>
+class PixCache {
+public:
+	explicit PixCache(int64 limit) : _limit(limit) {
+	}
+
+	// A found value is used only if check(value) returns true.
+	template <typename Check>
+	[[nodiscard]] const Value *find(Owner owner, uint64 key, Check &&check);
+	[[nodiscard]] const Value *find(Owner owner, uint64 key) {
+		return find(owner, key, [](const Value &value) { return true; });
+	}
+
+	const Value &set(Owner owner, uint64 key, Value &&value, int64 usage);
+
+	// Replaces only a value that is still in the cache.
+	bool replace(Owner owner, uint64 key, Value &&value, int64 usage);
+
+	void remove(Owner owner);
+	void clear();
+
+	[[nodiscard]] bool overflown() const {
+		return (_usage > _limit);
+	}
+	void shrink();
+
+	[[nodiscard]] int64 usage() const {
+		return _usage;
+	}
+	[[nodiscard]] PixCacheStats stats() const;
+
+private:
+	using Key = std::pair<Owner, uint64>;
+	struct Entry {
+		Value value;
+		int64 usage = 0;
+		typename std::list<Key>::iterator position;
+	};
+	using Map = std::map<Key, Entry>;
+
+	void up(typename Map::iterator i);
+	void erase(typename Map::iterator i);
+
+	Map _entries;
+	std::list<Key> _queue;
+	int64 _usage = 0;
+	int64 _limit = 0;
+	int64 _hits = 0;
+	int64 _misses = 0;
+
+};
+
+template <typename Owner, typename Value>
+template <typename Check>
+const Value *PixCache<Owner, Value>::find(
+		Owner owner,
+		uint64 key,
+		Check &&check) {
+	const auto i = _entries.find({ owner, key });
+	if (i == end(_entries) || !check(std::as_const(i->second.value))) {
+		++_misses;
+		return nullptr;
+	}
+	++_hits;
+	up(i);
+	return &i->second.value;
+}
+
+template <typename Owner, typename Value>
+const Value &PixCache<Owner, Value>::set(
+		Owner owner,
+		uint64 key,
+		Value &&value,
+		int64 usage) {
+	const auto [i, inserted] = _entries.try_emplace({ owner, key });
+	if (inserted) {
+		i->second.position = _queue.insert(end(_queue), i->first);
+	} else {
+		up(i);
+	}
+	_usage += usage - i->second.usage;
+	i->second.usage = usage;
+	i->second.value = std::move(value);
+	return i->second.value;
+}
+
+template <typename Owner, typename Value>
+bool PixCache<Owner, Value>::replace(
+		Owner owner,
+		uint64 key,
+		Value &&value,
+		int64 usage) {
+	const auto i = _entries.find({ owner, key });
+	if (i == end(_entries)) {
+		return false;
+	}
+	_usage += usage - i->second.usage;
+	i->second.usage = usage;
+	i->second.value = std::move(value);
+	return true;
+}
+
+template <typename Owner, typename Value>
+void PixCache<Owner, Value>::remove(Owner owner) {
+	auto i = _entries.lower_bound({ owner, uint64(0) });
+	while (i != end(_entries) && i->first.first == owner) {
+		erase(i++);
+	}
+}
+
+template <typename Owner, typename Value>
+void PixCache<Owner, Value>::clear() {
+	_entries.clear();
+	_queue.clear();
+	_usage = 0;
+}
+
+template <typename Owner, typename Value>
+void PixCache<Owner, Value>::shrink() {
+	while (overflown() && !_queue.empty()) {
+		erase(_entries.find(_queue.front()));
+	}
+}
+
+template <typename Owner, typename Value>
+PixCacheStats PixCache<Owner, Value>::stats() const {
+	auto result = PixCacheStats();
+	result.usage = _usage;
+	result.limit = _limit;
+	result.count = int(_entries.size());
+	result.hits = _hits;
+	result.misses = _misses;
+	return result;
+}
+
+template <typename Owner, typename Value>
+void PixCache<Owner, Value>::up(typename Map::iterator i) {
+	const auto position = i->second.position;
+	if (std::next(position) != end(_queue)) {
+		_queue.splice(end(_queue), _queue, position);
+	}
+}
+
+template <typename Owner, typename Value>
+void PixCache<Owner, Value>::erase(typename Map::iterator i) {
+	_usage -= i->second.usage;
+	_queue.erase(i->second.position);
+	_entries.erase(i);
+}
+
+// Pixmaps of one image prepared on background threads, by the key of
+// the size and options. A task result should be used only while its
+// guard is alive: the guard dies if the key is started again or cleared.
+class PixPreparing {
+public:
+	[[nodiscard]] base::binary_guard start(uint64 key) {
+		return _tasks[key].make_guard();
+	}
+	void finish(uint64 key) {
+		_tasks.remove(key);
+	}
+	void clear() {
+		_tasks.clear();
+	}
+
+	[[nodiscard]] bool preparing(uint64 key) const {
+		return _tasks.contains(key);
+	}
+
+private:
+	base::flat_map<uint64, base::binary_guard> _tasks;
+
+};
+
+} // namespace Images
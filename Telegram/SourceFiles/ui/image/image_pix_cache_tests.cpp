@@ -0,0 +1,245 @@
+/*
+This file is part of Telegram Desktop,
+the official desktop application for the Telegram messaging service.
+
+For license and copyright information please follow this link:
+https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
+*/
+#include "catch.hpp"
+
+#include "ui/image/image_pix_cache.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+const auto DisableBenchmarkTests = true;
+
+namespace {
+
+using Cache = Images::PixCache<int, std::vector<int>>;
+
+std::vector<int> Value(int size, int fill) {
+	return std::vector<int>(size, fill);
+}
+
+void Set(Cache &cache, int owner, uint64 key, int size) {
+	cache.set(owner, key, Value(size, owner), size);
+}
+
+// Image::preparePix() caches a placeholder and starts the task, the
+// result is applied on the main thread only if the guard is alive.
+base::binary_guard StartPreparing(
+		Cache &cache,
+		Images::PixPreparing &preparing,
+		int owner,
+		uint64 key) {
+	Set(cache, owner, key, 1);
+	return preparing.start(key);
+}
+
+bool ApplyPrepared(
+		Cache &cache,
+		Images::PixPreparing &preparing,
+		const base::binary_guard &guard,
+		int owner,
+		uint64 key,
+		int size) {
+	if (!guard) {
+		return false;
+	}
+	preparing.finish(key);
+	return cache.replace(owner, key, Value(size, owner), size);
+}
+
+} // namespace
+
+TEST_CASE("pix cache", "[pix_cache]") {
+	auto cache = Cache(100);
+
+	SECTION("values are found by owner and key") {
+		Set(cache, 1, 10, 5);
+		Set(cache, 2, 10, 6);
+		Set(cache, 1, 20, 7);
+		REQUIRE(cache.usage() == 18);
+
+		const auto first = cache.find(1, 10);
+		REQUIRE(first != nullptr);
+		REQUIRE(first->size() == 5);
+		const auto second = cache.find(2, 10);
+		REQUIRE(second != nullptr);
+		REQUIRE(second->size() == 6);
+		REQUIRE(cache.find(2, 20) == nullptr);
+		REQUIRE(cache.find(3, 10) == nullptr);
+
+		const auto stats = cache.stats();
+		REQUIRE(stats.count == 3);
+		REQUIRE(stats.usage == 18);
+		REQUIRE(stats.limit == 100);
+		REQUIRE(stats.hits == 2);
+		REQUIRE(stats.misses == 2);
+		REQUIRE(stats.hitRatio() == 0.5);
+	}
+	SECTION("failed check is a miss") {
+		Set(cache, 1, 10, 5);
+		const auto size = [](int size) {
+			return [=](const std::vector<int> &value) {
+				return (int(value.size()) == size);
+			};
+		};
+		REQUIRE(cache.find(1, 10, size(6)) == nullptr);
+		REQUIRE(cache.find(1, 10, size(5)) != nullptr);
+		REQUIRE(cache.stats().hits == 1);
+		REQUIRE(cache.stats().misses == 1);
+	}
+	SECTION("values are replaced") {
+		Set(cache, 1, 10, 5);
+		const auto &value = cache.set(1, 10, Value(8, 0), 8);
+		REQUIRE(value.size() == 8);
+		REQUIRE(cache.usage() == 8);
+		REQUIRE(cache.stats().count == 1);
+
+		REQUIRE(cache.replace(1, 10, Value(3, 0), 3));
+		REQUIRE(cache.usage() == 3);
+		REQUIRE(cache.find(1, 10)->size() == 3);
+		REQUIRE(!cache.replace(1, 20, Value(3, 0), 3));
+		REQUIRE(cache.usage() == 3);
+		REQUIRE(cache.find(1, 20) == nullptr);
+	}
+	SECTION("values of an owner are removed") {
+		Set(cache, 1, 10, 5);
+		Set(cache, 2, 0, 6);
+		Set(cache, 2, 10, 6);
+		Set(cache, 2, ~uint64(0), 6);
+		Set(cache, 3, 0, 7);
+		cache.remove(2);
+		REQUIRE(cache.usage() == 12);
+		REQUIRE(cache.stats().count == 2);
+		REQUIRE(cache.find(2, 0) == nullptr);
+		REQUIRE(cache.find(2, ~uint64(0)) == nullptr);
+		REQUIRE(cache.find(1, 10) != nullptr);
+		REQUIRE(cache.find(3, 0) != nullptr);
+
+		cache.clear();
+		REQUIRE(cache.usage() == 0);
+		REQUIRE(cache.stats().count == 0);
+	}
+	SECTION("least recently used values are dropped") {
+		for (auto i = 0; i != 10; ++i) {
+			Set(cache, i, 0, 20);
+		}
+		REQUIRE(cache.overflown());
+
+		// Values are dropped only by shrink().
+		REQUIRE(cache.find(0, 0) != nullptr);
+		cache.set(3, 0, Value(20, 3), 20);
+		cache.shrink();
+		REQUIRE(!cache.overflown());
+		REQUIRE(cache.usage() == 100);
+		REQUIRE(cache.find(0, 0) != nullptr);
+		REQUIRE(cache.find(3, 0) != nullptr);
+		REQUIRE(cache.find(1, 0) == nullptr);
+		REQUIRE(cache.find(2, 0) == nullptr);
+		REQUIRE(cache.find(4, 0) == nullptr);
+		REQUIRE(cache.find(5, 0) == nullptr);
+		REQUIRE(cache.find(6, 0) == nullptr);
+		REQUIRE(cache.find(7, 0) != nullptr);
+		REQUIRE(cache.find(8, 0) != nullptr);
+		REQUIRE(cache.find(9, 0) != nullptr);
+	}
+	SECTION("values are not moved in memory") {
+		const auto &first = cache.set(1, 10, Value(5, 1), 5);
+		const auto address = first.data();
+		for (auto i = 0; i != 1000; ++i) {
+			Set(cache, i + 2, 0, 0);
+		}
+		REQUIRE(cache.find(1, 10) == &first);
+		REQUIRE(first.data() == address);
+	}
+}
+
+TEST_CASE("pix preparing", "[pix_cache]") {
+	auto cache = Cache(100);
+	auto preparing = Images::PixPreparing();
+
+	SECTION("placeholder is replaced by the result") {
+		const auto guard = StartPreparing(cache, preparing, 1, 10);
+		REQUIRE(preparing.preparing(10));
+		REQUIRE(cache.find(1, 10)->size() == 1);
+		REQUIRE(cache.usage() == 1);
+
+		REQUIRE(ApplyPrepared(cache, preparing, guard, 1, 10, 8));
+		REQUIRE(!preparing.preparing(10));
+		REQUIRE(cache.find(1, 10)->size() == 8);
+		REQUIRE(cache.usage() == 8);
+	}
+	SECTION("results of invalidated sizes are dropped") {
+		const auto first = StartPreparing(cache, preparing, 1, 10);
+		const auto second = StartPreparing(cache, preparing, 1, 20);
+
+		// Image::invalidateSizeCache().
+		cache.remove(1);
+		preparing.clear();
+		REQUIRE(!first);
+		REQUIRE(!second);
+
+		REQUIRE(!ApplyPrepared(cache, preparing, first, 1, 10, 8));
+		REQUIRE(!ApplyPrepared(cache, preparing, second, 1, 20, 8));
+		REQUIRE(cache.find(1, 10) == nullptr);
+		REQUIRE(cache.usage() == 0);
+	}
+	SECTION("size prepared again drops the previous result") {
+		const auto first = StartPreparing(cache, preparing, 1, 10);
+		const auto second = StartPreparing(cache, preparing, 1, 10);
+		REQUIRE(!first);
+		REQUIRE(second);
+
+		REQUIRE(!ApplyPrepared(cache, preparing, first, 1, 10, 5));
+		REQUIRE(ApplyPrepared(cache, preparing, second, 1, 10, 8));
+		REQUIRE(cache.find(1, 10)->size() == 8);
+	}
+	SECTION("result of a dropped placeholder is not cached") {
+		const auto guard = StartPreparing(cache, preparing, 1, 10);
+		cache.remove(1);
+		REQUIRE(!ApplyPrepared(cache, preparing, guard, 1, 10, 8));
+		REQUIRE(!preparing.preparing(10));
+		REQUIRE(cache.find(1, 10) == nullptr);
+		REQUIRE(cache.usage() == 0);
+	}
+}
+
+TEST_CASE("pix cache benchmark", "[pix_cache]") {
+	if (DisableBenchmarkTests) {
+		return;
+	}
+	using namespace std::chrono;
+
+	// A chat with 500 photos is scrolled back and forth, the pixmaps of
+	// about 300 KB each fit in the cache for 200 of them.
+	constexpr auto kImages = 500;
+	constexpr auto kPixmapSize = 300 * 1024;
+	constexpr auto kVisible = 10;
+	constexpr auto kFrames = 100000;
+	auto cache = Images::PixCache<int, int>(200 * kPixmapSize);
+	auto engine = std::mt19937(7);
+	auto position = 0;
+	const auto start = steady_clock::now();
+	for (auto frame = 0; frame != kFrames; ++frame) {
+		position = std::clamp(
+			position + int(engine() % 11) - 5,
+			0,
+			kImages - kVisible);
+		for (auto i = position; i != position + kVisible; ++i) {
+			if (!cache.find(i, 0)) {
+				cache.set(i, 0, int(i), kPixmapSize);
+			}
+		}
+		cache.shrink();
+	}
+	const auto ms = duration_cast<milliseconds>(
+		steady_clock::now() - start).count();
+	const auto stats = cache.stats();
+	WARN(kFrames << " frames of " << kVisible << " pixmaps: " << ms
+		<< " ms, " << stats.count << " pixmaps of " << (stats.usage >> 20)
+		<< " MB resident, hit ratio " << stats.hitRatio());
+}
@@ -7,11 +7,24 @@ https://github.com/telegramdesktop/tdesktop/blob/master/LEGAL
 */
 #include "ui/image/image_prepare.h"
 
+#include "ui/image/image_blur.h"
+
 namespace Images {
 namespace {
 
-TG_FORCE_INLINE uint64 blurGetColors(const uchar *p) {
-	return (uint64)p[0] + ((uint64)p[1] << 16) + ((uint64)p[2] << 32) + ((uint64)p[3] << 48);
+QImage GenerateCircleMask(QSize size) {
+	auto mask = QImage(
+		size,
+		QImage::Format_ARGB32_Premultiplied);
+	mask.fill(Qt::transparent);
+	{
+		Painter p(&mask);
+		PainterHighQualityEnabler hq(p);
+		p.setBrush(Qt::white);
+		p.setPen(Qt::NoPen);
+		p.drawEllipse(QRect(QPoint(), size));
+	}
+	return mask;
 }
 
 const QImage &circleMask(QSize size) {
@@ -25,18 +38,31 @@ const QImage &circleMask(QSize size) {
 	if (i != end(masks)) {
 		return i->second;
 	}
-	auto mask = QImage(
-		size,
-		QImage::Format_ARGB32_Premultiplied);
-	mask.fill(Qt::transparent);
-	{
-		Painter p(&mask);
-		PainterHighQualityEnabler hq(p);
-		p.setBrush(Qt::white);
-		p.setPen(Qt::NoPen);
-		p.drawEllipse(QRect(QPoint(), size));
-	}
-	return masks.emplace(key, std::move(mask)).first->second;
+	return masks.emplace(key, GenerateCircleMask(size)).first->second;
+}
+
+void PrepareCircle(QImage &img, const QImage &mask) {
+	Assert(!img.isNull());
+
+	img = img.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	Assert(!img.isNull());
+
+	Painter p(&img);
+	p.setCompositionMode(QPainter::CompositionMode_DestinationIn);
+	p.drawImage(QRect(QPoint(), img.size() / img.devicePixelRatio()), mask);
+}
+
+void PrepareRound(
+		QImage &image,
+		const QImage *cornerMasks,
+		RectParts corners) {
+	Assert(!image.isNull());
+
+	image.setDevicePixelRatio(cRetinaFactor());
+	image = std::move(image).convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	Assert(!image.isNull());
+
+	prepareRound(image, cornerMasks, corners, QRect());
 }
 
 } // namespace
@@ -61,12 +87,10 @@ QImage prepareBlur(QImage img) {
 
 	uchar *pix = img.bits();
 	if (pix) {
-		int w = img.width(), h = img.height(), wold = w, hold = h;
+		int w = img.width(), h = img.height();
 		const int radius = 3;
-		const int r1 = radius + 1;
 		const int div = radius * 2 + 1;
-		const int stride = w * 4;
-		if (radius < 16 && div < w && div < h && stride <= w * 4) {
+		if (div < w && div < h) {
 			bool withalpha = img.hasAlphaChannel();
 			if (withalpha) {
 				QImage imgsmall(w, h, img.format());
@@ -87,83 +111,7 @@ QImage prepareBlur(QImage img) {
 				pix = img.bits();
 				if (!pix) return was;
 			}
-			uint64 *rgb = new uint64[w * h];
-
-			int x, y, i;
-
-			int yw = 0;
-			const int we = w - r1;
-			for (y = 0; y < h; y++) {
-				uint64 cur = blurGetColors(&pix[yw]);
-				uint64 rgballsum = -radius * cur;
-				uint64 rgbsum = cur * ((r1 * (r1 + 1)) >> 1);
-
-				for (i = 1; i <= radius; i++) {
-					uint64 cur = blurGetColors(&pix[yw + i * 4]);
-					rgbsum += cur * (r1 - i);
-					rgballsum += cur;
-				}
-
-				x = 0;
-
-#define update(start, middle, end) \
-rgb[y * w + x] = (rgbsum >> 4) & 0x00FF00FF00FF00FFLL; \
-rgballsum += blurGetColors(&pix[yw + (start) * 4]) - 2 * blurGetColors(&pix[yw + (middle) * 4]) + blurGetColors(&pix[yw + (end) * 4]); \
-rgbsum += rgballsum; \
-x++;
-
-				while (x < r1) {
-					update(0, x, x + r1);
-				}
-				while (x < we) {
-					update(x - r1, x, x + r1);
-				}
-				while (x < w) {
-					update(x - r1, x, w - 1);
-				}
-
-#undef update
-
-				yw += stride;
-			}
-
-			const int he = h - r1;
-			for (x = 0; x < w; x++) {
-				uint64 rgballsum = -radius * rgb[x];
-				uint64 rgbsum = rgb[x] * ((r1 * (r1 + 1)) >> 1);
-				for (i = 1; i <= radius; i++) {
-					rgbsum += rgb[i * w + x] * (r1 - i);
-					rgballsum += rgb[i * w + x];
-				}
-
-				y = 0;
-				int yi = x * 4;
-
-#define update(start, middle, end) \
-uint64 res = rgbsum >> 4; \
-pix[yi] = res & 0xFF; \
-pix[yi + 1] = (res >> 16) & 0xFF; \
-pix[yi + 2] = (res >> 32) & 0xFF; \
-pix[yi + 3] = (res >> 48) & 0xFF; \
-rgballsum += rgb[x + (start) * w] - 2 * rgb[x + (middle) * w] + rgb[x + (end) * w]; \
-rgbsum += rgballsum; \
-y++; \
-yi += stride;
-
-				while (y < r1) {
-					update(0, y, y + r1);
-				}
-				while (y < he) {
-					update(y - r1, y, y + r1);
-				}
-				while (y < h) {
-					update(y - r1, y, h - 1);
-				}
-
-#undef update
-			}
-
-			delete[] rgb;
+			BlurPixels(pix, w, h, img.bytesPerLine(), radius);
 		}
 	}
 	return img;
@@ -181,225 +129,24 @@ QImage BlurLargeImage(QImage image, int radius) {
 		image = std::move(image).convertToFormat(
 			QImage::Format_ARGB32_Premultiplied);
 	}
-	const auto pixels = image.bits();
-
-	const auto width_m1 = width - 1;
-	const auto height_m1 = height - 1;
-	const auto widthxheight = width * height;
-	const auto div = 2 * radius + 1;
-	const auto radius_p1 = radius + 1;
-	const auto divsum = radius_p1 * radius_p1;
-
-	const auto dvcount = 256 * divsum;
-	const auto buffers = (div * 3) // stack
-		+ std::max(width, height) // vmin
-		+ widthxheight * 3 // rgb
-		+ dvcount; // dv
-	auto storage = std::vector<int>(buffers);
-	auto taken = 0;
-	const auto take = [&](int size) {
-		const auto result = gsl::make_span(storage).subspan(taken, size);
-		taken += size;
-		return result;
-	};
-
-	// Small buffers
-	const auto stack = take(div * 3).data();
-	const auto vmin = take(std::max(width, height)).data();
-
-	// Large buffers
-	const auto rgb = take(widthxheight * 3).data();
-	const auto dvs = take(dvcount);
-
-	auto &&ints = ranges::view::ints;
-	for (auto &&[value, index] : ranges::view::zip(dvs, ints(0))) {
-		value = (index / divsum);
-	}
-	const auto dv = dvs.data();
-
-	// Variables
-	auto stackpointer = 0;
-	for (const auto x : ints(0, width)) {
-		vmin[x] = std::min(x + radius_p1, width_m1);
-	}
-	for (const auto y : ints(0, height)) {
-		auto rinsum = 0;
-		auto ginsum = 0;
-		auto binsum = 0;
-		auto routsum = 0;
-		auto goutsum = 0;
-		auto boutsum = 0;
-		auto rsum = 0;
-		auto gsum = 0;
-		auto bsum = 0;
-
-		const auto y_width = y * width;
-		for (const auto i : ints(-radius, radius + 1)) {
-			const auto sir = &stack[(i + radius) * 3];
-			const auto x = std::clamp(i, 0, width_m1);
-			const auto offset = (y_width + x) * 4;
-			sir[0] = pixels[offset];
-			sir[1] = pixels[offset + 1];
-			sir[2] = pixels[offset + 2];
-
-			const auto rbs = radius_p1 - std::abs(i);
-			rsum += sir[0] * rbs;
-			gsum += sir[1] * rbs;
-			bsum += sir[2] * rbs;
-
-			if (i > 0) {
-				rinsum += sir[0];
-				ginsum += sir[1];
-				binsum += sir[2];
-			} else {
-				routsum += sir[0];
-				goutsum += sir[1];
-				boutsum += sir[2];
-			}
-		}
-		stackpointer = radius;
-
-		for (const auto x : ints(0, width)) {
-			const auto position = (y_width + x) * 3;
-			rgb[position] = dv[rsum];
-			rgb[position + 1] = dv[gsum];
-			rgb[position + 2] = dv[bsum];
-
-			rsum -= routsum;
-			gsum -= goutsum;
-			bsum -= boutsum;
-
-			const auto stackstart = (stackpointer - radius + div) % div;
-			const auto sir = &stack[stackstart * 3];
-
-			routsum -= sir[0];
-			goutsum -= sir[1];
-			boutsum -= sir[2];
-
-			const auto offset = (y_width + vmin[x]) * 4;
-			sir[0] = pixels[offset];
-			sir[1] = pixels[offset + 1];
-			sir[2] = pixels[offset + 2];
-			rinsum += sir[0];
-			ginsum += sir[1];
-			binsum += sir[2];
-
-			rsum += rinsum;
-			gsum += ginsum;
-			bsum += binsum;
-			{
-				stackpointer = (stackpointer + 1) % div;
-				const auto sir = &stack[stackpointer * 3];
-
-				routsum += sir[0];
-				goutsum += sir[1];
-				boutsum += sir[2];
-
-				rinsum -= sir[0];
-				ginsum -= sir[1];
-				binsum -= sir[2];
-			}
-		}
-	}
-
-	for (const auto y : ints(0, height)) {
-		vmin[y] = std::min(y + radius_p1, height_m1) * width;
-	}
-	for (const auto x : ints(0, width)) {
-		auto rinsum = 0;
-		auto ginsum = 0;
-		auto binsum = 0;
-		auto routsum = 0;
-		auto goutsum = 0;
-		auto boutsum = 0;
-		auto rsum = 0;
-		auto gsum = 0;
-		auto bsum = 0;
-		for (const auto i : ints(-radius, radius + 1)) {
-			const auto y = std::clamp(i, 0, height_m1);
-			const auto position = (y * width + x) * 3;
-			const auto sir = &stack[(i + radius) * 3];
-
-			sir[0] = rgb[position];
-			sir[1] = rgb[position + 1];
-			sir[2] = rgb[position + 2];
-
-			const auto rbs = radius_p1 - std::abs(i);
-			rsum += sir[0] * rbs;
-			gsum += sir[1] * rbs;
-			bsum += sir[2] * rbs;
-			if (i > 0) {
-				rinsum += sir[0];
-				ginsum += sir[1];
-				binsum += sir[2];
-			} else {
-				routsum += sir[0];
-				goutsum += sir[1];
-				boutsum += sir[2];
-			}
-		}
-		stackpointer = radius;
-		for (const auto y : ints(0, height)) {
-			const auto offset = (y * width + x) * 4;
-			pixels[offset] = dv[rsum];
-			pixels[offset + 1] = dv[gsum];
-			pixels[offset + 2] = dv[bsum];
-			rsum -= routsum;
-			gsum -= goutsum;
-			bsum -= boutsum;
-
-			const auto stackstart = (stackpointer - radius + div) % div;
-			const auto sir = &stack[stackstart * 3];
-
-			routsum -= sir[0];
-			goutsum -= sir[1];
-			boutsum -= sir[2];
-
-			const auto position = (vmin[y] + x) * 3;
-			sir[0] = rgb[position];
-			sir[1] = rgb[position + 1];
-			sir[2] = rgb[position + 2];
-
-			rinsum += sir[0];
-			ginsum += sir[1];
-			binsum += sir[2];
-
-			rsum += rinsum;
-			gsum += ginsum;
-			bsum += binsum;
-			{
-				stackpointer = (stackpointer + 1) % div;
-				const auto sir = &stack[stackpointer * 3];
-
-				routsum += sir[0];
-				goutsum += sir[1];
-				boutsum += sir[2];
-
-				rinsum -= sir[0];
-				ginsum -= sir[1];
-				binsum -= sir[2];
-			}
-		}
-	}
+	BlurPixels(
+		image.bits(),
+		width,
+		height,
+		image.bytesPerLine(),
+		std::min(radius, kMaxBlurRadius));
 	return image;
 }
 
 void prepareCircle(QImage &img) {
 	Assert(!img.isNull());
 
-	img = img.convertToFormat(QImage::Format_ARGB32_Premultiplied);
-	Assert(!img.isNull());
-
-	Painter p(&img);
-	p.setCompositionMode(QPainter::CompositionMode_DestinationIn);
-	p.drawImage(
-		QRect(QPoint(), img.size() / img.devicePixelRatio()),
-		circleMask(img.size()));
+	PrepareCircle(img, circleMask(img.size()));
 }
 
 void prepareRound(
 		QImage &image,
-		QImage *cornerMasks,
+		const QImage *cornerMasks,
 		RectParts corners,
 		QRect target) {
 	if (target.isNull()) {
@@ -475,6 +222,20 @@ void prepareRound(
 	prepareRound(image, masks, corners, target);
 }
 
+PrepareMasks CopyPrepareMasks(Options options) {
+	auto result = PrepareMasks();
+	const auto radius = (options & Option::RoundedLarge)
+		? ImageRoundRadius::Large
+		: (options & Option::RoundedSmall)
+		? ImageRoundRadius::Small
+		: ImageRoundRadius::None;
+	if (radius != ImageRoundRadius::None) {
+		const auto masks = App::cornersMask(radius);
+		std::copy(masks, masks + 4, result.corners);
+	}
+	return result;
+}
+
 QImage prepareColored(style::color add, QImage image) {
 	return prepareColored(add->c, std::move(image));
 }
@@ -523,7 +284,17 @@ QImage prepareOpaque(QImage image) {
 	return image;
 }
 
-QImage prepare(QImage img, int w, int h, Images::Options options, int outerw, int outerh, const style::color *colored) {
+namespace {
+
+QImage Prepare(
+		QImage img,
+		int w,
+		int h,
+		Options options,
+		int outerw,
+		int outerh,
+		const style::color *colored,
+		const PrepareMasks *masks) {
 	Assert(!img.isNull());
 	if (options & Images::Option::Blurred) {
 		img = prepareBlur(std::move(img));
@@ -567,7 +338,16 @@ QImage prepare(QImage img, int w, int h, Images::Options options, int outerw, in
 			| ((options & Images::Option::RoundedBottomRight) ? RectPart::BottomRight : RectPart::None);
 	};
 	if (options & Images::Option::Circled) {
-		prepareCircle(img);
+		if (masks) {
+			PrepareCircle(img, GenerateCircleMask(img.size()));
+		} else {
+			prepareCircle(img);
+		}
+		Assert(!img.isNull());
+	} else if (masks
+		&& (options & (Images::Option::RoundedLarge
+			| Images::Option::RoundedSmall))) {
+		PrepareRound(img, masks->corners, corners(options));
 		Assert(!img.isNull());
 	} else if (options & Images::Option::RoundedLarge) {
 		prepareRound(img, ImageRoundRadius::Large, corners(options));
@@ -584,4 +364,37 @@ QImage prepare(QImage img, int w, int h, Images::Options options, int outerw, in
 	return img;
 }
 
+} // namespace
+
+QImage prepare(QImage img, int w, int h, Images::Options options, int outerw, int outerh, const style::color *colored) {
+	return Prepare(
+		std::move(img),
+		w,
+		h,
+		options,
+		outerw,
+		outerh,
+		colored,
+		nullptr);
+}
+
+QImage prepare(
+		QImage img,
+		int w,
+		int h,
+		Options options,
+		int outerw,
+		int outerh,
+		const PrepareMasks &masks) {
+	return Prepare(
+		std::move(img),
+		w,
+		h,
+		options,
+		outerw,
+		outerh,
+		nullptr,
+		&masks);
+}
+
 } // namespace Images
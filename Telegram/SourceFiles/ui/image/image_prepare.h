@@ -36,7 +36,7 @@ void prepareRound(
 	QRect target = QRect());
 void prepareRound(
 	QImage &image,
-	QImage *cornerMasks,
+	const QImage *cornerMasks,
 	RectParts corners = RectPart::AllCorners,
 	QRect target = QRect());
 void prepareCircle(QImage &image);
@@ -68,4 +68,20 @@ inline constexpr auto is_flag_type(Option) { return true; };
 
 QImage prepare(QImage img, int w, int h, Options options, int outerw, int outerh, const style::color *colored = nullptr);
 
+// The masks are copied on the main thread to call prepare() on another
+// one. The circle mask is not cached then and the colored option and
+// the background filled from the palette are not supported.
+struct PrepareMasks {
+	QImage corners[4];
+};
+[[nodiscard]] PrepareMasks CopyPrepareMasks(Options options);
+QImage prepare(
+	QImage img,
+	int w,
+	int h,
+	Options options,
+	int outerw,
+	int outerh,
+	const PrepareMasks &masks);
+
 } // namespace Images
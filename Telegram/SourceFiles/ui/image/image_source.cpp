@@ -279,6 +279,8 @@ QImage RemoteSource::takeLoaded() {
 		_cancelled = true;
 		destroyLoader();
 		return QImage();
+	} else if (!_loader->readImageAsync(shrinkBox())) {
+		return QImage();
 	}
 	auto data = _loader->imageData(shrinkBox());
 	if (data.isNull()) {
@@ -43,6 +43,8 @@
       '<(submodules_loc)/crl/src',
     ],
     'sources': [
+      '<(src_loc)/ffmpeg/ffmpeg_premultiply.cpp',
+      '<(src_loc)/ffmpeg/ffmpeg_premultiply.h',
       '<(src_loc)/ffmpeg/ffmpeg_utility.cpp',
       '<(src_loc)/ffmpeg/ffmpeg_utility.h',
     ],
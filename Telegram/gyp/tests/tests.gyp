@@ -52,6 +52,25 @@
       '<(src_loc)/base/algorithm.h',
       '<(src_loc)/base/algorithm_tests.cpp',
     ],
+  }, {
+    'target_name': 'tests_dialogs',
+    'includes': [
+      'common_test.gypi',
+    ],
+    'sources': [
+      '<(src_loc)/dialogs/dialogs_name_index.h',
+      '<(src_loc)/dialogs/dialogs_name_index_tests.cpp',
+    ],
+  }, {
+    'target_name': 'tests_ffmpeg',
+    'includes': [
+      'common_test.gypi',
+    ],
+    'sources': [
+      '<(src_loc)/ffmpeg/ffmpeg_premultiply.cpp',
+      '<(src_loc)/ffmpeg/ffmpeg_premultiply.h',
+      '<(src_loc)/ffmpeg/ffmpeg_premultiply_tests.cpp',
+    ],
   }, {
     'target_name': 'tests_flags',
     'includes': [
@@ -79,6 +98,87 @@
       '<(src_loc)/base/flat_set.h',
       '<(src_loc)/base/flat_set_tests.cpp',
     ],
+  }, {
+    'target_name': 'tests_images',
+    'includes': [
+      'common_test.gypi',
+    ],
+    'dependencies': [
+      '../crl.gyp:crl',
+    ],
+    'sources': [
+      '<(src_loc)/ui/image/image_blur.cpp',
+      '<(src_loc)/ui/image/image_blur.h',
+      '<(src_loc)/ui/image/image_blur_tests.cpp',
+      '<(src_loc)/ui/image/image_pix_cache.h',
+      '<(src_loc)/ui/image/image_pix_cache_tests.cpp',
+    ],
+  }, {
+    'target_name': 'tests_keyed_events',
+    'includes': [
+      'common_test.gypi',
+    ],
+    'sources': [
+      '<(src_loc)/base/keyed_events.h',
+      '<(src_loc)/base/keyed_events_tests.cpp',
+    ],
+  }, {
+    'target_name': 'tests_monotonic_map',
+    'includes': [
+      'common_test.gypi',
+    ],
+    'sources': [
+      '<(src_loc)/base/flat_map.h',
+      '<(src_loc)/base/monotonic_map.h',
+      '<(src_loc)/base/monotonic_map_tests.cpp',
+    ],
+  }, {
+    'target_name': 'tests_mpsc_queue',
+    'includes': [
+      'common_test.gypi',
+    ],
+    'sources': [
+      '<(src_loc)/base/mpsc_queue.h',
+      '<(src_loc)/base/mpsc_queue_tests.cpp',
+    ],
+  }, {
+    'target_name': 'tests_mtproto',
+    'includes': [
+      'common_test.gypi',
+      '../openssl.gypi',
+    ],
+    'include_dirs': [
+      '<(libs_loc)/zlib',
+    ],
+    'sources': [
+      '<(src_loc)/base/mpsc_queue.h',
+      '<(src_loc)/mtproto/mtp_fake_dc.cpp',
+      '<(src_loc)/mtproto/mtp_fake_dc.h',
+      '<(src_loc)/mtproto/mtp_fake_dc_tests.cpp',
+      '<(src_loc)/mtproto/mtp_gzip.cpp',
+      '<(src_loc)/mtproto/mtp_gzip.h',
+      '<(src_loc)/mtproto/mtp_gzip_tests.cpp',
+      '<(src_loc)/mtproto/mtp_tcp_read_buffer.cpp',
+      '<(src_loc)/mtproto/mtp_tcp_read_buffer.h',
+      '<(src_loc)/mtproto/mtp_tcp_read_buffer_tests.cpp',
+    ],
+    'conditions': [[ 'build_win', {
+      'libraries': [
+        'zlibstat',
+      ],
+      'configurations': {
+        'Debug': {
+          'library_dirs': [
+            '<(libs_loc)/zlib/contrib/vstudio/vc14/x86/ZlibStatDebug',
+          ],
+        },
+        'Release': {
+          'library_dirs': [
+            '<(libs_loc)/zlib/contrib/vstudio/vc14/x86/ZlibStatReleaseWithoutAsm',
+          ],
+        },
+      },
+    }]],
   }, {
     'target_name': 'tests_rpl',
     'includes': [
@@ -123,12 +223,27 @@
       'common_test.gypi',
       '../openssl.gypi',
     ],
+    'include_dirs': [
+      '<(libs_loc)/zlib',
+    ],
     'dependencies': [
       '../lib_storage.gyp:lib_storage',
     ],
     'sources': [
+      '<(src_loc)/mtproto/mtp_fake_dc.cpp',
+      '<(src_loc)/mtproto/mtp_fake_dc.h',
+      '<(src_loc)/mtproto/mtp_gzip.cpp',
+      '<(src_loc)/mtproto/mtp_gzip.h',
+      '<(src_loc)/storage/storage_download_journal.cpp',
+      '<(src_loc)/storage/storage_download_journal.h',
+      '<(src_loc)/storage/storage_download_journal_tests.cpp',
+      '<(src_loc)/storage/storage_download_scheduler.cpp',
+      '<(src_loc)/storage/storage_download_scheduler.h',
+      '<(src_loc)/storage/storage_download_scheduler_tests.cpp',
       '<(src_loc)/storage/storage_encrypted_file_tests.cpp',
+      '<(src_loc)/storage/storage_upload_reader_tests.cpp',
       '<(src_loc)/storage/cache/storage_cache_database_tests.cpp',
+      '<(src_loc)/storage/cache/storage_cache_key_map_tests.cpp',
       '<(src_loc)/platform/win/windows_dlls.cpp',
       '<(src_loc)/platform/win/windows_dlls.h',
     ],
@@ -137,6 +252,42 @@
         '<(src_loc)/platform/win/windows_dlls.cpp',
         '<(src_loc)/platform/win/windows_dlls.h',
       ],
+    }, {
+      'libraries': [
+        'zlibstat',
+      ],
+      'configurations': {
+        'Debug': {
+          'library_dirs': [
+            '<(libs_loc)/zlib/contrib/vstudio/vc14/x86/ZlibStatDebug',
+          ],
+        },
+        'Release': {
+          'library_dirs': [
+            '<(libs_loc)/zlib/contrib/vstudio/vc14/x86/ZlibStatReleaseWithoutAsm',
+          ],
+        },
+      },
     }]],
+  }, {
+    'target_name': 'storage_cache_replay',
+    'includes': [
+      '../common_executable.gypi',
+      '../qt.gypi',
+      '../openssl.gypi',
+    ],
+    'dependencies': [
+      '../lib_storage.gyp:lib_storage',
+    ],
+    'include_dirs': [
+      '<(src_loc)',
+      '<(submodules_loc)/GSL/include',
+      '<(submodules_loc)/variant/include',
+      '<(submodules_loc)/crl/src',
+      '<(libs_loc)/range-v3/include',
+    ],
+    'sources': [
+      '<(src_loc)/storage/cache/storage_cache_trace_replay.cpp',
+    ],
   }],
 }